@@ -15,16 +15,50 @@
 #define FMC_ISPCTL_ISPFF_Msk        FMC_ISPCON_ISPFF_Msk
 #endif
 
+#if ISP_STATS || ISP_TRACE
+static void FmcDone(uint32_t u32Cmd, uint32_t u32Start, uint32_t u32Addr)
+{
+    if (u32Cmd == FMC_ISPCMD_PAGE_ERASE)
+    {
+        TRACE(TRACE_ERASE_END, u32Addr);
+        STATS_RECORD(STAT_FMC_ERASE, u32Start);
+    }
+    else if (u32Cmd == FMC_ISPCMD_PROGRAM)
+    {
+        TRACE(TRACE_PROGRAM_END, u32Addr);
+        STATS_RECORD(STAT_FMC_PROGRAM, u32Start);
+    }
+    else if (u32Cmd == FMC_ISPCMD_READ)
+    {
+        STATS_RECORD(STAT_FMC_READ, u32Start);
+    }
+}
+#else
+#define FmcDone(u32Cmd, u32Start, u32Addr)
+#endif
+
 int FMC_Proc(uint32_t u32Cmd, uint32_t addr_start, uint32_t addr_end, uint32_t *data)
 {
     unsigned int u32Addr, Reg;
+#if ISP_STATS || ISP_TRACE
+    uint32_t u32Start = STATS_NOW();
+#endif
+
+    if (u32Cmd == FMC_ISPCMD_PAGE_ERASE)
+    {
+        TRACE(TRACE_ERASE_START, addr_start);
+    }
+    else if (u32Cmd == FMC_ISPCMD_PROGRAM)
+    {
+        TRACE(TRACE_PROGRAM_START, addr_start);
+    }
 
     for (u32Addr = addr_start; u32Addr < addr_end; data++)
     {
         FMC->ISPCMD = u32Cmd;
         FMC->ISPADDR = u32Addr;
 
-        if (u32Cmd == FMC_ISPCMD_PROGRAM)
+        if ((u32Cmd == FMC_ISPCMD_PROGRAM) || (u32Cmd == FMC_ISPCMD_RUN_CKS))
         {
             FMC->ISPDAT = *data;
         }
@@ -32,17 +66,21 @@ int FMC_Proc(uint32_t u32Cmd, uint32_t addr_start, uint32_t addr_end, uint32_t *
         FMC->ISPTRG = 0x1;
         __ISB();
 
-        while (FMC->ISPTRG & 0x1) ;  /* Wait for ISP command done. */
+        while (FMC->ISPTRG & 0x1)    /* Wait for ISP command done. */
+        {
+            ISP_YIELD();
+        }
 
         Reg = FMC->ISPCTL;
 
         if (Reg & FMC_ISPCTL_ISPFF_Msk)
         {
             FMC->ISPCTL = Reg;
+            FmcDone(u32Cmd, u32Start, u32Addr);
             return (-1);
         }
 
-        if (u32Cmd == FMC_ISPCMD_READ)
+        if ((u32Cmd == FMC_ISPCMD_READ) || (u32Cmd == FMC_ISPCMD_READ_UID) || (u32Cmd == FMC_ISPCMD_READ_CKS))
         {
             *data = FMC->ISPDAT;
         }
@@ -57,6 +95,7 @@ int FMC_Proc(uint32_t u32Cmd, uint32_t addr_start, uint32_t addr_end, uint32_t *
         }
     }
 
+    FmcDone(u32Cmd, u32Start, u32Addr);
     return (0);
 }
 
@@ -75,6 +114,20 @@ void UpdateConfig(uint32_t *data, uint32_t *res)
     FMC_DISABLE_CFG_UPDATE();
 }
 
+#if ISP_APPLY_PATCH
+uint32_t FMC_ChkSum_User(uint32_t u32Addr, uint32_t u32Len)
+{
+    /* RUN_CKS takes the length in ISPDAT, READ_CKS returns the CRC there */
+    if (FMC_Proc(FMC_ISPCMD_RUN_CKS, u32Addr, u32Addr + 4, &u32Len) ||
+            FMC_Proc(FMC_ISPCMD_READ_CKS, u32Addr, u32Addr + 4, &u32Len))
+    {
+        return 0xFFFFFFFF;
+    }
+
+    return u32Len;
+}
+#endif
+
 int32_t FMC_SetVectorAddr(uint32_t u32PageAddr)
 {
     FMC->ISPCMD = FMC_ISPCMD_VECMAP;  /* Set ISP Command Code */
@@ -57,5 +57,12 @@ extern int FMC_Proc(uint32_t u32Cmd, uint32_t addr_start, uint32_t addr_end, uin
 
 extern void UpdateConfig(uint32_t *data, uint32_t *res);
 
+/* Map the page at u32PageAddr to address 0 (FMC VECMAP) */
+extern int32_t FMC_SetVectorAddr(uint32_t u32PageAddr);
+
+/* CRC-32 of [u32Addr, u32Addr + u32Len) by FMC RUN_CKS, both page aligned;
+   0xFFFFFFFF if the FMC refuses */
+extern uint32_t FMC_ChkSum_User(uint32_t u32Addr, uint32_t u32Len);
+
 #endif
 
@@ -0,0 +1,149 @@
+/**************************************************************************//**
+ * @file     i2c_transfer.c
+ * @brief    I2C0 slave ISP source file
+ *
+ * @note
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (C) 2017-2018 Nuvoton Technology Corp. All rights reserved.
+ ******************************************************************************/
+
+/*!<Includes */
+#include <string.h>
+#include "NuMicro.h"
+#include "uart_transfer.h"
+#include "i2c_transfer.h"
+#include "isp_link.h"
+#include "isp_stats.h"
+#include "isp_trace.h"
+
+#if ISP_I2C
+
+#ifdef __ICCARM__
+#pragma data_alignment=4
+uint8_t i2c_rcvbuf[MAX_PKT_SIZE] = {0};
+#else
+__attribute__((aligned(4))) uint8_t i2c_rcvbuf[MAX_PKT_SIZE] = {0};
+#endif
+
+static uint8_t volatile bI2cDataReady = 0;
+static uint8_t volatile i2c_rxhead = 0;
+static uint8_t volatile i2c_txhead = 0;
+#if ISP_STATS
+static uint32_t i2c_txstart;
+#endif
+
+#ifdef __ICCARM__
+#pragma data_alignment=4
+extern uint8_t response_buff[64];
+#else
+extern __attribute__((aligned(4))) uint8_t response_buff[64];
+#endif
+
+/*---------------------------------------------------------------------------------------------------------*/
+/* I2C0 slave state machine                                                                                */
+/*---------------------------------------------------------------------------------------------------------*/
+void I2C0_IRQHandler(void)
+{
+    uint32_t u32Status = I2C0->STATUS0;
+
+    if (I2C0->TOCTL & I2C_TOCTL_TOIF_Msk)
+    {
+        I2C0->TOCTL |= I2C_TOCTL_TOIF_Msk;
+    }
+
+    switch (u32Status)
+    {
+        case 0x60:  /* own SLA+W received, ACK returned */
+            i2c_rxhead = 0;
+            break;
+
+        case 0x80:  /* data received, ACK returned */
+            i2c_rcvbuf[i2c_rxhead++] = (uint8_t)I2C0->DAT;
+
+            if (i2c_rxhead == MAX_PKT_SIZE)
+            {
+                bI2cDataReady = TRUE;
+                i2c_rxhead = 0;
+                STATS_RX_STAMP();
+                TRACE(TRACE_RX_FRAME, 0);
+                /* Leave SI set so SCL is stretched until I2C_PutString(). SI is
+                   write-one-to-clear and must not be written back here. */
+                I2C0->CTL0 &= ~(I2C_CTL0_INTEN_Msk | I2C_CTL0_SI_Msk);
+                return;
+            }
+
+            break;
+
+        case 0x88:  /* data received, NACK returned */
+        case 0xA0:  /* STOP or repeated START while addressed */
+            if (i2c_rxhead)
+            {
+                STATS_INC(u32RxTimeouts);
+                TRACE(TRACE_RX_TIMEOUT, i2c_rxhead);
+                i2c_rxhead = 0;
+            }
+
+            break;
+
+        case 0xA8:  /* own SLA+R received, ACK returned */
+            i2c_txhead = 0;
+            I2C0->DAT = response_buff[i2c_txhead++];
+            break;
+
+        case 0xB8:  /* data transmitted, ACK received */
+            I2C0->DAT = (i2c_txhead < MAX_PKT_SIZE) ? response_buff[i2c_txhead++] : 0xFF;
+            break;
+
+        case 0xC0:  /* data transmitted, NACK received */
+        case 0xC8:  /* last data transmitted, ACK received */
+            STATS_RECORD(STAT_TX, i2c_txstart);
+            break;
+
+        default:
+            break;
+    }
+
+    I2C0->CTL0 = (I2C0->CTL0 & ~0x3C) | I2C_CTL_SI_AA;
+}
+
+uint8_t *I2C_Poll(void)
+{
+    if (bI2cDataReady == TRUE)
+    {
+        bI2cDataReady = FALSE;
+        return i2c_rcvbuf;
+    }
+
+    return NULL;
+}
+
+/* The response is shifted out by I2C0_IRQHandler, this only releases SCL */
+void I2C_PutString(void)
+{
+    TRACE(TRACE_TX, inpw(response_buff + 4));
+#if ISP_STATS
+    i2c_txstart = STATS_NOW();
+#endif
+    I2C0->CTL0 = (I2C0->CTL0 & ~0x3C) | I2C_CTL0_INTEN_Msk | I2C_CTL_SI_AA;
+}
+
+void I2C_Init(void)
+{
+    /* Slave address, no general call */
+    I2C0->ADDR0 = (I2C_ISP_ADDR << I2C_ADDR0_ADDR_Pos);
+    I2C0->CTL0 = I2C_CTL0_I2CEN_Msk | I2C_CTL0_INTEN_Msk | I2C_CTL0_AA_Msk;
+    NVIC_SetPriority(I2C0_IRQn, 2);
+    NVIC_EnableIRQ(I2C0_IRQn);
+}
+
+/* Disabling the controller also releases SCL if a frame is being stretched */
+void I2C0_Close(void)
+{
+    NVIC_DisableIRQ(I2C0_IRQn);
+    I2C0->CTL0 = 0;
+}
+
+/* a dropped frame still has to release SCL, the master reads back a stale response */
+const ISP_LINK_T g_i2cLink = {I2C_Init, I2C_Poll, I2C_PutString, I2C_PutString, NULL, NULL, I2C0_Close, 1};
+
+#endif
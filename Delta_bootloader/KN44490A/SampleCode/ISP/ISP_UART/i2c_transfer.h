@@ -0,0 +1,48 @@
+/******************************************************************************
+ * @file     i2c_transfer.h
+ * @brief    I2C0 slave ISP header file
+ *
+ * @note
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (C) 2017-2018 Nuvoton Technology Corp. All rights reserved.
+ ******************************************************************************/
+#ifndef __I2C_TRANS_H__
+#define __I2C_TRANS_H__
+#include <stdint.h>
+
+/* Set to 1 to also offer the ISP as an I2C0 slave. SYS_Init() then takes
+ * PB4 and PB5 for the bus, so enable it only on boards that leave those
+ * pins to the bootloader: ISP_I2C=1 in the Keil project's C/C++ Define
+ * field or -DISP_I2C=1 for gcc. Costs 492 bytes of flash and 68 bytes of
+ * RAM on top of the UART0-only image (clang 14, -Os: 3336 -> 3828). With
+ * ISP_READ_FLASH as well it no longer fits the LDROM (4224), so build it
+ * with ISP_READ_FLASH=0.
+ */
+#ifndef ISP_I2C
+#define ISP_I2C                 0
+#endif
+
+/*-------------------------------------------------------------*/
+/*
+ * Framing (I2C0 on PB4 SDA / PB5 SCL, 7-bit address I2C_ISP_ADDR):
+ *
+ *  1. Master writes one 64-byte ISP frame in a single transfer.
+ *     SCL is held low after the last byte until the frame has been
+ *     processed, so the master's STOP is delayed by clock stretching
+ *     for the whole flash erase/program time.
+ *  2. Master reads the 64-byte response in a second transfer.
+ */
+#define I2C_ISP_ADDR            0x60
+
+/*-------------------------------------------------------------*/
+
+extern uint8_t  i2c_rcvbuf[];
+
+/*-------------------------------------------------------------*/
+void I2C_Init(void);
+void I2C0_IRQHandler(void);
+uint8_t *I2C_Poll(void);
+void I2C_PutString(void);
+void I2C0_Close(void);
+
+#endif  /* __I2C_TRANS_H__ */
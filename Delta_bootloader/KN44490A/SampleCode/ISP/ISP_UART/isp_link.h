@@ -0,0 +1,46 @@
+/******************************************************************************
+ * @file     isp_link.h
+ * @brief    ISP transport interface header file
+ *
+ * @note
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (C) 2017-2018 Nuvoton Technology Corp. All rights reserved.
+ ******************************************************************************/
+#ifndef __ISP_LINK_H__
+#define __ISP_LINK_H__
+#include <stdint.h>
+
+/*-------------------------------------------------------------*/
+/*
+ * One ISP transport. main() polls every link during the connect
+ * window and keeps the first one that delivers CMD_CONNECT.
+ */
+typedef struct
+{
+    void (*Init)(void);                 /* peripheral set-up, clocks and pins are done in SYS_Init() */
+    uint8_t *(*Poll)(void);             /* next complete MAX_PKT_SIZE frame, or NULL */
+    void (*PutString)(void);            /* send response_buff as the answer to the last frame */
+    void (*Discard)(void);              /* drop the last frame without answering, may be NULL */
+    void (*SetSpeed)(uint32_t u32Speed, uint32_t u32GapUs);
+                                        /* bit rate in Hz and inter-frame gap, 0 keeps the current
+                                           value. Waits for the last response to leave first.
+                                           NULL if the host sets the clock */
+    uint8_t (*SpeedOk)(uint32_t u32Speed, uint32_t u32GapUs);
+                                        /* 1 if SetSpeed can run the link at these values,
+                                           checked before the request is answered */
+    void (*Close)(void);                /* stop listening once another link owns the session */
+    uint8_t u8Window;                   /* frames Poll may deliver before the oldest response is sent,
+                                           1 when the host clocks the response (ISP_RTOS only) */
+} ISP_LINK_T;
+
+/*-------------------------------------------------------------*/
+
+extern const ISP_LINK_T g_uart0Link;
+extern const ISP_LINK_T g_uart1Link;
+extern const ISP_LINK_T g_spiLink;
+extern const ISP_LINK_T g_i2cLink;
+
+/* link the session is locked to, NULL during the connect window */
+extern const ISP_LINK_T *g_pIspLink;
+
+#endif  /* __ISP_LINK_H__ */
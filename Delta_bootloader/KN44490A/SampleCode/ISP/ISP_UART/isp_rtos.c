@@ -0,0 +1,168 @@
+/**************************************************************************//**
+ * @file     isp_rtos.c
+ * @brief    Optional CMSIS-RTOS2 (RTX5) ISP pipeline source file
+ *
+ * @note
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (C) 2017-2018 Nuvoton Technology Corp. All rights reserved.
+ ******************************************************************************/
+#include <string.h>
+#include "targetdev.h"
+#include "isp_link.h"
+
+#if ISP_RTOS
+#include "rtx_os.h"
+
+#define RTOS_FLAG_RESPONSE    0x01
+
+typedef struct
+{
+    uint8_t *pu8Frame;          /* pool block holding the received frame */
+    uint32_t u32Stamp;          /* STATS_RX_STAMP() of the frame */
+} ISP_RTOS_MSG_T;
+
+static uint64_t s_au64Stack[3][ISP_RTOS_STACK / 8];
+static osRtxThread_t s_asThreadCb[3];
+static osRtxMemoryPool_t s_sPoolCb;
+static uint32_t s_au32PoolMem[osRtxMemoryPoolMemSize(ISP_RTOS_DEPTH, MAX_PKT_SIZE) / 4];
+static osRtxMessageQueue_t s_sQueueCb;
+static uint32_t s_au32QueueMem[osRtxMessageQueueMemSize(ISP_RTOS_DEPTH, sizeof(ISP_RTOS_MSG_T)) / 4];
+static osRtxSemaphore_t s_asSemCb[2];
+
+static osMemoryPoolId_t s_pool;
+static osMessageQueueId_t s_rxQueue;
+static osSemaphoreId_t s_window;        /* frames the link may deliver before a response */
+static osSemaphoreId_t s_respFree;      /* response_buff not waiting to be sent */
+static osThreadId_t s_txThread;
+static uint8_t *s_pu8First;
+
+static void RxThread(void *argument)
+{
+    ISP_RTOS_MSG_T msg;
+    uint8_t *pu8Frame = s_pu8First;
+
+    while (1)
+    {
+        osSemaphoreAcquire(s_window, osWaitForever);
+        /* take the block before polling, the link buffer is reused once polled */
+        msg.pu8Frame = osMemoryPoolAlloc(s_pool, osWaitForever);
+
+        while (pu8Frame == NULL)
+        {
+            ISP_YIELD();
+            pu8Frame = g_pIspLink->Poll();
+        }
+
+        memcpy(msg.pu8Frame, pu8Frame, MAX_PKT_SIZE);
+#if ISP_STATS
+        msg.u32Stamp = g_u32StatsRxStamp;
+#endif
+        osMessageQueuePut(s_rxQueue, &msg, 0, osWaitForever);
+        pu8Frame = NULL;
+    }
+}
+
+static void CommitThread(void *argument)
+{
+    ISP_RTOS_MSG_T msg;
+    int i32Ret;
+
+    while (1)
+    {
+        osMessageQueueGet(s_rxQueue, &msg, NULL, osWaitForever);
+        osSemaphoreAcquire(s_respFree, osWaitForever);
+        STATS_RECORD(STAT_RX_DISPATCH, msg.u32Stamp);
+        i32Ret = ParseCmd(msg.pu8Frame, MAX_PKT_SIZE);
+        osMemoryPoolFree(s_pool, msg.pu8Frame);
+
+        if (i32Ret == 0)
+        {
+            osThreadFlagsSet(s_txThread, RTOS_FLAG_RESPONSE);
+        }
+        else
+        {
+            /* dropped: nothing to send, hand the slots back right away */
+            if (g_pIspLink->Discard)
+            {
+                g_pIspLink->Discard();
+            }
+
+            osSemaphoreRelease(s_respFree);
+            osSemaphoreRelease(s_window);
+        }
+    }
+}
+
+static void TxThread(void *argument)
+{
+    while (1)
+    {
+        osThreadFlagsWait(RTOS_FLAG_RESPONSE, osFlagsWaitAny, osWaitForever);
+        g_pIspLink->PutString();
+        ApplyLinkSpeed();
+        osSemaphoreRelease(s_respFree);
+        osSemaphoreRelease(s_window);
+    }
+}
+
+/**
+ * @brief       Run the rest of the ISP session as a receive/commit/transmit pipeline
+ *
+ * @param[in]   pu8Frame  The CMD_CONNECT frame that locked g_pIspLink
+ *
+ * @details     Starts the RTX5 kernel and never returns.
+ */
+void IspRtosRun(uint8_t *pu8Frame)
+{
+    static const osThreadFunc_t apfnThread[3] = {RxThread, CommitThread, TxThread};
+    osThreadAttr_t sThreadAttr;
+    osMemoryPoolAttr_t sPoolAttr;
+    osMessageQueueAttr_t sQueueAttr;
+    osSemaphoreAttr_t sSemAttr;
+    osThreadId_t aThread[3];
+    uint32_t i;
+
+    s_pu8First = pu8Frame;
+    osKernelInitialize();
+
+    memset(&sPoolAttr, 0, sizeof(sPoolAttr));
+    sPoolAttr.cb_mem = &s_sPoolCb;
+    sPoolAttr.cb_size = sizeof(s_sPoolCb);
+    sPoolAttr.mp_mem = s_au32PoolMem;
+    sPoolAttr.mp_size = sizeof(s_au32PoolMem);
+    s_pool = osMemoryPoolNew(ISP_RTOS_DEPTH, MAX_PKT_SIZE, &sPoolAttr);
+
+    memset(&sQueueAttr, 0, sizeof(sQueueAttr));
+    sQueueAttr.cb_mem = &s_sQueueCb;
+    sQueueAttr.cb_size = sizeof(s_sQueueCb);
+    sQueueAttr.mq_mem = s_au32QueueMem;
+    sQueueAttr.mq_size = sizeof(s_au32QueueMem);
+    s_rxQueue = osMessageQueueNew(ISP_RTOS_DEPTH, sizeof(ISP_RTOS_MSG_T), &sQueueAttr);
+
+    memset(&sSemAttr, 0, sizeof(sSemAttr));
+    sSemAttr.cb_size = sizeof(s_asSemCb[0]);
+    sSemAttr.cb_mem = &s_asSemCb[0];
+    s_window = osSemaphoreNew(g_pIspLink->u8Window, g_pIspLink->u8Window, &sSemAttr);
+    sSemAttr.cb_mem = &s_asSemCb[1];
+    s_respFree = osSemaphoreNew(1, 1, &sSemAttr);
+
+    memset(&sThreadAttr, 0, sizeof(sThreadAttr));
+    sThreadAttr.cb_size = sizeof(s_asThreadCb[0]);
+    sThreadAttr.stack_size = ISP_RTOS_STACK;
+    sThreadAttr.priority = osPriorityNormal;
+
+    for (i = 0; i < 3; i++)
+    {
+        sThreadAttr.cb_mem = &s_asThreadCb[i];
+        sThreadAttr.stack_mem = s_au64Stack[i];
+        aThread[i] = osThreadNew(apfnThread[i], NULL, &sThreadAttr);
+    }
+
+    s_txThread = aThread[2];
+    osKernelStart();
+
+    /* Trap the CPU */
+    while (1);
+}
+
+#endif
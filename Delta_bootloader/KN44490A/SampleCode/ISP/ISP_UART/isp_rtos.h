@@ -0,0 +1,91 @@
+/**************************************************************************//**
+ * @file     isp_rtos.h
+ * @brief    Optional CMSIS-RTOS2 (RTX5) ISP pipeline header file
+ *
+ * @note
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (C) 2017-2018 Nuvoton Technology Corp. All rights reserved.
+ ******************************************************************************/
+#ifndef ISP_RTOS_H
+#define ISP_RTOS_H
+
+#include <stdint.h>
+
+/*-------------------------------------------------------------*/
+/*
+ * Set ISP_RTOS to 1 to run the session as three RTX5 threads
+ * instead of the super-loop in main():
+ *
+ *  receive : copies each frame from the link into a pool block
+ *  commit  : ParseCmd(), i.e. all FMC_Proc() erase/program work
+ *  transmit: sends response_buff
+ *
+ * receive -> commit is an osMessageQueue, commit -> transmit a
+ * thread flag since only one response can be pending. The pool
+ * (ISP_RTOS_DEPTH blocks) and the per-link window
+ * (ISP_LINK_T.u8Window) give back-pressure: receive stops taking
+ * frames from the link when either is exhausted.
+ *
+ * All threads run at one priority and hand over explicitly with
+ * ISP_YIELD() in the FMC and UART TX busy-wait loops, so frames
+ * are drained from the link while flash is busy.
+ *
+ * Every RTX object is statically allocated; build with the
+ * library sources, libRTX_V8MB.a (the M2003 has no TrustZone)
+ * and:
+ *   OS_DYNAMIC_MEM_SIZE=0, OS_IDLE_THREAD_STACK_SIZE=128,
+ *   OS_TIMER_THREAD_STACK_SIZE=0, OS_TIMER_CB_QUEUE=0,
+ *   OS_EVR_*=0, Stack_Size=0x200, Heap_Size=0
+ * The RTX objects take about 1.6 KB of SRAM: 3 x (68 B control
+ * block + ISP_RTOS_STACK), the idle thread, the pool, the queue,
+ * two semaphores and the kernel data. Shrinking the main stack
+ * (only used by handlers once the kernel runs) and the unused heap
+ * returns 0.75 KB, so the net cost is about 0.9 KB.
+ *
+ * Measured with the default features (clang 14, -Os, Cortex-M23):
+ *   super-loop   3732 B flash, 2016 B SRAM with stack and heap
+ *   ISP_RTOS    13339 B flash, 2964 B SRAM with stack
+ * so the kernel does not fit the 4 KB LDROM, and ISP_RTOS cannot
+ * be used for the LDROM bootloader at all.
+ *
+ * Its throughput has not been measured. The simulator only runs the
+ * super-loop build, and no board has run this one, so nuisp-bench
+ * has no ISP_RTOS numbers. By design it should gain nothing with
+ * nuisp: the host keeps one frame in flight, so receive has nothing
+ * to take while commit runs and the frame time stays wire + flash +
+ * turnaround. Overlap needs a host that sends
+ * ahead within u8Window, and after a lost frame such a host cannot
+ * recover with CMD_RESEND_PACKET, which rolls back only the last
+ * frame. The only build using ISP_RTOS is the m2003-rtos entry of
+ * the host tools' size target, which keeps it compiling and tracks
+ * its cost for an APROM-resident ISP.
+ *
+ * SysTick is owned by the kernel tick, so ISP_STATS and ISP_TRACE
+ * time stamps come from osKernelGetSysTimerCount() instead.
+ */
+/*-------------------------------------------------------------*/
+#ifndef ISP_RTOS
+#define ISP_RTOS              0
+#endif
+
+/* Frames buffered between receive and commit */
+#ifndef ISP_RTOS_DEPTH
+#define ISP_RTOS_DEPTH        2
+#endif
+
+/* Stack size of each pipeline thread in bytes */
+#ifndef ISP_RTOS_STACK
+#define ISP_RTOS_STACK        256
+#endif
+
+#if ISP_RTOS
+#include "cmsis_os2.h"
+
+#define ISP_YIELD()           osThreadYield()
+
+extern void IspRtosRun(uint8_t *pu8Frame);
+#else
+#define ISP_YIELD()
+#endif
+
+#endif  // #ifndef ISP_RTOS_H
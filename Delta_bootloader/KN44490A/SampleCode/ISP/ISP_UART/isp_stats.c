@@ -0,0 +1,87 @@
+/**************************************************************************//**
+ * @file     isp_stats.c
+ * @brief    ISP performance counters source file
+ *
+ * @note
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (C) 2017-2018 Nuvoton Technology Corp. All rights reserved.
+ ******************************************************************************/
+#include <string.h>
+#include "NuMicro.h"
+#include "isp_stats.h"
+#include "isp_rtos.h"
+
+#if ISP_STATS
+
+ISP_STATS_T g_ispStats;
+volatile uint32_t g_u32StatsRxStamp;
+
+#if ISP_RTOS
+/* SysTick is the kernel tick, RTX already extends it to a 32-bit HCLK count */
+void StatsInit(void)
+{
+    memset(&g_ispStats, 0, sizeof(g_ispStats));
+}
+
+uint32_t StatsGetCycles(void)
+{
+    return osKernelGetSysTimerCount();
+}
+#else
+static volatile uint32_t g_u32StatsWraps;
+
+void SysTick_Handler(void)
+{
+    g_u32StatsWraps++;
+}
+
+/* Free-running SysTick used as a 24-bit cycle counter, extended to 32 bits
+   by SysTick_Handler. Called once the connect window is over. */
+void StatsInit(void)
+{
+    memset(&g_ispStats, 0, sizeof(g_ispStats));
+    g_u32StatsWraps = 0;
+    SysTick->LOAD = SysTick_LOAD_RELOAD_Msk;
+    SysTick->VAL  = (0x00);
+    SysTick->CTRL = SysTick_CTRL_CLKSOURCE_Msk | SysTick_CTRL_TICKINT_Msk | SysTick_CTRL_ENABLE_Msk;
+}
+
+uint32_t StatsGetCycles(void)
+{
+    uint32_t u32Wraps, u32Val;
+
+    do
+    {
+        u32Wraps = g_u32StatsWraps;
+        u32Val = SysTick->VAL;
+    }
+    while (u32Wraps != g_u32StatsWraps);
+
+    return (u32Wraps << 24) | (SysTick_LOAD_RELOAD_Msk - u32Val);
+}
+#endif
+
+void StatsRecord(uint32_t u32Id, uint32_t u32Start)
+{
+    ISP_STAT_TIMER_T *pTimer = &g_ispStats.asTimer[u32Id];
+    uint32_t u32Cycles = StatsGetCycles() - u32Start;
+    uint32_t u32Bucket = 0, u32Tmp = u32Cycles >> 8;
+
+    while (u32Tmp && (u32Bucket < STAT_HIST_BUCKETS - 1))
+    {
+        u32Tmp >>= 2;
+        u32Bucket++;
+    }
+
+    pTimer->u32Count++;
+    pTimer->u32Total += u32Cycles;
+
+    if (u32Cycles > pTimer->u32Max)
+    {
+        pTimer->u32Max = u32Cycles;
+    }
+
+    pTimer->au32Hist[u32Bucket]++;
+}
+
+#endif
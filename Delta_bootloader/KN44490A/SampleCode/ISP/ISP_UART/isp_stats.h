@@ -0,0 +1,74 @@
+/**************************************************************************//**
+ * @file     isp_stats.h
+ * @brief    ISP performance counters header file
+ *
+ * @note
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (C) 2017-2018 Nuvoton Technology Corp. All rights reserved.
+ ******************************************************************************/
+#ifndef ISP_STATS_H
+#define ISP_STATS_H
+
+#include <stdint.h>
+
+/* Set to 1 to add the counters and CMD_GET_STATS to the LDROM image.
+ * Costs 396 bytes of flash and 248 bytes of RAM on top of the UART0-only
+ * image (clang 14, -Os: 3336 -> 3732 flash, 732 -> 980 RAM). With
+ * ISP_READ_FLASH as well it no longer fits the LDROM (4128), so build it
+ * with ISP_READ_FLASH=0.
+ */
+#ifndef ISP_STATS
+#define ISP_STATS             0
+#endif
+
+/* Timed operations */
+#define STAT_RX_DISPATCH      0     /* last RX byte of a frame to ParseCmd() */
+#define STAT_FMC_ERASE        1     /* one FMC_Proc() page erase call */
+#define STAT_FMC_PROGRAM      2     /* one FMC_Proc() program call */
+#define STAT_FMC_READ         3     /* one FMC_Proc() read call */
+#define STAT_TX               4     /* one PutString() call */
+#define STAT_TIMER_NUM        5
+
+/* Histogram bucket n counts durations below (256 << 2n) HCLK cycles,
+   the last bucket collects everything above */
+#define STAT_HIST_BUCKETS     8
+
+typedef struct
+{
+    uint32_t u32Count;
+    uint32_t u32Total;          /* HCLK cycles */
+    uint32_t u32Max;            /* HCLK cycles */
+    uint32_t au32Hist[STAT_HIST_BUCKETS];
+} ISP_STAT_TIMER_T;
+
+typedef struct
+{
+    uint32_t u32Packets;
+    uint32_t u32Resends;        /* CMD_RESEND_PACKET, i.e. host saw a bad checksum */
+    uint32_t u32RxTimeouts;     /* partial frame dropped on RX time-out */
+    uint32_t u32BadCmds;        /* non-zero command word not in the command table */
+    ISP_STAT_TIMER_T asTimer[STAT_TIMER_NUM];
+} ISP_STATS_T;
+
+#if ISP_STATS
+extern ISP_STATS_T g_ispStats;
+extern volatile uint32_t g_u32StatsRxStamp;
+
+extern void StatsInit(void);
+extern uint32_t StatsGetCycles(void);
+extern void StatsRecord(uint32_t u32Id, uint32_t u32Start);
+
+#define STATS_INIT()            StatsInit()
+#define STATS_NOW()             StatsGetCycles()
+#define STATS_RECORD(id, t)     StatsRecord((id), (t))
+#define STATS_INC(field)        (g_ispStats.field++)
+#define STATS_RX_STAMP()        (g_u32StatsRxStamp = StatsGetCycles())
+#else
+#define STATS_INIT()
+#define STATS_NOW()             0
+#define STATS_RECORD(id, t)
+#define STATS_INC(field)
+#define STATS_RX_STAMP()
+#endif
+
+#endif  // #ifndef ISP_STATS_H
@@ -0,0 +1,17 @@
+/**************************************************************************//**
+ * @file     isp_trace.c
+ * @brief    ISP event trace source file
+ *
+ * @note
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (C) 2017-2018 Nuvoton Technology Corp. All rights reserved.
+ ******************************************************************************/
+#include "isp_trace.h"
+
+#if ISP_TRACE
+
+uint32_t g_au32Trace[TRACE_DEPTH * 2];
+volatile uint32_t g_u32TraceHead;
+volatile uint8_t g_u8TraceOn = 1;
+
+#endif
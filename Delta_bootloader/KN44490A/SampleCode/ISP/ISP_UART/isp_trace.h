@@ -0,0 +1,95 @@
+/**************************************************************************//**
+ * @file     isp_trace.h
+ * @brief    ISP event trace header file
+ *
+ * @note
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (C) 2017-2018 Nuvoton Technology Corp. All rights reserved.
+ ******************************************************************************/
+#ifndef ISP_TRACE_H
+#define ISP_TRACE_H
+
+#include "NuMicro.h"
+#include "isp_rtos.h"
+
+/* Set to 1 to add the trace ring and CMD_DUMP_TRACE to the LDROM image.
+ * Costs 668 bytes of flash and 520 bytes of RAM with the default
+ * TRACE_DEPTH on top of the UART0-only image (clang 14, -Os: 3336 ->
+ * 4004 flash, 732 -> 1252 RAM). With ISP_READ_FLASH as well it no
+ * longer fits the LDROM, so build it with ISP_READ_FLASH=0.
+ */
+#ifndef ISP_TRACE
+#define ISP_TRACE             0
+#endif
+
+/* Number of records, must be a power of 2. 8 bytes each. */
+#ifndef TRACE_DEPTH
+#define TRACE_DEPTH           64
+#endif
+
+/* Event codes, stored in bits [31:24] of the first record word */
+#define TRACE_RX_FRAME        0x01  /* arg: 0 */
+#define TRACE_RX_TIMEOUT      0x02  /* arg: bytes dropped */
+#define TRACE_CMD             0x03  /* arg: command word */
+#define TRACE_ERASE_START     0x04  /* arg: start address */
+#define TRACE_ERASE_END       0x05  /* arg: end address */
+#define TRACE_PROGRAM_START   0x06  /* arg: start address */
+#define TRACE_PROGRAM_END     0x07  /* arg: end address */
+#define TRACE_TX              0x08  /* arg: response packet number */
+#define TRACE_TX_TIMEOUT      0x09  /* arg: response bytes queued */
+
+/* CMD_DUMP_TRACE control word (second payload word) */
+#define TRACE_CTL_FREEZE      0x01  /* stop recording so the dump does not trace itself */
+#define TRACE_CTL_RESTART     0x02  /* clear the ring and resume recording */
+
+/* Records per CMD_DUMP_TRACE response */
+#define TRACE_PER_FRAME       5
+
+/* Time stamp source: a 24-bit down-counter and its reload value */
+#if ISP_RTOS
+#define TRACE_STAMP()         (SysTick_LOAD_RELOAD_Msk - (osKernelGetSysTimerCount() & SysTick_LOAD_RELOAD_Msk))
+#define TRACE_RELOAD()        SysTick_LOAD_RELOAD_Msk
+#else
+#define TRACE_STAMP()         SysTick->VAL
+#define TRACE_RELOAD()        SysTick->LOAD
+#endif
+
+#if ISP_TRACE
+extern uint32_t g_au32Trace[TRACE_DEPTH * 2];
+extern volatile uint32_t g_u32TraceHead;
+extern volatile uint8_t g_u8TraceOn;
+
+/**
+ * @brief       Append one record to the trace ring
+ *
+ * @param[in]   u32Event  TRACE_xxx event code
+ * @param[in]   u32Arg    Event argument
+ *
+ * @details     A record is the raw SysTick down-counter in bits [23:0] with the
+ *              event in bits [31:24], followed by the argument. The host unwraps
+ *              the time stamps using the SysTick reload value from CMD_DUMP_TRACE.
+ *              PRIMASK is held only while the slot is claimed and written, so
+ *              records from UART0_IRQHandler never collide with the main loop.
+ */
+__STATIC_INLINE void TraceRecord(uint32_t u32Event, uint32_t u32Arg)
+{
+    uint32_t u32Primask, u32Idx;
+
+    if (g_u8TraceOn)
+    {
+        u32Primask = __get_PRIMASK();
+        __disable_irq();
+        u32Idx = (g_u32TraceHead & (TRACE_DEPTH - 1)) * 2;
+        g_u32TraceHead = g_u32TraceHead + 1;
+        g_au32Trace[u32Idx] = (u32Event << 24) | TRACE_STAMP();
+        g_au32Trace[u32Idx + 1] = u32Arg;
+        __set_PRIMASK(u32Primask);
+    }
+}
+
+#define TRACE(ev, arg)          TraceRecord((ev), (uint32_t)(arg))
+#else
+#define TRACE(ev, arg)
+#endif
+
+#endif  // #ifndef ISP_TRACE_H
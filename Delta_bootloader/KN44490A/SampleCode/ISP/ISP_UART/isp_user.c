@@ -11,6 +11,7 @@
 #include <stdio.h>
 #include "isp_user.h"
 #include "fmc_user.h"
+#include "isp_link.h"
 
 #if 0
 #define RSTSTS      RSTSRC
@@ -29,8 +30,20 @@ static uint8_t aprom_buf[FMC_FLASH_PAGE_SIZE] __attribute__((aligned(4)));
 #endif
 
 uint32_t bUpdateApromCmd;
+#if ISP_READ_FLASH
+/* CMD_ERASE_ALL ran, so a locked part has nothing left to read out */
+static uint8_t bEraseAllCmd;
+#endif
 uint32_t g_apromSize, g_dataFlashAddr, g_dataFlashSize;
 
+/* CONFIG0..3 cached in RAM, reloaded only after the CONFIG page is rewritten */
+static uint32_t g_config[4];
+static uint32_t StartAddress, TotalLen, LastDataLen, g_packno = 1;
+static uint32_t gcmd;
+/* CMD_SET_SPEED request, applied by ApplyLinkSpeed() after the response is sent */
+static uint32_t g_u32NewSpeed, g_u32NewGapUs;
+static uint8_t g_u8SpeedPending;
+
 __STATIC_INLINE uint16_t Checksum(unsigned char *buf, int len)
 {
     int i;
@@ -44,163 +57,575 @@ __STATIC_INLINE uint16_t Checksum(unsigned char *buf, int len)
     return (c);
 }
 
-int ParseCmd(unsigned char *buffer, uint8_t len)
+void LoadConfig(void)
 {
-    static uint32_t StartAddress, TotalLen, LastDataLen, g_packno = 1;
-    uint8_t *response;
-    uint16_t lcksum;
-    uint32_t lcmd, srclen, i, regcnf0, security;
-    unsigned char *pSrc;
-    static uint32_t gcmd;
-    response = response_buff;
-    pSrc = buffer;
-    srclen = len;
-    lcmd = inpw(pSrc);
-    outpw(response + 4, 0);
-    pSrc += 8;
-    srclen -= 8;
-    ReadData(Config0, Config0 + 16, (uint32_t *)(response + 8)); /*read config */
-    regcnf0 = *(uint32_t *)(response + 8);
-    security = regcnf0 & 0x2;
+    ReadData(Config0, Config0 + 16, g_config); /*read config */
+}
+
+static void ProgramData(uint8_t *pSrc, uint32_t srclen)
+{
+    if (TotalLen < srclen)
+    {
+        srclen = TotalLen;/*prevent last package from over writing*/
+    }
+
+    TotalLen -= srclen;
+    WriteData(StartAddress, StartAddress + srclen, (uint32_t *)pSrc);
+    memset(pSrc, 0, srclen);
+    ReadData(StartAddress, StartAddress + srclen, (uint32_t *)pSrc);
+    StartAddress += srclen;
+    LastDataLen =  srclen;
+}
+
+static void CmdSyncPackno(uint32_t lcmd, uint8_t *pSrc, uint32_t srclen)
+{
+    g_packno = inpw(pSrc);
+}
+
+static void CmdReadConfig(uint32_t lcmd, uint8_t *pSrc, uint32_t srclen)
+{
+    /* every response carries CONFIG0..3 at offset 8 already */
+}
+
+static void CmdGetFwVer(uint32_t lcmd, uint8_t *pSrc, uint32_t srclen)
+{
+    response_buff[8] = FW_VERSION;
+}
+
+static void CmdGetDeviceId(uint32_t lcmd, uint8_t *pSrc, uint32_t srclen)
+{
+    outpw(response_buff + 8, SYS->PDID);
+}
+
+static void CmdGetDeviceInfo(uint32_t lcmd, uint8_t *pSrc, uint32_t srclen)
+{
+    uint32_t i;
+    uint8_t *response = response_buff;
 
-    if (lcmd == CMD_SYNC_PACKNO)
+    /* everything the host needs before programming, in one frame */
+    outpw(response + DEVINFO_FWVER, FW_VERSION);
+    outpw(response + DEVINFO_PDID, SYS->PDID);
+    outpw(response + DEVINFO_CONFIG0, g_config[0]);
+    outpw(response + DEVINFO_CONFIG1, g_config[1]);
+    outpw(response + DEVINFO_APROM_SIZE, g_apromSize);
+    outpw(response + DEVINFO_DF_ADDR, g_dataFlashAddr);
+    outpw(response + DEVINFO_DF_SIZE, g_dataFlashSize);
+
+    for (i = 0; i < 3; i++)
+    {
+        FMC_Proc(FMC_ISPCMD_READ_UID, i * 4, i * 4 + 4, (uint32_t *)(response + DEVINFO_UID + i * 4));
+    }
+
+    outpw(response + DEVINFO_CAPS, ISP_CAPABILITIES);
+}
+
+static void CmdSetSpeed(uint32_t lcmd, uint8_t *pSrc, uint32_t srclen)
+{
+    g_u32NewSpeed = inpw(pSrc);
+    g_u32NewGapUs = inpw(pSrc + 4);
+
+    /* a rate the link cannot run at keeps the current one */
+    if (g_pIspLink->SetSpeed && g_pIspLink->SpeedOk(g_u32NewSpeed, g_u32NewGapUs))
     {
-        g_packno = inpw(pSrc);
+        g_u8SpeedPending = 1;
     }
 
-    if ((lcmd) && (lcmd != CMD_RESEND_PACKET))
+    outpw(response_buff + SPEED_ACCEPTED, g_u8SpeedPending);
+}
+
+void ApplyLinkSpeed(void)
+{
+    if (g_u8SpeedPending)
     {
-        gcmd = lcmd;
+        g_u8SpeedPending = 0;
+        g_pIspLink->SetSpeed(g_u32NewSpeed, g_u32NewGapUs);
     }
+}
+
+static void CmdRun(uint32_t lcmd, uint8_t *pSrc, uint32_t srclen)
+{
+    uint32_t i;
 
-    if (lcmd == CMD_GET_FWVER)
+    SYS->RSTSTS = 3; /*clear bit*/
+
+    /* Set BS */
+    if (lcmd == CMD_RUN_APROM)
     {
-        response[8] = FW_VERSION;
+        i = (FMC->ISPCTL & 0xFFFFFFFC);
     }
-    else if (lcmd == CMD_GET_DEVICEID)
+    else if (lcmd == CMD_RUN_LDROM)
     {
-        outpw(response + 8, SYS->PDID);
-        goto out;
+        i = (FMC->ISPCTL & 0xFFFFFFFC);
+        i |= 0x00000002;
     }
-    else if (lcmd == CMD_RUN_APROM || lcmd == CMD_RUN_LDROM || lcmd == CMD_RESET)
+    else
     {
-        SYS->RSTSTS = 3; /*clear bit*/
+        i = (FMC->ISPCTL & 0xFFFFFFFE);/* ISP disable */
+    }
 
-        /* Set BS */
-        if (lcmd == CMD_RUN_APROM)
-        {
-            i = (FMC->ISPCTL & 0xFFFFFFFC);
-        }
-        else if (lcmd == CMD_RUN_LDROM)
-        {
-            i = (FMC->ISPCTL & 0xFFFFFFFC);
-            i |= 0x00000002;
-        }
-        else
-        {
-            i = (FMC->ISPCTL & 0xFFFFFFFE);/* ISP disable */
-        }
+    FMC->ISPCTL = i;
+    SCB->AIRCR = (V6M_AIRCR_VECTKEY_DATA | V6M_AIRCR_SYSRESETREQ);
+
+    /* Trap the CPU */
+    while (1);
+}
+
+static void CmdConnect(uint32_t lcmd, uint8_t *pSrc, uint32_t srclen)
+{
+    g_packno = 1;
+}
+
+static void CmdEraseAll(uint32_t lcmd, uint8_t *pSrc, uint32_t srclen)
+{
+    EraseAP(FMC_APROM_BASE, (g_apromSize < g_dataFlashAddr) ? g_apromSize : g_dataFlashAddr); /* erase APROM */
+    EraseAP(g_dataFlashAddr, g_dataFlashSize);
+    outpw(response_buff + 8, g_config[0] | 0x02);
+    UpdateConfig((uint32_t *)(response_buff + 8), NULL);
+    LoadConfig();
+    bUpdateApromCmd = TRUE;
+#if ISP_READ_FLASH
+    bEraseAllCmd = TRUE;
+#endif
+}
+
+static void CmdUpdateAprom(uint32_t lcmd, uint8_t *pSrc, uint32_t srclen)
+{
+    EraseAP(FMC_APROM_BASE, (g_apromSize < g_dataFlashAddr) ? g_apromSize : g_dataFlashAddr); /* erase APROM */
+    bUpdateApromCmd = TRUE;
+    StartAddress = 0;
+    TotalLen = inpw(pSrc + 4);
+    ProgramData(pSrc + 8, srclen - 8);
+}
+
+static void CmdUpdateDataflash(uint32_t lcmd, uint8_t *pSrc, uint32_t srclen)
+{
+    if (g_dataFlashSize == 0)   /*g_dataFlashAddr*/
+    {
+        return;
+    }
+
+    EraseAP(g_dataFlashAddr, g_dataFlashSize);
+    StartAddress = g_dataFlashAddr;
+    TotalLen = inpw(pSrc + 4);
+    ProgramData(pSrc + 8, srclen - 8);
+}
+
+#if ISP_DF_WRITE_AT
+/* bytes of the last frame behind a finished page, which is only written once
+   the next frame shows that frame arrived */
+static uint8_t s_au8Carry[64 - 8];
+static uint8_t s_u8CarryLen;
+
+#define DF_NO_PAGE            0xFFFFFFFFUL
+
+/* data flash page staged in aprom_buf, or DF_NO_PAGE */
+static uint32_t s_u32DfPage = DF_NO_PAGE;
+static uint8_t s_u8DfErr;
+
+/* Erase and program the staged page, once for all the frames it took */
+static void DfFlush(void)
+{
+    if (s_u32DfPage == DF_NO_PAGE)
+    {
+        return;
+    }
+
+    if (FMC_Erase_User(s_u32DfPage) ||
+            WriteData(s_u32DfPage, s_u32DfPage + FMC_FLASH_PAGE_SIZE, (uint32_t *)aprom_buf))
+    {
+        s_u8DfErr = 1;
+    }
+
+    s_u32DfPage = DF_NO_PAGE;
+}
+
+/* Copy bytes for u32Addr on into its page, writing the staged page first if
+   it is another one; returns the bytes that fit before the page ends */
+static uint32_t DfStage(uint32_t u32Addr, uint8_t *pSrc, uint32_t srclen)
+{
+    uint32_t PageAddress = u32Addr & ~(FMC_FLASH_PAGE_SIZE - 1);
+    uint32_t u32Off = u32Addr - PageAddress;
+
+    if (s_u32DfPage != PageAddress)
+    {
+        DfFlush();
+        ReadData(PageAddress, PageAddress + FMC_FLASH_PAGE_SIZE, (uint32_t *)aprom_buf);
+        s_u32DfPage = PageAddress;
+    }
 
-        FMC->ISPCTL = i;
-        SCB->AIRCR = (V6M_AIRCR_VECTKEY_DATA | V6M_AIRCR_SYSRESETREQ);
+    if (srclen > FMC_FLASH_PAGE_SIZE - u32Off)
+    {
+        srclen = FMC_FLASH_PAGE_SIZE - u32Off;
+    }
 
-        /* Trap the CPU */
-        while (1);
+    memcpy(aprom_buf + u32Off, pSrc, srclen);
+    return srclen;
+}
+
+/* The carried bytes start the page after the staged one */
+static void DfStageCarry(void)
+{
+    if (s_u8CarryLen)
+    {
+        DfStage(StartAddress - s_u8CarryLen, s_au8Carry, s_u8CarryLen);
+        s_u8CarryLen = 0;
     }
-    else if (lcmd == CMD_CONNECT)
+}
+
+/* Page read-modify-write, so bytes outside the range keep their contents.
+   Frames are gathered in aprom_buf and each page is erased and programmed
+   once: when a later frame leaves it, or when the last byte has arrived.
+   A frame never writes the page it finishes, so CMD_RESEND_PACKET only has
+   to drop the carried bytes. */
+static void ProgramDataAt(uint8_t *pSrc, uint32_t srclen)
+{
+    uint32_t n;
+
+    if (TotalLen < srclen)
     {
-        g_packno = 1;
-        goto out;
+        srclen = TotalLen;
     }
-    else if ((lcmd == CMD_UPDATE_APROM) || (lcmd == CMD_ERASE_ALL))
+
+    TotalLen -= srclen;
+    LastDataLen = srclen;
+
+    /* frames after the last one, or after a rejected command, write nothing */
+    if (srclen)
     {
-        EraseAP(FMC_APROM_BASE, (g_apromSize < g_dataFlashAddr) ? g_apromSize : g_dataFlashAddr); /* erase APROM */
+        DfStageCarry();
+        n = DfStage(StartAddress, pSrc, srclen);
+        StartAddress += srclen;
+        s_u8CarryLen = srclen - n;
+        memcpy(s_au8Carry, pSrc + n, s_u8CarryLen);
 
-        if (lcmd == CMD_ERASE_ALL)
+        /* no frame follows the last one */
+        if (TotalLen == 0)
         {
-            EraseAP(g_dataFlashAddr, g_dataFlashSize);
-            *(uint32_t *)(response + 8) = regcnf0 | 0x02;
-            UpdateConfig((uint32_t *)(response + 8), NULL);
+            DfStageCarry();
+            DfFlush();
         }
+    }
+
+    outpw(response_buff + DF_AT_REMAIN, s_u8DfErr ? DF_AT_REJECTED : TotalLen);
+}
 
-        bUpdateApromCmd = TRUE;
+static void CmdWriteDataflashAt(uint32_t lcmd, uint8_t *pSrc, uint32_t srclen)
+{
+    uint32_t u32Off = inpw(pSrc), u32Len = inpw(pSrc + 4);
+
+    /* a write left unfinished is dropped with its staged page */
+    TotalLen = 0;
+    s_u32DfPage = DF_NO_PAGE;
+    s_u8CarryLen = 0;
+    s_u8DfErr = 0;
+
+    if (((u32Off | u32Len) & 3) || (u32Len == 0) || (u32Len > g_dataFlashSize) ||
+            (u32Off > g_dataFlashSize - u32Len))
+    {
+        outpw(response_buff + DF_AT_REMAIN, DF_AT_REJECTED);
+        return;
     }
 
-    if ((lcmd == CMD_UPDATE_APROM) || (lcmd == CMD_UPDATE_DATAFLASH))
+    StartAddress = g_dataFlashAddr + u32Off;
+    TotalLen = u32Len;
+    ProgramDataAt(pSrc + 8, srclen - 8);
+}
+#endif
+
+#if ISP_READ_FLASH
+/* CRC-16/CCITT-FALSE, bitwise to keep LDROM small */
+static uint16_t Crc16(uint8_t *buf, uint32_t len)
+{
+    uint32_t i;
+    uint16_t crc = 0xFFFF;
+
+    while (len--)
     {
-        if (lcmd == CMD_UPDATE_DATAFLASH)
-        {
-            StartAddress = g_dataFlashAddr;
+        crc ^= (uint16_t)(*buf++) << 8;
 
-            if (g_dataFlashSize)   /*g_dataFlashAddr*/
-            {
-                EraseAP(g_dataFlashAddr, g_dataFlashSize);
-            }
-            else
-            {
-                goto out;
-            }
-        }
-        else
+        for (i = 0; i < 8; i++)
         {
-            StartAddress = 0;
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
         }
+    }
+
+    return crc;
+}
+
+static void ReadChunk(void)
+{
+    uint32_t u32Len = (TotalLen < RDFLASH_CHUNK) ? TotalLen : RDFLASH_CHUNK;
+
+    memset(response_buff + RDFLASH_ADDR, 0, 64 - RDFLASH_ADDR);
+    outpw(response_buff + RDFLASH_ADDR, StartAddress);
+    ReadData(StartAddress, StartAddress + u32Len, (uint32_t *)(response_buff + RDFLASH_DATA));
+    outps(response_buff + RDFLASH_LEN, u32Len);
+    outps(response_buff + RDFLASH_CRC, Crc16(response_buff + RDFLASH_DATA, u32Len));
+    StartAddress += u32Len;
+    TotalLen -= u32Len;
+    LastDataLen = u32Len;
+}
+
+static void CmdReadFlash(uint32_t lcmd, uint8_t *pSrc, uint32_t srclen)
+{
+    uint32_t u32Addr = inpw(pSrc), u32Len = inpw(pSrc + 4);
+    uint32_t u32Base = FMC_APROM_BASE, u32Size = g_apromSize;
+
+    TotalLen = 0;
+
+    if ((u32Addr >= g_dataFlashAddr) && (u32Addr - g_dataFlashAddr < g_dataFlashSize))
+    {
+        u32Base = g_dataFlashAddr;
+        u32Size = g_dataFlashSize;
+    }
+
+    /* locked parts only after CMD_ERASE_ALL: CMD_UPDATE_APROM leaves data flash */
+    if ((((g_config[0] & 0x2) == 0) && (!bEraseAllCmd)) || ((u32Addr | u32Len) & 3) ||
+            (u32Addr < u32Base) || (u32Len > u32Size) || (u32Addr - u32Base > u32Size - u32Len))
+    {
+        memset(response_buff + RDFLASH_ADDR, 0, 64 - RDFLASH_ADDR);
+        outps(response_buff + RDFLASH_LEN, RDFLASH_REJECTED);
+        return;
+    }
+
+    StartAddress = u32Addr;
+    TotalLen = u32Len;
+    ReadChunk();
+}
+#endif
+
+static void CmdUpdateConfig(uint32_t lcmd, uint8_t *pSrc, uint32_t srclen)
+{
+    if (((g_config[0] & 0x2) == 0) && (!bUpdateApromCmd))   /*security lock*/
+    {
+        return;
+    }
+
+    UpdateConfig((uint32_t *)(pSrc), (uint32_t *)(response_buff + 8));
+    LoadConfig();
+    GetDataFlashInfo(&g_dataFlashAddr, &g_dataFlashSize);
+}
+
+static void CmdResendPacket(uint32_t lcmd, uint8_t *pSrc, uint32_t srclen)     /*for APROM&Data flash only*/
+{
+    uint32_t PageAddress, u32Len = LastDataLen;
+    STATS_INC(u32Resends);
+    /* the host repeats CMD_RESEND_PACKET when its answer got lost, roll back only once */
+    LastDataLen = 0;
+    StartAddress -= u32Len;
+    TotalLen += u32Len;
+#if ISP_DF_WRITE_AT
+
+    /* the resent frame rewrites the same bytes in the staged page */
+    if (gcmd == CMD_WRITE_DATAFLASH_AT)
+    {
+        s_u8CarryLen = 0;
+        return;
+    }
+
+#endif
+#if ISP_READ_FLASH
+
+    if (gcmd == CMD_READ_FLASH)
+    {
+        ReadChunk();
+        return;
+    }
+
+#endif
+#if ISP_APPLY_PATCH
+
+    if (gcmd == CMD_APPLY_PATCH)
+    {
+        PatchResend();
+        return;
+    }
+
+#endif
+    PageAddress = StartAddress & (0x100000 - FMC_FLASH_PAGE_SIZE);
+
+    if (PageAddress >= Config0)
+    {
+        return;
+    }
+
+    ReadData(PageAddress, StartAddress, (uint32_t *)aprom_buf);
+    FMC_Erase_User(PageAddress);
+    WriteData(PageAddress, StartAddress, (uint32_t *)aprom_buf);
+
+    if ((StartAddress % FMC_FLASH_PAGE_SIZE) >= (FMC_FLASH_PAGE_SIZE - u32Len))
+    {
+        FMC_Erase_User(PageAddress + FMC_FLASH_PAGE_SIZE);
+    }
+}
+
+#if ISP_STATS
+static void CmdGetStats(uint32_t lcmd, uint8_t *pSrc, uint32_t srclen)
+{
+    uint32_t sel = pSrc[0];
 
-        TotalLen = inpw(pSrc + 4);
-        pSrc += 8;
-        srclen -= 8;
+    if (sel == STATS_SEL_COUNTERS)
+    {
+        memcpy(response_buff + 8, &g_ispStats, 16);
+        outpw(response_buff + 24, SystemCoreClock);
+    }
+    else if ((sel - STATS_SEL_TIMER) < STAT_TIMER_NUM)
+    {
+        memcpy(response_buff + 8, &g_ispStats.asTimer[sel - STATS_SEL_TIMER], sizeof(ISP_STAT_TIMER_T));
+    }
+    else if (sel == STATS_SEL_CLEAR)
+    {
+        memset(&g_ispStats, 0, sizeof(g_ispStats));
+    }
+}
+#endif
+
+#if ISP_TRACE
+/* payload: first record index, control word.
+   response: records written so far, SysTick reload, TRACE_PER_FRAME records */
+static void CmdDumpTrace(uint32_t lcmd, uint8_t *pSrc, uint32_t srclen)
+{
+    uint32_t i, idx = inpw(pSrc), ctl = inpw(pSrc + 4);
+
+    if (ctl & TRACE_CTL_FREEZE)
+    {
+        g_u8TraceOn = 0;
+    }
+
+    outpw(response_buff + 8, g_u32TraceHead);
+    outpw(response_buff + 12, TRACE_RELOAD());
+
+    for (i = 0; i < TRACE_PER_FRAME; i++, idx++)
+    {
+        outpw(response_buff + 16 + i * 8, g_au32Trace[(idx & (TRACE_DEPTH - 1)) * 2]);
+        outpw(response_buff + 20 + i * 8, g_au32Trace[(idx & (TRACE_DEPTH - 1)) * 2 + 1]);
     }
-    else if (lcmd == CMD_UPDATE_CONFIG)
+
+    if (ctl & TRACE_CTL_RESTART)
+    {
+        g_u32TraceHead = 0;
+        g_u8TraceOn = 1;
+    }
+}
+#endif
+
+/* keyed by the low byte of CMD_* */
+static const ISP_CMD_ENTRY g_cmdTable[] =
+{
+    {CMD_UPDATE_APROM & 0xFF,     CmdUpdateAprom},
+    {CMD_UPDATE_CONFIG & 0xFF,    CmdUpdateConfig},
+    {CMD_READ_CONFIG & 0xFF,      CmdReadConfig},
+    {CMD_ERASE_ALL & 0xFF,        CmdEraseAll},
+    {CMD_SYNC_PACKNO & 0xFF,      CmdSyncPackno},
+    {CMD_GET_FWVER & 0xFF,        CmdGetFwVer},
+    {CMD_RUN_APROM & 0xFF,        CmdRun},
+    {CMD_RUN_LDROM & 0xFF,        CmdRun},
+    {CMD_RESET & 0xFF,            CmdRun},
+    {CMD_CONNECT & 0xFF,          CmdConnect},
+    {CMD_GET_DEVICEID & 0xFF,     CmdGetDeviceId},
+    {CMD_GET_DEVICE_INFO & 0xFF,  CmdGetDeviceInfo},
+    {CMD_SET_SPEED & 0xFF,        CmdSetSpeed},
+    {CMD_UPDATE_DATAFLASH & 0xFF, CmdUpdateDataflash},
+    {CMD_RESEND_PACKET & 0xFF,    CmdResendPacket},
+#if ISP_DF_WRITE_AT
+    {CMD_WRITE_DATAFLASH_AT & 0xFF, CmdWriteDataflashAt},
+#endif
+#if ISP_READ_FLASH
+    {CMD_READ_FLASH & 0xFF,       CmdReadFlash},
+#endif
+#if ISP_APPLY_PATCH
+    {CMD_APPLY_PATCH & 0xFF,      CmdApplyPatch},
+#endif
+#if ISP_STATS
+    {CMD_GET_STATS & 0xFF,        CmdGetStats},
+#endif
+#if ISP_TRACE
+    {CMD_DUMP_TRACE & 0xFF,       CmdDumpTrace},
+#endif
+};
+
+static ISP_CMD_HANDLER FindHandler(uint32_t lcmd)
+{
+    uint32_t i;
+
+    if ((lcmd & CMD_PREFIX_MSK) == CMD_PREFIX)
     {
-        if ((security == 0) && (!bUpdateApromCmd))   /*security lock*/
+        for (i = 0; i < sizeof(g_cmdTable) / sizeof(g_cmdTable[0]); i++)
         {
-            goto out;
+            if (g_cmdTable[i].cmd == (uint8_t)lcmd)
+            {
+                return g_cmdTable[i].handler;
+            }
         }
+    }
+
+    return NULL;
+}
+
+int ParseCmd(unsigned char *buffer, uint8_t len)
+{
+    uint8_t *response;
+    uint16_t lcksum;
+    uint32_t lcmd;
+    ISP_CMD_HANDLER handler;
+    response = response_buff;
+    lcmd = inpw(buffer);
+    STATS_INC(u32Packets);
+    handler = lcmd ? FindHandler(lcmd) : NULL;
 
-        UpdateConfig((uint32_t *)(pSrc), (uint32_t *)(response + 8));
-        GetDataFlashInfo(&g_dataFlashAddr, &g_dataFlashSize);
-        goto out;
+    /* a command word no handler knows is a corrupted frame: leave gcmd and the
+       packet count alone and let the host time out, as if it never arrived */
+    if (lcmd && !handler)
+    {
+        STATS_INC(u32BadCmds);
+        TRACE(TRACE_CMD, lcmd);
+        return (-1);
     }
-    else if (lcmd == CMD_RESEND_PACKET)     /*for APROM&Data flash only*/
+
+    outpw(response + 4, 0);
+    memcpy(response + 8, g_config, sizeof(g_config)); /* cached config */
+
+    if (lcmd == 0)
     {
-        uint32_t PageAddress;
-        StartAddress -= LastDataLen;
-        TotalLen += LastDataLen;
-        PageAddress = StartAddress & (0x100000 - FMC_FLASH_PAGE_SIZE);
+        /* continuation packet of CMD_UPDATE_APROM / CMD_UPDATE_DATAFLASH */
+        if ((gcmd == CMD_UPDATE_APROM) || (gcmd == CMD_UPDATE_DATAFLASH))
+        {
+            ProgramData(buffer + 8, len - 8);
+        }
 
-        if (PageAddress >= Config0)
+#if ISP_DF_WRITE_AT
+        else if (gcmd == CMD_WRITE_DATAFLASH_AT)
         {
-            goto out;
+            ProgramDataAt(buffer + 8, len - 8);
         }
 
-        ReadData(PageAddress, StartAddress, (uint32_t *)aprom_buf);
-        FMC_Erase_User(PageAddress);
-        WriteData(PageAddress, StartAddress, (uint32_t *)aprom_buf);
+#endif
+#if ISP_READ_FLASH
+        else if (gcmd == CMD_READ_FLASH)
+        {
+            ReadChunk();
+        }
 
-        if ((StartAddress % FMC_FLASH_PAGE_SIZE) >= (FMC_FLASH_PAGE_SIZE - LastDataLen))
+#endif
+#if ISP_APPLY_PATCH
+        else if (gcmd == CMD_APPLY_PATCH)
         {
-            FMC_Erase_User(PageAddress + FMC_FLASH_PAGE_SIZE);
+            PatchFrame(buffer + 8, len - 8);
         }
 
-        goto out;
+#endif
     }
-
-    if ((gcmd == CMD_UPDATE_APROM) || (gcmd == CMD_UPDATE_DATAFLASH))
+    else
     {
-        if (TotalLen < srclen)
+        if (lcmd != CMD_RESEND_PACKET)
         {
-            srclen = TotalLen;/*prevent last package from over writing*/
+            gcmd = lcmd;
         }
 
-        TotalLen -= srclen;
-        WriteData(StartAddress, StartAddress + srclen, (uint32_t *)pSrc);
-        memset(pSrc, 0, srclen);
-        ReadData(StartAddress, StartAddress + srclen, (uint32_t *)pSrc);
-        StartAddress += srclen;
-        LastDataLen =  srclen;
+        TRACE(TRACE_CMD, lcmd);
+        handler(lcmd, buffer + 8, len - 8);
     }
 
-out:
     lcksum = Checksum(buffer, len);
     outps(response, lcksum);
     ++g_packno;
@@ -208,4 +633,3 @@ out:
     g_packno++;
     return (0);
 }
-
@@ -14,9 +14,46 @@
 #define FW_VERSION 0x34
 
 #include "fmc_user.h"
+#include "isp_stats.h"
+#include "isp_trace.h"
+#include "spi_transfer.h"
+#include "i2c_transfer.h"
+#include "uart_transfer.h"
+#include "isp_rtos.h"
 #include <string.h>
 
+/* Set to 1 to add CMD_WRITE_DATAFLASH_AT. Costs 576 bytes of flash and 68
+ * bytes of RAM on top of the UART0-only image (clang 14, -Os: 3336 ->
+ * 3912 flash, 732 -> 800 RAM). With ISP_READ_FLASH as well it no longer
+ * fits the LDROM (4308), so build it with ISP_READ_FLASH=0.
+ */
+#ifndef ISP_DF_WRITE_AT
+#define ISP_DF_WRITE_AT       0
+#endif
+
+/* Set to 0 to build without CMD_READ_FLASH. On by default since the host's
+ * verify reads back through it. Costs 396 bytes of flash and 4 bytes of
+ * RAM on top of the UART0-only image, which leaves the default image at
+ * 3732 of the 4096-byte LDROM (clang 14, -Os).
+ */
+#ifndef ISP_READ_FLASH
+#define ISP_READ_FLASH        1
+#endif
+
+/* CMD_APPLY_PATCH is for the simulator only. Its decoder took 1168 bytes
+ * of flash (clang 14, -Os), which put even the UART0-only image over the
+ * 4096-byte LDROM, so it lives in ISP_Host_Tools/sim/m2003/src/sim_patch.cpp.
+ * ISP_APPLY_PATCH=1 only adds the hooks declared further down; a firmware
+ * build with it does not link.
+ */
+#ifndef ISP_APPLY_PATCH
+#define ISP_APPLY_PATCH       0
+#endif
+
 //for DELTA only
+#define CMD_PREFIX            0xC1D2E300
+#define CMD_PREFIX_MSK        0xFFFFFF00
+
 #define CMD_UPDATE_APROM      0xC1D2E3A0
 #define CMD_UPDATE_CONFIG     0xC1D2E3A1
 #define CMD_READ_CONFIG       0xC1D2E3A2
@@ -28,9 +65,95 @@
 #define CMD_RESET             0xC1D2E3AD
 #define CMD_CONNECT           0xC1D2E3AE
 #define CMD_GET_DEVICEID      0xC1D2E3B1
+#define CMD_GET_DEVICE_INFO   0xC1D2E3B2
+#define CMD_GET_STATS         0xC1D2E3B3
+#define CMD_DUMP_TRACE        0xC1D2E3B4
+#define CMD_SET_SPEED         0xC1D2E3B5
 #define CMD_UPDATE_DATAFLASH  0xC1D2E3C3
+#define CMD_WRITE_DATAFLASH_AT 0xC1D2E3C4
+#define CMD_READ_FLASH        0xC1D2E3C5
+#define CMD_APPLY_PATCH       0xC1D2E3C6
 #define CMD_RESEND_PACKET     0xC1D2E3FF
 
+/* CMD_GET_DEVICE_INFO response layout (byte offsets in response_buff) */
+#define DEVINFO_FWVER         8
+#define DEVINFO_PDID          12
+#define DEVINFO_CONFIG0       16
+#define DEVINFO_CONFIG1       20
+#define DEVINFO_APROM_SIZE    24
+#define DEVINFO_DF_ADDR       28
+#define DEVINFO_DF_SIZE       32
+#define DEVINFO_UID           36    /* UID[31:0], UID[63:32], UID[95:64] */
+#define DEVINFO_CAPS          48
+
+/* Capability bitmap reported at DEVINFO_CAPS */
+#define ISP_CAP_DEVICE_INFO   0x00000001UL
+#define ISP_CAP_STATS         0x00000002UL
+#define ISP_CAP_TRACE         0x00000004UL
+#define ISP_CAP_SPI           0x00000008UL
+#define ISP_CAP_I2C           0x00000010UL
+#define ISP_CAP_UART1         0x00000020UL
+#define ISP_CAP_DF_WRITE_AT   0x00000040UL
+#define ISP_CAP_READ_FLASH    0x00000080UL
+#define ISP_CAP_SET_SPEED     0x00000100UL
+#define ISP_CAP_APPLY_PATCH   0x00000200UL
+
+#define ISP_CAPABILITIES      (ISP_CAP_DEVICE_INFO | ISP_CAP_SET_SPEED | (ISP_STATS ? ISP_CAP_STATS : 0) | \
+                               (ISP_TRACE ? ISP_CAP_TRACE : 0) | (ISP_SPI ? ISP_CAP_SPI : 0) | \
+                               (ISP_I2C ? ISP_CAP_I2C : 0) | (ISP_UART1 ? ISP_CAP_UART1 : 0) | \
+                               (ISP_DF_WRITE_AT ? ISP_CAP_DF_WRITE_AT : 0) | (ISP_READ_FLASH ? ISP_CAP_READ_FLASH : 0) | \
+                               (ISP_APPLY_PATCH ? ISP_CAP_APPLY_PATCH : 0))
+
+/* CMD_GET_STATS selector (first payload byte) */
+#define STATS_SEL_COUNTERS    0     /* packets, resends, RX time-outs, bad commands, HCLK */
+#define STATS_SEL_TIMER       1     /* 1 + STAT_xxx: one ISP_STAT_TIMER_T */
+#define STATS_SEL_CLEAR       0xFF
+
+/* CMD_SET_SPEED: payload is bit rate in Hz, inter-frame gap in us, 0 keeps the
+   current value. The response still goes out at the old rate, then the link
+   switches. SPEED_ACCEPTED is 1, or 0 and the link keeps its speed when the
+   host clocks the link or the rate or gap is out of its range. */
+#define SPEED_ACCEPTED        24
+
+/* CMD_WRITE_DATAFLASH_AT: payload is offset into data flash, length, data.
+   Every response reports the bytes still expected at DF_AT_REMAIN, or
+   DF_AT_REJECTED. Pages are gathered in RAM and written once the write
+   leaves them and the next frame has arrived, the last one with the last
+   byte; a command before then drops the unwritten page. */
+#define DF_AT_REMAIN          24
+#define DF_AT_REJECTED        0xFFFFFFFFUL  /* offset/length not word aligned or out of range, or flash error */
+
+/* CMD_READ_FLASH: payload is address, length. The request and each following
+   continuation frame (command word 0) return the next chunk:
+   chunk address, chunk length (u16), CRC-16/CCITT of the chunk (u16), data.
+   A chunk length of 0 ends the read, RDFLASH_REJECTED refuses it. */
+#define RDFLASH_ADDR          8
+#define RDFLASH_LEN           12
+#define RDFLASH_CRC           14
+#define RDFLASH_DATA          16
+#define RDFLASH_CHUNK         48
+#define RDFLASH_REJECTED      0xFFFF        /* locked and not erased by CMD_ERASE_ALL, not word aligned or
+                                               outside APROM/data flash */
+
+/* CMD_APPLY_PATCH: rebuild APROM pages from the image installed now.
+   Payload: old image length and its FMC RUN_CKS CRC-32, new image length
+   (both whole pages), stream length, then the stream, continued in the
+   following frames. The stream is page records, a page number (u16) and
+   ops that fill exactly that page:
+     0x00-0x7F  INSERT  the next 1-128 bytes
+     0x80-0xBF  COPY    length - 1 in 14 bits with the next byte, u24 source
+     0xC0-0xFF  FILL    length - 1 in 14 bits with the next byte, value
+   COPY reads the installed image below the old length. A finished page is
+   written when the next frame arrives, so a CMD_RESEND_PACKET never has to
+   undo flash; COPY may read the page being rebuilt but no page written
+   before it, and the host ends with one more frame to write the last page.
+   Every response reports the stream bytes still expected at PATCH_REMAIN
+   and, once all pages are written, the new image's CRC-32 at PATCH_CRC. */
+#define PATCH_REMAIN          24
+#define PATCH_CRC             28
+#define PATCH_HDR             16
+#define PATCH_REJECTED        0xFFFFFFFFUL  /* old CRC differs, bad record or flash error */
+
 #define V6M_AIRCR_VECTKEY_DATA    0x05FA0000UL
 #define V6M_AIRCR_SYSRESETREQ     0x00000004UL
 
@@ -39,7 +162,23 @@ extern void GetDataFlashInfo(uint32_t *addr, uint32_t *size);
 extern uint32_t GetApromSize(void);
 
 // isp_user.c
-extern int ParseCmd(unsigned char *buffer, uint8_t len);
+typedef void (*ISP_CMD_HANDLER)(uint32_t lcmd, uint8_t *pSrc, uint32_t srclen);
+
+typedef struct
+{
+    uint8_t         cmd;        /* low byte of the CMD_* word */
+    ISP_CMD_HANDLER handler;
+} ISP_CMD_ENTRY;
+
+extern int ParseCmd(unsigned char *buffer, uint8_t len);   /* 0: answer with response_buff, else drop */
+extern void LoadConfig(void);
+extern void ApplyLinkSpeed(void);
+#if ISP_APPLY_PATCH
+/* CMD_APPLY_PATCH decoder, supplied by the simulator */
+extern void CmdApplyPatch(uint32_t lcmd, uint8_t *pSrc, uint32_t srclen);
+extern void PatchFrame(uint8_t *pSrc, uint32_t srclen);     /* continuation frame */
+extern void PatchResend(void);                              /* CMD_RESEND_PACKET of the last frame */
+#endif
 extern uint32_t g_apromSize, g_dataFlashAddr, g_dataFlashSize;
 
 #ifdef __ICCARM__
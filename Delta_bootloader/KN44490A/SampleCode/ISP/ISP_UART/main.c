@@ -11,6 +11,9 @@
 #include <stdio.h>
 #include "targetdev.h"
 #include "uart_transfer.h"
+#include "spi_transfer.h"
+#include "i2c_transfer.h"
+#include "isp_link.h"
 
 void SYS_Init(void)
 {
@@ -40,41 +43,97 @@ void SYS_Init(void)
     /* Set PB multi-function pins for UART0 RXD=PB.14 and TXD=PB.15 */  // For DELTA KN9994A
     SYS->GPB_MFPH &= ~(SYS_GPB_MFPH_PB14MFP_Msk | SYS_GPB_MFPH_PB15MFP_Msk);
     SYS->GPB_MFPH |= (SYS_GPB_MFPH_PB14MFP_UART0_RXD | SYS_GPB_MFPH_PB15MFP_UART0_TXD);
+#if ISP_UART1
+    /* Enable UART1 module clock, HIRC and divider 1 like UART0 */
+    CLK->APBCLK0 |= CLK_APBCLK0_UART1CKEN_Msk;
+    CLK->CLKSEL2 = (CLK->CLKSEL2 & (~CLK_CLKSEL2_UART1SEL_Msk)) | CLK_CLKSEL2_UART1SEL_HIRC;
+    CLK->CLKDIV0 = (CLK->CLKDIV0 & (~CLK_CLKDIV0_UART1DIV_Msk)) | CLK_CLKDIV0_UART1(1);
+    /* Set PB multi-function pins for UART1 RXD=PB.2 and TXD=PB.3 */
+    SYS->GPB_MFPL &= ~(SYS_GPB_MFPL_PB2MFP_Msk | SYS_GPB_MFPL_PB3MFP_Msk);
+    SYS->GPB_MFPL |= (SYS_GPB_MFPL_PB2MFP_UART1_RXD | SYS_GPB_MFPL_PB3MFP_UART1_TXD);
+#endif
+#if ISP_SPI
+    /* Enable USCI0 module clock */
+    CLK->APBCLK1 |= CLK_APBCLK1_USCI0CKEN_Msk;
+    /* Set PB multi-function pins for USCI0 SPI CLK=PB.7, MOSI=PB.8, MISO=PB.9 and SS=PB.11 */
+    SYS->GPB_MFPL = (SYS->GPB_MFPL & ~SYS_GPB_MFPL_PB7MFP_Msk) | SYS_GPB_MFPL_PB7MFP_USCI0_CLK;
+    SYS->GPB_MFPH &= ~(SYS_GPB_MFPH_PB8MFP_Msk | SYS_GPB_MFPH_PB9MFP_Msk | SYS_GPB_MFPH_PB11MFP_Msk);
+    SYS->GPB_MFPH |= (SYS_GPB_MFPH_PB8MFP_USCI0_DAT0 | SYS_GPB_MFPH_PB9MFP_USCI0_DAT1 | SYS_GPB_MFPH_PB11MFP_USCI0_CTL0);
+#endif
+#if ISP_I2C
+    /* Enable I2C0 module clock */
+    CLK->APBCLK0 |= CLK_APBCLK0_I2C0CKEN_Msk;
+    /* Set PB multi-function pins for I2C0 SDA=PB.4 and SCL=PB.5 */
+    SYS->GPB_MFPL &= ~(SYS_GPB_MFPL_PB4MFP_Msk | SYS_GPB_MFPL_PB5MFP_Msk);
+    SYS->GPB_MFPL |= (SYS_GPB_MFPL_PB4MFP_I2C0_SDA | SYS_GPB_MFPL_PB5MFP_I2C0_SCL);
+#endif
 }
 
+/*---------------------------------------------------------------------------------------------------------*/
+/*  ISP transports listened to during the connect window                                                   */
+/*---------------------------------------------------------------------------------------------------------*/
+static const ISP_LINK_T *const s_apIspLinks[] =
+{
+    &g_uart0Link,
+#if ISP_UART1
+    &g_uart1Link,
+#endif
+#if ISP_SPI
+    &g_spiLink,
+#endif
+#if ISP_I2C
+    &g_i2cLink,
+#endif
+};
+
+#define ISP_LINK_NUM    (sizeof(s_apIspLinks) / sizeof(s_apIspLinks[0]))
+
+const ISP_LINK_T *g_pIspLink;
+
 /*---------------------------------------------------------------------------------------------------------*/
 /*  Main Function                                                                                          */
 /*---------------------------------------------------------------------------------------------------------*/
 int32_t main(void)
 {
+    uint32_t i;
+    uint8_t *pu8Frame;
+
     /* Init System, peripheral clock and multi-function I/O */
     SYS_Init();
-    /* Init UART to 38400-8n1 for DELTA */
-    UART_Init();
+
+    /* Init UART to 38400-8n1 for DELTA, and the other transports */
+    for (i = 0; i < ISP_LINK_NUM; i++)
+    {
+        s_apIspLinks[i]->Init();
+    }
 
     CLK->AHBCLK |= CLK_AHBCLK_ISPCKEN_Msk;
     FMC->ISPCTL |= (FMC_ISPCTL_ISPEN_Msk | FMC_ISPCTL_APUEN_Msk);
     g_apromSize = GetApromSize();
     GetDataFlashInfo(&g_dataFlashAddr, &g_dataFlashSize);
+    LoadConfig();
     SysTick->LOAD = 300000 * CyclesPerUs;
     SysTick->VAL   = (0x00);
     SysTick->CTRL = SysTick->CTRL | SysTick_CTRL_CLKSOURCE_Msk | SysTick_CTRL_ENABLE_Msk;
 
     while (1)
     {
-        if ((bufhead >= 4) || (bUartDataReady == TRUE))
+        for (i = 0; i < ISP_LINK_NUM; i++)
         {
-            uint32_t lcmd;
-            lcmd = inpw(uart_rcvbuf);
+            pu8Frame = s_apIspLinks[i]->Poll();
 
-            if (lcmd == CMD_CONNECT)
-            {
-                goto _ISP;
-            }
-            else
+            if (pu8Frame)
             {
-                bUartDataReady = FALSE;
-                bufhead = 0;
+                if (inpw(pu8Frame) == CMD_CONNECT)
+                {
+                    g_pIspLink = s_apIspLinks[i];
+                    goto _LOCK;
+                }
+
+                if (s_apIspLinks[i]->Discard)
+                {
+                    s_apIspLinks[i]->Discard();
+                }
             }
         }
 
@@ -84,16 +143,42 @@ int32_t main(void)
         }
     }
 
-_ISP:
+_LOCK:
+
+    /* first CMD_CONNECT wins, the other links go quiet for the rest of the session */
+    for (i = 0; i < ISP_LINK_NUM; i++)
+    {
+        if ((s_apIspLinks[i] != g_pIspLink) && s_apIspLinks[i]->Close)
+        {
+            s_apIspLinks[i]->Close();
+        }
+    }
+
+    /* free-running 24-bit SysTick from here on, the UART gap timing relies on it */
+    SysTick->LOAD = SysTick_LOAD_RELOAD_Msk;
+    SysTick->VAL = (0x00);
+    STATS_INIT();
+#if ISP_RTOS
+    IspRtosRun(pu8Frame);
+#endif
 
     while (1)
     {
-        if (bUartDataReady == TRUE)
+        if (pu8Frame)
         {
-            bUartDataReady = FALSE;
-            ParseCmd(uart_rcvbuf, 64);
-            PutString();
+            STATS_RECORD(STAT_RX_DISPATCH, g_u32StatsRxStamp);
+            if (ParseCmd(pu8Frame, 64) == 0)
+            {
+                g_pIspLink->PutString();
+                ApplyLinkSpeed();
+            }
+            else if (g_pIspLink->Discard)
+            {
+                g_pIspLink->Discard();
+            }
         }
+
+        pu8Frame = g_pIspLink->Poll();
     }
 
 _APROM:
@@ -0,0 +1,175 @@
+/**************************************************************************//**
+ * @file     spi_transfer.c
+ * @brief    USCI0 SPI slave ISP source file
+ *
+ * @note
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (C) 2017-2018 Nuvoton Technology Corp. All rights reserved.
+ ******************************************************************************/
+
+/*!<Includes */
+#include <string.h>
+#include "NuMicro.h"
+#include "uart_transfer.h"
+#include "spi_transfer.h"
+#include "isp_link.h"
+#include "isp_stats.h"
+#include "isp_trace.h"
+
+#if ISP_SPI
+
+#ifdef __ICCARM__
+#pragma data_alignment=4
+uint8_t spi_rcvbuf[MAX_PKT_SIZE] = {0};
+#else
+__attribute__((aligned(4))) uint8_t spi_rcvbuf[MAX_PKT_SIZE] = {0};
+#endif
+
+#ifdef __ICCARM__
+#pragma data_alignment=4
+extern uint8_t response_buff[64];
+#else
+extern __attribute__((aligned(4))) uint8_t response_buff[64];
+#endif
+
+/*---------------------------------------------------------------------------------------------------------*/
+/* SysTick cycles since *pu32Last, across a reload. Only VAL is read: reading CTRL would clear the          */
+/* COUNTFLAG that ends the connect window in main().                                                     */
+/*---------------------------------------------------------------------------------------------------------*/
+static uint32_t SPI_Ticks(uint32_t *pu32Last)
+{
+    uint32_t u32Now = SysTick->VAL;
+    uint32_t u32Ticks;
+
+    if (u32Now <= *pu32Last)
+    {
+        u32Ticks = *pu32Last - u32Now;
+    }
+    else
+    {
+        u32Ticks = *pu32Last + SysTick->LOAD + 1 - u32Now;
+    }
+
+    *pu32Last = u32Now;
+    return u32Ticks;
+}
+
+/*---------------------------------------------------------------------------------------------------------*/
+/* Receive one frame once the master starts clocking. The frame is read with polling, a word every 16    */
+/* SPI clocks is too fast for an interrupt per word at multi-MHz bus clocks.                              */
+/*---------------------------------------------------------------------------------------------------------*/
+uint8_t *SPI_Poll(void)
+{
+    uint32_t i = 0, u32Data;
+    uint32_t u32Last = SysTick->VAL, u32Waited = 0;
+
+    if (USPI0->BUFSTS & USPI_BUFSTS_RXEMPTY_Msk)
+    {
+        return NULL;
+    }
+
+    while (i < MAX_PKT_SIZE)
+    {
+        if ((USPI0->BUFSTS & USPI_BUFSTS_RXEMPTY_Msk) == 0)
+        {
+            u32Data = USPI0->RXDAT;
+            spi_rcvbuf[i++] = (uint8_t)(u32Data >> 8);
+            spi_rcvbuf[i++] = (uint8_t)u32Data;
+        }
+        else if (USPI0->PROTSTS & USPI_PROTSTS_SSLINE_Msk)
+        {
+            /* SS released before a whole frame arrived */
+            break;
+        }
+        else if ((u32Waited += SPI_Ticks(&u32Last)) > SPI_TIMEOUT_US * CyclesPerUs)
+        {
+            /* master stalled with SS low, or SS floating */
+            break;
+        }
+    }
+
+    USPI0->BUFCTL |= USPI_BUFCTL_RXCLR_Msk;
+
+    if (i < MAX_PKT_SIZE)
+    {
+        STATS_INC(u32RxTimeouts);
+        TRACE(TRACE_RX_TIMEOUT, i);
+        return NULL;
+    }
+
+    STATS_RX_STAMP();
+    TRACE(TRACE_RX_FRAME, 0);
+    return spi_rcvbuf;
+}
+
+void SPI_PutString(void)
+{
+    uint32_t i;
+    uint32_t u32Last = SysTick->VAL, u32Waited = 0;
+#if ISP_STATS
+    uint32_t u32Start = STATS_NOW();
+#endif
+
+    TRACE(TRACE_TX, inpw(response_buff + 4));
+    /* drop busy polls received while the frame was processed */
+    USPI0->BUFCTL |= (USPI_BUFCTL_RXCLR_Msk | USPI_BUFCTL_TXCLR_Msk);
+    USPI0->TXDAT = SPI_READY_WORD;
+
+    /* the whole response, the polls before it included, has to go within SPI_TIMEOUT_US */
+    for (i = 0; i < MAX_PKT_SIZE; i += 2)
+    {
+        while (USPI0->BUFSTS & USPI_BUFSTS_TXFULL_Msk)
+        {
+            if ((u32Waited += SPI_Ticks(&u32Last)) > SPI_TIMEOUT_US * CyclesPerUs)
+            {
+                goto _ABORT;
+            }
+        }
+
+        USPI0->TXDAT = ((uint32_t)response_buff[i] << 8) | response_buff[i + 1];
+    }
+
+    /* wait for the master to finish the read, then discard what it clocked in */
+    while (((USPI0->BUFSTS & USPI_BUFSTS_TXEMPTY_Msk) == 0) ||
+            ((USPI0->PROTSTS & USPI_PROTSTS_SSLINE_Msk) == 0))
+    {
+        if ((u32Waited += SPI_Ticks(&u32Last)) > SPI_TIMEOUT_US * CyclesPerUs)
+        {
+            goto _ABORT;
+        }
+    }
+
+    USPI0->BUFCTL |= USPI_BUFCTL_RXCLR_Msk;
+    STATS_RECORD(STAT_TX, u32Start);
+    return;
+
+_ABORT:
+    /* the master never read the response; it times out and resends the frame */
+    USPI0->BUFCTL |= (USPI_BUFCTL_RXCLR_Msk | USPI_BUFCTL_TXCLR_Msk);
+    TRACE(TRACE_TX_TIMEOUT, i);
+}
+
+void SPI_Init(void)
+{
+    /* Enable USCI_SPI protocol */
+    USPI0->CTL = 1ul << USPI_CTL_FUNMODE_Pos;
+    /* 16-bit words, MSB first */
+    USPI0->LINECTL = (USPI0->LINECTL & ~(USPI_LINECTL_DWIDTH_Msk | USPI_LINECTL_LSB_Msk));
+    /* Slave select input active low */
+    USPI0->CTLIN0 |= USPI_CTLIN0_ININV_Msk;
+    /* Slave, mode 0, shift out 0 on under-run */
+    USPI0->PROTCTL = USPI_PROTCTL_SLAVE_Msk | (0x0ul << USPI_PROTCTL_SCLKMODE_Pos);
+    USPI0->BUFCTL |= (USPI_BUFCTL_RXCLR_Msk | USPI_BUFCTL_TXCLR_Msk);
+    USPI0->PROTCTL |= USPI_PROTCTL_PROTEN_Msk;
+}
+
+void SPI_Close(void)
+{
+    USPI0->PROTCTL &= ~USPI_PROTCTL_PROTEN_Msk;
+}
+
+/* a dropped frame is still answered, or the master would poll for SPI_READY_WORD until it gives up;
+   it reads back a stale response */
+const ISP_LINK_T g_spiLink = {SPI_Init, SPI_Poll, SPI_PutString, SPI_PutString, NULL, NULL, SPI_Close, 1};
+
+#endif
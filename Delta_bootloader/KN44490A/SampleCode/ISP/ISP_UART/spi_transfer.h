@@ -0,0 +1,61 @@
+/******************************************************************************
+ * @file     spi_transfer.h
+ * @brief    USCI0 SPI slave ISP header file
+ *
+ * @note
+ * SPDX-License-Identifier: Apache-2.0
+ * Copyright (C) 2017-2018 Nuvoton Technology Corp. All rights reserved.
+ ******************************************************************************/
+#ifndef __SPI_TRANS_H__
+#define __SPI_TRANS_H__
+#include <stdint.h>
+
+/* Set to 1 to also offer the ISP as a USCI0 SPI slave. SYS_Init() then
+ * takes PB7, PB8, PB9 and PB11 for the bus, so enable it only on boards
+ * that leave those pins to the bootloader: ISP_SPI=1 in the Keil
+ * project's C/C++ Define field or -DISP_SPI=1 for gcc. Costs 584 bytes
+ * of flash and 64 bytes of RAM on top of the UART0-only image (clang 14,
+ * -Os: 3336 -> 3920). With ISP_READ_FLASH as well it no longer fits the
+ * LDROM (4316), so build it with ISP_READ_FLASH=0.
+ */
+#ifndef ISP_SPI
+#define ISP_SPI                 0
+#endif
+
+/*-------------------------------------------------------------*/
+/*
+ * Framing (SPI mode 0, MSB first, SS active low, USCI0 on
+ * PB7 CLK / PB8 MOSI / PB9 MISO / PB11 SS):
+ *
+ *  1. Master clocks one 64-byte ISP frame in a single SS cycle.
+ *  2. While the frame is being processed the slave shifts out 0x00.
+ *     The master polls by clocking 2 bytes per SS cycle until it
+ *     reads SPI_READY_WORD, then keeps SS low and clocks the
+ *     64-byte response in the same cycle.
+ *
+ * The bus runs 16-bit words internally, so every SS cycle must
+ * carry an even number of bytes.
+ *
+ * A frame has to arrive, and a response be read out after the
+ * slave is ready, within SPI_TIMEOUT_US. A master that stalls
+ * with SS low, or a floating SS line, costs at most that long
+ * before the frame is dropped, so the connect window still runs
+ * out and UART0 keeps being served.
+ */
+#define SPI_READY_WORD          0x5AA5
+
+#ifndef SPI_TIMEOUT_US
+#define SPI_TIMEOUT_US          20000
+#endif
+
+/*-------------------------------------------------------------*/
+
+extern uint8_t  spi_rcvbuf[];
+
+/*-------------------------------------------------------------*/
+void SPI_Init(void);
+uint8_t *SPI_Poll(void);
+void SPI_PutString(void);
+void SPI_Close(void);
+
+#endif  /* __SPI_TRANS_H__ */
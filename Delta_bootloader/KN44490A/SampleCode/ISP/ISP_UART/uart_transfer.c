@@ -13,6 +13,10 @@
 #include <string.h>
 #include "NuMicro.h"
 #include "uart_transfer.h"
+#include "isp_link.h"
+#include "isp_stats.h"
+#include "isp_trace.h"
+#include "isp_rtos.h"
 
 #ifdef __ICCARM__
 #pragma data_alignment=4
@@ -23,36 +27,99 @@ __attribute__((aligned(4))) uint8_t uart_rcvbuf[MAX_PKT_SIZE] = {0};
 
 uint8_t volatile bUartDataReady = 0;
 uint8_t volatile bufhead = 0;
+static uint32_t s_u32LastRx;
+
+#if ISP_UART1
+#ifdef __ICCARM__
+#pragma data_alignment=4
+uint8_t uart1_rcvbuf[MAX_PKT_SIZE] = {0};
+#else
+__attribute__((aligned(4))) uint8_t uart1_rcvbuf[MAX_PKT_SIZE] = {0};
+#endif
+
+uint8_t volatile bUart1DataReady = 0;
+uint8_t volatile bufhead1 = 0;
+static uint32_t s_u32LastRx1;
+#endif
+
+/* Only the locked link changes speed, so the timing is shared by both ports */
+static uint32_t s_u32Baud = 38400, s_u32GapUs = UART_GAP_DEFAULT_US;
+static uint32_t s_u32GapCycles;         /* 0 when the RX time-out marks frame boundaries */
+
+/* Up-counting time stamps in HCLK cycles. Outside the RTOS build SysTick runs
+   free over 24 bits once the connect window is over. */
+#if ISP_RTOS
+#define UART_STAMP()            osKernelGetSysTimerCount()
+#define UART_ELAPSED(t)         (osKernelGetSysTimerCount() - (t))
+#else
+#define UART_STAMP()            (SysTick_LOAD_RELOAD_Msk - SysTick->VAL)
+#define UART_ELAPSED(t)         ((UART_STAMP() - (t)) & SysTick_LOAD_RELOAD_Msk)
+#endif
 
 
 /* please check "targetdev.h" for chip specifc define option */
 
 /*---------------------------------------------------------------------------------------------------------*/
-/* INTSTS to handle UART Channel 0 interrupt event                                                            */
+/* Shared RX interrupt body for UART0 and UART1                                                            */
 /*---------------------------------------------------------------------------------------------------------*/
-void UART0_IRQHandler(void)
+static void UartPortRx(UART_T *uart, uint8_t *rcvbuf, uint8_t volatile *head, uint8_t volatile *ready, uint32_t *pu32Last)
 {
     /*----- Determine interrupt source -----*/
-    uint32_t u32IntSrc = UART0->INTSTS;
+    uint32_t u32IntSrc = uart->INTSTS;
 
     if (u32IntSrc & 0x11)   /*RDA FIFO interrupt & RDA timeout interrupt*/
     {
-        while (((UART0->FIFOSTS & UART_FIFOSTS_RXEMPTY_Msk) == 0) && (bufhead < MAX_PKT_SIZE))      /*RX fifo not empty*/
+        if (s_u32GapCycles && *head && ((uart->FIFOSTS & UART_FIFOSTS_RXEMPTY_Msk) == 0) &&
+                (UART_ELAPSED(*pu32Last) > s_u32GapCycles))
+        {
+            /* the partial frame went stale before these bytes arrived */
+            STATS_INC(u32RxTimeouts);
+            TRACE(TRACE_RX_TIMEOUT, *head);
+            *head = 0;
+        }
+
+        while (((uart->FIFOSTS & UART_FIFOSTS_RXEMPTY_Msk) == 0) && (*head < MAX_PKT_SIZE))      /*RX fifo not empty*/
         {
-            uart_rcvbuf[bufhead++] = UART0->DAT;
+            rcvbuf[(*head)++] = uart->DAT;
         }
+
+        *pu32Last = UART_STAMP();
     }
 
-    if (bufhead == MAX_PKT_SIZE)
+    if (*head == MAX_PKT_SIZE)
     {
-        bUartDataReady = TRUE;
-        bufhead = 0;
+        *ready = TRUE;
+        *head = 0;
+        STATS_RX_STAMP();
+        TRACE(TRACE_RX_FRAME, 0);
     }
-    else if (u32IntSrc & 0x10)
+    else if ((u32IntSrc & 0x10) && (s_u32GapCycles == 0))
     {
-        bufhead = 0;
+        if (*head)
+        {
+            STATS_INC(u32RxTimeouts);
+            TRACE(TRACE_RX_TIMEOUT, *head);
+        }
+
+        *head = 0;
     }
 }
+
+/*---------------------------------------------------------------------------------------------------------*/
+/* INTSTS to handle UART Channel 0 interrupt event                                                            */
+/*---------------------------------------------------------------------------------------------------------*/
+void UART0_IRQHandler(void)
+{
+    UartPortRx(UART0, uart_rcvbuf, &bufhead, &bUartDataReady, &s_u32LastRx);
+}
+
+#if ISP_UART1
+void UART1_IRQHandler(void)
+{
+    UartPortRx(UART1, uart1_rcvbuf, &bufhead1, &bUart1DataReady, &s_u32LastRx1);
+}
+#endif
+
 #ifdef __ICCARM__
 #pragma data_alignment=4
 extern uint8_t response_buff[64];
@@ -60,36 +127,198 @@ extern uint8_t response_buff[64];
 extern __attribute__((aligned(4))) uint8_t response_buff[64];
 #endif 
 
-void PutString(void)
+static void UartPortTx(UART_T *uart)
 {
     uint32_t i;
+#if ISP_STATS
+    uint32_t u32Start = STATS_NOW();
+#endif
+
+    TRACE(TRACE_TX, inpw(response_buff + 4));
 
     for (i = 0; i < MAX_PKT_SIZE; i++)
     {
-        while ((UART0->FIFOSTS & UART_FIFOSTS_TXFULL_Msk));
+        while ((uart->FIFOSTS & UART_FIFOSTS_TXFULL_Msk))
+        {
+            ISP_YIELD();
+        }
 
-        UART0->DAT = response_buff[i];
+        uart->DAT = response_buff[i];
     }
+
+    STATS_RECORD(STAT_TX, u32Start);
 }
 
-void UART_Init()
+void PutString(void)
+{
+    UartPortTx(UART0);
+}
+
+#if ISP_UART1
+void UART1_PutString(void)
+{
+    UartPortTx(UART1);
+}
+#endif
+
+/* Baud divider, RX FIFO trigger and time-out comparator for s_u32Baud / s_u32GapUs */
+static void UartPortTiming(UART_T *uart)
+{
+    uint32_t u32Bits, u32Rfitl;
+
+    uart->BAUD = (UART_BAUD_MODE2 | UART_BAUD_MODE2_DIVIDER(__HIRC, s_u32Baud));
+
+    /* (16 - trigger) characters of 10 bits must cover the interrupt latency */
+    if ((16 - 8) * 10000000UL / s_u32Baud >= UART_RX_LATENCY_US)
+    {
+        u32Rfitl = UART_FIFO_RFITL_8BYTES;
+    }
+    else if ((16 - 4) * 10000000UL / s_u32Baud >= UART_RX_LATENCY_US)
+    {
+        u32Rfitl = UART_FIFO_RFITL_4BYTES;
+    }
+    else
+    {
+        u32Rfitl = UART_FIFO_RFITL_1BYTE;
+    }
+
+    uart->FIFO = (uart->FIFO & ~UART_FIFO_RFITL_Msk) | u32Rfitl;
+
+    /* gap in bit times, scaled down first to stay within 32 bits */
+    u32Bits = (s_u32GapUs / 100) * (s_u32Baud / 100) / 100;
+
+    if (u32Bits <= (UART_TOUT_TOIC_Msk >> UART_TOUT_TOIC_Pos))
+    {
+        s_u32GapCycles = 0;
+    }
+    else
+    {
+        s_u32GapCycles = s_u32GapUs * CyclesPerUs;
+        u32Bits = UART_TOIC_MIN;
+    }
+
+    if (u32Bits < UART_TOIC_MIN)
+    {
+        u32Bits = UART_TOIC_MIN;
+    }
+
+    uart->TOUT = (uart->TOUT & ~UART_TOUT_TOIC_Msk) | u32Bits;
+}
+
+static void UartPortSetSpeed(UART_T *uart, uint32_t u32Baud, uint32_t u32GapUs)
+{
+    if (u32Baud)
+    {
+        s_u32Baud = u32Baud;
+    }
+
+    if (u32GapUs)
+    {
+        s_u32GapUs = u32GapUs;
+    }
+
+    /* let the response to the speed change leave at the old rate */
+    while ((uart->FIFOSTS & UART_FIFOSTS_TXEMPTYF_Msk) == 0);
+
+    UartPortTiming(uart);
+}
+
+static void UartPortInit(UART_T *uart, IRQn_Type irq)
 {
     /*---------------------------------------------------------------------------------------------------------*/
     /* Init UART                                                                                               */
     /*---------------------------------------------------------------------------------------------------------*/
     /* Select UART function mode */
-    UART0->FUNCSEL = ((UART0->FUNCSEL & (~UART_FUNCSEL_FUNCSEL_Msk)) | UART_FUNCSEL_MODE);
+    uart->FUNCSEL = ((uart->FUNCSEL & (~UART_FUNCSEL_FUNCSEL_Msk)) | UART_FUNCSEL_MODE);
     /* Set UART line configuration */
-    UART0->LINE = UART_WORD_LEN_8 | UART_PARITY_NONE | UART_STOP_BIT_1;
-    /* Set UART Rx and RTS trigger level */
-    UART0->FIFO = UART_FIFO_RFITL_14BYTES | UART_FIFO_RTSTRGLV_14BYTES;
-    /* Set UART baud rate */
-    UART0->BAUD = (UART_BAUD_MODE2 | UART_BAUD_MODE2_DIVIDER(__HIRC, 38400));   //for DELTA 38400
-    /* Set time-out interrupt comparator */
-    UART0->TOUT = (UART0->TOUT & ~UART_TOUT_TOIC_Msk) | (0x40);
-    NVIC_SetPriority(UART0_IRQn, 2);
-    NVIC_EnableIRQ(UART0_IRQn);
+    uart->LINE = UART_WORD_LEN_8 | UART_PARITY_NONE | UART_STOP_BIT_1;
+    /* Set UART RTS trigger level */
+    uart->FIFO = UART_FIFO_RTSTRGLV_14BYTES;
+    /* Set UART baud rate (38400 for DELTA), Rx trigger level and time-out comparator */
+    UartPortTiming(uart);
+    NVIC_SetPriority(irq, 2);
+    NVIC_EnableIRQ(irq);
     /* 0x0811 */
-    UART0->INTEN = (UART_INTEN_TOCNTEN_Msk | UART_INTEN_RXTOIEN_Msk | UART_INTEN_RDAIEN_Msk);
+    uart->INTEN = (UART_INTEN_TOCNTEN_Msk | UART_INTEN_RXTOIEN_Msk | UART_INTEN_RDAIEN_Msk);
+}
+
+static void UartPortClose(UART_T *uart, IRQn_Type irq)
+{
+    uart->INTEN = 0;
+    NVIC_DisableIRQ(irq);
+}
+
+void UART_Init()
+{
+    UartPortInit(UART0, UART0_IRQn);
+}
+
+void UART0_Close(void)
+{
+    UartPortClose(UART0, UART0_IRQn);
+}
+
+#if ISP_UART1
+void UART1_Init(void)
+{
+    UartPortInit(UART1, UART1_IRQn);
+}
+
+void UART1_Close(void)
+{
+    UartPortClose(UART1, UART1_IRQn);
+}
+#endif
+
+uint8_t *UART_Poll(void)
+{
+    if (bUartDataReady == TRUE)
+    {
+        bUartDataReady = FALSE;
+        return uart_rcvbuf;
+    }
+
+    return NULL;
+}
+
+#if ISP_UART1
+uint8_t *UART1_Poll(void)
+{
+    if (bUart1DataReady == TRUE)
+    {
+        bUart1DataReady = FALSE;
+        return uart1_rcvbuf;
+    }
+
+    return NULL;
 }
+#endif
+
+void UART_SetSpeed(uint32_t u32Baud, uint32_t u32GapUs)
+{
+    UartPortSetSpeed(UART0, u32Baud, u32GapUs);
+}
+
+#if ISP_UART1
+void UART1_SetSpeed(uint32_t u32Baud, uint32_t u32GapUs)
+{
+    UartPortSetSpeed(UART1, u32Baud, u32GapUs);
+}
+#endif
+
+/* Both ports run from HIRC, so one check serves both */
+uint8_t UART_SpeedOk(uint32_t u32Baud, uint32_t u32GapUs)
+{
+    if (u32Baud && ((u32Baud < UART_BAUD_MIN) || (u32Baud > UART_BAUD_MAX)))
+    {
+        return 0;
+    }
+
+    return (u32GapUs <= UART_GAP_MAX_US);
+}
+
+const ISP_LINK_T g_uart0Link = {UART_Init, UART_Poll, PutString, NULL, UART_SetSpeed, UART_SpeedOk, UART0_Close, 2};
+#if ISP_UART1
+const ISP_LINK_T g_uart1Link = {UART1_Init, UART1_Poll, UART1_PutString, NULL, UART1_SetSpeed, UART_SpeedOk, UART1_Close, 2};
+#endif
 
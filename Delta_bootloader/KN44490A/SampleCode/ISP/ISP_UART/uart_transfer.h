@@ -16,16 +16,69 @@
 /* Define maximum packet size */
 #define MAX_PKT_SIZE            64
 
+/* Set to 1 to also offer the ISP on UART1. SYS_Init() then takes PB2 (RXD)
+ * and PB3 (TXD), so enable it only on boards that leave those pins to the
+ * bootloader: ISP_UART1=1 in the Keil project's C/C++ Define field or
+ * -DISP_UART1=1 for gcc. Costs 448 bytes of flash and 72 bytes of RAM on
+ * top of the UART0-only image (clang 14, -Os: 3336 -> 3784). With
+ * ISP_READ_FLASH as well it no longer fits the LDROM (4180), so build it
+ * with ISP_READ_FLASH=0.
+ */
+#ifndef ISP_UART1
+#define ISP_UART1               0
+#endif
+
+/*
+ * RX timing, recomputed by UART_SetSpeed():
+ *  - RX FIFO trigger: the largest of 8/4/1 bytes that still leaves
+ *    UART_RX_LATENCY_US of FIFO headroom. 8 and 4 divide the frame
+ *    size, so a frame normally completes on the trigger rather than
+ *    waiting for the time-out.
+ *  - Frame boundary: an idle gap of at least the inter-frame gap
+ *    drops a partial frame. If the gap fits the 8-bit time-out
+ *    comparator it is done by the RX time-out, otherwise the time-out
+ *    only flushes the FIFO and the gap is measured with SysTick when
+ *    the next byte arrives, so USB-serial pauses inside a frame at
+ *    high bit rates no longer reset it.
+ */
+#define UART_RX_LATENCY_US      40      /* worst-case RX interrupt latency budget */
+#define UART_GAP_DEFAULT_US     1700    /* 0x40 bit times at 38400, as before */
+#define UART_TOIC_MIN           20      /* two characters */
+
+/*
+ * CMD_SET_SPEED limits: rates the mode 2 divider can encode, BRD from
+ * 3 to 0xFFFF as UART_BAUD_MODE2_DIVIDER() rounds it, and a gap that
+ * keeps the comparator and SysTick arithmetic within 32 bits.
+ */
+#define UART_BAUD_MIN           (__HIRC / (0xFFFF + 2) + 1)
+#define UART_BAUD_MAX           (__HIRC / (3 + 2))
+#define UART_GAP_MAX_US         1000000
+
 /*-------------------------------------------------------------*/
 
 extern uint8_t  uart_rcvbuf[];
 extern uint8_t volatile bUartDataReady;
 extern uint8_t volatile bufhead;
+#if ISP_UART1
+extern uint8_t  uart1_rcvbuf[];
+extern uint8_t volatile bUart1DataReady;
+extern uint8_t volatile bufhead1;
+#endif
 
 /*-------------------------------------------------------------*/
 void UART_Init(void);
 void UART0_IRQHandler(void);
 void PutString(void);
+uint8_t *UART_Poll(void);
+void UART_SetSpeed(uint32_t u32Baud, uint32_t u32GapUs);
+uint8_t UART_SpeedOk(uint32_t u32Baud, uint32_t u32GapUs);
+void UART0_Close(void);
+void UART1_Init(void);
+void UART1_IRQHandler(void);
+void UART1_PutString(void);
+uint8_t *UART1_Poll(void);
+void UART1_SetSpeed(uint32_t u32Baud, uint32_t u32GapUs);
+void UART1_Close(void);
 
 #include "clk.h"
 ///*---------------------------------------------------------------------------------------------------------*/
@@ -0,0 +1,369 @@
+# SPDX-License-Identifier: Apache-2.0
+#
+# Flash and RAM of each bootloader configuration against the 4 KB LDROM,
+# checked against a tracked baseline (cmake --build build --target size):
+#
+#   cmake -DFIRMWARE=../Delta_bootloader -DBASELINE=bench/firmware-size.txt
+#         -DWORK=build/firmware-size [-DARM_SYSROOT=DIR] [-DUPDATE=ON]
+#         -P cmake/firmware_size.cmake
+#
+# KN44490A is built with arm-none-eabi-gcc, gcc_arm.ld and startup_M2003.S:
+# with the defaults, UART0 only, UART0 plus each optional feature, with all
+# of them and with ISP_RTOS. Without arm-none-eabi-gcc, clang and ld.lld
+# build it against the C library in ARM_SYSROOT (include/, and lib/ with
+# what gcc_arm.ld's GROUP names), starting at main() as there is no crt0.
+# W20B ISP_UART0 and ISP_UART1 are built with SDCC as their SDCC projects
+# do. A toolchain that is not on PATH is skipped; finding none at all fails.
+#
+# Flash is text + data (SDCC: ROM/EPROM/FLASH), RAM is data + bss (SDCC:
+# XRAM plus the internal RAM below the stack); the KN44490A stack and heap,
+# 0x400 and 0x100 from startup_M2003.S, come on top. Sizes depend on the
+# compiler, so the baseline keeps them per toolchain and major.minor
+# version. A configuration that grew beyond its baseline fails, as does one
+# with no baseline for this toolchain and one that no longer fits the LDROM
+# without being documented not to; UPDATE=ON writes the new sizes.
+cmake_minimum_required(VERSION 3.16)
+
+foreach(var FIRMWARE BASELINE WORK)
+    if(NOT DEFINED ${var})
+        message(FATAL_ERROR "firmware_size.cmake: -D${var}=... is required")
+    endif()
+endforeach()
+
+get_filename_component(FIRMWARE ${FIRMWARE} ABSOLUTE)
+
+set(LDROM_SIZE 4096)
+set(CONFIGS)
+
+set(KN ${FIRMWARE}/KN44490A)
+set(ISP ${KN}/SampleCode/ISP/ISP_UART)
+set(RTOS2 ${KN}/Library/CMSIS/RTOS2)
+set(W20B ${FIRMWARE}/W20B)
+
+# Optional KN44490A features, each "#ifndef X / #define X 0|1".
+# ISP_APPLY_PATCH is not one: its decoder is in the simulator only.
+set(M2003_FEATURES
+    ISP_STATS ISP_TRACE ISP_DF_WRITE_AT ISP_READ_FLASH ISP_SPI ISP_I2C ISP_UART1)
+
+# Configurations that are documented not to fit the LDROM: all features at
+# once and ISP_RTOS (isp_rtos.h)
+set(OVER_LDROM m2003-all m2003-rtos)
+
+# The Keil project's file list
+set(M2003_SOURCES
+    ${KN}/Library/Device/Nuvoton/M2003/Source/system_M2003.c
+    ${KN}/Library/Device/Nuvoton/M2003/Source/GCC/startup_M2003.S
+    ${ISP}/fmc_user.c
+    ${ISP}/isp_user.c
+    ${ISP}/targetdev.c
+    ${ISP}/main.c
+    ${ISP}/uart_transfer.c
+    ${ISP}/isp_stats.c
+    ${ISP}/isp_trace.c
+    ${ISP}/spi_transfer.c
+    ${ISP}/i2c_transfer.c
+    ${ISP}/isp_rtos.c
+)
+set(M2003_FLAGS
+    -mcpu=cortex-m23 -mthumb -Os -std=gnu11 -ffunction-sections -fdata-sections -w
+    -I${ISP}
+    -I${KN}/Library/Device/Nuvoton/M2003/Include
+    -I${KN}/Library/StdDriver/inc
+    -I${KN}/Library/CMSIS/Include
+)
+set(M2003_LDSCRIPT ${KN}/Library/Device/Nuvoton/M2003/Source/GCC/gcc_arm.ld)
+set(M2003_LDFLAGS -T ${M2003_LDSCRIPT} --specs=nano.specs -Wl,--gc-sections)
+set(M2003_CLANG_FLAGS
+    --target=thumbv8m.base-none-eabi --sysroot=${ARM_SYSROOT}
+    -D__START=main -D__STARTUP_CLEAR_BSS
+)
+
+# RTX5 from the library, configured as isp_rtos.h asks
+set(RTOS_SOURCES
+    ${RTOS2}/RTX/Config/RTX_Config.c
+    ${RTOS2}/RTX/Source/rtx_lib.c
+    ${RTOS2}/Source/os_systick.c
+)
+set(RTOS_FLAGS
+    -DISP_RTOS=1 -D__STACK_SIZE=0x200 -D__HEAP_SIZE=0
+    -DOS_DYNAMIC_MEM_SIZE=0 -DOS_IDLE_THREAD_STACK_SIZE=128
+    -DOS_TIMER_THREAD_STACK_SIZE=0 -DOS_TIMER_CB_QUEUE=0
+    -DOS_EVR_MEMORY=0 -DOS_EVR_KERNEL=0 -DOS_EVR_THREAD=0 -DOS_EVR_TIMER=0
+    -DOS_EVR_EVFLAGS=0 -DOS_EVR_MUTEX=0 -DOS_EVR_SEMAPHORE=0 -DOS_EVR_MEMPOOL=0
+    -DOS_EVR_MSGQUEUE=0
+    -I${WORK} -I${RTOS2}/Include -I${RTOS2}/RTX/Include -I${RTOS2}/RTX/Config
+)
+
+# Records one configuration's sizes, built with TOOLCHAIN, in the caller's
+# scope.
+macro(record name flash ram)
+    set(CONFIGS ${CONFIGS} ${name} PARENT_SCOPE)
+    set(TOOLCHAIN_${name} ${TOOLCHAIN} PARENT_SCOPE)
+    set(FLASH_${name} ${flash} PARENT_SCOPE)
+    set(RAM_${name} ${ram} PARENT_SCOPE)
+endmacro()
+
+# Sets out to family-major.minor of the compiler's version.
+function(toolchain_id out family compiler)
+    execute_process(COMMAND ${compiler} ${ARGN}
+        OUTPUT_VARIABLE version ERROR_VARIABLE version)
+    if(NOT version MATCHES "([0-9]+\\.[0-9]+)\\.[0-9]+")
+        message(FATAL_ERROR "no version in: ${compiler} ${ARGN}\n${version}")
+    endif()
+    set(${out} ${family}-${CMAKE_MATCH_1} PARENT_SCOPE)
+endfunction()
+
+function(m2003_build name)
+    if(ARM_GCC)
+        execute_process(
+            COMMAND ${ARM_GCC} ${M2003_FLAGS} ${ARGN} ${M2003_SOURCES} ${EXTRA_SOURCES}
+                    -o ${WORK}/${name}.elf ${M2003_LDFLAGS} ${EXTRA_LIBS}
+            RESULT_VARIABLE rc OUTPUT_VARIABLE log ERROR_VARIABLE log)
+    else()
+        # the integrated assembler takes startup_M2003.S like the C files
+        set(dir ${WORK}/${name})
+        file(MAKE_DIRECTORY ${dir})
+        set(objs)
+        foreach(src ${M2003_SOURCES} ${EXTRA_SOURCES})
+            get_filename_component(base ${src} NAME_WE)
+            execute_process(
+                COMMAND ${ARM_CLANG} ${M2003_CLANG_FLAGS} ${M2003_FLAGS} ${ARGN}
+                        -c ${src} -o ${dir}/${base}.o
+                RESULT_VARIABLE rc OUTPUT_VARIABLE log ERROR_VARIABLE log)
+            if(NOT rc EQUAL 0)
+                break()
+            endif()
+            list(APPEND objs ${dir}/${base}.o)
+        endforeach()
+        if(rc EQUAL 0)
+            execute_process(
+                COMMAND ${ARM_LLD} -T ${M2003_LDSCRIPT} --gc-sections -L${ARM_SYSROOT}/lib
+                        ${objs} ${EXTRA_LIBS} -o ${WORK}/${name}.elf
+                RESULT_VARIABLE rc OUTPUT_VARIABLE log ERROR_VARIABLE log)
+        endif()
+    endif()
+    if(NOT rc EQUAL 0)
+        message(SEND_ERROR "${name}: build failed\n${log}")
+        return()
+    endif()
+    # Berkeley format: a header line, then text data bss dec hex filename
+    execute_process(COMMAND ${ARM_SIZE} ${WORK}/${name}.elf
+        RESULT_VARIABLE rc OUTPUT_VARIABLE out ERROR_VARIABLE out)
+    if(NOT rc EQUAL 0 OR NOT out MATCHES "\n *([0-9]+)[ \t]+([0-9]+)[ \t]+([0-9]+)")
+        message(SEND_ERROR "${name}: ${ARM_SIZE} failed\n${out}")
+        return()
+    endif()
+    math(EXPR flash "${CMAKE_MATCH_1} + ${CMAKE_MATCH_2}")
+    math(EXPR ram "${CMAKE_MATCH_2} + ${CMAKE_MATCH_3}")
+    record(${name} ${flash} ${ram})
+endfunction()
+
+function(ms51_build name project source)
+    set(dir ${WORK}/${name})
+    set(src ${W20B}/SampleCode/ISP/${project})
+    file(MAKE_DIRECTORY ${dir})
+    set(rels)
+    foreach(c ${src}/main.c ${src}/${source})
+        get_filename_component(base ${c} NAME_WE)
+        execute_process(
+            COMMAND ${SDCC} -c --model-large -D__SDCC__
+                    -I${W20B}/Library/Device/Include -I${src}/include -I${W20B}/Library/StdDriver/inc
+                    ${c} -o ${dir}/${base}.rel
+            RESULT_VARIABLE rc OUTPUT_VARIABLE log ERROR_VARIABLE log)
+        if(NOT rc EQUAL 0)
+            message(SEND_ERROR "${name}: ${c} failed\n${log}")
+            return()
+        endif()
+        list(APPEND rels ${dir}/${base}.rel)
+    endforeach()
+    execute_process(
+        COMMAND ${SDCC} --model-large -o ${dir}/${name}.ihx ${rels}
+        RESULT_VARIABLE rc OUTPUT_VARIABLE log ERROR_VARIABLE log)
+    if(NOT rc EQUAL 0 OR NOT EXISTS ${dir}/${name}.mem)
+        message(SEND_ERROR "${name}: link failed\n${log}")
+        return()
+    endif()
+    # the linker's memory summary
+    file(READ ${dir}/${name}.mem mem)
+    set(hex "0x[0-9A-Fa-f]+")
+    if(NOT mem MATCHES "ROM/EPROM/FLASH +${hex} +${hex} +([0-9]+)")
+        message(SEND_ERROR "${name}: no code size in ${name}.mem")
+        return()
+    endif()
+    set(flash ${CMAKE_MATCH_1})
+    set(ram 0)
+    if(mem MATCHES "EXTERNAL RAM +${hex} +${hex} +([0-9]+)")
+        set(ram ${CMAKE_MATCH_1})
+    endif()
+    if(mem MATCHES "with ([0-9]+) bytes available")
+        math(EXPR ram "${ram} + 256 - ${CMAKE_MATCH_1}")
+    endif()
+    record(${name} ${flash} ${ram})
+endfunction()
+
+# Right-aligns value in width columns, or left-aligns it with LEFT.
+function(pad out value width)
+    string(LENGTH "${value}" len)
+    while(len LESS width)
+        if(ARGN STREQUAL "LEFT")
+            string(APPEND value " ")
+        else()
+            string(PREPEND value " ")
+        endif()
+        math(EXPR len "${len} + 1")
+    endwhile()
+    set(${out} "${value}" PARENT_SCOPE)
+endfunction()
+
+file(MAKE_DIRECTORY ${WORK})
+
+find_program(ARM_GCC arm-none-eabi-gcc)
+find_program(ARM_SIZE NAMES arm-none-eabi-size llvm-size)
+if(ARM_GCC)
+    toolchain_id(TOOLCHAIN gcc ${ARM_GCC} -dumpfullversion)
+elseif(DEFINED ARM_SYSROOT)
+    find_program(ARM_CLANG clang)
+    find_program(ARM_LLD ld.lld)
+    if(ARM_CLANG AND ARM_LLD)
+        toolchain_id(TOOLCHAIN clang ${ARM_CLANG} -dumpversion)
+    endif()
+endif()
+if(TOOLCHAIN AND ARM_SIZE)
+    m2003_build(m2003)
+    set(all_off)
+    set(all_on)
+    foreach(f ${M2003_FEATURES})
+        list(APPEND all_off -D${f}=0)
+        list(APPEND all_on -D${f}=1)
+    endforeach()
+    m2003_build(m2003-uart-only ${all_off})
+    foreach(f ${M2003_FEATURES})
+        m2003_build(m2003-uart+${f} ${all_off} -D${f}=1)
+    endforeach()
+    m2003_build(m2003-all ${all_on})
+
+    # the device header RTX includes through the generated RTE_Components.h
+    file(WRITE ${WORK}/RTE_Components.h "#define CMSIS_device_header \"M2003.h\"\n")
+    set(EXTRA_SOURCES ${RTOS_SOURCES})
+    set(EXTRA_LIBS ${RTOS2}/RTX/Library/GCC/libRTX_V8MB.a)
+    m2003_build(m2003-rtos ${RTOS_FLAGS})
+    unset(EXTRA_SOURCES)
+    unset(EXTRA_LIBS)
+else()
+    message(STATUS "neither arm-none-eabi-gcc nor clang and ld.lld with ARM_SYSROOT found, "
+                   "KN44490A skipped")
+endif()
+
+find_program(SDCC sdcc)
+if(SDCC)
+    toolchain_id(TOOLCHAIN sdcc ${SDCC} --version)
+    ms51_build(ms51-uart0 ISP_UART0 isp_uart0.c)
+    ms51_build(ms51-uart1 ISP_UART1 isp_uart1.c)
+else()
+    message(STATUS "sdcc not found, W20B skipped")
+endif()
+
+if(NOT CONFIGS)
+    message(FATAL_ERROR "no bootloader configuration built, nothing checked against ${BASELINE}")
+endif()
+
+# Baseline: "toolchain config flash ram" per line, # comments
+set(BASE_KEYS)
+if(EXISTS ${BASELINE})
+    file(STRINGS ${BASELINE} lines REGEX "^[^#]")
+    foreach(line ${lines})
+        string(REGEX MATCH "^([^ \t]+)[ \t]+([^ \t]+)[ \t]+([0-9]+)[ \t]+([0-9]+)" ok "${line}")
+        if(ok)
+            set(key ${CMAKE_MATCH_1}/${CMAKE_MATCH_2})
+            list(APPEND BASE_KEYS ${key})
+            set(BASE_FLASH_${key} ${CMAKE_MATCH_3})
+            set(BASE_RAM_${key} ${CMAKE_MATCH_4})
+        endif()
+    endforeach()
+endif()
+
+message("config                      flash  of LDROM     ram   baseline")
+set(failed 0)
+foreach(c ${CONFIGS})
+    set(key ${TOOLCHAIN_${c}}/${c})
+    math(EXPR whole "${FLASH_${c}} * 100 / ${LDROM_SIZE}")
+    math(EXPR tenth "${FLASH_${c}} * 1000 / ${LDROM_SIZE} % 10")
+    set(pct "${whole}.${tenth}")
+    pad(name_col "${c}" 26 LEFT)
+    pad(flash_col ${FLASH_${c}} 7)
+    pad(pct_col "${pct}%" 10)
+    pad(ram_col ${RAM_${c}} 8)
+    if(DEFINED BASE_FLASH_${key})
+        math(EXPR dflash "${FLASH_${c}} - ${BASE_FLASH_${key}}")
+        math(EXPR dram "${RAM_${c}} - ${BASE_RAM_${key}}")
+        set(note "${BASE_FLASH_${key}} / ${BASE_RAM_${key}}")
+        if(dflash GREATER 0 OR dram GREATER 0)
+            string(APPEND note "  GREW by ${dflash} / ${dram}")
+            set(failed 1)
+        elseif(dflash LESS 0 OR dram LESS 0)
+            math(EXPR dflash "-(${dflash})")
+            math(EXPR dram "-(${dram})")
+            string(APPEND note "  shrank by ${dflash} / ${dram}")
+        endif()
+    else()
+        set(note "NONE for ${TOOLCHAIN_${c}}")
+        set(failed 1)
+    endif()
+    if(FLASH_${c} GREATER LDROM_SIZE)
+        if(c IN_LIST OVER_LDROM)
+            string(APPEND note "  over LDROM, as documented")
+        else()
+            string(APPEND note "  OVER LDROM")
+            set(failed 1)
+        endif()
+    endif()
+    message("${name_col}${flash_col}${pct_col}${ram_col}   ${note}")
+endforeach()
+
+# What each feature adds to UART0 only
+if(DEFINED FLASH_m2003-uart-only)
+    message("")
+    message("feature                     flash     ram")
+    foreach(f ${M2003_FEATURES})
+        if(DEFINED FLASH_m2003-uart+${f})
+            math(EXPR dflash "${FLASH_m2003-uart+${f}} - ${FLASH_m2003-uart-only}")
+            math(EXPR dram "${RAM_m2003-uart+${f}} - ${RAM_m2003-uart-only}")
+            pad(name_col "${f}" 26 LEFT)
+            pad(flash_col ${dflash} 7)
+            pad(ram_col ${dram} 8)
+            message("${name_col}${flash_col}${ram_col}")
+        endif()
+    endforeach()
+endif()
+
+# The shipped Keil and SDCC images, for reference
+foreach(bin ${KN}/ISP_UART.bin ${W20B}/ISP_UART0.bin ${W20B}/ISP_UART1.bin)
+    if(EXISTS ${bin})
+        file(SIZE ${bin} size)
+        file(RELATIVE_PATH rel ${FIRMWARE} ${bin})
+        message("shipped ${rel}: ${size} bytes")
+    endif()
+endforeach()
+
+if(UPDATE)
+    # keep the entries of other toolchains and of configurations skipped here
+    set(text "# toolchain config flash ram, written by: cmake --build build --target size-baseline\n")
+    foreach(c ${CONFIGS})
+        set(FLASH_${TOOLCHAIN_${c}}/${c} ${FLASH_${c}})
+        set(RAM_${TOOLCHAIN_${c}}/${c} ${RAM_${c}})
+        list(APPEND BASE_KEYS ${TOOLCHAIN_${c}}/${c})
+    endforeach()
+    list(REMOVE_DUPLICATES BASE_KEYS)
+    foreach(key ${BASE_KEYS})
+        string(REPLACE "/" " " entry ${key})
+        if(DEFINED FLASH_${key})
+            string(APPEND text "${entry} ${FLASH_${key}} ${RAM_${key}}\n")
+        else()
+            string(APPEND text "${entry} ${BASE_FLASH_${key}} ${BASE_RAM_${key}}\n")
+        endif()
+    endforeach()
+    file(WRITE ${BASELINE} "${text}")
+    message(STATUS "baseline written to ${BASELINE}")
+elseif(failed)
+    message(FATAL_ERROR "firmware size regression against ${BASELINE}")
+endif()
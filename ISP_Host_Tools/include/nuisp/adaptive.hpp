@@ -0,0 +1,140 @@
+// SPDX-License-Identifier: Apache-2.0
+//
+// Link adaptation for the blocking Session. A LinkTuner tracks the resend,
+// time-out and failure rates of a station and picks the bit rate and the
+// device's inter-frame gap from a ladder; an AdaptiveSession runs the ISP
+// operations in segments, moves the link to the tuner's choice before each
+// one and retries a failed segment one step further down.
+//
+// The protocol fixes the frame at 64 bytes and runs one frame at a time,
+// so the knobs are the bit rate (CMD_SET_SPEED, Delta with cap::SetSpeed),
+// the idle gap after which the device drops a partial frame, and how much
+// work a failure throws away. CMD_UPDATE_* cannot be resumed, so a
+// program() is one segment; verify() is cut into segments of read-back
+// chunks that halve on a failure and double after a clean window.
+//
+// Rates step down on a resend share above stepDown or on any failure, and
+// back up after clean windows, 2^n of them for a rate that failed n times,
+// so a station settles just below the rate its cabling stops holding. Keep
+// one LinkTuner per station, or save() and load() it between processes.
+#pragma once
+
+#include "nuisp/packet_cache.hpp"
+#include "nuisp/session.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace nuisp {
+
+struct TunerPolicy
+{
+    // Bit rates to choose from, ascending. The first is the bootloader's
+    // power-on rate, where a device is looked for after it was lost.
+    std::vector<std::uint32_t> rates{38400, 57600, 115200, 230400, 460800};
+    // Index into rates a new station starts at
+    std::size_t startRate = 2;
+    // Inter-frame gaps in microseconds, ascending; 0 keeps the firmware's
+    std::vector<std::uint32_t> gapsUs{0, 5000, 20000};
+    // Frames per decision
+    std::size_t window = 64;
+    // Bounds of the read-back chunks per verify() segment
+    std::size_t minSegment = 4;
+    std::size_t maxSegment = 64;
+    // Resends per frame above which the rate steps down
+    double stepDown = 0.02;
+    // Cap on the clean windows a failed rate waits for, as a power of two
+    unsigned maxBackoff = 6;
+    // Tries per segment, each after a step down and a reconnect
+    unsigned attempts = 4;
+};
+
+struct TunerStats
+{
+    std::uint64_t frames = 0;
+    std::uint64_t resends = 0;
+    std::uint64_t timeouts = 0;
+    std::uint64_t failures = 0;  // errors other than time-outs
+    unsigned stepsUp = 0;
+    unsigned stepsDown = 0;
+};
+
+class LinkTuner
+{
+public:
+    enum class Outcome
+    {
+        Ok,
+        Timeout,  // the device stopped answering: lost bytes or a stalled host
+        Failed,   // corrupted beyond what the resends could repair
+    };
+
+    explicit LinkTuner(TunerPolicy policy = {});
+
+    std::uint32_t rate() const { return policy_.rates[rate_]; }
+    std::uint32_t gapUs() const { return policy_.gapsUs[gap_]; }
+    std::size_t segment() const { return segment_; }
+
+    // Frames and resends of one segment, and how it ended.
+    void record(std::uint64_t frames, std::uint64_t resends, Outcome outcome);
+
+    // Rate, gap, segment and per-rate failure counts as text. load() keeps
+    // the start state if the file does not exist and ignores rates not in
+    // the ladder.
+    void load(const std::string& path);
+    void save(const std::string& path) const;
+
+    const TunerPolicy& policy() const { return policy_; }
+    const TunerStats& stats() const { return stats_; }
+
+private:
+    void stepDown();
+
+    TunerPolicy policy_;
+    TunerStats stats_;
+    std::size_t rate_;
+    std::size_t gap_ = 0;
+    std::size_t segment_;
+    std::vector<unsigned> failures_;  // per rate
+    std::uint64_t windowFrames_ = 0;
+    std::uint64_t windowResends_ = 0;
+    unsigned cleanWindows_ = 0;
+};
+
+// Session operations under a LinkTuner. The session's link must follow
+// setBaudRate(). Not thread safe, like the Session.
+class AdaptiveSession
+{
+public:
+    AdaptiveSession(Session& session, LinkTuner& tuner);
+
+    // Connect at the power-on rate and find out whether the device can
+    // switch; operations then run at the tuner's rate.
+    void connect(std::chrono::milliseconds window);
+
+    void eraseAll();
+    void program(const PacketCache& cache, const Progress& progress = {});
+    void verify(std::uint32_t address, const PacketCache& cache, const Progress& progress = {});
+    void run();
+
+    // Current rate of both ends; stays at the power-on rate if the device
+    // lacks cap::SetSpeed or declines.
+    std::uint32_t baud() const { return baud_; }
+
+private:
+    void apply();
+    void recover();
+    void attempt(const std::function<void()>& segment);
+
+    Session& session_;
+    LinkTuner& tuner_;
+    std::chrono::milliseconds connectWindow_{0};
+    std::uint32_t baud_;
+    std::uint32_t gapUs_ = 0;
+    bool canSwitch_ = false;
+};
+
+}  // namespace nuisp
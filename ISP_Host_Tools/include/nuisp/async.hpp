@@ -0,0 +1,291 @@
+// SPDX-License-Identifier: Apache-2.0
+//
+// Coroutine plumbing for the asynchronous API: a lazy Task<T>, the
+// IoExecutor interface it suspends on, and EpollExecutor, a stand-alone
+// single-threaded implementation of it. A host application with its own
+// event loop implements IoExecutor on top of that loop instead.
+//
+// Cancellation is std::stop_token based: a wait whose token is stopped
+// resumes with WaitResult::Cancelled, from whichever thread requested it.
+#pragma once
+
+#include "nuisp/link.hpp"
+
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace nuisp {
+
+// The operation's std::stop_token was stopped.
+class CancelledError : public Error
+{
+public:
+    using Error::Error;
+};
+
+using Deadline = std::chrono::steady_clock::time_point;
+constexpr Deadline kNoDeadline = Deadline::max();
+
+template<typename T = void>
+class Task;
+
+namespace detail {
+
+struct PromiseBase
+{
+    std::coroutine_handle<> continuation = std::noop_coroutine();
+    std::exception_ptr error;
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+
+    struct FinalAwaiter
+    {
+        bool await_ready() noexcept { return false; }
+        template<typename P>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept
+        {
+            return h.promise().continuation;
+        }
+        void await_resume() noexcept {}
+    };
+    FinalAwaiter final_suspend() noexcept { return {}; }
+
+    void unhandled_exception() { error = std::current_exception(); }
+};
+
+template<typename T>
+struct Promise : PromiseBase
+{
+    std::optional<T> value;
+
+    void return_value(T v) { value = std::move(v); }
+    T result()
+    {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        return std::move(*value);
+    }
+};
+
+template<>
+struct Promise<void> : PromiseBase
+{
+    void return_void() {}
+    void result()
+    {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+};
+
+}  // namespace detail
+
+// Lazily started coroutine; runs when awaited and resumes the awaiter when
+// done. Arguments passed by reference must outlive the co_await.
+template<typename T>
+class [[nodiscard]] Task
+{
+public:
+    struct promise_type : detail::Promise<T>
+    {
+        Task get_return_object()
+        {
+            return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+    };
+
+    Task(Task&& other) noexcept : handle_(std::exchange(other.handle_, {})) {}
+    Task& operator=(Task&& other) noexcept
+    {
+        if (this != &other) {
+            if (handle_) {
+                handle_.destroy();
+            }
+            handle_ = std::exchange(other.handle_, {});
+        }
+        return *this;
+    }
+    ~Task()
+    {
+        if (handle_) {
+            handle_.destroy();
+        }
+    }
+
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiter) noexcept
+    {
+        handle_.promise().continuation = awaiter;
+        return handle_;
+    }
+    T await_resume() { return handle_.promise().result(); }
+
+private:
+    explicit Task(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+
+    std::coroutine_handle<promise_type> handle_;
+};
+
+enum class WaitResult
+{
+    Ready,
+    Timeout,
+    Cancelled,
+};
+
+// Event loop the asynchronous API suspends on. Everything but cancel() is
+// called from the loop's own thread.
+class IoExecutor
+{
+public:
+    struct Wait
+    {
+        int fd = -1;  // -1: deadline only
+        bool writable = false;
+        Deadline deadline = kNoDeadline;
+        std::coroutine_handle<> waiter;
+        WaitResult result = WaitResult::Ready;
+        std::uint64_t id = 0;  // assigned by start()
+    };
+
+    virtual ~IoExecutor() = default;
+
+    // Resume w.waiter exactly once, later and from the loop, with w.result
+    // set: when fd is ready, when the deadline passes, or after cancel().
+    virtual void start(Wait& w) = 0;
+
+    // Any thread. Does nothing if the wait has already completed.
+    virtual void cancel(std::uint64_t id) = 0;
+};
+
+// co_await IoAwait(executor, fd, false, deadline, stop) -> WaitResult
+class IoAwait
+{
+public:
+    IoAwait(IoExecutor& executor, int fd, bool writable, Deadline deadline, std::stop_token stop)
+        : executor_(executor), stop_(std::move(stop))
+    {
+        wait_.fd = fd;
+        wait_.writable = writable;
+        wait_.deadline = deadline;
+    }
+
+    bool await_ready() const noexcept { return stop_.stop_requested(); }
+    void await_suspend(std::coroutine_handle<> h)
+    {
+        wait_.waiter = h;
+        executor_.start(wait_);
+        if (stop_.stop_possible()) {
+            // runs at once if the stop came in between
+            cancel_.emplace(stop_, CancelWait{&executor_, wait_.id});
+        }
+    }
+    WaitResult await_resume()
+    {
+        cancel_.reset();
+        return stop_.stop_requested() ? WaitResult::Cancelled : wait_.result;
+    }
+
+private:
+    struct CancelWait
+    {
+        IoExecutor* executor;
+        std::uint64_t id;
+        void operator()() const { executor->cancel(id); }
+    };
+
+    IoExecutor& executor_;
+    std::stop_token stop_;
+    IoExecutor::Wait wait_;
+    std::optional<std::stop_callback<CancelWait>> cancel_;
+};
+
+// epoll based IoExecutor that owns its loop. One outstanding wait per fd.
+class EpollExecutor : public IoExecutor
+{
+public:
+    EpollExecutor();
+    ~EpollExecutor() override;
+
+    EpollExecutor(const EpollExecutor&) = delete;
+    EpollExecutor& operator=(const EpollExecutor&) = delete;
+
+    void start(Wait& w) override;
+    void cancel(std::uint64_t id) override;
+
+    // Run task on this executor; done (if set) gets its exception or null.
+    // The task starts right away, up to its first suspension.
+    void spawn(Task<void> task, std::function<void(std::exception_ptr)> done = {});
+
+    // Serve waits until every spawned task has finished.
+    void run();
+
+private:
+    struct Entry
+    {
+        Wait* wait;
+        std::multimap<Deadline, std::uint64_t>::iterator timer;
+    };
+
+    void complete(std::uint64_t id, WaitResult result);
+
+    int epoll_ = -1;
+    int wakeup_ = -1;  // eventfd for cancel() from other threads
+    std::uint64_t nextId_ = 1;
+    std::unordered_map<std::uint64_t, Entry> waits_;
+    std::multimap<Deadline, std::uint64_t> timers_;
+    std::deque<std::coroutine_handle<>> ready_;
+    std::mutex cancelLock_;
+    std::vector<std::uint64_t> cancels_;
+    std::size_t tasks_ = 0;
+};
+
+// Wait out a delay; WaitResult::Cancelled if stop is requested first.
+inline Task<WaitResult> sleepFor(IoExecutor& executor, std::chrono::nanoseconds delay,
+                                 std::stop_token stop = {})
+{
+    const WaitResult r = co_await IoAwait(executor, -1, false,
+                                          std::chrono::steady_clock::now() + delay, stop);
+    co_return r == WaitResult::Timeout ? WaitResult::Ready : r;
+}
+
+// Run one task to completion on a private loop and return its result.
+template<typename T>
+T syncWait(EpollExecutor& executor, Task<T> task)
+{
+    std::exception_ptr error;
+    if constexpr (std::is_void_v<T>) {
+        executor.spawn(std::move(task), [&](std::exception_ptr e) { error = e; });
+        executor.run();
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    } else {
+        std::optional<T> value;
+        auto keep = [](Task<T> t, std::optional<T>& out) -> Task<void> {
+            out = co_await std::move(t);
+        };
+        executor.spawn(keep(std::move(task), value), [&](std::exception_ptr e) { error = e; });
+        executor.run();
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        return std::move(*value);
+    }
+}
+
+}  // namespace nuisp
@@ -0,0 +1,94 @@
+// SPDX-License-Identifier: Apache-2.0
+//
+// Coroutine counterpart of Session: the same ProtocolCore, suspended on an
+// IoExecutor instead of blocking in read(), so one thread can drive many
+// devices alongside other work. Any Link with a pollFd() will do, so a
+// CaptureLink or ImpairedLink can sit in between.
+//
+//   EpollExecutor loop;
+//   SerialPort port("/dev/ttyUSB0", 38400);
+//   AsyncSession s(loop, port, Variant::Delta);
+//   loop.spawn([](AsyncSession& s, const PacketCache& c) -> Task<> {
+//       co_await s.connect(std::chrono::seconds(5));
+//       co_await s.program(c);
+//       co_await s.verify(0, c);
+//   }(s, cache));
+//   loop.run();
+//
+// Every operation takes a std::stop_token and a deadline for the operation
+// as a whole, on top of the per-frame timeouts in SessionOptions. A stop
+// throws CancelledError and a passed deadline TimeoutError, both leaving
+// the device mid-command: connect() again before the next operation.
+// Frames go out through Link::write(), which blocks only while the
+// driver's output buffer is full.
+#pragma once
+
+#include "nuisp/async.hpp"
+#include "nuisp/link.hpp"
+#include "nuisp/packet_cache.hpp"
+#include "nuisp/protocol.hpp"
+#include "nuisp/protocol_core.hpp"
+#include "nuisp/session.hpp"
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <span>
+#include <stop_token>
+
+namespace nuisp {
+
+class AsyncSession
+{
+public:
+    // Throws if link has no pollFd().
+    AsyncSession(IoExecutor& executor, Link& link, Variant variant, SessionOptions options = {});
+
+    Task<> connect(std::chrono::milliseconds window, std::stop_token stop = {});
+
+    Task<std::array<std::uint32_t, 4>> readConfig(std::stop_token stop = {},
+                                                  Deadline deadline = kNoDeadline);
+
+    Task<> eraseAll(std::stop_token stop = {}, Deadline deadline = kNoDeadline);
+
+    // As Session::program(const PacketCache&) and Session::verify(address,
+    // const PacketCache&); the cache must outlive the co_await.
+    Task<> program(const PacketCache& cache, Progress progress = {}, std::stop_token stop = {},
+                   Deadline deadline = kNoDeadline);
+    Task<> verify(std::uint32_t address, const PacketCache& cache, Progress progress = {},
+                  std::stop_token stop = {}, Deadline deadline = kNoDeadline);
+
+    // Leave the bootloader; the device resets without answering.
+    Task<> run(std::stop_token stop = {});
+
+    Task<Frame> transact(std::uint32_t command, std::span<const std::uint8_t> payload,
+                         std::chrono::milliseconds timeout, std::stop_token stop = {},
+                         Deadline deadline = kNoDeadline);
+
+    Variant variant() const { return core_.variant(); }
+    const SessionStats& stats() const { return core_.stats(); }
+
+private:
+    // Always a named local: GCC 12 destroys aggregate temporaries inside a
+    // co_await expression twice.
+    struct Op
+    {
+        std::stop_token stop;
+        Deadline deadline;
+    };
+
+    // false if the frame timeout passed first; throws on stop or deadline
+    Task<bool> read(Frame& frame, std::chrono::milliseconds timeout, const Op& op);
+    // Write core_.next() and read its answer; false if none (complete)
+    // came in time
+    Task<bool> exchange(Frame& response, const Op& op);
+    // Run the core's operation to its end
+    Task<> drive(const Op& op);
+    Task<WaitResult> wait(Deadline until, const Op& op);
+
+    IoExecutor& executor_;
+    Link& link_;
+    ProtocolCore core_;
+};
+
+}  // namespace nuisp
@@ -0,0 +1,73 @@
+// SPDX-License-Identifier: Apache-2.0
+//
+// ISP traffic capture: a text file with one line per chunk of bytes seen
+// on the link, timestamped in microseconds from the start of the capture.
+//
+//   # nuisp capture 1
+//   0 = 38400
+//   1204 > ae e3 d2 c1 01 00 00 00 ...
+//   17950 < 70 03 00 00 02 00 00 00 ...
+//
+// '>' is host to device, '<' device to host, '=' a bit rate change. A
+// chunk is whatever one write or read moved, so a host-side capture sees a
+// request as one chunk and a proxy sees a response arrive piecemeal.
+#pragma once
+
+#include "nuisp/link.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace nuisp {
+
+struct CaptureRecord
+{
+    std::uint64_t us = 0;
+    char kind = '>';                  // '>', '<' or '='
+    std::vector<std::uint8_t> bytes;  // '>' and '<'
+    std::uint32_t baud = 0;           // '='
+};
+
+class CaptureWriter
+{
+public:
+    CaptureWriter(const std::string& path, std::uint32_t baud);
+    ~CaptureWriter();
+
+    CaptureWriter(const CaptureWriter&) = delete;
+    CaptureWriter& operator=(const CaptureWriter&) = delete;
+
+    void data(bool toDevice, std::span<const std::uint8_t> bytes);
+    void baud(std::uint32_t baud);
+
+private:
+    std::uint64_t now() const;
+
+    std::FILE* file_ = nullptr;
+    std::chrono::steady_clock::time_point start_;
+};
+
+// Records everything that passes through another Link.
+class CaptureLink : public Link
+{
+public:
+    CaptureLink(Link& inner, CaptureWriter& writer) : inner_(inner), writer_(writer) {}
+
+    void write(std::span<const std::uint8_t> data) override;
+    std::size_t read(std::span<std::uint8_t> data, std::chrono::milliseconds timeout) override;
+    void discardInput() override { inner_.discardInput(); }
+    void setBaudRate(std::uint32_t baud) override;
+    int pollFd() const override { return inner_.pollFd(); }
+
+private:
+    Link& inner_;
+    CaptureWriter& writer_;
+};
+
+std::vector<CaptureRecord> readCapture(const std::string& path);
+
+}  // namespace nuisp
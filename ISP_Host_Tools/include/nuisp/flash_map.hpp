@@ -0,0 +1,81 @@
+// SPDX-License-Identifier: Apache-2.0
+//
+// Sparse image of the device address space, filled by the HEX, S-record
+// and ELF loaders in image.hpp. Data lands in 512-byte pages allocated on
+// first touch; records only ever copy into them, so a 10 MB HEX costs its
+// pages plus one index entry each, not one buffer per record.
+//
+// splitFlashMap() then cuts the map along the geometry the bootloader
+// reports (CMD_GET_DEVICE_INFO) into the APROM, data flash and CONFIG
+// contents to program.
+#pragma once
+
+#include "nuisp/session.hpp"
+
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <span>
+#include <utility>
+#include <vector>
+
+namespace nuisp {
+
+class FlashMap
+{
+public:
+    static constexpr std::uint32_t kPageSize = 512;
+
+    // Copy bytes to [address, address + size); later writes win.
+    void write(std::uint32_t address, std::span<const std::uint8_t> bytes);
+
+    bool empty() const { return index_.empty(); }
+    std::size_t pageCount() const { return pages_.size(); }
+
+    // Written address ranges, ascending and coalesced. Within a page the
+    // range runs from its lowest to its highest written byte.
+    std::vector<std::pair<std::uint32_t, std::uint32_t>> ranges() const;
+
+    // [from, to) as a flat image, 0xFF where nothing was written.
+    std::vector<std::uint8_t> read(std::uint32_t from, std::uint32_t to) const;
+
+private:
+    struct Page
+    {
+        std::array<std::uint8_t, kPageSize> bytes;
+        std::uint16_t lo = kPageSize;  // written [lo, hi)
+        std::uint16_t hi = 0;
+    };
+
+    Page& page(std::uint32_t base);
+
+    std::deque<Page> pages_;  // stable addresses, allocated in blocks
+    std::map<std::uint32_t, Page*> index_;
+    std::uint32_t lastBase_ = 1;  // never a page base
+    Page* last_ = nullptr;
+};
+
+struct FlashGeometry
+{
+    std::uint32_t apromSize = 0;
+    std::uint32_t dataflashAddr = 0;
+    std::uint32_t dataflashSize = 0;
+    // CONFIG0; CONFIG1..3 follow
+    std::uint32_t configAddr = 0x00300000;
+
+    static FlashGeometry from(const DeviceInfo& info);
+};
+
+struct FlashImages
+{
+    std::vector<std::uint8_t> aprom;      // from address 0, empty if none
+    std::vector<std::uint8_t> dataflash;  // from dataflashAddr, empty if none
+    std::vector<std::uint32_t> config;    // CONFIG0.. as far as the file sets them
+};
+
+// Throws if anything was written outside APROM, data flash and CONFIG.
+// APROM ends where data flash starts when the two share the flash.
+FlashImages splitFlashMap(const FlashMap& map, const FlashGeometry& geometry);
+
+}  // namespace nuisp
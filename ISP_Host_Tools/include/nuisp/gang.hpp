@@ -0,0 +1,94 @@
+// SPDX-License-Identifier: Apache-2.0
+//
+// Gang programming: one image onto many boards at once from a single
+// thread. Every port drives its own ProtocolCore, the one Session uses,
+// through
+//
+//   CONNECT -> CMD_UPDATE_APROM frames -> CMD_READ_FLASH verify -> CMD_RUN_APROM
+//
+// and one epoll loop multiplexes all of them. A port waiting for its
+// device costs nothing but an fd in the epoll set, so the per-station
+// limit is the number of USB-serial adapters, not CPU. Frames, response
+// checksums and read-back CRCs all come from one shared PacketCache.
+#pragma once
+
+#include "nuisp/packet_cache.hpp"
+#include "nuisp/protocol.hpp"
+#include "nuisp/session.hpp"
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace nuisp {
+
+struct GangOptions
+{
+    std::uint32_t baud = 38400;
+    // How long each port keeps sending CMD_CONNECT
+    std::chrono::milliseconds connectWindow{5000};
+    // Timeouts and resend limit, same meaning as for a single Session
+    SessionOptions session;
+    // Read back through CMD_READ_FLASH after programming (Delta only)
+    bool verify = true;
+    // Send CMD_RUN_APROM when done
+    bool run = true;
+};
+
+struct PortResult
+{
+    std::string path;
+    bool ok = false;
+    std::string error;
+    SessionStats stats;
+    // From the CONNECT answer to the last response
+    std::chrono::duration<double> elapsed{};
+
+    // Payload bytes (programmed plus read back) per second
+    double throughput() const
+    {
+        return elapsed.count() > 0 ? static_cast<double>(stats.payloadBytes) / elapsed.count()
+                                   : 0.0;
+    }
+};
+
+class GangProgrammer
+{
+public:
+    GangProgrammer(const std::vector<std::string>& ports, PacketCache cache,
+                   GangOptions options = {});
+    ~GangProgrammer();
+
+    GangProgrammer(const GangProgrammer&) = delete;
+    GangProgrammer& operator=(const GangProgrammer&) = delete;
+
+    // Run all ports to completion. onFinished is called as each port ends.
+    std::vector<PortResult> run(const std::function<void(const PortResult&)>& onFinished = {});
+
+private:
+    struct Port;
+
+    void start(Port& port);
+    void send(Port& port, const Frame& frame, std::chrono::milliseconds timeout);
+    // write the core's next frame, or move on once its operation is done
+    void step(Port& port);
+    void onReadable(Port& port);
+    void onFrame(Port& port);
+    void onTimeout(Port& port);
+    void startProgram(Port& port);
+    void sendNextData(Port& port);
+    void sendReadFlash(Port& port);
+    void afterData(Port& port);
+    void finish(Port& port, std::string error);
+
+    PacketCache cache_;
+    GangOptions options_;
+    std::vector<std::unique_ptr<Port>> ports_;
+    std::function<void(const PortResult&)> onFinished_;
+    int epfd_ = -1;
+    std::size_t active_ = 0;
+};
+
+}  // namespace nuisp
@@ -0,0 +1,40 @@
+// SPDX-License-Identifier: Apache-2.0
+#pragma once
+
+#include "nuisp/flash_map.hpp"
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace nuisp {
+
+enum class ImageFormat
+{
+    Binary,
+    IntelHex,  // .hex .ihx
+    Srec,      // .srec .s19 .s28 .s37 .mot
+    Elf,       // .elf .axf, or any file starting with the ELF magic
+};
+
+ImageFormat imageFormat(const std::string& path);
+
+// Whole file as a flat binary image, offset 0 = start of the target region.
+std::vector<std::uint8_t> loadBinaryFile(const std::string& path);
+
+// Map an addressed image (HEX, S-record, or the PT_LOAD segments of a
+// 32-bit little-endian ELF at their load addresses) and parse it in one
+// pass straight into a FlashMap.
+FlashMap loadFlashMap(const std::string& path);
+
+// Any format as one flat image. Addressed data is placed relative to its
+// lowest address rounded down to a 512-byte flash page; gaps are filled
+// with 0xFF.
+std::vector<std::uint8_t> loadImageFile(const std::string& path);
+
+// Image length without trailing erased (0xFF) bytes, rounded up to a flash
+// word. Everything past it already reads 0xFF after the loader's erase.
+std::size_t trimmedSize(std::span<const std::uint8_t> image);
+
+}  // namespace nuisp
@@ -0,0 +1,60 @@
+// SPDX-License-Identifier: Apache-2.0
+//
+// Link decorator that degrades another Link in a reproducible way: a fixed
+// delay per write and per read that returns data, and random bit errors in
+// both directions. Used to measure how the protocol copes with a bad cable
+// without needing one.
+#pragma once
+
+#include "nuisp/link.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+namespace nuisp {
+
+struct Impairment
+{
+    // One-way delay, added before each write and after each read that
+    // returned data, so a request/response round trip costs twice this.
+    std::chrono::microseconds latency{0};
+    // Probability that a byte has one bit flipped, in either direction.
+    double byteErrorRate = 0.0;
+    std::uint32_t seed = 1;
+};
+
+struct ImpairmentStats
+{
+    std::uint64_t bytesOut = 0;
+    std::uint64_t bytesIn = 0;
+    std::uint64_t corruptedOut = 0;
+    std::uint64_t corruptedIn = 0;
+};
+
+class ImpairedLink : public Link
+{
+public:
+    ImpairedLink(Link& inner, Impairment impairment);
+
+    void write(std::span<const std::uint8_t> data) override;
+    std::size_t read(std::span<std::uint8_t> data, std::chrono::milliseconds timeout) override;
+    void discardInput() override { inner_.discardInput(); }
+    void setBaudRate(std::uint32_t baud) override { inner_.setBaudRate(baud); }
+    int pollFd() const override { return inner_.pollFd(); }
+
+    const ImpairmentStats& stats() const { return stats_; }
+
+private:
+    // flip one random bit in some bytes, return how many
+    std::uint64_t corrupt(std::span<std::uint8_t> data);
+
+    Link& inner_;
+    Impairment impairment_;
+    ImpairmentStats stats_;
+    std::mt19937 rng_;
+    std::vector<std::uint8_t> scratch_;
+};
+
+}  // namespace nuisp
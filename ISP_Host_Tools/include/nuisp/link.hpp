@@ -0,0 +1,52 @@
+// SPDX-License-Identifier: Apache-2.0
+//
+// Byte stream to one device. SerialPort is the termios implementation;
+// anything else that moves bytes (a pty, a simulator, a test double) can
+// implement the same interface and drive a Session.
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <stdexcept>
+#include <string>
+
+namespace nuisp {
+
+class Error : public std::runtime_error
+{
+public:
+    using std::runtime_error::runtime_error;
+};
+
+// No (complete) response within the allowed time.
+class TimeoutError : public Error
+{
+public:
+    using Error::Error;
+};
+
+class Link
+{
+public:
+    virtual ~Link() = default;
+
+    // Write all bytes or throw.
+    virtual void write(std::span<const std::uint8_t> data) = 0;
+
+    // Read until the buffer is full or the timeout expires, return bytes read.
+    virtual std::size_t read(std::span<std::uint8_t> data, std::chrono::milliseconds timeout) = 0;
+
+    // Drop anything received but not read yet.
+    virtual void discardInput() = 0;
+
+    // Change the host side bit rate, no-op where it does not apply.
+    virtual void setBaudRate(std::uint32_t baud) = 0;
+
+    // Descriptor that polls readable when read() has bytes to return, for
+    // the asynchronous API; -1 if there is none.
+    virtual int pollFd() const { return -1; }
+};
+
+}  // namespace nuisp
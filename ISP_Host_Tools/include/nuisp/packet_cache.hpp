@@ -0,0 +1,103 @@
+// SPDX-License-Identifier: Apache-2.0
+//
+// Precompiled image: every CMD_UPDATE_* frame of one image, built once and
+// saved as an mmap-able .nupc file, so programming a board is copying
+// frames out of the map and patching in the packet number.
+//
+// File layout, all fields little-endian:
+//
+//   0x00  header (64 bytes, see below)
+//   frames      frameCount x 64 bytes, packet number field 0
+//   expect      frameCount x {u16 checksum, u16 programmed sum}
+//   page crc    pageCount x u32, CRC-32 of each 512-byte page as the FMC
+//               RUN_CKS command computes it (tail padded with 0xFF)
+//   read crc    readChunks x u16, CRC-16 of each CMD_READ_FLASH chunk
+//
+// The response checksum of frame i sent as packet p is
+// expect[i].checksum + packnoSum(p); the programmed sum is what W20B
+// reports at offset 8. Verifying a CMD_READ_FLASH chunk is comparing its
+// CRC with read crc[i].
+#pragma once
+
+#include "nuisp/mapped_file.hpp"
+#include "nuisp/protocol.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace nuisp {
+
+constexpr std::uint32_t kPacketCacheVersion = 1;
+constexpr std::uint32_t kFlashPageSize = 512;
+
+struct FrameExpect
+{
+    std::uint16_t checksum;       // response checksum with packet number 0
+    std::uint16_t programmedSum;  // running 16-bit sum after this frame (W20B)
+};
+
+// Serialized cache for the trimmed image.
+std::vector<std::uint8_t> buildPacketCache(Variant variant, std::uint32_t command,
+                                           std::span<const std::uint8_t> image);
+
+class PacketCache
+{
+public:
+    // Map a .nupc file.
+    static PacketCache open(const std::string& path);
+    // Build in memory from a raw image.
+    static PacketCache build(Variant variant, std::uint32_t command,
+                             std::span<const std::uint8_t> image);
+
+    Variant variant() const { return variant_; }
+    std::uint32_t command() const { return command_; }
+    // Trimmed image length, the total length sent in the first frame
+    std::uint32_t imageSize() const { return imageSize_; }
+    std::uint32_t imageCrc32() const { return imageCrc32_; }
+
+    std::size_t frameCount() const { return frameCount_; }
+    // Frame i with packet number 0
+    std::span<const std::uint8_t, kFrameSize> frame(std::size_t i) const
+    {
+        return std::span<const std::uint8_t, kFrameSize>(frames_ + i * kFrameSize, kFrameSize);
+    }
+    FrameExpect expect(std::size_t i) const
+    {
+        return {getLe16(expect_ + 4 * i), getLe16(expect_ + 4 * i + 2)};
+    }
+    // Image bytes carried by frame i
+    std::size_t frameBytes(std::size_t i) const;
+
+    std::size_t pageCount() const { return pageCount_; }
+    std::uint32_t pageCrc(std::size_t i) const { return getLe32(pageCrc_ + 4 * i); }
+
+    std::size_t readChunks() const { return readChunks_; }
+    std::uint16_t readCrc(std::size_t i) const { return getLe16(readCrc_ + 2 * i); }
+
+    std::span<const std::uint8_t> bytes() const { return bytes_; }
+
+private:
+    PacketCache() = default;
+    void parse();
+
+    std::shared_ptr<MappedFile> file_;
+    std::shared_ptr<std::vector<std::uint8_t>> buffer_;
+    std::span<const std::uint8_t> bytes_;
+
+    Variant variant_ = Variant::Delta;
+    std::uint32_t command_ = 0;
+    std::uint32_t imageSize_ = 0;
+    std::uint32_t imageCrc32_ = 0;
+    std::size_t frameCount_ = 0;
+    std::size_t pageCount_ = 0;
+    std::size_t readChunks_ = 0;
+    const std::uint8_t* frames_ = nullptr;
+    const std::uint8_t* expect_ = nullptr;
+    const std::uint8_t* pageCrc_ = nullptr;
+    const std::uint8_t* readCrc_ = nullptr;
+};
+
+}  // namespace nuisp
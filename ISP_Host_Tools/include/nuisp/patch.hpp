@@ -0,0 +1,61 @@
+// SPDX-License-Identifier: Apache-2.0
+//
+// Binary patches for CMD_APPLY_PATCH (Delta with cap::ApplyPatch): the new
+// APROM image as COPY, INSERT and FILL ops against the installed one, which
+// the bootloader rebuilds in place, page by page (isp_user.h has the op
+// encoding). A patch names its base by length and RUN_CKS CRC-32, so the
+// device refuses it on any other image.
+//
+// Only the simulator decodes patches: the decoder does not fit the LDROM
+// next to the bootloader, so real KN44490A devices lack cap::ApplyPatch.
+//
+// Each rebuilt page overwrites the old one, so a COPY can only read pages
+// that are not rewritten yet. makePatch() lays out the changed pages in
+// ascending and in descending order, since code that moved up copies best
+// from below and the other way round, keeps the shorter stream and checks
+// it by replaying it on a copy of the base.
+//
+// .nupd file layout, all fields little-endian:
+//
+//   0x00  "NUPD", version
+//   0x08  base size, base CRC-32, image size, image CRC-32
+//   0x18  page records, stream length
+//   0x20  stream
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace nuisp {
+
+constexpr std::uint32_t kPatchVersion = 1;
+
+struct Patch
+{
+    // Images with trailing 0xFF dropped and padded to whole pages, as the
+    // device's RUN_CKS sees them after CMD_UPDATE_APROM erased APROM
+    std::uint32_t baseSize = 0;
+    std::uint32_t baseCrc = 0;
+    std::uint32_t imageSize = 0;
+    std::uint32_t imageCrc = 0;
+    std::uint32_t pages = 0;  // page records in the stream
+    std::vector<std::uint8_t> stream;
+};
+
+// Throws if either image is blank or too large for the encoding.
+Patch makePatch(std::span<const std::uint8_t> base, std::span<const std::uint8_t> image);
+
+// The flash after the bootloader ran the stream over base, from address 0
+// to the end of the last page either covers. Throws on a record the device
+// would reject.
+std::vector<std::uint8_t> replayPatch(std::span<const std::uint8_t> base, const Patch& patch);
+
+std::vector<std::uint8_t> serializePatch(const Patch& patch);
+Patch parsePatch(std::span<const std::uint8_t> bytes);
+
+Patch loadPatchFile(const std::string& path);
+void savePatchFile(const std::string& path, const Patch& patch);
+
+}  // namespace nuisp
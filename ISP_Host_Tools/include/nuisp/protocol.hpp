@@ -0,0 +1,160 @@
+// SPDX-License-Identifier: Apache-2.0
+//
+// Wire format of the Delta ISP protocol (KN44490A, isp_user.h) and of the
+// W20B MS51 variant (isp_uart0.h). Both exchange fixed 64-byte frames,
+// stop-and-wait:
+//
+//   host -> device   [0..3] command word, [4..7] packet number, [8..] payload
+//   device -> host   [0..1] byte sum of the received frame, [4..] packet
+//                    number + 1, [8..] command specific
+//
+// Data transfers (CMD_UPDATE_APROM / CMD_UPDATE_DATAFLASH) carry start
+// address and total length in the first frame followed by 48 data bytes,
+// then continuation frames with command word 0 and 56 data bytes.
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+namespace nuisp {
+
+constexpr std::size_t kFrameSize = 64;
+using Frame = std::array<std::uint8_t, kFrameSize>;
+
+enum class Variant
+{
+    Delta,  // KN44490A / M2003 LDROM bootloader
+    W20B,   // MS51 8051 LDROM bootloader
+};
+
+namespace cmd {
+constexpr std::uint32_t UpdateAprom = 0xC1D2E3A0;
+constexpr std::uint32_t UpdateConfig = 0xC1D2E3A1;
+constexpr std::uint32_t ReadConfig = 0xC1D2E3A2;
+constexpr std::uint32_t EraseAll = 0xC1D2E3A3;
+constexpr std::uint32_t SyncPackno = 0xC1D2E3A4;
+constexpr std::uint32_t GetFwVer = 0xC1D2E3A6;
+constexpr std::uint32_t RunAprom = 0xC1D2E3AB;
+constexpr std::uint32_t RunLdrom = 0xC1D2E3AC;
+constexpr std::uint32_t Reset = 0xC1D2E3AD;
+constexpr std::uint32_t Connect = 0xC1D2E3AE;
+constexpr std::uint32_t GetDeviceId = 0xC1D2E3B1;
+constexpr std::uint32_t GetDeviceInfo = 0xC1D2E3B2;
+constexpr std::uint32_t GetStats = 0xC1D2E3B3;
+constexpr std::uint32_t DumpTrace = 0xC1D2E3B4;
+constexpr std::uint32_t SetSpeed = 0xC1D2E3B5;
+constexpr std::uint32_t UpdateDataflash = 0xC1D2E3C3;
+constexpr std::uint32_t WriteDataflashAt = 0xC1D2E3C4;
+constexpr std::uint32_t ReadFlash = 0xC1D2E3C5;
+constexpr std::uint32_t ApplyPatch = 0xC1D2E3C6;
+constexpr std::uint32_t ResendPacket = 0xC1D2E3FF;
+}  // namespace cmd
+
+// Capability bits reported by CMD_GET_DEVICE_INFO (Delta only)
+namespace cap {
+constexpr std::uint32_t DeviceInfo = 0x001;
+constexpr std::uint32_t Stats = 0x002;
+constexpr std::uint32_t Trace = 0x004;
+constexpr std::uint32_t Spi = 0x008;
+constexpr std::uint32_t I2c = 0x010;
+constexpr std::uint32_t Uart1 = 0x020;
+constexpr std::uint32_t DataflashWriteAt = 0x040;
+constexpr std::uint32_t ReadFlash = 0x080;
+constexpr std::uint32_t SetSpeed = 0x100;
+constexpr std::uint32_t ApplyPatch = 0x200;
+}  // namespace cap
+
+// Payload offsets of the data transfer frames
+constexpr std::size_t kFirstDataOffset = 16;
+constexpr std::size_t kFirstDataSize = kFrameSize - kFirstDataOffset;
+constexpr std::size_t kNextDataOffset = 8;
+constexpr std::size_t kNextDataSize = kFrameSize - kNextDataOffset;
+
+// CMD_READ_FLASH response layout
+constexpr std::size_t kReadFlashAddr = 8;
+constexpr std::size_t kReadFlashLen = 12;
+constexpr std::size_t kReadFlashCrc = 14;
+constexpr std::size_t kReadFlashData = 16;
+constexpr std::size_t kReadFlashChunk = 48;
+constexpr std::uint16_t kReadFlashRejected = 0xFFFF;
+
+// CMD_SET_SPEED response: 1 if the device will switch after answering
+constexpr std::size_t kSpeedAccepted = 24;
+
+// CMD_APPLY_PATCH: header before the stream in the first frame; every
+// response reports the stream bytes still expected, or kPatchRejected, and
+// the CRC-32 of the new image once the last page is written
+constexpr std::size_t kPatchHeaderSize = 16;
+constexpr std::size_t kPatchRemain = 24;
+constexpr std::size_t kPatchCrc = 28;
+constexpr std::uint32_t kPatchRejected = 0xFFFFFFFF;
+
+inline std::uint16_t getLe16(const std::uint8_t* p)
+{
+    return static_cast<std::uint16_t>(p[0] | (p[1] << 8));
+}
+
+inline std::uint32_t getLe32(const std::uint8_t* p)
+{
+    return static_cast<std::uint32_t>(p[0]) | (static_cast<std::uint32_t>(p[1]) << 8) |
+           (static_cast<std::uint32_t>(p[2]) << 16) | (static_cast<std::uint32_t>(p[3]) << 24);
+}
+
+inline void putLe16(std::uint8_t* p, std::uint16_t v)
+{
+    p[0] = static_cast<std::uint8_t>(v);
+    p[1] = static_cast<std::uint8_t>(v >> 8);
+}
+
+inline void putLe32(std::uint8_t* p, std::uint32_t v)
+{
+    for (int i = 0; i < 4; ++i) {
+        p[i] = static_cast<std::uint8_t>(v >> (8 * i));
+    }
+}
+
+// Byte sum the device returns at offset 0 of every response.
+std::uint16_t frameChecksum(std::span<const std::uint8_t> bytes);
+
+// CRC-16/CCITT-FALSE as used by CMD_READ_FLASH.
+std::uint16_t crc16Ccitt(std::span<const std::uint8_t> bytes);
+
+// CRC-32 (IEEE 802.3, reflected) as computed by the FMC RUN_CKS command
+// over 512-byte aligned flash ranges (FMC_GetChkSum).
+std::uint32_t crc32(std::span<const std::uint8_t> bytes);
+
+// Contribution of the packet number field to frameChecksum(), so a
+// precomputed checksum of a frame sent with packet number 0 can be
+// completed for any packet number.
+inline std::uint16_t packnoSum(std::uint32_t packno)
+{
+    return static_cast<std::uint16_t>((packno & 0xFF) + ((packno >> 8) & 0xFF) +
+                                      ((packno >> 16) & 0xFF) + (packno >> 24));
+}
+
+// Zeroed frame with command word and packet number filled in.
+Frame makeFrame(std::uint32_t command, std::uint32_t packno);
+
+// Packet number the device answers with. W20B only echoes 16 bits.
+bool responsePacknoMatches(Variant variant, const Frame& response, std::uint32_t sentPackno);
+
+// CMD_UPDATE_APROM / CMD_UPDATE_DATAFLASH frame carrying image bytes from
+// offset on: the first frame (offset 0) has the command, start address 0 and
+// total length, later ones are continuation frames. Returns the bytes taken.
+std::size_t makeDataFrame(Frame& frame, std::uint32_t command,
+                          std::span<const std::uint8_t> image, std::size_t offset);
+
+enum class ReadFlashStatus
+{
+    Ok,
+    Corrupted,  // checksum, length or CRC wrong: re-request
+    Rejected,   // device refused the range
+};
+
+// Check a CMD_READ_FLASH response to sent; on Ok chunk holds the data.
+ReadFlashStatus checkReadFlash(const Frame& sent, const Frame& response,
+                               std::span<const std::uint8_t>& chunk);
+
+}  // namespace nuisp
@@ -0,0 +1,186 @@
+// SPDX-License-Identifier: Apache-2.0
+//
+// The ISP conversation with one device, without the I/O: packet numbering,
+// response checks, CMD_RESEND_PACKET recovery and the CMD_READ_FLASH loop.
+// Session, GangProgrammer and AsyncSession all drive the same core, each
+// with its own way of waiting for bytes:
+//
+//   core.command(cmd::ReadConfig, {}, timeout);
+//   while (core.busy()) {
+//       write(core.next());
+//       Frame r;
+//       if (read(r, core.timeout())) core.onResponse(&r);
+//       else { discardInput(); core.onResponse(nullptr); }
+//   }
+//   use(core.response());
+//
+// Errors the recovery cannot repair are thrown from onResponse().
+#pragma once
+
+#include "nuisp/link.hpp"
+#include "nuisp/protocol.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <span>
+
+namespace nuisp {
+
+struct SessionOptions
+{
+    std::chrono::milliseconds responseTimeout{1000};
+    // Erase-bearing frames: CMD_ERASE_ALL and the first CMD_UPDATE_* frame
+    std::chrono::milliseconds eraseTimeout{10000};
+    // How often CMD_CONNECT is repeated while waiting for the device to reset;
+    // longer than a 64-byte round trip at 38400 baud (33 ms)
+    std::chrono::milliseconds connectRetry{50};
+    // CMD_RESEND_PACKET attempts per data frame before giving up (Delta only)
+    unsigned maxResends = 3;
+};
+
+struct SessionStats
+{
+    std::uint64_t frames = 0;
+    std::uint64_t resends = 0;
+    std::uint64_t payloadBytes = 0;
+};
+
+// bytes done, bytes total
+using Progress = std::function<void(std::size_t, std::size_t)>;
+
+class ProtocolCore
+{
+public:
+    enum class Reply
+    {
+        Ok,
+        Corrupted,  // answers another packet number
+        Missing,    // nothing (complete) in time
+    };
+
+    // offset into the range, chunk data, the response carrying it; throws
+    // to end the read-back
+    using ChunkCheck =
+        std::function<void(std::size_t, std::span<const std::uint8_t>, const Frame&)>;
+
+    ProtocolCore(Variant variant, SessionOptions options);
+
+    // CMD_CONNECT always goes out as packet 1. True if response answers it,
+    // which restarts the numbering.
+    static Frame connectFrame() { return makeFrame(cmd::Connect, 1); }
+    bool connected(const Frame& response);
+
+    // Operations; each replaces whatever was in progress.
+
+    // One command. Delta commands are repeated on a bad or missing answer,
+    // except CMD_SET_SPEED.
+    void command(std::uint32_t command, std::span<const std::uint8_t> payload,
+                 std::chrono::milliseconds timeout);
+    // W20B: tell the device the next packet number, which also stops the
+    // timer that boots APROM
+    void syncPackno();
+    // One CMD_UPDATE_* or CMD_APPLY_PATCH frame; checksum is the expected
+    // response checksum for packet number 0
+    void data(std::span<const std::uint8_t, kFrameSize> frame, std::uint16_t checksum,
+              std::chrono::milliseconds timeout);
+    // CMD_READ_FLASH of [address, address + size), chunk by chunk
+    void readFlash(std::uint32_t address, std::size_t size, ChunkCheck check);
+
+    // An operation is waiting for a response to next().
+    bool busy() const { return op_ != Op::None; }
+    // Frame to write now, packet number filled in, and how long its answer
+    // may take. Write each one once: it has used up its packet number.
+    const Frame& next() const { return out_; }
+    std::chrono::milliseconds timeout() const { return timeout_; }
+    // The answer to next(), nullptr if none (complete) came in time; the
+    // caller drops any late bytes before the next write.
+    void onResponse(const Frame* response);
+    // The answer that completed command(), syncPackno() or data()
+    const Frame& response() const { return response_; }
+
+    // Single exchanges outside the operations above: request() makes
+    // next(), classify() checks the packet number of its answer.
+    void request(const Frame& frame, std::chrono::milliseconds timeout);
+    Reply classify(const Frame* response);
+
+    // CMD_RUN_APROM; the device resets without answering.
+    Frame runAprom();
+
+    Variant variant() const { return variant_; }
+    const SessionOptions& options() const { return options_; }
+    SessionStats& stats() { return stats_; }
+    const SessionStats& stats() const { return stats_; }
+
+private:
+    enum class Op
+    {
+        None,
+        Command,
+        Data,
+        Resend,
+        ReadFlash,
+    };
+
+    struct DataFrame
+    {
+        Frame frame;
+        std::uint16_t checksum;
+    };
+
+    void sendData();
+    void sendResend();
+    void onCommand(Reply reply, const Frame* response);
+    void onData(Reply reply, const Frame* response);
+    void onResend(Reply reply);
+    void onReadFlash(Reply reply, const Frame* response);
+    void readAgain(const Frame& frame);
+
+    Variant variant_;
+    SessionOptions options_;
+    SessionStats stats_;
+
+    Op op_ = Op::None;
+    Frame out_{};
+    std::chrono::milliseconds timeout_{0};
+    Frame response_{};
+    unsigned attempt_ = 0;
+
+    std::uint32_t packno_ = 1;
+    std::uint32_t sentPackno_ = 0;
+    // frames sent since the last answer; its packet number tells how many
+    // of them the device received
+    unsigned unanswered_ = 0;
+    // how many of those the last answer showed never arrived
+    unsigned skipped_ = 0;
+
+    // command(): the frame, repeated as is
+    Frame request_{};
+    std::chrono::milliseconds requestTimeout_{0};
+
+    // data(): the frame to send, then the one before it if the device
+    // rolled that back in place of one it missed
+    DataFrame pending_[2]{};
+    std::size_t queued_ = 0;
+    std::chrono::milliseconds dataTimeout_{0};
+    std::uint32_t dataPackno_ = 0;
+    // last data frame the device accepted
+    std::optional<DataFrame> lastData_;
+    // CMD_RESEND_PACKET undid lastData_ already; another one does nothing
+    bool rolledBack_ = false;
+    // CMD_RESEND_PACKET in progress: unanswered frames before the first
+    // one, and before the last one
+    unsigned resendLost_ = 0;
+    unsigned resendBefore_ = 0;
+    unsigned resendAttempt_ = 0;
+
+    // readFlash()
+    std::uint32_t readAddress_ = 0;
+    std::size_t readSize_ = 0;
+    std::size_t readDone_ = 0;
+    bool readFirst_ = true;
+    ChunkCheck check_;
+};
+
+}  // namespace nuisp
@@ -0,0 +1,37 @@
+// SPDX-License-Identifier: Apache-2.0
+#pragma once
+
+#include "nuisp/link.hpp"
+
+#include <string>
+
+namespace nuisp {
+
+// Raw 8N1 termios port. Works on USB-serial adapters and on ptys.
+class SerialPort : public Link
+{
+public:
+    SerialPort(const std::string& path, std::uint32_t baud);
+    ~SerialPort() override;
+
+    SerialPort(const SerialPort&) = delete;
+    SerialPort& operator=(const SerialPort&) = delete;
+
+    void write(std::span<const std::uint8_t> data) override;
+    std::size_t read(std::span<std::uint8_t> data, std::chrono::milliseconds timeout) override;
+    void discardInput() override;
+    void setBaudRate(std::uint32_t baud) override;
+    int pollFd() const override { return fd_; }
+
+    int fd() const { return fd_; }
+    const std::string& path() const { return path_; }
+
+private:
+    std::string path_;
+    int fd_ = -1;
+};
+
+// Bit rate of a termios speed_t code, 0 for one SerialPort does not use.
+std::uint32_t baudFromSpeed(unsigned int speed);
+
+}  // namespace nuisp
@@ -0,0 +1,119 @@
+// SPDX-License-Identifier: Apache-2.0
+#pragma once
+
+#include "nuisp/link.hpp"
+#include "nuisp/packet_cache.hpp"
+#include "nuisp/patch.hpp"
+#include "nuisp/protocol.hpp"
+#include "nuisp/protocol_core.hpp"
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <span>
+
+namespace nuisp {
+
+enum class Target
+{
+    Aprom,
+    Dataflash,
+};
+
+// CMD_GET_DEVICE_INFO payload (Delta firmware with cap::DeviceInfo)
+struct DeviceInfo
+{
+    std::uint32_t fwVersion = 0;
+    std::uint32_t pdid = 0;
+    std::uint32_t config0 = 0;
+    std::uint32_t config1 = 0;
+    std::uint32_t apromSize = 0;
+    std::uint32_t dataflashAddr = 0;
+    std::uint32_t dataflashSize = 0;
+    std::array<std::uint32_t, 3> uid{};
+    std::uint32_t capabilities = 0;
+};
+
+// One ISP session over a Link. Not thread safe; one Session per device.
+class Session
+{
+public:
+    Session(Link& link, Variant variant, SessionOptions options = {});
+
+    // Repeat CMD_CONNECT until the bootloader answers or the window closes.
+    void connect(std::chrono::milliseconds window);
+
+    std::uint8_t firmwareVersion();
+    std::uint32_t deviceId();
+    std::array<std::uint32_t, 4> readConfig();
+
+    // Empty if the firmware predates CMD_GET_DEVICE_INFO or is W20B.
+    std::optional<DeviceInfo> deviceInfo();
+
+    // CMD_SET_SPEED (Delta, cap::SetSpeed): move both ends of the link to
+    // baud and set the device's inter-frame gap; 0 keeps either. Returns
+    // false, with the host side unchanged, if the device declined.
+    bool setSpeed(std::uint32_t baud, std::uint32_t gapUs = 0);
+
+    void eraseAll();
+
+    // CMD_UPDATE_CONFIG: rewrite CONFIG0..3 and return them as read back.
+    // A locked part takes it only after eraseAll().
+    std::array<std::uint32_t, 4> updateConfig(const std::array<std::uint32_t, 4>& config);
+
+    // Each response is checked against the read-back the device does, so a
+    // completed program() is already verified frame by frame. Trailing 0xFF
+    // bytes are not sent, the loader's erase already left them.
+    void program(Target target, std::span<const std::uint8_t> image, const Progress& progress = {});
+
+    // Same, with frames and expected checksums taken from a precompiled cache.
+    void program(const PacketCache& cache, const Progress& progress = {});
+
+    // Independent read-back of [address, address + image size) through
+    // CMD_READ_FLASH (Delta, cap::ReadFlash). Throws on the first difference.
+    void verify(std::uint32_t address, std::span<const std::uint8_t> image,
+                const Progress& progress = {});
+
+    // Read-back compared by CRC against the cache's chunk table.
+    void verify(std::uint32_t address, const PacketCache& cache, const Progress& progress = {});
+
+    // Same for [offset, offset + size) of the image only. The range starts
+    // on a kReadFlashChunk boundary and ends on one or at the image end.
+    // Progress counts within the range.
+    void verify(std::uint32_t address, const PacketCache& cache, std::size_t offset,
+                std::size_t size, const Progress& progress = {});
+
+    // CMD_APPLY_PATCH (Delta, cap::ApplyPatch): rebuild APROM from the
+    // image installed now. Throws if the device refuses the patch, which it
+    // does before writing anything when that image is not the patch's base,
+    // and if the CRC-32 it reports for the result is not the patch's.
+    // Progress counts stream bytes.
+    void applyPatch(const Patch& patch, const Progress& progress = {});
+
+    // Leave the bootloader. The device resets without answering.
+    void run();
+
+    // Raw exchange for commands the library does not wrap.
+    Frame transact(std::uint32_t command, std::span<const std::uint8_t> payload,
+                   std::chrono::milliseconds timeout);
+
+    Variant variant() const { return core_.variant(); }
+    const SessionStats& stats() const { return core_.stats(); }
+    Link& link() { return link_; }
+
+private:
+    // Write core_.next() and read its answer; nullptr if none (complete)
+    // came in time
+    const Frame* exchange(Frame& response);
+    // Run the core's operation to its end
+    void drive();
+    // CMD_READ_FLASH loop; check(offset, chunk, response) throws on a mismatch
+    void readBack(std::uint32_t address, std::size_t size, const ProtocolCore::ChunkCheck& check,
+                  const Progress& progress);
+
+    Link& link_;
+    ProtocolCore core_;
+};
+
+}  // namespace nuisp
@@ -0,0 +1,123 @@
+// SPDX-License-Identifier: Apache-2.0
+//
+// Pty and reset plumbing shared by the simulators.
+#include "sim_host.hpp"
+
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <thread>
+#include <unistd.h>
+
+namespace simhost {
+
+namespace {
+
+char g_linkPath[4096];
+
+void onSignal(int)
+{
+    if (g_linkPath[0]) {
+        ::unlink(g_linkPath);
+    }
+    ::_exit(130);
+}
+
+bool isResetOption(const char* arg)
+{
+    return std::strncmp(arg, "--pty-fd=", 9) == 0 || std::strncmp(arg, "--flash-fd=", 11) == 0;
+}
+
+}  // namespace
+
+int openPty(std::string& slave)
+{
+    const int master = ::posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || ::grantpt(master) != 0 || ::unlockpt(master) != 0) {
+        throw std::runtime_error("posix_openpt: " + std::string(std::strerror(errno)));
+    }
+    slave = ::ptsname(master);
+    const int fd = ::open(slave.c_str(), O_RDWR | O_NOCTTY);
+    if (fd < 0) {
+        throw std::runtime_error(slave + ": " + std::strerror(errno));
+    }
+    termios tio;
+    ::tcgetattr(fd, &tio);
+    ::cfmakeraw(&tio);
+    ::tcsetattr(fd, TCSANOW, &tio);
+    return master;
+}
+
+void publishPty(const std::string& slave, const std::string& link)
+{
+    if (!link.empty()) {
+        ::unlink(link.c_str());
+        if (::symlink(slave.c_str(), link.c_str()) != 0) {
+            throw std::runtime_error(link + ": " + std::strerror(errno));
+        }
+    }
+    std::printf("%s\n", link.empty() ? slave.c_str() : link.c_str());
+    std::fflush(stdout);
+    keepLinkOnSignal(link);
+}
+
+void keepLinkOnSignal(const std::string& link)
+{
+    std::snprintf(g_linkPath, sizeof(g_linkPath), "%s", link.c_str());
+    std::signal(SIGINT, onSignal);
+    std::signal(SIGTERM, onSignal);
+}
+
+void drainPty(int master, long maxMs)
+{
+    const int slave = ::open(::ptsname(master), O_RDONLY | O_NOCTTY | O_NONBLOCK);
+    if (slave < 0) {
+        return;
+    }
+    // a write reaches the slave's queue from a kernel work item, so an
+    // empty queue only means "read" once that has had time to run
+    constexpr long kSettleMs = 20;
+    for (long ms = 0; ms < maxMs; ++ms) {
+        int pending = 0;
+        if (::ioctl(slave, FIONREAD, &pending) != 0 || (pending == 0 && ms >= kSettleMs)) {
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    ::close(slave);
+}
+
+std::vector<std::string> restartArgs(int argc, char** argv)
+{
+    std::vector<std::string> args;
+    for (int i = 0; i < argc; ++i) {
+        if (!isResetOption(argv[i])) {
+            args.emplace_back(argv[i]);
+        }
+    }
+    return args;
+}
+
+void reexec(std::vector<std::string> args, int ptyFd, int flashFd)
+{
+    args.push_back("--pty-fd=" + std::to_string(ptyFd));
+    args.push_back("--flash-fd=" + std::to_string(flashFd));
+    std::vector<char*> argv;
+    for (std::string& a : args) {
+        argv.push_back(a.data());
+    }
+    argv.push_back(nullptr);
+    std::fflush(nullptr);
+    ::execv("/proc/self/exe", argv.data());
+    std::fprintf(stderr, "%s: execv: %s\n", args[0].c_str(), std::strerror(errno));
+    ::_exit(1);
+}
+
+}  // namespace simhost
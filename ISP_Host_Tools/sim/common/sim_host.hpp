@@ -0,0 +1,35 @@
+// SPDX-License-Identifier: Apache-2.0
+//
+// Host plumbing shared by the bootloader simulators: the pty the host
+// tools open, and the re-exec that stands in for a chip reset.
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace simhost {
+
+// New pty; returns the master. The slave is held open in raw mode for the
+// life of the process, across reexec(), so the master never sees a hang-up.
+int openPty(std::string& slave);
+
+// Symlink link to the slave (if link is not empty), print the path the host
+// should open on stdout, and remove the link again on SIGINT/SIGTERM.
+void publishPty(const std::string& slave, const std::string& link);
+
+// Forget the link cleanup on SIGINT/SIGTERM for a run that inherited its pty.
+void keepLinkOnSignal(const std::string& link);
+
+// Wait, up to maxMs, for the host to read what was written to the pty;
+// closing the master discards it.
+void drainPty(int master, long maxMs);
+
+// Command line for the next run: argv without the --pty-fd= / --flash-fd=
+// options reexec() adds.
+std::vector<std::string> restartArgs(int argc, char** argv);
+
+// Start this executable again in place with the pty master and flash
+// descriptor passed on. Does not return.
+[[noreturn]] void reexec(std::vector<std::string> args, int ptyFd, int flashFd);
+
+}  // namespace simhost
@@ -0,0 +1,155 @@
+/*
+ * Host stand-in for the CMSIS Cortex-M23 core header, used to build the
+ * M2003 ISP firmware for the simulator. It is found ahead of
+ * Library/CMSIS/Include, so M2003.h pulls it in unchanged.
+ *
+ * Registers are plain memory mapped at their Cortex-M addresses by the
+ * simulator. Instructions the firmware uses as "the hardware acts now"
+ * points (__ISB after ISPTRG, NVIC_SystemReset) call into the model.
+ */
+#ifndef __CORE_CM23_H_GENERIC
+#define __CORE_CM23_H_GENERIC
+#define __CORE_CM23_H_DEPENDANT
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define __CM23_CMSIS_VERSION_MAIN   5U
+#define __CM23_CMSIS_VERSION_SUB    0U
+#define __CORTEX_M                  23U
+
+#define __I         volatile const
+#define __O         volatile
+#define __IO        volatile
+#define __IM        volatile const
+#define __OM        volatile
+#define __IOM       volatile
+
+#define __ASM               __asm
+#define __INLINE            inline
+#define __STATIC_INLINE     static inline
+#define __STATIC_FORCEINLINE static inline
+#define __NO_RETURN         __attribute__((__noreturn__))
+#define __USED              __attribute__((used))
+#define __WEAK              __attribute__((weak))
+#define __PACKED            __attribute__((packed, aligned(1)))
+#define __ALIGNED(x)        __attribute__((aligned(x)))
+
+/* simulator entry points, sim_core.cpp */
+void SimSync(void);
+void SimSystemReset(void) __NO_RETURN;
+void SimIrqEnable(int32_t irq, uint32_t enable);
+
+#define __ISB()             SimSync()
+#define __DSB()             SimSync()
+#define __DMB()             ((void)0)
+#define __NOP()             ((void)0)
+#define __WFI()             SimSync()
+#define __WFE()             SimSync()
+#define __enable_irq()      ((void)0)
+#define __disable_irq()     ((void)0)
+
+/* interrupts only run inside the model's hooks, nothing to mask */
+__STATIC_INLINE uint32_t __get_PRIMASK(void)
+{
+    return 0U;
+}
+
+__STATIC_INLINE void __set_PRIMASK(uint32_t priMask)
+{
+    (void)priMask;
+}
+
+typedef struct
+{
+    __IOM uint32_t CTRL;
+    __IOM uint32_t LOAD;
+    __IOM uint32_t VAL;
+    __IM  uint32_t CALIB;
+} SysTick_Type;
+
+typedef struct
+{
+    __IM  uint32_t CPUID;
+    __IOM uint32_t ICSR;
+    __IOM uint32_t VTOR;
+    __IOM uint32_t AIRCR;
+    __IOM uint32_t SCR;
+    __IOM uint32_t CCR;
+          uint32_t RESERVED1;
+    __IOM uint32_t SHPR[2U];
+    __IOM uint32_t SHCSR;
+} SCB_Type;
+
+#define SysTick_CTRL_COUNTFLAG_Pos  16U
+#define SysTick_CTRL_COUNTFLAG_Msk  (1UL << SysTick_CTRL_COUNTFLAG_Pos)
+#define SysTick_CTRL_CLKSOURCE_Pos  2U
+#define SysTick_CTRL_CLKSOURCE_Msk  (1UL << SysTick_CTRL_CLKSOURCE_Pos)
+#define SysTick_CTRL_TICKINT_Pos    1U
+#define SysTick_CTRL_TICKINT_Msk    (1UL << SysTick_CTRL_TICKINT_Pos)
+#define SysTick_CTRL_ENABLE_Pos     0U
+#define SysTick_CTRL_ENABLE_Msk     (1UL)
+#define SysTick_LOAD_RELOAD_Pos     0U
+#define SysTick_LOAD_RELOAD_Msk     (0xFFFFFFUL)
+#define SysTick_VAL_CURRENT_Pos     0U
+#define SysTick_VAL_CURRENT_Msk     (0xFFFFFFUL)
+
+#define SCB_AIRCR_VECTKEY_Pos       16U
+#define SCB_AIRCR_VECTKEY_Msk       (0xFFFFUL << SCB_AIRCR_VECTKEY_Pos)
+#define SCB_AIRCR_SYSRESETREQ_Pos   2U
+#define SCB_AIRCR_SYSRESETREQ_Msk   (1UL << SCB_AIRCR_SYSRESETREQ_Pos)
+
+#define SCS_BASE            (0xE000E000UL)
+#define SysTick_BASE        (SCS_BASE + 0x0010UL)
+#define SCB_BASE            (SCS_BASE + 0x0D00UL)
+
+#define SysTick             ((SysTick_Type *) SysTick_BASE)
+#define SCB                 ((SCB_Type *)     SCB_BASE)
+
+__STATIC_INLINE void NVIC_EnableIRQ(IRQn_Type IRQn)
+{
+    SimIrqEnable((int32_t)IRQn, 1U);
+}
+
+__STATIC_INLINE void NVIC_DisableIRQ(IRQn_Type IRQn)
+{
+    SimIrqEnable((int32_t)IRQn, 0U);
+}
+
+__STATIC_INLINE void NVIC_SetPriority(IRQn_Type IRQn, uint32_t priority)
+{
+    (void)IRQn;
+    (void)priority;
+}
+
+__STATIC_INLINE void NVIC_ClearPendingIRQ(IRQn_Type IRQn)
+{
+    (void)IRQn;
+}
+
+__NO_RETURN __STATIC_INLINE void NVIC_SystemReset(void)
+{
+    SimSystemReset();
+}
+
+__STATIC_INLINE uint32_t SysTick_Config(uint32_t ticks)
+{
+    if ((ticks - 1UL) > SysTick_LOAD_RELOAD_Msk)
+    {
+        return (1UL);
+    }
+
+    SysTick->LOAD = (uint32_t)(ticks - 1UL);
+    SysTick->VAL  = 0UL;
+    SysTick->CTRL = SysTick_CTRL_CLKSOURCE_Msk | SysTick_CTRL_TICKINT_Msk | SysTick_CTRL_ENABLE_Msk;
+    return (0UL);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __CORE_CM23_H_GENERIC */
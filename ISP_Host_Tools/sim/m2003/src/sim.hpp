@@ -0,0 +1,90 @@
+// SPDX-License-Identifier: Apache-2.0
+//
+// M2003 register model shared by the simulator sources. The firmware runs
+// unmodified on the main thread; it only enters the model through hooks
+// (__ISB/SimSync, the UART link functions, NVIC_SystemReset), so time is
+// virtual and only advances there:
+//
+//   - modelled busy time (flash operations, characters on the wire) is
+//     paced at --time-scale times wall clock, 0 runs it as fast as possible;
+//   - idle time, when the firmware polls with nothing to do, is spent
+//     waiting for the host and counted 1:1, so the connect window and the
+//     RX inter-frame gap see the host's real timing.
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+namespace m2003 {
+
+constexpr std::uint32_t kHclk = 24000000;  // HIRC, HCLK divider 1
+constexpr std::uint64_t kNsPerSec = 1000000000;
+
+struct Options
+{
+    std::string link;       // symlink created to the pty slave
+    std::string flash;      // APROM + CONFIG backing file, empty = volatile
+    double timeScale = 1.0;
+    std::uint32_t apromSize = 0x8000;
+    std::uint32_t config0 = 0xFFFFFFFE;  // data flash enabled, not locked
+    std::uint32_t config1 = 0x7000;      // 4 KB data flash at the top
+    std::uint32_t pdid = 0x00220003;
+    std::uint64_t eraseNs = 5000000;     // page erase
+    std::uint64_t programNs = 25000;     // word program
+    std::uint64_t readNs = 100;          // word read through ISP
+    std::uint32_t failProgramAt = 0;     // 1-based program op that raises ISPFF
+    std::uint32_t failEraseAt = 0;       // 1-based erase op that raises ISPFF
+    double failRate = 0.0;               // ISPFF probability per program/erase
+    long appMs = 1000;                   // APROM "runs" this long before power cycling
+    bool exitOnRun = false;              // exit instead of power cycling
+    bool verbose = false;
+    int ptyFd = -1;                      // master inherited across a reset
+    int flashFd = -1;                    // flash memfd inherited across a reset
+};
+
+extern Options g_options;
+
+// Serializes the model between the firmware thread and the bus watcher.
+std::recursive_mutex& busLock();
+
+// Virtual time since reset, ns.
+std::uint64_t now();
+// Modelled time passes, paced by --time-scale.
+void advance(std::uint64_t ns);
+// Nothing to do until host input or for ns at most, counted in wall time.
+void idle(std::uint64_t ns);
+
+void log(const char* fmt, ...) __attribute__((format(printf, 1, 2)));
+
+// Registers at their M2003 addresses, reset values set.
+void mapRegisters();
+
+// Flash controller: run the command in ISPTRG, if any.
+void fmcInit();
+void fmcStep();
+
+// SysTick from virtual time; runs SysTick_Handler on wrap if TICKINT.
+void sysTickUpdate();
+// When VAL next reaches 0, or UINT64_MAX while stopped
+std::uint64_t sysTickNextWrap();
+
+// UART0 model
+void uartInit(int ptyFd);
+void uartService();
+// Next modelled (compressible) UART event, or UINT64_MAX
+std::uint64_t uartNextEvent();
+// Deadline the firmware's RX gap logic is waiting for, or UINT64_MAX
+std::uint64_t uartGapDeadline();
+void uartStats(std::string& out);
+
+// Everything the hardware does between two firmware instructions.
+void service();
+
+[[noreturn]] void systemReset();
+// Start the image again in place, keeping pty and flash (sim_main.cpp)
+[[noreturn]] void reexec();
+// Run-time flash state for the reset log
+void fmcStats(std::string& out);
+
+}  // namespace m2003
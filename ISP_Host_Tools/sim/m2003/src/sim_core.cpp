@@ -0,0 +1,521 @@
+// SPDX-License-Identifier: Apache-2.0
+//
+// Clock, flash controller, SysTick and reset of the simulated M2003.
+#include "sim.hpp"
+#include "sim_host.hpp"
+
+extern "C" {
+#include "NuMicro.h"
+}
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <random>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <thread>
+#include <unistd.h>
+
+// system_M2003.c is not part of the simulator
+extern "C" {
+uint32_t SystemCoreClock = m2003::kHclk;
+uint32_t CyclesPerUs = m2003::kHclk / 1000000;
+
+// isp_stats.c, absent without ISP_STATS like the startup code's weak default
+__attribute__((weak)) void SysTick_Handler(void);
+}
+
+namespace m2003 {
+
+Options g_options;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr std::uint32_t kLdromBase = 0x100000;
+constexpr std::uint32_t kLdromSize = 0x1000;
+constexpr std::uint32_t kConfigBase = 0x300000;
+constexpr std::uint32_t kConfigSize = 16;  // CONFIG0..3
+constexpr std::uint32_t kPageSize = 512;
+
+constexpr std::uint32_t kCmdRead = 0x00;
+constexpr std::uint32_t kCmdReadUid = 0x04;
+constexpr std::uint32_t kCmdReadCid = 0x0B;
+constexpr std::uint32_t kCmdReadDid = 0x0C;
+constexpr std::uint32_t kCmdReadCks = 0x0D;
+constexpr std::uint32_t kCmdProgram = 0x21;
+constexpr std::uint32_t kCmdPageErase = 0x22;
+constexpr std::uint32_t kCmdRunCks = 0x2D;
+constexpr std::uint32_t kCmdVecmap = 0x2E;
+
+constexpr std::array<std::uint32_t, 3> kUid = {0x4E55564F, 0x54303033, 0x53494D30};
+
+std::uint64_t g_now;            // virtual ns
+std::int64_t g_paceDebt;        // wall ns owed to --time-scale
+Clock::time_point g_wallStart;
+
+struct Flash
+{
+    std::uint8_t* base = nullptr;  // APROM | LDROM | CONFIG, MAP_SHARED on flashFd
+    std::uint32_t checksum = 0;    // last RUN_CKS result
+    std::uint64_t reads = 0, programs = 0, erases = 0, failures = 0;
+    std::mt19937 rng{0x2003};
+} g_flash;
+
+struct Tick
+{
+    std::uint32_t load = 0, val = 0;  // what the model last left in the registers
+    std::uint32_t startVal = 0;       // VAL when counting (re)started
+    std::uint64_t start = 0;          // ... and when
+    std::uint64_t zeros = 0;          // times VAL reached 0 since start
+    bool enabled = false;
+} g_tick;
+
+// Register writes from the hardware side, read-only ones included
+void poke(const volatile std::uint32_t& reg, std::uint32_t value)
+{
+    const_cast<volatile std::uint32_t&>(reg) = value;
+}
+
+void setBits(const volatile std::uint32_t& reg, std::uint32_t mask)
+{
+    poke(reg, reg | mask);
+}
+
+void clearBits(const volatile std::uint32_t& reg, std::uint32_t mask)
+{
+    poke(reg, reg & ~mask);
+}
+
+// 24 MHz: 125/3 ns per cycle, kept as a ratio so hours of run time fit in 64 bits
+std::uint64_t cyclesToNs(std::uint64_t c)
+{
+    return c * 125 / 3;
+}
+
+std::uint64_t nsToCycles(std::uint64_t ns)
+{
+    return ns * 3 / 125;
+}
+
+// Byte offset of addr in the flash image, or -1 outside the array
+std::int64_t flashOffset(std::uint32_t addr)
+{
+    if (addr < g_options.apromSize) {
+        return addr;
+    }
+    if (addr >= kLdromBase && addr < kLdromBase + kLdromSize) {
+        return g_options.apromSize + (addr - kLdromBase);
+    }
+    if (addr >= kConfigBase && addr < kConfigBase + kConfigSize) {
+        return g_options.apromSize + kLdromSize + (addr - kConfigBase);
+    }
+    return -1;
+}
+
+bool inDataFlash(std::uint32_t addr)
+{
+    const std::uint32_t config0 = *reinterpret_cast<std::uint32_t*>(
+        g_flash.base + flashOffset(kConfigBase));
+    const std::uint32_t config1 = *reinterpret_cast<std::uint32_t*>(
+        g_flash.base + flashOffset(kConfigBase + 4));
+    return (config0 & 1) == 0 && addr >= (config1 & 0xFFFFF) && addr < g_options.apromSize;
+}
+
+// Update enable needed for a write to addr
+bool writeAllowed(std::uint32_t addr)
+{
+    const std::uint32_t ctl = FMC->ISPCTL;
+    if (addr < g_options.apromSize) {
+        return (ctl & FMC_ISPCTL_APUEN_Msk) || inDataFlash(addr);
+    }
+    if (addr >= kLdromBase && addr < kLdromBase + kLdromSize) {
+        return ctl & FMC_ISPCTL_LDUEN_Msk;
+    }
+    return ctl & FMC_ISPCTL_CFGUEN_Msk;
+}
+
+bool injectFailure(std::uint64_t count, std::uint32_t at)
+{
+    if (at != 0 && count == at) {
+        return true;
+    }
+    return g_options.failRate > 0 &&
+           std::uniform_real_distribution<double>(0, 1)(g_flash.rng) < g_options.failRate;
+}
+
+std::uint32_t crc32(const std::uint8_t* p, std::size_t n)
+{
+    std::uint32_t crc = 0xFFFFFFFF;
+    while (n--) {
+        crc ^= *p++;
+        for (int k = 0; k < 8; ++k) {
+            crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+// Execute FMC->ISPCMD; returns false to raise ISPFF
+bool fmcExecute()
+{
+    const std::uint32_t cmd = FMC->ISPCMD;
+    const std::uint32_t addr = FMC->ISPADDR;
+    const std::int64_t off = flashOffset(addr & ~3u);
+
+    if ((FMC->ISPCTL & FMC_ISPCTL_ISPEN_Msk) == 0) {
+        return false;
+    }
+
+    switch (cmd) {
+    case kCmdRead:
+        advance(g_options.readNs);
+        ++g_flash.reads;
+        if (off < 0) {
+            return false;
+        }
+        FMC->ISPDAT = *reinterpret_cast<std::uint32_t*>(g_flash.base + off);
+        return true;
+
+    case kCmdProgram: {
+        advance(g_options.programNs);
+        ++g_flash.programs;
+        if (off < 0 || !writeAllowed(addr) ||
+            injectFailure(g_flash.programs, g_options.failProgramAt)) {
+            return false;
+        }
+        // programming only clears bits
+        *reinterpret_cast<std::uint32_t*>(g_flash.base + off) &= FMC->ISPDAT;
+        return true;
+    }
+
+    case kCmdPageErase: {
+        advance(g_options.eraseNs);
+        ++g_flash.erases;
+        if (off < 0 || !writeAllowed(addr) ||
+            injectFailure(g_flash.erases, g_options.failEraseAt)) {
+            return false;
+        }
+        if (addr >= kConfigBase) {
+            std::memset(g_flash.base + flashOffset(kConfigBase), 0xFF, kConfigSize);
+        } else {
+            std::memset(g_flash.base + (off & ~std::int64_t(kPageSize - 1)), 0xFF, kPageSize);
+        }
+        return true;
+    }
+
+    case kCmdReadUid:
+        FMC->ISPDAT = kUid[(addr / 4) % kUid.size()];
+        return true;
+    case kCmdReadCid:
+        FMC->ISPDAT = 0xDA;
+        return true;
+    case kCmdReadDid:
+        FMC->ISPDAT = g_options.pdid;
+        return true;
+
+    case kCmdRunCks: {
+        const std::uint32_t len = FMC->ISPDAT;
+        const std::int64_t end = flashOffset(addr + len - 1);
+        if (off < 0 || end < 0 || (addr | len) % kPageSize != 0 || len == 0) {
+            return false;
+        }
+        advance(g_options.readNs * (len / 4));
+        g_flash.checksum = crc32(g_flash.base + off, len);
+        return true;
+    }
+    case kCmdReadCks:
+        FMC->ISPDAT = g_flash.checksum;
+        return true;
+
+    case kCmdVecmap:
+        FMC->ISPSTS = (FMC->ISPSTS & ~FMC_ISPSTS_VECMAP_Msk) |
+                      ((addr >> 9) << FMC_ISPSTS_VECMAP_Pos);
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+void openFlash()
+{
+    const std::size_t size = g_options.apromSize + kLdromSize + kConfigSize;
+    bool blank = false;
+
+    if (g_options.flashFd < 0) {
+        // a memfd rather than anonymous memory so it survives reexec()
+        const int fd = g_options.flash.empty()
+                           ? ::memfd_create("m2003-flash", 0)
+                           : ::open(g_options.flash.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd < 0) {
+            throw std::runtime_error("open flash: " + std::string(std::strerror(errno)));
+        }
+        blank = ::lseek(fd, 0, SEEK_END) < static_cast<off_t>(size);
+        if (blank && ::ftruncate(fd, static_cast<off_t>(size)) != 0) {
+            throw std::runtime_error("size flash: " + std::string(std::strerror(errno)));
+        }
+        g_options.flashFd = fd;
+    }
+
+    void* p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, g_options.flashFd, 0);
+    if (p == MAP_FAILED) {
+        throw std::runtime_error("map flash: " + std::string(std::strerror(errno)));
+    }
+    g_flash.base = static_cast<std::uint8_t*>(p);
+    if (blank) {
+        std::memset(g_flash.base, 0xFF, size);
+        std::memcpy(g_flash.base + flashOffset(kConfigBase), &g_options.config0, 4);
+        std::memcpy(g_flash.base + flashOffset(kConfigBase + 4), &g_options.config1, 4);
+    }
+}
+
+void* mapFixed(std::uintptr_t addr, std::size_t size)
+{
+    void* p = ::mmap(reinterpret_cast<void*>(addr), size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if (p != reinterpret_cast<void*>(addr)) {
+        char msg[80];
+        std::snprintf(msg, sizeof(msg), "cannot map registers at 0x%08lX: %s",
+                      static_cast<unsigned long>(addr), std::strerror(errno));
+        throw std::runtime_error(msg);
+    }
+    return p;
+}
+
+// The bus watcher: hardware that finishes on its own while the firmware
+// spins without calling into the model (FMC_SetVectorAddr's ISPTRG loop,
+// the while(1) after a SYSRESETREQ write)
+void watch()
+{
+    for (;;) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        std::lock_guard lock(busLock());
+        fmcStep();
+        if ((SCB->AIRCR & SCB_AIRCR_SYSRESETREQ_Msk) &&
+            (SCB->AIRCR >> SCB_AIRCR_VECTKEY_Pos) == 0x05FA) {
+            systemReset();
+        }
+    }
+}
+
+}  // namespace
+
+std::recursive_mutex& busLock()
+{
+    static std::recursive_mutex lock;
+    return lock;
+}
+
+std::uint64_t now()
+{
+    return g_now;
+}
+
+void advance(std::uint64_t ns)
+{
+    g_now += ns;
+    if (g_options.timeScale <= 0) {
+        return;
+    }
+    g_paceDebt += static_cast<std::int64_t>(static_cast<double>(ns) * g_options.timeScale);
+    if (g_paceDebt >= 200000) {
+        const auto t0 = Clock::now();
+        std::this_thread::sleep_for(std::chrono::nanoseconds(g_paceDebt));
+        g_paceDebt -= std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - t0).count();
+    }
+}
+
+void idle(std::uint64_t ns)
+{
+    pollfd pfd{g_options.ptyFd, POLLIN, 0};
+    const timespec ts{static_cast<time_t>(ns / kNsPerSec), static_cast<long>(ns % kNsPerSec)};
+    const auto t0 = Clock::now();
+    ::ppoll(&pfd, 1, &ts, nullptr);
+    g_now += static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - t0).count());
+}
+
+void log(const char* fmt, ...)
+{
+    if (!g_options.verbose) {
+        return;
+    }
+    const double wall = std::chrono::duration<double>(Clock::now() - g_wallStart).count();
+    std::fprintf(stderr, "[%9.3f %9.3f] ", wall, static_cast<double>(g_now) / kNsPerSec);
+    va_list ap;
+    va_start(ap, fmt);
+    std::vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    std::fputc('\n', stderr);
+}
+
+void mapRegisters()
+{
+    g_wallStart = Clock::now();
+    mapFixed(PERIPH_BASE, 0x100000);
+    mapFixed(SCS_BASE & ~0xFFFu, 0x1000);
+
+    // reset values the firmware waits on or reads back
+    poke(CLK->STATUS, CLK_STATUS_HIRCSTB_Msk);
+    poke(SYS->PDID, g_options.pdid);
+    FMC->ISPCTL = FMC_ISPCTL_BS_Msk;  // CBS: boot from LDROM
+}
+
+void fmcInit()
+{
+    openFlash();
+    std::thread(watch).detach();
+}
+
+void fmcStep()
+{
+    std::lock_guard lock(busLock());
+    if ((FMC->ISPTRG & 1) == 0) {
+        return;
+    }
+    // the firmware clears ISPFF by writing it back as 1; plain memory keeps
+    // it set, so each new command starts with a clean flag instead
+    clearBits(FMC->ISPCTL, FMC_ISPCTL_ISPFF_Msk);
+    clearBits(FMC->ISPSTS, FMC_ISPSTS_ISPFF_Msk);
+    if (!fmcExecute()) {
+        ++g_flash.failures;
+        log("FMC cmd 0x%02X at 0x%06X failed", static_cast<unsigned>(FMC->ISPCMD),
+            static_cast<unsigned>(FMC->ISPADDR));
+        setBits(FMC->ISPCTL, FMC_ISPCTL_ISPFF_Msk);
+        setBits(FMC->ISPSTS, FMC_ISPSTS_ISPFF_Msk);
+    }
+    FMC->ISPTRG = 0;
+}
+
+void fmcStats(std::string& out)
+{
+    char line[160];
+    std::snprintf(line, sizeof(line), "fmc reads %llu programs %llu erases %llu failed %llu",
+                  static_cast<unsigned long long>(g_flash.reads),
+                  static_cast<unsigned long long>(g_flash.programs),
+                  static_cast<unsigned long long>(g_flash.erases),
+                  static_cast<unsigned long long>(g_flash.failures));
+    out += line;
+}
+
+std::uint64_t sysTickNextWrap()
+{
+    if (!g_tick.enabled) {
+        return UINT64_MAX;
+    }
+    const std::uint64_t period = std::uint64_t(g_tick.load) + 1;
+    const std::uint64_t c = g_tick.startVal == 0
+                                ? (g_tick.zeros + 1) * period
+                                : g_tick.startVal + g_tick.zeros * period;
+    return g_tick.start + cyclesToNs(c) + 1;
+}
+
+void sysTickUpdate()
+{
+    std::lock_guard lock(busLock());
+    const std::uint32_t ctrl = SysTick->CTRL;
+    const std::uint32_t load = SysTick->LOAD & SysTick_LOAD_RELOAD_Msk;
+    const std::uint32_t val = SysTick->VAL & SysTick_VAL_CURRENT_Msk;
+    const bool enabled = ctrl & SysTick_CTRL_ENABLE_Msk;
+
+    // a firmware write to LOAD or VAL restarts the count from VAL
+    if (load != g_tick.load || val != g_tick.val || enabled != g_tick.enabled) {
+        g_tick = {load, val, val, g_now, 0, enabled};
+    }
+    if (!enabled) {
+        return;
+    }
+
+    // counting down from startVal, reloading LOAD after each 0
+    const std::uint64_t period = std::uint64_t(load) + 1;
+    const std::uint64_t c = nsToCycles(g_now - g_tick.start);
+    std::uint64_t zeros;
+    std::uint64_t k;
+    if (g_tick.startVal == 0) {
+        zeros = c / period;
+        k = c % period;
+    } else if (c < g_tick.startVal) {
+        zeros = 0;
+        k = period - (g_tick.startVal - c);
+    } else {
+        zeros = 1 + (c - g_tick.startVal) / period;
+        k = (c - g_tick.startVal) % period;
+    }
+    g_tick.val = k == 0 ? 0 : static_cast<std::uint32_t>(period - k);
+    SysTick->VAL = g_tick.val;
+
+    for (; g_tick.zeros < zeros; ++g_tick.zeros) {
+        setBits(SysTick->CTRL, SysTick_CTRL_COUNTFLAG_Msk);
+        if ((ctrl & SysTick_CTRL_TICKINT_Msk) && SysTick_Handler) {
+            SysTick_Handler();
+        }
+    }
+}
+
+void service()
+{
+    std::lock_guard lock(busLock());
+    sysTickUpdate();
+    fmcStep();
+    uartService();
+}
+
+void systemReset()
+{
+    std::lock_guard lock(busLock());
+
+    // the last response still leaves the TX FIFO before the chip resets
+    for (std::uint64_t t; (t = uartNextEvent()) != UINT64_MAX && t > g_now;) {
+        advance(t - g_now);
+        uartService();
+    }
+
+    std::string stats;
+    uartStats(stats);
+    stats += ", ";
+    fmcStats(stats);
+    log("reset: %s", stats.c_str());
+
+    if ((FMC->ISPCTL & FMC_ISPCTL_BS_Msk) == 0) {
+        if (g_options.exitOnRun) {
+            std::fprintf(stderr, "m2003-sim: booting APROM, exiting\n");
+            ::msync(g_flash.base, g_options.apromSize + kLdromSize + kConfigSize, MS_SYNC);
+            simhost::drainPty(g_options.ptyFd, 1000);
+            std::fflush(nullptr);
+            ::_exit(0);
+        }
+        log("booting APROM for %ld ms", g_options.appMs);
+        std::this_thread::sleep_for(std::chrono::milliseconds(g_options.appMs));
+    }
+    reexec();
+}
+
+}  // namespace m2003
+
+extern "C" {
+
+void SimSync(void)
+{
+    m2003::fmcStep();
+}
+
+void SimSystemReset(void)
+{
+    m2003::systemReset();
+}
+
+void SimIrqEnable(int32_t irq, uint32_t enable)
+{
+    m2003::log("IRQ %d %s", static_cast<int>(irq), enable ? "enabled" : "disabled");
+}
+
+}  // extern "C"
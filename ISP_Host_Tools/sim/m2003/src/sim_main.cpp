@@ -0,0 +1,159 @@
+// SPDX-License-Identifier: Apache-2.0
+//
+// nuisp-sim-m2003: the KN44490A LDROM bootloader, compiled for the host,
+// behind a pseudo-terminal.
+//
+//   nuisp-sim-m2003 -s 0 --link /tmp/m2003 &
+//   nuisp -p /tmp/m2003 erase program app.bin verify app.bin run
+#include "sim.hpp"
+#include "sim_host.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <getopt.h>
+#include <string>
+#include <termios.h>
+#include <vector>
+
+extern "C" int32_t FirmwareMain(void);  // main.c built with -Dmain=FirmwareMain
+
+using namespace m2003;
+
+namespace {
+
+std::vector<std::string> g_args;  // command line without the reset-time options
+
+enum LongOnly
+{
+    kApromSize = 256,
+    kConfig0,
+    kConfig1,
+    kPdid,
+    kEraseUs,
+    kProgramUs,
+    kFailProgram,
+    kFailErase,
+    kFailRate,
+    kAppMs,
+    kPtyFd,
+    kFlashFd,
+};
+
+void usage()
+{
+    std::fprintf(stderr,
+                 "usage: nuisp-sim-m2003 [options]\n"
+                 "\n"
+                 "Runs the KN44490A bootloader against a simulated M2003 on a pty.\n"
+                 "\n"
+                 "options:\n"
+                 "  -l, --link PATH         symlink to the pty slave (default: print its path)\n"
+                 "  -f, --flash FILE        APROM/LDROM/CONFIG image, kept across runs\n"
+                 "                          (default: blank, in memory)\n"
+                 "  -s, --time-scale S      wall time per simulated second of busy time,\n"
+                 "                          0 = as fast as possible (default 1)\n"
+                 "      --aprom-size N      APROM bytes (default 0x8000)\n"
+                 "      --config0 N         CONFIG0 of a new flash (default 0xFFFFFFFE)\n"
+                 "      --config1 N         CONFIG1 of a new flash (default 0x7000)\n"
+                 "      --pdid N            part ID (default 0x00220003)\n"
+                 "      --erase-us US       page erase time (default 5000)\n"
+                 "      --program-us US     word program time (default 25)\n"
+                 "      --fail-program N    Nth word program after power-on fails\n"
+                 "      --fail-erase N      Nth page erase after power-on fails\n"
+                 "      --fail-rate P       probability of ISPFF per program/erase\n"
+                 "      --app-ms MS         time APROM \"runs\" before the next power-on\n"
+                 "                          (default 1000)\n"
+                 "  -x, --exit-on-run       exit instead of booting APROM\n"
+                 "  -v, --verbose           log the model to stderr\n");
+}
+
+}  // namespace
+
+namespace m2003 {
+
+void reexec()
+{
+    simhost::reexec(g_args, g_options.ptyFd, g_options.flashFd);
+}
+
+}  // namespace m2003
+
+int main(int argc, char** argv)
+{
+    static const option longOptions[] = {
+        {"link", required_argument, nullptr, 'l'},
+        {"flash", required_argument, nullptr, 'f'},
+        {"time-scale", required_argument, nullptr, 's'},
+        {"aprom-size", required_argument, nullptr, kApromSize},
+        {"config0", required_argument, nullptr, kConfig0},
+        {"config1", required_argument, nullptr, kConfig1},
+        {"pdid", required_argument, nullptr, kPdid},
+        {"erase-us", required_argument, nullptr, kEraseUs},
+        {"program-us", required_argument, nullptr, kProgramUs},
+        {"fail-program", required_argument, nullptr, kFailProgram},
+        {"fail-erase", required_argument, nullptr, kFailErase},
+        {"fail-rate", required_argument, nullptr, kFailRate},
+        {"app-ms", required_argument, nullptr, kAppMs},
+        {"exit-on-run", no_argument, nullptr, 'x'},
+        {"verbose", no_argument, nullptr, 'v'},
+        {"pty-fd", required_argument, nullptr, kPtyFd},
+        {"flash-fd", required_argument, nullptr, kFlashFd},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+
+    Options& o = g_options;
+    auto number = [] { return static_cast<std::uint32_t>(std::strtoul(optarg, nullptr, 0)); };
+
+    int c;
+    while ((c = getopt_long(argc, argv, "l:f:s:xvh", longOptions, nullptr)) != -1) {
+        switch (c) {
+        case 'l': o.link = optarg; break;
+        case 'f': o.flash = optarg; break;
+        case 's': o.timeScale = std::strtod(optarg, nullptr); break;
+        case kApromSize: o.apromSize = number(); break;
+        case kConfig0: o.config0 = number(); break;
+        case kConfig1: o.config1 = number(); break;
+        case kPdid: o.pdid = number(); break;
+        case kEraseUs: o.eraseNs = std::uint64_t(number()) * 1000; break;
+        case kProgramUs: o.programNs = std::uint64_t(number()) * 1000; break;
+        case kFailProgram: o.failProgramAt = number(); break;
+        case kFailErase: o.failEraseAt = number(); break;
+        case kFailRate: o.failRate = std::strtod(optarg, nullptr); break;
+        case kAppMs: o.appMs = std::strtol(optarg, nullptr, 0); break;
+        case 'x': o.exitOnRun = true; break;
+        case 'v': o.verbose = true; break;
+        case kPtyFd: o.ptyFd = static_cast<int>(number()); break;
+        case kFlashFd: o.flashFd = static_cast<int>(number()); break;
+        default: usage(); return c == 'h' ? 0 : 2;
+        }
+    }
+    g_args = simhost::restartArgs(argc, argv);
+    if (optind != argc || o.apromSize == 0 || o.apromSize % 512 != 0) {
+        usage();
+        return 2;
+    }
+
+    try {
+        if (o.ptyFd < 0) {
+            std::string slave;
+            o.ptyFd = simhost::openPty(slave);
+            simhost::publishPty(slave, o.link);
+        } else {
+            // whatever the host sent while the chip was off is gone
+            ::tcflush(o.ptyFd, TCIFLUSH);
+            simhost::keepLinkOnSignal(o.link);
+        }
+
+        mapRegisters();
+        fmcInit();
+        uartInit(o.ptyFd);
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "nuisp-sim-m2003: %s\n", e.what());
+        return 1;
+    }
+
+    log("power-on, LDROM boot");
+    FirmwareMain();
+    return 0;
+}
@@ -0,0 +1,184 @@
+// SPDX-License-Identifier: Apache-2.0
+//
+// CMD_APPLY_PATCH for the simulated M2003.
+//
+// The decoder takes about 1.2 KB of flash, more than the 4 KB LDROM has
+// left next to even the UART0-only bootloader, so it is not part of the
+// KN44490A sources. ISP_APPLY_PATCH=1 there only adds the command table
+// entry, the continuation and the CMD_RESEND_PACKET rollback, which call
+// into this file. The patch format is therefore host and simulator only:
+// nuisp patch, nuisp-diff and the patch test exercise it here.
+//
+// The code is written against the firmware's FMC helpers as isp_user.c
+// code would be, with its own page buffer and frame carry.
+extern "C" {
+#include "isp_user.h"
+}
+
+#include <cstdint>
+#include <cstring>
+
+namespace m2003 {
+
+namespace {
+
+constexpr std::uint32_t kNoPage = 0xFFFFFFFF;
+
+// Decoder state; mark is it before the last frame
+struct PatchState
+{
+    std::uint32_t page;    // page being rebuilt in buf, or kNoPage
+    std::uint32_t left;    // stream bytes not received yet
+    std::uint16_t fill;    // bytes of buf rebuilt
+    std::uint16_t insert;  // INSERT bytes still to come
+    std::uint8_t hdrLen;
+    std::uint8_t err;
+    std::uint8_t hdr[5];   // page number or op header being collected
+};
+
+PatchState patch, mark;
+std::uint32_t baseLen, newLen;
+std::uint32_t wordAddr, word;
+bool full;
+__attribute__((aligned(4))) std::uint8_t buf[FMC_FLASH_PAGE_SIZE];
+// bytes of the last frame behind a finished page, which is only written
+// once the next frame shows that frame arrived
+std::uint8_t carry[64 - 8];
+std::uint32_t carryLen;
+
+std::uint32_t apromEnd()
+{
+    return g_apromSize < g_dataFlashAddr ? g_apromSize : g_dataFlashAddr;
+}
+
+std::uint8_t byteAt(std::uint32_t addr)
+{
+    if ((addr & ~3U) != wordAddr) {
+        wordAddr = addr & ~3U;
+        ReadData(wordAddr, wordAddr + 4, &word);
+    }
+    return static_cast<std::uint8_t>(word >> ((addr & 3) * 8));
+}
+
+// Decode up to a finished page; returns the bytes taken
+std::uint32_t decode(const std::uint8_t* src, std::uint32_t len)
+{
+    PatchState* p = &patch;
+    std::uint8_t* hdr = p->hdr;
+    const std::uint32_t end = apromEnd();
+    std::uint32_t i;
+
+    for (i = 0; i < len && !full && !p->err; i++) {
+        if (p->insert) {
+            buf[p->fill++] = src[i];
+            p->insert--;
+        } else {
+            hdr[p->hdrLen++] = src[i];
+            const std::uint32_t need = p->page == kNoPage ? 2 : hdr[0] < 0x80 ? 1 : hdr[0] < 0xC0 ? 5 : 3;
+            if (p->hdrLen < need) {
+                continue;
+            }
+            p->hdrLen = 0;
+
+            if (p->page == kNoPage) {
+                p->page = (hdr[0] | hdr[1] << 8) * FMC_FLASH_PAGE_SIZE;
+                p->err = p->page >= end;
+                continue;
+            }
+
+            std::uint32_t n = hdr[0] < 0x80 ? hdr[0] + 1U : ((hdr[0] & 0x3F) << 8 | hdr[1]) + 1U;
+            std::uint32_t from = hdr[2] | hdr[3] << 8 | static_cast<std::uint32_t>(hdr[4]) << 16;
+
+            if (n > static_cast<std::uint32_t>(FMC_FLASH_PAGE_SIZE - p->fill) ||
+                ((hdr[0] & 0xC0) == 0x80 && (from > baseLen || n > baseLen - from))) {
+                p->err = 1;
+            } else if (hdr[0] < 0x80) {
+                p->insert = static_cast<std::uint16_t>(n);
+            } else if (hdr[0] < 0xC0) {
+                while (n--) {
+                    buf[p->fill++] = byteAt(from++);
+                }
+            } else {
+                std::memset(buf + p->fill, hdr[2], n);
+                p->fill = static_cast<std::uint16_t>(p->fill + n);
+            }
+        }
+        full = p->fill == FMC_FLASH_PAGE_SIZE;
+    }
+    return i;
+}
+
+}  // namespace
+
+}  // namespace m2003
+
+using namespace m2003;
+
+extern "C" {
+
+// One frame of stream. A new frame means the last one arrived intact, so
+// first the page it finished is written and the bytes behind it decoded.
+void PatchFrame(uint8_t* pSrc, uint32_t srclen)
+{
+    PatchState* p = &patch;
+
+    while (full) {
+        if (FMC_Erase_User(p->page) ||
+            WriteData(p->page, p->page + FMC_FLASH_PAGE_SIZE, reinterpret_cast<uint32_t*>(buf))) {
+            p->err = 1;
+        }
+        p->page = kNoPage;
+        p->fill = 0;
+        full = false;
+        wordAddr = 1;
+        const std::uint32_t n = decode(carry, carryLen);
+        carryLen -= n;
+        std::memmove(carry, carry + n, carryLen);
+    }
+
+    mark = *p;
+
+    if (srclen > p->left) {
+        srclen = p->left;
+    }
+    p->left -= srclen;
+    const std::uint32_t n = decode(pSrc, srclen);
+    carryLen = srclen - n;
+    std::memcpy(carry, pSrc + n, carryLen);
+    outpw(response_buff + PATCH_REMAIN, p->err ? PATCH_REJECTED : p->left);
+    outpw(response_buff + PATCH_CRC,
+          (p->err || p->left || full) ? 0 : FMC_ChkSum_User(FMC_APROM_BASE, newLen));
+}
+
+void CmdApplyPatch(uint32_t, uint8_t* pSrc, uint32_t srclen)
+{
+    const std::uint32_t end = apromEnd();
+
+    baseLen = inpw(pSrc);
+    newLen = inpw(pSrc + 8);
+    patch = {};
+    patch.page = kNoPage;
+    patch.left = inpw(pSrc + 12);
+    full = false;
+    carryLen = 0;
+    wordAddr = 1;
+
+    // the stream is only meaningful against the image it was made from
+    if (((baseLen | newLen) & (FMC_FLASH_PAGE_SIZE - 1)) || baseLen == 0 || newLen == 0 ||
+        baseLen > end || newLen > end ||
+        FMC_ChkSum_User(FMC_APROM_BASE, baseLen) != inpw(pSrc + 4)) {
+        patch.err = 1;
+    }
+
+    PatchFrame(pSrc + PATCH_HDR, srclen - PATCH_HDR);
+}
+
+// Nothing of the frame reached the flash yet, decode it again
+void PatchResend(void)
+{
+    patch = mark;
+    full = false;
+    carryLen = 0;
+}
+
+}  // extern "C"
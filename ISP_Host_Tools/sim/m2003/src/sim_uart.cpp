@@ -0,0 +1,346 @@
+// SPDX-License-Identifier: Apache-2.0
+//
+// UART0 of the simulated M2003 and the ISP link on top of it.
+//
+// uart_transfer.c cannot run as is: its interrupt handler pops the RX FIFO
+// by reading UART0->DAT, which plain memory cannot turn into a side effect.
+// This file takes its place. The UART is modelled (16-byte FIFOs, RX FIFO
+// trigger, time-out counter, overrun, 10 bit times per character) and the
+// RX interrupt and PutString() bodies are ports of UartPortRx() and
+// UartPortTx(), timing set up as in UartPortTiming(), so frame boundaries
+// and the CMD_SET_SPEED path behave like the firmware's.
+#include "sim.hpp"
+
+extern "C" {
+#include "NuMicro.h"
+#include "isp_link.h"
+#include "isp_stats.h"
+#include "isp_trace.h"
+#include "uart_transfer.h"
+
+extern uint8_t response_buff[64];  // isp_user.c
+}
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <unistd.h>
+#include <utility>
+
+extern "C" {
+__attribute__((aligned(4))) uint8_t uart_rcvbuf[MAX_PKT_SIZE];
+uint8_t volatile bUartDataReady;
+uint8_t volatile bufhead;
+}
+
+namespace m2003 {
+
+namespace {
+
+constexpr std::size_t kFifoDepth = 16;
+constexpr std::uint64_t kIdleSliceNs = 50000000;
+
+#define UART_STAMP()            (SysTick_LOAD_RELOAD_Msk - SysTick->VAL)
+#define UART_ELAPSED(t)         ((UART_STAMP() - (t)) & SysTick_LOAD_RELOAD_Msk)
+
+struct Uart
+{
+    int fd = -1;
+    bool irq = false;  // INTEN set and NVIC line enabled
+
+    std::uint32_t baud = 38400;
+    std::uint32_t gapUs = UART_GAP_DEFAULT_US;
+    std::uint32_t gapCycles = 0;  // 0 when the RX time-out marks frame boundaries
+    std::uint32_t rfitl = 8;      // RX FIFO trigger level, bytes
+    std::uint32_t toic = UART_TOIC_MIN;  // RX time-out, bit times
+    std::uint32_t lastRx = 0;     // UART_STAMP() of the last RX interrupt
+
+    std::deque<std::pair<std::uint64_t, std::uint8_t>> wire;  // host bytes, stop bit time
+    std::uint64_t wireEnd = 0;
+    std::deque<std::uint8_t> rxFifo;
+    std::uint64_t rxLast = 0;  // last byte into the RX FIFO, restarts the time-out counter
+    std::deque<std::pair<std::uint64_t, std::uint8_t>> tx;  // TX FIFO and shift register
+    std::uint64_t txEnd = 0;
+
+    std::uint64_t framesIn = 0, bytesIn = 0, bytesOut = 0, overruns = 0, partials = 0;
+} g_uart;
+
+std::uint64_t charNs()
+{
+    return 10 * kNsPerSec / g_uart.baud;
+}
+
+std::uint64_t timeoutNs()
+{
+    return g_uart.toic * kNsPerSec / g_uart.baud;
+}
+
+// UartPortTiming()
+void timing()
+{
+    std::uint32_t bits;
+
+    if ((16 - 8) * 10000000UL / g_uart.baud >= UART_RX_LATENCY_US) {
+        g_uart.rfitl = 8;
+    } else if ((16 - 4) * 10000000UL / g_uart.baud >= UART_RX_LATENCY_US) {
+        g_uart.rfitl = 4;
+    } else {
+        g_uart.rfitl = 1;
+    }
+
+    bits = (g_uart.gapUs / 100) * (g_uart.baud / 100) / 100;
+    if (bits <= (UART_TOUT_TOIC_Msk >> UART_TOUT_TOIC_Pos)) {
+        g_uart.gapCycles = 0;
+    } else {
+        g_uart.gapCycles = g_uart.gapUs * CyclesPerUs;
+        bits = UART_TOIC_MIN;
+    }
+    g_uart.toic = bits < UART_TOIC_MIN ? UART_TOIC_MIN : bits;
+
+    log("uart %u baud, RX trigger %u, time-out %u bits, gap %s", g_uart.baud, g_uart.rfitl,
+        g_uart.toic, g_uart.gapCycles ? "by SysTick" : "by time-out");
+}
+
+// UartPortRx(): the RX interrupt body
+void rxInterrupt(bool timeout)
+{
+    if (g_uart.gapCycles && bufhead && !g_uart.rxFifo.empty() &&
+        UART_ELAPSED(g_uart.lastRx) > g_uart.gapCycles) {
+        STATS_INC(u32RxTimeouts);
+        TRACE(TRACE_RX_TIMEOUT, bufhead);
+        ++g_uart.partials;
+        bufhead = 0;
+    }
+
+    while (!g_uart.rxFifo.empty() && bufhead < MAX_PKT_SIZE) {
+        uart_rcvbuf[bufhead] = g_uart.rxFifo.front();
+        bufhead = bufhead + 1;
+        g_uart.rxFifo.pop_front();
+    }
+    g_uart.lastRx = UART_STAMP();
+
+    if (bufhead == MAX_PKT_SIZE) {
+        bUartDataReady = TRUE;
+        bufhead = 0;
+        STATS_RX_STAMP();
+        TRACE(TRACE_RX_FRAME, 0);
+        ++g_uart.framesIn;
+    } else if (timeout && g_uart.gapCycles == 0) {
+        if (bufhead) {
+            STATS_INC(u32RxTimeouts);
+            TRACE(TRACE_RX_TIMEOUT, bufhead);
+            ++g_uart.partials;
+        }
+        bufhead = 0;
+    }
+}
+
+// RX time-out: the FIFO holds data and nothing arrived for toic bit times
+void checkTimeout(std::uint64_t t)
+{
+    if (g_uart.irq && !g_uart.rxFifo.empty() && t >= g_uart.rxLast + timeoutNs()) {
+        rxInterrupt(true);
+    }
+}
+
+void readHost()
+{
+    std::uint8_t buf[256];
+    for (;;) {
+        const ssize_t n = ::read(g_uart.fd, buf, sizeof(buf));
+        if (n <= 0) {
+            return;  // EAGAIN, or EIO while no host has the pty open
+        }
+        for (ssize_t i = 0; i < n; ++i) {
+            g_uart.wireEnd = std::max(g_uart.wireEnd, now()) + charNs();
+            g_uart.wire.emplace_back(g_uart.wireEnd, buf[i]);
+        }
+        g_uart.bytesIn += static_cast<std::uint64_t>(n);
+    }
+}
+
+void flushTx()
+{
+    std::uint8_t buf[kFifoDepth];
+    std::size_t n = 0;
+    while (!g_uart.tx.empty() && g_uart.tx.front().first <= now()) {
+        buf[n++] = g_uart.tx.front().second;
+        g_uart.tx.pop_front();
+    }
+    for (std::size_t done = 0; done < n;) {
+        const ssize_t w = ::write(g_uart.fd, buf + done, n - done);
+        if (w < 0 && errno != EAGAIN && errno != EINTR) {
+            log("pty write: %s", std::strerror(errno));
+            return;
+        }
+        done += w > 0 ? static_cast<std::size_t>(w) : 0;
+    }
+    g_uart.bytesOut += n;
+}
+
+// Let modelled UART time pass until the next event, or wait for the host
+void waitForWork()
+{
+    const std::uint64_t next = uartNextEvent();
+    if (next != UINT64_MAX) {
+        advance(next > now() ? next - now() : 0);
+        return;
+    }
+    const std::uint64_t deadline =
+        std::min({uartGapDeadline(), sysTickNextWrap(), now() + kIdleSliceNs});
+    idle(deadline > now() ? deadline - now() : 0);
+}
+
+}  // namespace
+
+void uartInit(int ptyFd)
+{
+    g_uart.fd = ptyFd;
+    ::fcntl(ptyFd, F_SETFL, ::fcntl(ptyFd, F_GETFL) | O_NONBLOCK);
+}
+
+void uartService()
+{
+    std::lock_guard lock(busLock());
+    readHost();
+
+    // characters complete on the wire in order, each may trigger the ISR
+    while (!g_uart.wire.empty() && g_uart.wire.front().first <= now()) {
+        const auto [t, byte] = g_uart.wire.front();
+        g_uart.wire.pop_front();
+        checkTimeout(t);
+        if (g_uart.rxFifo.size() == kFifoDepth) {
+            ++g_uart.overruns;
+        } else {
+            g_uart.rxFifo.push_back(byte);
+        }
+        g_uart.rxLast = t;
+        if (g_uart.irq && g_uart.rxFifo.size() >= g_uart.rfitl) {
+            rxInterrupt(false);
+        }
+    }
+    checkTimeout(now());
+    flushTx();
+}
+
+std::uint64_t uartNextEvent()
+{
+    std::uint64_t next = UINT64_MAX;
+    if (!g_uart.wire.empty()) {
+        next = g_uart.wire.front().first;
+    }
+    if (!g_uart.tx.empty()) {
+        next = std::min(next, g_uart.tx.front().first);
+    }
+    return next;
+}
+
+std::uint64_t uartGapDeadline()
+{
+    return g_uart.irq && !g_uart.rxFifo.empty() ? g_uart.rxLast + timeoutNs() : UINT64_MAX;
+}
+
+void uartStats(std::string& out)
+{
+    char line[160];
+    std::snprintf(line, sizeof(line),
+                  "uart frames %llu bytes in %llu out %llu partial %llu overruns %llu",
+                  static_cast<unsigned long long>(g_uart.framesIn),
+                  static_cast<unsigned long long>(g_uart.bytesIn),
+                  static_cast<unsigned long long>(g_uart.bytesOut),
+                  static_cast<unsigned long long>(g_uart.partials),
+                  static_cast<unsigned long long>(g_uart.overruns));
+    out += line;
+}
+
+}  // namespace m2003
+
+using namespace m2003;
+
+extern "C" {
+
+void UART_Init(void)
+{
+    std::lock_guard lock(busLock());
+    timing();
+    g_uart.irq = true;
+}
+
+void UART0_Close(void)
+{
+    std::lock_guard lock(busLock());
+    g_uart.irq = false;
+}
+
+uint8_t* UART_Poll(void)
+{
+    std::lock_guard lock(busLock());
+    service();
+    if (bUartDataReady != TRUE) {
+        waitForWork();
+        service();
+    }
+    if (bUartDataReady == TRUE) {
+        bUartDataReady = FALSE;
+        return uart_rcvbuf;
+    }
+    return nullptr;
+}
+
+// UartPortTx()
+void PutString(void)
+{
+    std::lock_guard lock(busLock());
+#if ISP_STATS
+    const uint32_t u32Start = STATS_NOW();
+#endif
+
+    TRACE(TRACE_TX, inpw(response_buff + 4));
+
+    for (uint32_t i = 0; i < MAX_PKT_SIZE; i++) {
+        while (g_uart.tx.size() >= kFifoDepth) {
+            waitForWork();
+            service();
+        }
+        g_uart.txEnd = std::max(g_uart.txEnd, now()) + charNs();
+        g_uart.tx.emplace_back(g_uart.txEnd, response_buff[i]);
+    }
+    service();
+
+    STATS_RECORD(STAT_TX, u32Start);
+}
+
+// UartPortSetSpeed()
+void UART_SetSpeed(uint32_t u32Baud, uint32_t u32GapUs)
+{
+    std::lock_guard lock(busLock());
+    if (u32Baud) {
+        g_uart.baud = u32Baud;
+    }
+    if (u32GapUs) {
+        g_uart.gapUs = u32GapUs;
+    }
+
+    // let the response to the speed change leave at the old rate
+    while (!g_uart.tx.empty()) {
+        waitForWork();
+        service();
+    }
+    timing();
+}
+
+// UART_SpeedOk()
+uint8_t UART_SpeedOk(uint32_t u32Baud, uint32_t u32GapUs)
+{
+    if (u32Baud && (u32Baud < UART_BAUD_MIN || u32Baud > UART_BAUD_MAX)) {
+        return 0;
+    }
+    return u32GapUs <= UART_GAP_MAX_US;
+}
+
+const ISP_LINK_T g_uart0Link = {UART_Init, UART_Poll, PutString, NULL, UART_SetSpeed, UART_SpeedOk, UART0_Close, 2};
+
+}  // extern "C"
@@ -0,0 +1,68 @@
+// SPDX-License-Identifier: Apache-2.0
+//
+// The MS51 special function registers as the firmware sees them when it is
+// built for the simulator. Each SFR and sbit is an object whose reads and
+// writes call into the model, so SBUF, TA, IAPTRG and friends get their
+// side effects at the access that causes them. ORL/ANL/XRL on an SFR are a
+// single read-modify-write access, which matters for the TA window.
+#pragma once
+
+#include <cstdint>
+
+namespace ms51 {
+
+std::uint8_t sfrRead(std::uint8_t addr);
+void sfrWrite(std::uint8_t addr, std::uint8_t value);
+void sfrModify(std::uint8_t addr, std::uint8_t andMask, std::uint8_t orMask, std::uint8_t xorMask);
+// The firmware tested a bit variable: where its busy-wait loops spin.
+void flagRead();
+
+template <unsigned Addr>
+struct Sfr
+{
+    operator std::uint8_t() const { return sfrRead(Addr); }
+    // value of the assignment is what was written, not a second read
+    std::uint8_t operator=(unsigned v) const
+    {
+        sfrWrite(Addr, static_cast<std::uint8_t>(v));
+        return static_cast<std::uint8_t>(v);
+    }
+    void operator|=(unsigned v) const { sfrModify(Addr, 0xFF, static_cast<std::uint8_t>(v), 0); }
+    void operator&=(unsigned v) const { sfrModify(Addr, static_cast<std::uint8_t>(v), 0, 0); }
+    void operator^=(unsigned v) const { sfrModify(Addr, 0xFF, 0, static_cast<std::uint8_t>(v)); }
+};
+
+template <unsigned Addr>
+struct Sbit
+{
+    static constexpr std::uint8_t kSfr = Addr & 0xF8;
+    static constexpr std::uint8_t kMask = 1u << (Addr & 7);
+
+    operator std::uint8_t() const { return (sfrRead(kSfr) & kMask) ? 1 : 0; }
+    std::uint8_t operator=(unsigned v) const
+    {
+        sfrModify(kSfr, static_cast<std::uint8_t>(~kMask), v ? kMask : 0, 0);
+        return v ? 1 : 0;
+    }
+};
+
+// SDCC __bit: a flag in bit-addressable RAM
+class Bit
+{
+public:
+    operator int() const volatile
+    {
+        flagRead();
+        return value_;
+    }
+    int operator=(int v) volatile
+    {
+        value_ = v != 0;
+        return value_;
+    }
+
+private:
+    std::uint8_t value_ = 0;
+};
+
+}  // namespace ms51
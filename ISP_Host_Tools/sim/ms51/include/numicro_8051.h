@@ -0,0 +1,33 @@
+/*
+ * Host stand-in for numicro_8051.h, used to build the W20B ISP firmware
+ * for the MS51 simulator. It is found ahead of Library/Device/Include and
+ * maps the SDCC extensions onto ms51_bus.hpp, then includes the vendor
+ * SDCC header unchanged. The firmware is compiled as C++ for this.
+ */
+#ifndef MS51_SIM_NUMICRO_8051_H
+#define MS51_SIM_NUMICRO_8051_H
+
+#include "ms51_bus.hpp"
+
+#define __SDCC__            1
+
+#define __data
+#define __near
+#define __idata
+#define __xdata
+#define __far
+#define __pdata
+#define __code
+#define __critical
+#define __naked
+#define __using(x)
+#define __interrupt(x)
+#define __bit               ::ms51::Bit
+/* "__sfr __at (0x80) P0" becomes "static ::ms51::Sfr <(0x80)> P0" */
+#define __sfr               static ::ms51::Sfr
+#define __sbit              static ::ms51::Sbit
+#define __at(x)             <(x)>
+
+#include "ms51_16k_sdcc.h"
+
+#endif /* MS51_SIM_NUMICRO_8051_H */
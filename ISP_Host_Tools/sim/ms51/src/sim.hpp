@@ -0,0 +1,81 @@
+// SPDX-License-Identifier: Apache-2.0
+//
+// MS51 model shared by the simulator sources. The firmware runs on the main
+// thread and enters the model on every SFR access and every test of a bit
+// variable (ms51_bus.hpp), so time is virtual and advances there:
+//
+//   - each access costs a few machine cycles; flash operations and
+//     characters on the wire are paced at --time-scale times wall clock,
+//     0 runs them as fast as possible;
+//   - when the firmware spins on a flag with nothing pending it waits for
+//     the host, or for the next Timer0 overflow, in wall time, so the
+//     connect window and the RX time-out see the host's real timing.
+//
+// Interrupts are dispatched between accesses, as the CPU would between
+// instructions, while EA and the source's enable allow it.
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// The firmware's entry points (main.c, built with -Dmain=FirmwareMain)
+void FirmwareMain(void);
+void Serial_ISR(void);
+void Timer0_ISR(void);
+
+namespace ms51 {
+
+constexpr std::uint64_t kNsPerSec = 1000000000;
+constexpr std::uint32_t kFlashSize = 16 * 1024;  // APROM + LDROM
+constexpr std::uint32_t kConfigSize = 8;         // CONFIG0..4, padded
+
+struct Options
+{
+    std::string link;       // symlink created to the pty slave
+    std::string flash;      // APROM/LDROM + CONFIG backing file, empty = volatile
+    double timeScale = 1.0;
+    std::uint8_t config[5] = {0x7F, 0xF8, 0xFF, 0xFF, 0xFF};  // LDROM boot, 4 KB LDROM
+    std::uint16_t did = 0x4B21;
+    std::uint16_t pid = 0x0000;
+    std::uint64_t eraseNs = 5000000;  // 128-byte page erase
+    std::uint64_t programNs = 25000;  // byte program
+    std::uint32_t failProgramAt = 0;  // 1-based byte program that raises IAPFF
+    std::uint32_t failEraseAt = 0;    // 1-based page erase that raises IAPFF
+    double failRate = 0.0;            // IAPFF probability per program/erase
+    long appMs = 1000;                // APROM "runs" this long before power cycling
+    long hangMs = 2000;               // no SFR access for this long: power cycle
+    bool exitOnRun = false;           // exit instead of power cycling
+    bool verbose = false;
+    int ptyFd = -1;                   // master inherited across a reset
+    int flashFd = -1;                 // flash memfd inherited across a reset
+};
+
+extern Options g_options;
+
+// Virtual time since reset, ns.
+std::uint64_t now();
+
+void log(const char* fmt, ...) __attribute__((format(printf, 1, 2)));
+
+// Reset values, flash, and the hang watcher.
+void powerOn();
+
+// Raw SFR file, for the peripheral models; no side effects.
+std::uint8_t& sfr(std::uint8_t addr);
+
+// UART0 (sim_uart.cpp)
+void uartInit(int ptyFd);
+// Characters that complete by now(): RI/TI, bytes to the host.
+void uartService();
+// Next character completion, or UINT64_MAX
+std::uint64_t uartNextEvent();
+void uartSbufWrite(std::uint8_t value);
+std::uint8_t uartSbufRead();
+// Fsys or the baud rate registers changed
+void uartRetime(std::uint32_t fsys);
+void uartStats(std::string& out);
+
+// Start the image again in place, keeping pty and flash (sim_main.cpp)
+[[noreturn]] void reexec();
+
+}  // namespace ms51
@@ -0,0 +1,756 @@
+// SPDX-License-Identifier: Apache-2.0
+//
+// SFR file, TA protection, IAP, Timer0, interrupt dispatch and reset of
+// the simulated MS51 (16 KB flash, HIRC at 16 or 24 MHz).
+#include "sim.hpp"
+#include "sim_host.hpp"
+
+#include "ms51_bus.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <random>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <thread>
+#include <unistd.h>
+
+namespace ms51 {
+
+Options g_options;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// SFRs with behaviour in the model
+constexpr std::uint8_t kRctrim0 = 0x84;
+constexpr std::uint8_t kRctrim1 = 0x85;
+constexpr std::uint8_t kPcon = 0x87;
+constexpr std::uint8_t kTcon = 0x88;
+constexpr std::uint8_t kTmod = 0x89;
+constexpr std::uint8_t kTl0 = 0x8A;
+constexpr std::uint8_t kTh0 = 0x8C;
+constexpr std::uint8_t kCkcon = 0x8E;
+constexpr std::uint8_t kSp = 0x81;
+constexpr std::uint8_t kScon = 0x98;
+constexpr std::uint8_t kSbuf = 0x99;
+constexpr std::uint8_t kChpcon = 0x9F;
+constexpr std::uint8_t kIaptrg = 0xA4;
+constexpr std::uint8_t kIapuen = 0xA5;
+constexpr std::uint8_t kIapal = 0xA6;
+constexpr std::uint8_t kIapah = 0xA7;
+constexpr std::uint8_t kIe = 0xA8;
+constexpr std::uint8_t kWdcon = 0xAA;
+constexpr std::uint8_t kIapfd = 0xAE;
+constexpr std::uint8_t kIapcn = 0xAF;
+constexpr std::uint8_t kIph = 0xB7;
+constexpr std::uint8_t kT3con = 0xC4;
+constexpr std::uint8_t kRl3 = 0xC5;
+constexpr std::uint8_t kRh3 = 0xC6;
+constexpr std::uint8_t kTa = 0xC7;
+
+constexpr std::uint8_t kTconTf0 = 0x20;
+constexpr std::uint8_t kTconTr0 = 0x10;
+constexpr std::uint8_t kCkconT0m = 0x08;
+constexpr std::uint8_t kSconRi = 0x01;
+constexpr std::uint8_t kSconTi = 0x02;
+constexpr std::uint8_t kIeEa = 0x80;
+constexpr std::uint8_t kIeEs = 0x10;
+constexpr std::uint8_t kIeEt0 = 0x02;
+constexpr std::uint8_t kIphPsh = 0x10;
+constexpr std::uint8_t kChpconSwrst = 0x80;
+constexpr std::uint8_t kChpconIapff = 0x40;
+constexpr std::uint8_t kChpconBs = 0x02;
+constexpr std::uint8_t kChpconIapen = 0x01;
+constexpr std::uint8_t kIapuenCfuen = 0x04;
+constexpr std::uint8_t kIapuenLduen = 0x02;
+constexpr std::uint8_t kIapuenApuen = 0x01;
+constexpr std::uint8_t kWdconWdclr = 0x40;
+
+constexpr std::uint8_t kIapReadAp = 0x00;
+constexpr std::uint8_t kIapReadUid = 0x04;
+constexpr std::uint8_t kIapReadDid = 0x0C;
+constexpr std::uint8_t kIapProgramAp = 0x21;
+constexpr std::uint8_t kIapEraseAp = 0x22;
+constexpr std::uint8_t kIapReadLd = 0x40;
+constexpr std::uint8_t kIapProgramLd = 0x61;
+constexpr std::uint8_t kIapEraseLd = 0x62;
+constexpr std::uint8_t kIapReadConfig = 0xC0;
+constexpr std::uint8_t kIapProgramConfig = 0xE1;
+constexpr std::uint8_t kIapEraseConfig = 0xE2;
+
+constexpr std::uint32_t kPageSize = 128;
+
+// SFR read/write and bit test costs, system clocks
+constexpr std::uint32_t kAccessClocks = 4;
+constexpr std::uint32_t kFlagClocks = 2;
+constexpr std::uint32_t kIsrClocks = 24;  // LCALL, context save, RETI
+// Tests of flags/SFRs in a row without a write: the firmware is polling
+constexpr std::uint32_t kSpinReads = 32;
+constexpr std::uint64_t kIdleSliceNs = 50000000;
+
+// HIRC trim values in the UID area, read by MODIFY_HIRC_16/24
+constexpr std::uint8_t kTrim16[2] = {0x5C, 0x01};
+constexpr std::uint8_t kTrim24[2] = {0x7A, 0x00};
+constexpr std::array<std::uint8_t, 12> kUid = {0x4E, 0x55, 0x56, 0x4F, 0x54, 0x4F,
+                                               0x4E, 0x53, 0x31, 0x4D, 0x53, 0x35};
+
+std::array<std::uint8_t, 256> g_sfr;
+std::uint32_t g_fsys = 16000000;
+std::uint64_t g_now;            // virtual ns
+std::int64_t g_paceDebt;        // wall ns owed to --time-scale
+Clock::time_point g_wallStart;
+
+enum class TaState { kLocked, kAa, kOpen };
+TaState g_ta = TaState::kLocked;
+
+bool g_inIsr = false;
+std::uint32_t g_quietReads = 0;
+std::atomic<std::uint64_t> g_accesses{0};  // for the hang watcher
+std::atomic<bool> g_resetting{false};
+
+struct Timer0
+{
+    std::uint64_t base = 0;   // virtual time when the count was `count`
+    std::uint32_t count = 0;  // TH0:TL0 as a linear count for the mode
+    bool running = false;
+} g_t0;
+
+struct Flash
+{
+    std::uint8_t* base = nullptr;  // APROM | LDROM | CONFIG, MAP_SHARED on flashFd
+    std::uint64_t reads = 0, programs = 0, erases = 0, failures = 0;
+    std::uint64_t taViolations = 0;
+    std::uint8_t lastViolation = 0;
+    std::mt19937 rng{0x51};
+} g_flash;
+
+bool isProtected(std::uint8_t addr)
+{
+    switch (addr) {
+    case 0x84: case 0x85:  // RCTRIM0/1
+    case 0x91: case 0x96: case 0x97: case 0x9F: case 0xA3: case 0xA4:
+    case 0xA5: case 0xAA: case 0xAB: case 0xF9: case 0xFA:
+        return true;
+    default:
+        return false;
+    }
+}
+
+std::uint64_t clocksToNs(std::uint64_t clocks)
+{
+    return clocks * kNsPerSec / g_fsys;
+}
+
+void pace(std::uint64_t ns)
+{
+    if (g_options.timeScale <= 0) {
+        return;
+    }
+    g_paceDebt += static_cast<std::int64_t>(static_cast<double>(ns) * g_options.timeScale);
+    if (g_paceDebt >= 200000) {
+        const auto t0 = Clock::now();
+        std::this_thread::sleep_for(std::chrono::nanoseconds(g_paceDebt));
+        g_paceDebt -= std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - t0).count();
+    }
+}
+
+// --- Timer0 --------------------------------------------------------------
+
+std::uint32_t t0Mode()
+{
+    return g_sfr[kTmod] & 3;
+}
+
+std::uint32_t t0Modulus()
+{
+    switch (t0Mode()) {
+    case 0: return 1u << 13;
+    case 1: return 1u << 16;
+    default: return 1u << 8;  // 2, and 3 as far as TL0 goes
+    }
+}
+
+std::uint32_t t0Divider()
+{
+    return (g_sfr[kCkcon] & kCkconT0m) ? 1 : 12;
+}
+
+std::uint32_t t0FromRegs()
+{
+    switch (t0Mode()) {
+    case 0: return (std::uint32_t(g_sfr[kTh0]) << 5) | (g_sfr[kTl0] & 0x1F);
+    case 1: return (std::uint32_t(g_sfr[kTh0]) << 8) | g_sfr[kTl0];
+    default: return g_sfr[kTl0];
+    }
+}
+
+void t0ToRegs(std::uint32_t count)
+{
+    switch (t0Mode()) {
+    case 0:
+        g_sfr[kTh0] = static_cast<std::uint8_t>(count >> 5);
+        g_sfr[kTl0] = static_cast<std::uint8_t>((g_sfr[kTl0] & 0xE0) | (count & 0x1F));
+        break;
+    case 1:
+        g_sfr[kTh0] = static_cast<std::uint8_t>(count >> 8);
+        g_sfr[kTl0] = static_cast<std::uint8_t>(count);
+        break;
+    default:
+        g_sfr[kTl0] = static_cast<std::uint8_t>(count);
+        break;
+    }
+}
+
+std::uint64_t t0NextOverflow()
+{
+    if (!g_t0.running) {
+        return UINT64_MAX;
+    }
+    const std::uint64_t counts = t0Modulus() - g_t0.count;
+    const std::uint64_t clocks = counts * t0Divider();
+    // rounded up, so the count has wrapped by then
+    return g_t0.base + (clocks * kNsPerSec + g_fsys - 1) / g_fsys;
+}
+
+// Overflows up to now set TF0; TH0:TL0 show the count at now
+void t0Update()
+{
+    if (!g_t0.running) {
+        return;
+    }
+    for (std::uint64_t t; (t = t0NextOverflow()) <= g_now;) {
+        g_sfr[kTcon] |= kTconTf0;
+        g_t0.base = t;
+        g_t0.count = t0Mode() == 2 ? g_sfr[kTh0] : 0;
+    }
+    const std::uint64_t counts = (g_now - g_t0.base) * g_fsys / kNsPerSec / t0Divider();
+    t0ToRegs(static_cast<std::uint32_t>(g_t0.count + counts));
+}
+
+// The firmware changed the count, mode, clock or run bit
+void t0Restart()
+{
+    g_t0.base = g_now;
+    g_t0.count = t0FromRegs();
+    g_t0.running = g_sfr[kTcon] & kTconTr0;
+}
+
+bool touchesTimer0(std::uint8_t addr)
+{
+    return addr == kTcon || addr == kTmod || addr == kTl0 || addr == kTh0 || addr == kCkcon ||
+           addr == kRctrim0 || addr == kRctrim1;
+}
+
+// --- Flash and IAP -------------------------------------------------------
+
+std::uint32_t ldromSize(std::uint8_t config1)
+{
+    switch (config1 & 7) {
+    case 7: return 0;
+    case 6: return 1024;
+    case 5: return 2048;
+    case 4: return 3072;
+    default: return 4096;
+    }
+}
+
+std::uint8_t* config()
+{
+    return g_flash.base + kFlashSize;
+}
+
+std::uint32_t apromSize()
+{
+    return kFlashSize - ldromSize(config()[1]);
+}
+
+bool injectFailure(std::uint64_t count, std::uint32_t at)
+{
+    if (at != 0 && count == at) {
+        return true;
+    }
+    return g_options.failRate > 0 &&
+           std::uniform_real_distribution<double>(0, 1)(g_flash.rng) < g_options.failRate;
+}
+
+// The CPU is halted while IAP runs: time passes, interrupts wait
+void stall(std::uint64_t ns);
+
+bool programByte(std::uint8_t* p, std::uint8_t unlocked)
+{
+    stall(g_options.programNs);
+    ++g_flash.programs;
+    if (!unlocked || injectFailure(g_flash.programs, g_options.failProgramAt)) {
+        return false;
+    }
+    *p &= g_sfr[kIapfd];  // programming only clears bits
+    return true;
+}
+
+bool erase(std::uint8_t* p, std::uint32_t size, std::uint8_t unlocked)
+{
+    stall(g_options.eraseNs);
+    ++g_flash.erases;
+    if (!unlocked || injectFailure(g_flash.erases, g_options.failEraseAt)) {
+        return false;
+    }
+    if (g_sfr[kIapfd] != 0xFF) {
+        log("IAP erase with IAPFD 0x%02X", g_sfr[kIapfd]);
+    }
+    std::memset(p, 0xFF, size);
+    return true;
+}
+
+// Execute IAPCN at IAPAH:IAPAL; returns false to raise IAPFF
+bool iapExecute()
+{
+    const std::uint8_t cmd = g_sfr[kIapcn];
+    const std::uint32_t addr = (std::uint32_t(g_sfr[kIapah]) << 8) | g_sfr[kIapal];
+    const std::uint8_t uen = g_sfr[kIapuen];
+    const std::uint32_t ap = apromSize();
+    std::uint8_t& fd = g_sfr[kIapfd];
+
+    switch (cmd) {
+    case kIapReadAp:
+    case kIapReadLd: {
+        const bool inRange = cmd == kIapReadAp ? addr < ap : addr >= ap && addr < kFlashSize;
+        ++g_flash.reads;
+        if (!inRange) {
+            return false;
+        }
+        fd = g_flash.base[addr];
+        return true;
+    }
+    case kIapProgramAp:
+        if (addr >= ap) {
+            return false;
+        }
+        return programByte(g_flash.base + addr, uen & kIapuenApuen);
+    case kIapProgramLd:
+        if (addr < ap || addr >= kFlashSize) {
+            return false;
+        }
+        return programByte(g_flash.base + addr, uen & kIapuenLduen);
+    case kIapEraseAp:
+        if (addr >= ap) {
+            return false;
+        }
+        return erase(g_flash.base + (addr & ~(kPageSize - 1)), kPageSize, uen & kIapuenApuen);
+    case kIapEraseLd:
+        if (addr < ap || addr >= kFlashSize) {
+            return false;
+        }
+        return erase(g_flash.base + (addr & ~(kPageSize - 1)), kPageSize, uen & kIapuenLduen);
+
+    case kIapReadConfig:
+        fd = addr < 5 && addr != 3 ? config()[addr] : 0xFF;
+        return true;
+    case kIapProgramConfig:
+        if (addr >= 5) {
+            return false;
+        }
+        return programByte(config() + addr, uen & kIapuenCfuen);
+    case kIapEraseConfig:
+        return erase(config(), 5, uen & kIapuenCfuen);
+
+    case kIapReadUid:
+        if (addr < kUid.size()) {
+            fd = kUid[addr];
+        } else if (addr == 0x30 || addr == 0x31) {
+            fd = kTrim16[addr - 0x30];
+        } else if (addr == 0x38 || addr == 0x39) {
+            fd = kTrim24[addr - 0x38];
+        } else {
+            fd = 0xFF;
+        }
+        return true;
+    case kIapReadDid: {
+        const std::uint8_t id[4] = {static_cast<std::uint8_t>(g_options.did),
+                                    static_cast<std::uint8_t>(g_options.did >> 8),
+                                    static_cast<std::uint8_t>(g_options.pid),
+                                    static_cast<std::uint8_t>(g_options.pid >> 8)};
+        fd = addr < 4 ? id[addr] : 0xFF;
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+void iapTrigger()
+{
+    if ((g_sfr[kChpcon] & kChpconIapen) == 0) {
+        log("IAPGO with IAPEN clear, ignored");
+        return;
+    }
+    if (!iapExecute()) {
+        ++g_flash.failures;
+        log("IAP cmd 0x%02X at 0x%02X%02X failed", g_sfr[kIapcn], g_sfr[kIapah], g_sfr[kIapal]);
+        g_sfr[kChpcon] |= kChpconIapff;
+    }
+}
+
+void openFlash()
+{
+    const std::size_t size = kFlashSize + kConfigSize;
+    bool blank = false;
+
+    if (g_options.flashFd < 0) {
+        // a memfd rather than anonymous memory so it survives reexec()
+        const int fd = g_options.flash.empty()
+                           ? ::memfd_create("ms51-flash", 0)
+                           : ::open(g_options.flash.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd < 0) {
+            throw std::runtime_error("open flash: " + std::string(std::strerror(errno)));
+        }
+        blank = ::lseek(fd, 0, SEEK_END) < static_cast<off_t>(size);
+        if (blank && ::ftruncate(fd, static_cast<off_t>(size)) != 0) {
+            throw std::runtime_error("size flash: " + std::string(std::strerror(errno)));
+        }
+        g_options.flashFd = fd;
+    }
+
+    void* p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, g_options.flashFd, 0);
+    if (p == MAP_FAILED) {
+        throw std::runtime_error("map flash: " + std::string(std::strerror(errno)));
+    }
+    g_flash.base = static_cast<std::uint8_t*>(p);
+    if (blank) {
+        std::memset(g_flash.base, 0xFF, size);
+        std::memcpy(config(), g_options.config, sizeof(g_options.config));
+    }
+}
+
+// --- Time and interrupts ---------------------------------------------------
+
+// Let modelled time pass to t, handling timer overflows and characters as
+// they fall due; interrupts are left pending for the caller
+void runUntil(std::uint64_t t)
+{
+    for (;;) {
+        const std::uint64_t next = std::min({t, t0NextOverflow(), uartNextEvent()});
+        if (next > g_now) {
+            pace(next - g_now);
+            g_now = next;
+        }
+        t0Update();
+        uartService();
+        if (next >= t) {
+            return;
+        }
+    }
+}
+
+void stall(std::uint64_t ns)
+{
+    runUntil(g_now + ns);
+}
+
+void runIsr(void (*isr)())
+{
+    g_inIsr = true;
+    g_now += clocksToNs(kIsrClocks);
+    isr();
+    g_inIsr = false;
+}
+
+// Between two instructions: vector to whatever is pending and enabled
+void dispatch()
+{
+    // an ISR that leaves its flag set would be re-entered forever; so would
+    // the chip, but a bounded loop keeps the model responsive
+    for (int round = 0; round < 4 && !g_inIsr && (g_sfr[kIe] & kIeEa); ++round) {
+        const bool serial = (g_sfr[kIe] & kIeEs) && (g_sfr[kScon] & (kSconRi | kSconTi));
+        const bool timer0 = (g_sfr[kIe] & kIeEt0) && (g_sfr[kTcon] & kTconTf0);
+        if (!serial && !timer0) {
+            return;
+        }
+        g_quietReads = 0;
+        // natural priority puts Timer0 first unless the serial port is raised (PSH)
+        if (serial && (!timer0 || (g_sfr[kIph] & kIphPsh))) {
+            runIsr(Serial_ISR);
+        } else {
+            g_sfr[kTcon] &= static_cast<std::uint8_t>(~kTconTf0);  // cleared on vectoring
+            runIsr(Timer0_ISR);
+        }
+    }
+}
+
+void idle(std::uint64_t ns)
+{
+    pollfd pfd{g_options.ptyFd, POLLIN, 0};
+    const timespec ts{static_cast<time_t>(ns / kNsPerSec), static_cast<long>(ns % kNsPerSec)};
+    const auto t0 = Clock::now();
+    ::ppoll(&pfd, 1, &ts, nullptr);
+    g_now += static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - t0).count());
+}
+
+// The firmware is spinning: skip to the next character on the wire, or
+// wait for the host or the next Timer0 overflow
+void waitForWork()
+{
+    uartService();
+    const std::uint64_t next = uartNextEvent();
+    if (next != UINT64_MAX) {
+        runUntil(next);
+        return;
+    }
+    const std::uint64_t deadline = std::min(t0NextOverflow(), g_now + kIdleSliceNs);
+    idle(deadline > g_now ? deadline - g_now : 0);
+    runUntil(g_now);
+}
+
+// Every access: a few clocks pass, then interrupts get their chance
+void access(std::uint32_t clocks)
+{
+    g_accesses.fetch_add(1, std::memory_order_relaxed);
+    const std::uint64_t t = g_now + clocksToNs(clocks);
+    if (std::min(t0NextOverflow(), uartNextEvent()) <= t) {
+        runUntil(t);
+    } else {
+        pace(t - g_now);
+        g_now = t;
+    }
+}
+
+void polled()
+{
+    if (!g_inIsr && ++g_quietReads >= kSpinReads) {
+        g_quietReads = 0;
+        waitForWork();
+    }
+    dispatch();
+}
+
+[[noreturn]] void softwareReset()
+{
+    g_resetting = true;
+    uartService();
+    std::string stats;
+    uartStats(stats);
+    char line[200];
+    std::snprintf(line, sizeof(line),
+                  ", iap reads %llu programs %llu erases %llu failed %llu, TA violations %llu",
+                  static_cast<unsigned long long>(g_flash.reads),
+                  static_cast<unsigned long long>(g_flash.programs),
+                  static_cast<unsigned long long>(g_flash.erases),
+                  static_cast<unsigned long long>(g_flash.failures),
+                  static_cast<unsigned long long>(g_flash.taViolations));
+    stats += line;
+    if (g_flash.taViolations) {
+        std::snprintf(line, sizeof(line), " (last SFR 0x%02X)", g_flash.lastViolation);
+        stats += line;
+    }
+    log("reset: %s", stats.c_str());
+
+    if ((g_sfr[kChpcon] & kChpconBs) == 0) {
+        if (g_options.exitOnRun) {
+            std::fprintf(stderr, "nuisp-sim-ms51: booting APROM, exiting\n");
+            ::msync(g_flash.base, kFlashSize + kConfigSize, MS_SYNC);
+            simhost::drainPty(g_options.ptyFd, 1000);
+            std::fflush(nullptr);
+            ::_exit(0);
+        }
+        log("booting APROM for %ld ms", g_options.appMs);
+        std::this_thread::sleep_for(std::chrono::milliseconds(g_options.appMs));
+    }
+    reexec();
+}
+
+// Side effects of a write that got past TA protection
+void written(std::uint8_t addr, std::uint8_t old)
+{
+    const std::uint8_t v = g_sfr[addr];
+    switch (addr) {
+    case kSbuf:
+        uartSbufWrite(v);
+        break;
+    case kIaptrg:
+        g_sfr[kIaptrg] = 0;
+        if (v & 1) {
+            iapTrigger();
+        }
+        break;
+    case kChpcon:
+        if (v & kChpconSwrst) {
+            softwareReset();
+        }
+        // IAPFF only clears
+        g_sfr[kChpcon] = static_cast<std::uint8_t>((v & ~kChpconIapff) | (v & old & kChpconIapff));
+        break;
+    case kWdcon:
+        g_sfr[kWdcon] &= static_cast<std::uint8_t>(~kWdconWdclr);  // WDT not modelled
+        break;
+    case kRctrim0:
+    case kRctrim1:
+        g_fsys = g_sfr[kRctrim0] == kTrim24[0] && g_sfr[kRctrim1] == kTrim24[1] ? 24000000 : 16000000;
+        log("HIRC %u MHz", g_fsys / 1000000);
+        uartRetime(g_fsys);
+        break;
+    case kPcon:
+    case kT3con:
+    case kRl3:
+    case kRh3:
+        uartRetime(g_fsys);
+        break;
+    default:
+        break;
+    }
+}
+
+void store(std::uint8_t addr, std::uint8_t value)
+{
+    if (addr == kTa) {
+        g_ta = value == 0xAA ? TaState::kAa
+               : value == 0x55 && g_ta == TaState::kAa ? TaState::kOpen
+                                                       : TaState::kLocked;
+        g_sfr[kTa] = value;
+        return;
+    }
+    const bool open = g_ta == TaState::kOpen;
+    g_ta = TaState::kLocked;
+    if (isProtected(addr) && !open) {
+        ++g_flash.taViolations;
+        g_flash.lastViolation = addr;
+        log("write 0x%02X to SFR 0x%02X without TA, ignored", value, addr);
+        return;
+    }
+
+    const bool timer = touchesTimer0(addr);
+    if (timer) {
+        t0Update();
+    }
+    const std::uint8_t old = g_sfr[addr];
+    g_sfr[addr] = value;
+    written(addr, old);
+    if (timer) {
+        t0Restart();
+    }
+}
+
+void watchHangs()
+{
+    std::uint64_t seen = g_accesses.load();
+    auto since = Clock::now();
+    for (;;) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        const std::uint64_t n = g_accesses.load();
+        if (n != seen || g_resetting) {
+            seen = n;
+            since = Clock::now();
+        } else if (Clock::now() - since >= std::chrono::milliseconds(g_options.hangMs)) {
+            std::fprintf(stderr, "nuisp-sim-ms51: firmware stopped (no SFR access for %ld ms), "
+                                 "power cycling\n", g_options.hangMs);
+            reexec();
+        }
+    }
+}
+
+}  // namespace
+
+std::uint64_t now()
+{
+    return g_now;
+}
+
+std::uint8_t& sfr(std::uint8_t addr)
+{
+    return g_sfr[addr];
+}
+
+void log(const char* fmt, ...)
+{
+    if (!g_options.verbose) {
+        return;
+    }
+    const double wall = std::chrono::duration<double>(Clock::now() - g_wallStart).count();
+    std::fprintf(stderr, "[%9.3f %9.3f] ", wall, static_cast<double>(g_now) / kNsPerSec);
+    va_list ap;
+    va_start(ap, fmt);
+    std::vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    std::fputc('\n', stderr);
+}
+
+void powerOn()
+{
+    g_wallStart = Clock::now();
+    openFlash();
+
+    g_sfr.fill(0);
+    for (std::uint8_t port : {0x80, 0x90, 0xA0, 0xB0}) {
+        g_sfr[port] = 0xFF;
+    }
+    g_sfr[kSp] = 0x07;
+    g_sfr[kRctrim0] = kTrim16[0];
+    g_sfr[kRctrim1] = kTrim16[1];
+    // CBS: CONFIG0 bit 7 clear boots LDROM
+    g_sfr[kChpcon] = (config()[0] & 0x80) ? 0 : kChpconBs;
+    uartRetime(g_fsys);
+
+    log("power-on, APROM %u bytes, %s boot", apromSize(),
+        (g_sfr[kChpcon] & kChpconBs) ? "LDROM" : "APROM");
+    if ((g_sfr[kChpcon] & kChpconBs) == 0) {
+        softwareReset();  // CONFIG0 selects APROM: nothing for the bootloader to do
+    }
+    if (g_options.hangMs > 0) {
+        std::thread(watchHangs).detach();
+    }
+}
+
+// --- ms51_bus.hpp ----------------------------------------------------------
+
+std::uint8_t sfrRead(std::uint8_t addr)
+{
+    access(kAccessClocks);
+    g_ta = TaState::kLocked;
+    std::uint8_t v;
+    if (addr == kSbuf) {
+        v = uartSbufRead();
+    } else {
+        if (addr == kTl0 || addr == kTh0) {
+            t0Update();
+        }
+        v = g_sfr[addr];
+    }
+    polled();
+    return v;
+}
+
+void sfrWrite(std::uint8_t addr, std::uint8_t value)
+{
+    access(kAccessClocks);
+    g_quietReads = 0;
+    store(addr, value);
+    dispatch();
+}
+
+void sfrModify(std::uint8_t addr, std::uint8_t andMask, std::uint8_t orMask, std::uint8_t xorMask)
+{
+    access(kAccessClocks);
+    g_quietReads = 0;
+    if (addr == kTl0 || addr == kTh0) {
+        t0Update();
+    }
+    store(addr, static_cast<std::uint8_t>(((g_sfr[addr] & andMask) | orMask) ^ xorMask));
+    dispatch();
+}
+
+void flagRead()
+{
+    access(kFlagClocks);
+    polled();
+}
+
+}  // namespace ms51
@@ -0,0 +1,167 @@
+// SPDX-License-Identifier: Apache-2.0
+//
+// nuisp-sim-ms51: the W20B LDROM bootloader, compiled for the host, behind
+// a pseudo-terminal.
+//
+//   nuisp-sim-ms51 -s 0 --link /tmp/ms51 &
+//   nuisp -w -p /tmp/ms51 program app.bin run
+#include "sim.hpp"
+#include "sim_host.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <getopt.h>
+#include <string>
+#include <termios.h>
+#include <vector>
+
+using namespace ms51;
+
+namespace {
+
+std::vector<std::string> g_args;  // command line without the reset-time options
+
+enum LongOnly
+{
+    kConfig0 = 256,
+    kConfig1,
+    kConfig2,
+    kConfig4,
+    kDid,
+    kPid,
+    kEraseUs,
+    kProgramUs,
+    kFailProgram,
+    kFailErase,
+    kFailRate,
+    kAppMs,
+    kHangMs,
+    kPtyFd,
+    kFlashFd,
+};
+
+void usage()
+{
+    std::fprintf(stderr,
+                 "usage: nuisp-sim-ms51 [options]\n"
+                 "\n"
+                 "Runs the W20B bootloader against a simulated MS51 (16 KB) on a pty.\n"
+                 "\n"
+                 "options:\n"
+                 "  -l, --link PATH         symlink to the pty slave (default: print its path)\n"
+                 "  -f, --flash FILE        APROM/LDROM/CONFIG image, kept across runs\n"
+                 "                          (default: blank, in memory)\n"
+                 "  -s, --time-scale S      wall time per simulated second of busy time,\n"
+                 "                          0 = as fast as possible (default 1)\n"
+                 "      --config0 N         CONFIG0 of a new flash (default 0x7F, LDROM boot)\n"
+                 "      --config1 N         CONFIG1 of a new flash (default 0xF8, 4 KB LDROM)\n"
+                 "      --config2 N         CONFIG2 of a new flash (default 0xFF)\n"
+                 "      --config4 N         CONFIG4 of a new flash (default 0xFF)\n"
+                 "      --did N             device ID (default 0x4B21)\n"
+                 "      --pid N             product ID (default 0x0000)\n"
+                 "      --erase-us US       page erase time (default 5000)\n"
+                 "      --program-us US     byte program time (default 25)\n"
+                 "      --fail-program N    Nth byte program after power-on fails\n"
+                 "      --fail-erase N      Nth page erase after power-on fails\n"
+                 "      --fail-rate P       probability of IAPFF per program/erase\n"
+                 "      --app-ms MS         time APROM \"runs\" before the next power-on\n"
+                 "                          (default 1000)\n"
+                 "      --hang-ms MS        power cycle after this long without an SFR\n"
+                 "                          access, 0 = never (default 2000)\n"
+                 "  -x, --exit-on-run       exit instead of booting APROM\n"
+                 "  -v, --verbose           log the model to stderr\n");
+}
+
+}  // namespace
+
+namespace ms51 {
+
+void reexec()
+{
+    simhost::reexec(g_args, g_options.ptyFd, g_options.flashFd);
+}
+
+}  // namespace ms51
+
+int main(int argc, char** argv)
+{
+    static const option longOptions[] = {
+        {"link", required_argument, nullptr, 'l'},
+        {"flash", required_argument, nullptr, 'f'},
+        {"time-scale", required_argument, nullptr, 's'},
+        {"config0", required_argument, nullptr, kConfig0},
+        {"config1", required_argument, nullptr, kConfig1},
+        {"config2", required_argument, nullptr, kConfig2},
+        {"config4", required_argument, nullptr, kConfig4},
+        {"did", required_argument, nullptr, kDid},
+        {"pid", required_argument, nullptr, kPid},
+        {"erase-us", required_argument, nullptr, kEraseUs},
+        {"program-us", required_argument, nullptr, kProgramUs},
+        {"fail-program", required_argument, nullptr, kFailProgram},
+        {"fail-erase", required_argument, nullptr, kFailErase},
+        {"fail-rate", required_argument, nullptr, kFailRate},
+        {"app-ms", required_argument, nullptr, kAppMs},
+        {"hang-ms", required_argument, nullptr, kHangMs},
+        {"exit-on-run", no_argument, nullptr, 'x'},
+        {"verbose", no_argument, nullptr, 'v'},
+        {"pty-fd", required_argument, nullptr, kPtyFd},
+        {"flash-fd", required_argument, nullptr, kFlashFd},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+
+    Options& o = g_options;
+    auto number = [] { return static_cast<std::uint32_t>(std::strtoul(optarg, nullptr, 0)); };
+
+    int c;
+    while ((c = getopt_long(argc, argv, "l:f:s:xvh", longOptions, nullptr)) != -1) {
+        switch (c) {
+        case 'l': o.link = optarg; break;
+        case 'f': o.flash = optarg; break;
+        case 's': o.timeScale = std::strtod(optarg, nullptr); break;
+        case kConfig0: o.config[0] = static_cast<std::uint8_t>(number()); break;
+        case kConfig1: o.config[1] = static_cast<std::uint8_t>(number()); break;
+        case kConfig2: o.config[2] = static_cast<std::uint8_t>(number()); break;
+        case kConfig4: o.config[4] = static_cast<std::uint8_t>(number()); break;
+        case kDid: o.did = static_cast<std::uint16_t>(number()); break;
+        case kPid: o.pid = static_cast<std::uint16_t>(number()); break;
+        case kEraseUs: o.eraseNs = std::uint64_t(number()) * 1000; break;
+        case kProgramUs: o.programNs = std::uint64_t(number()) * 1000; break;
+        case kFailProgram: o.failProgramAt = number(); break;
+        case kFailErase: o.failEraseAt = number(); break;
+        case kFailRate: o.failRate = std::strtod(optarg, nullptr); break;
+        case kAppMs: o.appMs = std::strtol(optarg, nullptr, 0); break;
+        case kHangMs: o.hangMs = std::strtol(optarg, nullptr, 0); break;
+        case 'x': o.exitOnRun = true; break;
+        case 'v': o.verbose = true; break;
+        case kPtyFd: o.ptyFd = static_cast<int>(number()); break;
+        case kFlashFd: o.flashFd = static_cast<int>(number()); break;
+        default: usage(); return c == 'h' ? 0 : 2;
+        }
+    }
+    g_args = simhost::restartArgs(argc, argv);
+    if (optind != argc) {
+        usage();
+        return 2;
+    }
+
+    try {
+        if (o.ptyFd < 0) {
+            std::string slave;
+            o.ptyFd = simhost::openPty(slave);
+            simhost::publishPty(slave, o.link);
+        } else {
+            // whatever the host sent while the chip was off is gone
+            ::tcflush(o.ptyFd, TCIFLUSH);
+            simhost::keepLinkOnSignal(o.link);
+        }
+        uartInit(o.ptyFd);
+        powerOn();
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "nuisp-sim-ms51: %s\n", e.what());
+        return 1;
+    }
+
+    FirmwareMain();
+    return 0;
+}
@@ -0,0 +1,166 @@
+// SPDX-License-Identifier: Apache-2.0
+//
+// UART0 of the simulated MS51: mode 1, baud rate from Timer3, no FIFO.
+// A received character sets RI when its stop bit completes; if RI is still
+// set from the previous one the new character is lost, as on the chip. A
+// write to SBUF shifts the character out and sets TI 10 bit times later.
+#include "sim.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <unistd.h>
+#include <utility>
+
+namespace ms51 {
+
+namespace {
+
+constexpr std::uint8_t kPcon = 0x87;
+constexpr std::uint8_t kScon = 0x98;
+constexpr std::uint8_t kT3con = 0xC4;
+constexpr std::uint8_t kRl3 = 0xC5;
+constexpr std::uint8_t kRh3 = 0xC6;
+
+constexpr std::uint8_t kPconSmod = 0x80;
+constexpr std::uint8_t kSconRi = 0x01;
+constexpr std::uint8_t kSconTi = 0x02;
+constexpr std::uint8_t kSconRen = 0x10;
+constexpr std::uint8_t kT3conBrck = 0x20;
+constexpr std::uint8_t kT3conTr3 = 0x08;
+
+struct Uart
+{
+    int fd = -1;
+    std::uint32_t baud = 38400;
+    std::uint8_t rxBuf = 0;  // SBUF as read
+
+    std::deque<std::pair<std::uint64_t, std::uint8_t>> wire;  // host bytes, stop bit time
+    std::uint64_t wireEnd = 0;
+    std::deque<std::pair<std::uint64_t, std::uint8_t>> tx;    // shift register and beyond
+    std::uint64_t txEnd = 0;
+
+    std::uint64_t bytesIn = 0, bytesOut = 0, overruns = 0, dropped = 0;
+} g_uart;
+
+std::uint64_t charNs()
+{
+    return 10 * kNsPerSec / g_uart.baud;
+}
+
+void readHost()
+{
+    std::uint8_t buf[256];
+    for (;;) {
+        const ssize_t n = ::read(g_uart.fd, buf, sizeof(buf));
+        if (n <= 0) {
+            return;  // EAGAIN, or EIO while no host has the pty open
+        }
+        for (ssize_t i = 0; i < n; ++i) {
+            g_uart.wireEnd = std::max(g_uart.wireEnd, now()) + charNs();
+            g_uart.wire.emplace_back(g_uart.wireEnd, buf[i]);
+        }
+        g_uart.bytesIn += static_cast<std::uint64_t>(n);
+    }
+}
+
+void writeHost(std::uint8_t byte)
+{
+    for (;;) {
+        const ssize_t w = ::write(g_uart.fd, &byte, 1);
+        if (w == 1) {
+            ++g_uart.bytesOut;
+            return;
+        }
+        if (w < 0 && errno != EAGAIN && errno != EINTR) {
+            log("pty write: %s", std::strerror(errno));
+            return;
+        }
+    }
+}
+
+}  // namespace
+
+void uartInit(int ptyFd)
+{
+    g_uart.fd = ptyFd;
+    ::fcntl(ptyFd, F_SETFL, ::fcntl(ptyFd, F_GETFL) | O_NONBLOCK);
+}
+
+void uartService()
+{
+    readHost();
+
+    std::uint8_t& scon = sfr(kScon);
+    while (!g_uart.wire.empty() && g_uart.wire.front().first <= now()) {
+        const std::uint8_t byte = g_uart.wire.front().second;
+        g_uart.wire.pop_front();
+        if ((scon & kSconRen) == 0) {
+            ++g_uart.dropped;
+        } else if (scon & kSconRi) {
+            ++g_uart.overruns;
+        } else {
+            g_uart.rxBuf = byte;
+            scon |= kSconRi;
+        }
+    }
+    while (!g_uart.tx.empty() && g_uart.tx.front().first <= now()) {
+        writeHost(g_uart.tx.front().second);
+        g_uart.tx.pop_front();
+        scon |= kSconTi;
+    }
+}
+
+std::uint64_t uartNextEvent()
+{
+    std::uint64_t next = UINT64_MAX;
+    if (!g_uart.wire.empty()) {
+        next = g_uart.wire.front().first;
+    }
+    if (!g_uart.tx.empty()) {
+        next = std::min(next, g_uart.tx.front().first);
+    }
+    return next;
+}
+
+void uartSbufWrite(std::uint8_t value)
+{
+    g_uart.txEnd = std::max(g_uart.txEnd, now()) + charNs();
+    g_uart.tx.emplace_back(g_uart.txEnd, value);
+}
+
+std::uint8_t uartSbufRead()
+{
+    return g_uart.rxBuf;
+}
+
+void uartRetime(std::uint32_t fsys)
+{
+    const std::uint8_t t3con = sfr(kT3con);
+    if ((t3con & (kT3conBrck | kT3conTr3)) != (kT3conBrck | kT3conTr3)) {
+        return;  // Timer3 stopped, or Timer1 as baud clock (not modelled): keep the rate
+    }
+    const std::uint32_t reload = 65536 - ((std::uint32_t(sfr(kRh3)) << 8) | sfr(kRl3));
+    const std::uint32_t div = ((sfr(kPcon) & kPconSmod) ? 16 : 32) * (1u << (t3con & 7)) * reload;
+    const std::uint32_t baud = fsys / div;
+    if (baud != 0 && baud != g_uart.baud) {
+        g_uart.baud = baud;
+        log("uart %u baud", baud);
+    }
+}
+
+void uartStats(std::string& out)
+{
+    char line[160];
+    std::snprintf(line, sizeof(line), "uart bytes in %llu out %llu overruns %llu dropped %llu",
+                  static_cast<unsigned long long>(g_uart.bytesIn),
+                  static_cast<unsigned long long>(g_uart.bytesOut),
+                  static_cast<unsigned long long>(g_uart.overruns),
+                  static_cast<unsigned long long>(g_uart.dropped));
+    out += line;
+}
+
+}  // namespace ms51
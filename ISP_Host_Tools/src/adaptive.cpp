@@ -0,0 +1,282 @@
+// SPDX-License-Identifier: Apache-2.0
+#include "nuisp/adaptive.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <sstream>
+
+namespace nuisp {
+
+namespace {
+
+constexpr const char* kHeader = "# nuisp tuner 1";
+
+// A device that was lost mid-command is looked for at its current rate this long
+constexpr std::chrono::milliseconds kRecoverWindow{500};
+
+constexpr std::uint32_t kUnknownGap = 0xFFFFFFFF;
+
+}  // namespace
+
+LinkTuner::LinkTuner(TunerPolicy policy)
+    : policy_(std::move(policy)), failures_(policy_.rates.size(), 0)
+{
+    if (policy_.rates.empty() || policy_.gapsUs.empty() || policy_.window == 0 ||
+        policy_.minSegment == 0 || policy_.minSegment > policy_.maxSegment ||
+        !std::is_sorted(policy_.rates.begin(), policy_.rates.end())) {
+        throw Error("tuner needs ascending rates, a gap, a window and segment bounds");
+    }
+    rate_ = std::min(policy_.startRate, policy_.rates.size() - 1);
+    segment_ = policy_.maxSegment;
+}
+
+void LinkTuner::stepDown()
+{
+    ++failures_[rate_];
+    if (rate_ > 0) {
+        --rate_;
+        ++stats_.stepsDown;
+    }
+    windowFrames_ = 0;
+    windowResends_ = 0;
+    cleanWindows_ = 0;
+}
+
+void LinkTuner::record(std::uint64_t frames, std::uint64_t resends, Outcome outcome)
+{
+    stats_.frames += frames;
+    stats_.resends += resends;
+
+    if (outcome != Outcome::Ok) {
+        if (outcome == Outcome::Timeout) {
+            ++stats_.timeouts;
+            // a partial frame the device dropped looks the same as lost bytes,
+            // so give stalls inside a frame more room as well
+            gap_ = std::min(gap_ + 1, policy_.gapsUs.size() - 1);
+        } else {
+            ++stats_.failures;
+        }
+        segment_ = std::max(segment_ / 2, policy_.minSegment);
+        stepDown();
+        return;
+    }
+
+    windowFrames_ += frames;
+    windowResends_ += resends;
+    if (windowFrames_ < policy_.window) {
+        return;
+    }
+    const double share = static_cast<double>(windowResends_) / static_cast<double>(windowFrames_);
+    const bool clean = windowResends_ == 0;
+    windowFrames_ = 0;
+    windowResends_ = 0;
+
+    if (share > policy_.stepDown) {
+        stepDown();
+    } else if (!clean) {
+        cleanWindows_ = 0;
+    } else if (segment_ < policy_.maxSegment) {
+        segment_ = std::min(segment_ * 2, policy_.maxSegment);
+    } else if (rate_ + 1 < policy_.rates.size() &&
+               ++cleanWindows_ >= 1u << std::min(failures_[rate_ + 1], policy_.maxBackoff)) {
+        ++rate_;
+        ++stats_.stepsUp;
+        cleanWindows_ = 0;
+    }
+}
+
+void LinkTuner::load(const std::string& path)
+{
+    std::ifstream in(path);
+    if (!in) {
+        return;
+    }
+
+    std::string line;
+    unsigned lineNo = 0;
+    while (std::getline(in, line)) {
+        ++lineNo;
+        if (lineNo == 1 && line != kHeader) {
+            throw Error(path + ": not a nuisp tuner state");
+        }
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+
+        std::istringstream fields(line);
+        std::string key;
+        std::uint32_t value = 0;
+        unsigned count = 0;
+        fields >> key >> value;
+        if (key == "failed") {
+            fields >> count;
+        }
+        if (!fields || (key != "rate" && key != "gap" && key != "segment" && key != "failed")) {
+            throw Error(path + ":" + std::to_string(lineNo) + ": malformed line");
+        }
+        if (key == "segment") {
+            segment_ = std::clamp<std::size_t>(value, policy_.minSegment, policy_.maxSegment);
+            continue;
+        }
+
+        const auto& ladder = key == "gap" ? policy_.gapsUs : policy_.rates;
+        const auto it = std::find(ladder.begin(), ladder.end(), value);
+        if (it == ladder.end()) {
+            continue;
+        }
+        const auto i = static_cast<std::size_t>(it - ladder.begin());
+        if (key == "rate") {
+            rate_ = i;
+        } else if (key == "gap") {
+            gap_ = i;
+        } else {
+            failures_[i] = count;
+        }
+    }
+}
+
+void LinkTuner::save(const std::string& path) const
+{
+    std::ofstream out(path);
+    if (!out) {
+        throw Error("cannot create " + path + ": " + std::strerror(errno));
+    }
+    out << kHeader << '\n' << "rate " << rate() << '\n' << "gap " << gapUs() << '\n'
+        << "segment " << segment_ << '\n';
+    for (std::size_t i = 0; i < policy_.rates.size(); ++i) {
+        out << "failed " << policy_.rates[i] << ' ' << failures_[i] << '\n';
+    }
+    if (!out.flush()) {
+        throw Error("cannot write " + path);
+    }
+}
+
+AdaptiveSession::AdaptiveSession(Session& session, LinkTuner& tuner)
+    : session_(session), tuner_(tuner), baud_(tuner.policy().rates.front())
+{
+}
+
+void AdaptiveSession::connect(std::chrono::milliseconds window)
+{
+    connectWindow_ = window;
+    baud_ = tuner_.policy().rates.front();
+    gapUs_ = 0;
+    session_.link().setBaudRate(baud_);
+
+    for (unsigned n = 1;; ++n) {
+        try {
+            session_.connect(window);
+            const std::optional<DeviceInfo> info = session_.deviceInfo();
+            canSwitch_ = info && (info->capabilities & cap::SetSpeed);
+            return;
+        } catch (const TimeoutError&) {
+            throw;
+        } catch (const Error&) {
+            if (n >= tuner_.policy().attempts) {
+                throw;
+            }
+        }
+    }
+}
+
+void AdaptiveSession::apply()
+{
+    if (!canSwitch_ || (tuner_.rate() == baud_ && tuner_.gapUs() == gapUs_)) {
+        return;
+    }
+    // a gap of 0 keeps the device's, which only matters before the first raise
+    if (!session_.setSpeed(tuner_.rate(), tuner_.gapUs())) {
+        canSwitch_ = false;
+        return;
+    }
+    baud_ = tuner_.rate();
+    gapUs_ = tuner_.gapUs();
+}
+
+void AdaptiveSession::recover()
+{
+    // the device is at the old rate, or at the new one if only the answer to
+    // CMD_SET_SPEED was lost; its gap is unknown either way
+    for (const std::uint32_t rate : {baud_, tuner_.rate()}) {
+        try {
+            session_.link().setBaudRate(rate);
+            session_.connect(kRecoverWindow);
+            baud_ = rate;
+            gapUs_ = kUnknownGap;
+            return;
+        } catch (const Error&) {
+        }
+    }
+    // reset: start over at power-on
+    connect(connectWindow_);
+}
+
+void AdaptiveSession::attempt(const std::function<void()>& segment)
+{
+    for (unsigned n = 1;; ++n) {
+        const SessionStats before = session_.stats();
+        LinkTuner::Outcome outcome = LinkTuner::Outcome::Ok;
+        std::exception_ptr error;
+        try {
+            apply();
+            segment();
+        } catch (const TimeoutError&) {
+            outcome = LinkTuner::Outcome::Timeout;
+            error = std::current_exception();
+        } catch (const Error&) {
+            outcome = LinkTuner::Outcome::Failed;
+            error = std::current_exception();
+        }
+        // a device that cannot switch says nothing about the station's rates
+        if (canSwitch_) {
+            const SessionStats& after = session_.stats();
+            tuner_.record(after.frames - before.frames, after.resends - before.resends, outcome);
+        }
+        if (!error) {
+            return;
+        }
+        if (n >= tuner_.policy().attempts) {
+            std::rethrow_exception(error);
+        }
+        recover();
+    }
+}
+
+void AdaptiveSession::eraseAll()
+{
+    attempt([&] { session_.eraseAll(); });
+}
+
+void AdaptiveSession::program(const PacketCache& cache, const Progress& progress)
+{
+    attempt([&] { session_.program(cache, progress); });
+}
+
+void AdaptiveSession::verify(std::uint32_t address, const PacketCache& cache,
+                             const Progress& progress)
+{
+    const std::size_t size = cache.imageSize();
+    std::size_t offset = 0;
+    while (offset < size) {
+        // taken again after each segment, a failure halves it
+        const std::size_t len = std::min(tuner_.segment() * kReadFlashChunk, size - offset);
+        attempt([&] {
+            session_.verify(address, cache, offset, len, [&](std::size_t done, std::size_t) {
+                if (progress) {
+                    progress(offset + done, size);
+                }
+            });
+        });
+        offset += len;
+    }
+}
+
+void AdaptiveSession::run()
+{
+    session_.run();
+}
+
+}  // namespace nuisp
@@ -0,0 +1,169 @@
+// SPDX-License-Identifier: Apache-2.0
+#include "nuisp/async.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace nuisp {
+
+namespace {
+
+// Fire-and-forget frame that owns a spawned Task until it finishes.
+struct Detached
+{
+    struct promise_type
+    {
+        Detached get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+Detached runSpawned(Task<void> task, std::size_t& live,
+                    std::function<void(std::exception_ptr)> done)
+{
+    std::exception_ptr error;
+    try {
+        co_await std::move(task);
+    } catch (...) {
+        error = std::current_exception();
+    }
+    --live;
+    if (done) {
+        done(error);
+    }
+}
+
+[[noreturn]] void throwErrno(const char* what)
+{
+    throw Error(std::string(what) + ": " + std::strerror(errno));
+}
+
+}  // namespace
+
+EpollExecutor::EpollExecutor()
+{
+    epoll_ = ::epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_ < 0) {
+        throwErrno("epoll_create1");
+    }
+    wakeup_ = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (wakeup_ < 0) {
+        ::close(epoll_);
+        throwErrno("eventfd");
+    }
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.u64 = 0;  // wait ids start at 1
+    ::epoll_ctl(epoll_, EPOLL_CTL_ADD, wakeup_, &ev);
+}
+
+EpollExecutor::~EpollExecutor()
+{
+    ::close(wakeup_);
+    ::close(epoll_);
+}
+
+void EpollExecutor::start(Wait& w)
+{
+    w.id = nextId_++;
+    if (w.fd >= 0) {
+        epoll_event ev{};
+        ev.events = w.writable ? EPOLLOUT : EPOLLIN;
+        ev.data.u64 = w.id;
+        if (::epoll_ctl(epoll_, EPOLL_CTL_ADD, w.fd, &ev) != 0) {
+            throwErrno("epoll_ctl");
+        }
+    }
+    auto timer = w.deadline == kNoDeadline ? timers_.end() : timers_.emplace(w.deadline, w.id);
+    waits_.emplace(w.id, Entry{&w, timer});
+}
+
+void EpollExecutor::cancel(std::uint64_t id)
+{
+    {
+        std::lock_guard lock(cancelLock_);
+        cancels_.push_back(id);
+    }
+    const std::uint64_t one = 1;
+    [[maybe_unused]] ssize_t n = ::write(wakeup_, &one, sizeof(one));
+}
+
+void EpollExecutor::complete(std::uint64_t id, WaitResult result)
+{
+    auto it = waits_.find(id);
+    if (it == waits_.end()) {
+        return;
+    }
+    Wait& w = *it->second.wait;
+    if (it->second.timer != timers_.end()) {
+        timers_.erase(it->second.timer);
+    }
+    if (w.fd >= 0) {
+        ::epoll_ctl(epoll_, EPOLL_CTL_DEL, w.fd, nullptr);
+    }
+    waits_.erase(it);
+    w.result = result;
+    ready_.push_back(w.waiter);
+}
+
+void EpollExecutor::spawn(Task<void> task, std::function<void(std::exception_ptr)> done)
+{
+    ++tasks_;
+    runSpawned(std::move(task), tasks_, std::move(done));
+}
+
+void EpollExecutor::run()
+{
+    using Clock = std::chrono::steady_clock;
+
+    for (;;) {
+        while (!ready_.empty()) {
+            std::coroutine_handle<> h = ready_.front();
+            ready_.pop_front();
+            h.resume();
+        }
+        if (tasks_ == 0) {
+            return;
+        }
+
+        int timeout = -1;
+        if (!timers_.empty()) {
+            const auto left = std::chrono::ceil<std::chrono::milliseconds>(
+                timers_.begin()->first - Clock::now());
+            timeout = static_cast<int>(std::max<long long>(0, left.count()));
+        }
+        epoll_event events[16];
+        const int n = ::epoll_wait(epoll_, events, 16, timeout);
+        if (n < 0 && errno != EINTR) {
+            throwErrno("epoll_wait");
+        }
+        for (int i = 0; i < n; ++i) {
+            if (events[i].data.u64 != 0) {
+                complete(events[i].data.u64, WaitResult::Ready);
+                continue;
+            }
+            std::uint64_t count;
+            [[maybe_unused]] ssize_t r = ::read(wakeup_, &count, sizeof(count));
+            std::vector<std::uint64_t> ids;
+            {
+                std::lock_guard lock(cancelLock_);
+                ids.swap(cancels_);
+            }
+            for (std::uint64_t id : ids) {
+                complete(id, WaitResult::Cancelled);
+            }
+        }
+        const auto now = Clock::now();
+        while (!timers_.empty() && timers_.begin()->first <= now) {
+            complete(timers_.begin()->second, WaitResult::Timeout);
+        }
+    }
+}
+
+}  // namespace nuisp
@@ -0,0 +1,193 @@
+// SPDX-License-Identifier: Apache-2.0
+#include "nuisp/async_session.hpp"
+
+#include <algorithm>
+#include <cstdio>
+
+namespace nuisp {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+std::string hex32(std::uint32_t v)
+{
+    char buf[16];
+    std::snprintf(buf, sizeof(buf), "0x%08X", v);
+    return buf;
+}
+
+}  // namespace
+
+AsyncSession::AsyncSession(IoExecutor& executor, Link& link, Variant variant,
+                           SessionOptions options)
+    : executor_(executor), link_(link), core_(variant, options)
+{
+    if (link_.pollFd() < 0) {
+        throw Error("link has no descriptor to wait on");
+    }
+}
+
+Task<WaitResult> AsyncSession::wait(Deadline until, const Op& op)
+{
+    const WaitResult r = co_await IoAwait(executor_, link_.pollFd(), false, until, op.stop);
+    if (r == WaitResult::Cancelled) {
+        throw CancelledError("operation cancelled");
+    }
+    if (r == WaitResult::Timeout && Clock::now() >= op.deadline) {
+        throw TimeoutError("operation deadline passed");
+    }
+    co_return r;
+}
+
+Task<bool> AsyncSession::read(Frame& frame, std::chrono::milliseconds timeout, const Op& op)
+{
+    const Deadline until = std::min(Clock::now() + timeout, op.deadline);
+    std::size_t got = 0;
+    for (;;) {
+        // a zero timeout only takes what is buffered already
+        got += link_.read(std::span(frame).subspan(got), std::chrono::milliseconds(0));
+        if (got == frame.size()) {
+            co_return true;
+        }
+        if (co_await wait(until, op) == WaitResult::Timeout) {
+            co_return false;
+        }
+    }
+}
+
+Task<bool> AsyncSession::exchange(Frame& response, const Op& op)
+{
+    link_.write(core_.next());
+    const bool answered = co_await read(response, core_.timeout(), op);
+    if (!answered) {
+        // a late answer must not pass for the next one
+        link_.discardInput();
+    }
+    co_return answered;
+}
+
+Task<> AsyncSession::drive(const Op& op)
+{
+    while (core_.busy()) {
+        Frame response{};
+        const bool answered = co_await exchange(response, op);
+        core_.onResponse(answered ? &response : nullptr);
+    }
+}
+
+Task<Frame> AsyncSession::transact(std::uint32_t command, std::span<const std::uint8_t> payload,
+                                   std::chrono::milliseconds timeout, std::stop_token stop,
+                                   Deadline deadline)
+{
+    const Op op{stop, deadline};
+    core_.command(command, payload, timeout);
+    co_await drive(op);
+    co_return core_.response();
+}
+
+Task<> AsyncSession::connect(std::chrono::milliseconds window, std::stop_token stop)
+{
+    const SessionOptions& options = core_.options();
+    const Op op{stop, Clock::now() + window};
+
+    for (;;) {
+        Frame response{};
+        bool answered = false;
+        try {
+            link_.write(ProtocolCore::connectFrame());
+            answered = co_await read(response, options.connectRetry, op);
+        } catch (const TimeoutError&) {
+            throw TimeoutError("bootloader did not answer CMD_CONNECT");
+        }
+
+        if (answered && core_.connected(response)) {
+            // an earlier attempt may still be answered, do not mistake it for the next response
+            if (co_await sleepFor(executor_, options.connectRetry, stop) ==
+                WaitResult::Cancelled) {
+                throw CancelledError("operation cancelled");
+            }
+            link_.discardInput();
+            if (core_.variant() == Variant::W20B) {
+                // see Session::connect()
+                const Op syncOp{stop, kNoDeadline};
+                core_.syncPackno();
+                co_await drive(syncOp);
+            }
+            co_return;
+        }
+        link_.discardInput();
+    }
+}
+
+Task<std::array<std::uint32_t, 4>> AsyncSession::readConfig(std::stop_token stop,
+                                                            Deadline deadline)
+{
+    const Frame r =
+        co_await transact(cmd::ReadConfig, {}, core_.options().responseTimeout, stop, deadline);
+    co_return std::array<std::uint32_t, 4>{getLe32(r.data() + 8), getLe32(r.data() + 12),
+                                           getLe32(r.data() + 16), getLe32(r.data() + 20)};
+}
+
+Task<> AsyncSession::eraseAll(std::stop_token stop, Deadline deadline)
+{
+    co_await transact(cmd::EraseAll, {}, core_.options().eraseTimeout, stop, deadline);
+}
+
+Task<> AsyncSession::program(const PacketCache& cache, Progress progress, std::stop_token stop,
+                             Deadline deadline)
+{
+    if (cache.variant() != core_.variant()) {
+        throw Error("packet cache was built for the other bootloader");
+    }
+    const SessionOptions& options = core_.options();
+    const Op op{stop, deadline};
+
+    std::size_t done = 0;
+    for (std::size_t i = 0; i < cache.frameCount(); ++i) {
+        const FrameExpect expect = cache.expect(i);
+        core_.data(cache.frame(i), expect.checksum,
+                   i == 0 ? options.eraseTimeout : options.responseTimeout);
+        co_await drive(op);
+        done += cache.frameBytes(i);
+        if (core_.variant() == Variant::W20B &&
+            getLe16(core_.response().data() + 8) != expect.programmedSum) {
+            throw Error("programmed byte sum mismatch at offset " + std::to_string(done));
+        }
+        core_.stats().payloadBytes += cache.frameBytes(i);
+        if (progress) {
+            progress(done, cache.imageSize());
+        }
+    }
+}
+
+Task<> AsyncSession::verify(std::uint32_t address, const PacketCache& cache, Progress progress,
+                            std::stop_token stop, Deadline deadline)
+{
+    const Op op{stop, deadline};
+    const std::size_t size = cache.imageSize();
+
+    core_.readFlash(
+        address, size,
+        [&](std::size_t done, std::span<const std::uint8_t> chunk, const Frame& r) {
+            const std::size_t i = done / kReadFlashChunk;
+            if (i >= cache.readChunks() || getLe16(r.data() + kReadFlashCrc) != cache.readCrc(i) ||
+                chunk.size() != std::min<std::size_t>(kReadFlashChunk, size - done)) {
+                throw Error("verify failed in chunk at " +
+                            hex32(address + static_cast<std::uint32_t>(done)));
+            }
+            core_.stats().payloadBytes += chunk.size();
+            if (progress) {
+                progress(done + chunk.size(), size);
+            }
+        });
+    co_await drive(op);
+}
+
+Task<> AsyncSession::run(std::stop_token)
+{
+    link_.write(core_.runAprom());
+    co_return;
+}
+
+}  // namespace nuisp
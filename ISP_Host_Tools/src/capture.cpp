@@ -0,0 +1,116 @@
+// SPDX-License-Identifier: Apache-2.0
+#include "nuisp/capture.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+namespace nuisp {
+
+namespace {
+
+constexpr const char* kHeader = "# nuisp capture 1";
+
+}  // namespace
+
+CaptureWriter::CaptureWriter(const std::string& path, std::uint32_t baud)
+    : start_(std::chrono::steady_clock::now())
+{
+    file_ = std::fopen(path.c_str(), "w");
+    if (!file_) {
+        throw Error("cannot create " + path + ": " + std::strerror(errno));
+    }
+    std::fprintf(file_, "%s\n", kHeader);
+    this->baud(baud);
+}
+
+CaptureWriter::~CaptureWriter()
+{
+    std::fclose(file_);
+}
+
+std::uint64_t CaptureWriter::now() const
+{
+    return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+                                          std::chrono::steady_clock::now() - start_)
+                                          .count());
+}
+
+void CaptureWriter::data(bool toDevice, std::span<const std::uint8_t> bytes)
+{
+    if (bytes.empty()) {
+        return;
+    }
+    std::fprintf(file_, "%llu %c", static_cast<unsigned long long>(now()), toDevice ? '>' : '<');
+    for (std::uint8_t b : bytes) {
+        std::fprintf(file_, " %02x", b);
+    }
+    std::fputc('\n', file_);
+}
+
+void CaptureWriter::baud(std::uint32_t baud)
+{
+    std::fprintf(file_, "%llu = %u\n", static_cast<unsigned long long>(now()), baud);
+}
+
+void CaptureLink::write(std::span<const std::uint8_t> data)
+{
+    writer_.data(true, data);
+    inner_.write(data);
+}
+
+std::size_t CaptureLink::read(std::span<std::uint8_t> data, std::chrono::milliseconds timeout)
+{
+    const std::size_t n = inner_.read(data, timeout);
+    writer_.data(false, data.first(n));
+    return n;
+}
+
+void CaptureLink::setBaudRate(std::uint32_t baud)
+{
+    inner_.setBaudRate(baud);
+    writer_.baud(baud);
+}
+
+std::vector<CaptureRecord> readCapture(const std::string& path)
+{
+    std::ifstream in(path);
+    if (!in) {
+        throw Error("cannot open " + path);
+    }
+
+    std::vector<CaptureRecord> records;
+    std::string line;
+    unsigned lineNo = 0;
+    while (std::getline(in, line)) {
+        ++lineNo;
+        if (lineNo == 1 && line != kHeader) {
+            throw Error(path + ": not a nuisp capture");
+        }
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+
+        std::istringstream fields(line);
+        CaptureRecord r;
+        fields >> r.us >> r.kind;
+        if (r.kind == '=') {
+            fields >> r.baud;
+        } else {
+            unsigned byte;
+            while (fields >> std::hex >> byte) {
+                r.bytes.push_back(static_cast<std::uint8_t>(byte));
+            }
+        }
+        const bool ok = r.kind == '=' ? r.baud != 0
+                                      : (r.kind == '>' || r.kind == '<') && fields.eof();
+        if (!ok) {
+            throw Error(path + ":" + std::to_string(lineNo) + ": malformed record");
+        }
+        records.push_back(std::move(r));
+    }
+    return records;
+}
+
+}  // namespace nuisp
@@ -0,0 +1,141 @@
+// SPDX-License-Identifier: Apache-2.0
+#include "nuisp/flash_map.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+namespace nuisp {
+
+namespace {
+
+// CONFIG0..3
+constexpr std::uint32_t kConfigBytes = 16;
+
+std::string hex32(std::uint32_t v)
+{
+    char buf[16];
+    std::snprintf(buf, sizeof(buf), "0x%08X", v);
+    return buf;
+}
+
+}  // namespace
+
+FlashMap::Page& FlashMap::page(std::uint32_t base)
+{
+    if (base == lastBase_) {
+        return *last_;
+    }
+    auto [it, inserted] = index_.try_emplace(base, nullptr);
+    if (inserted) {
+        Page& p = pages_.emplace_back();
+        p.bytes.fill(0xFF);
+        it->second = &p;
+    }
+    lastBase_ = base;
+    last_ = it->second;
+    return *last_;
+}
+
+void FlashMap::write(std::uint32_t address, std::span<const std::uint8_t> bytes)
+{
+    if (bytes.size() > 0x100000000ull - address) {
+        throw Error("image data runs past the 4 GB address space");
+    }
+    while (!bytes.empty()) {
+        const std::uint32_t base = address & ~(kPageSize - 1);
+        const std::uint32_t off = address - base;
+        const std::size_t n = std::min<std::size_t>(kPageSize - off, bytes.size());
+        Page& p = page(base);
+        std::memcpy(p.bytes.data() + off, bytes.data(), n);
+        p.lo = static_cast<std::uint16_t>(std::min<std::uint32_t>(p.lo, off));
+        p.hi = static_cast<std::uint16_t>(std::max<std::size_t>(p.hi, off + n));
+        address += static_cast<std::uint32_t>(n);
+        bytes = bytes.subspan(n);
+    }
+}
+
+std::vector<std::pair<std::uint32_t, std::uint32_t>> FlashMap::ranges() const
+{
+    std::vector<std::pair<std::uint32_t, std::uint32_t>> out;
+    for (const auto& [base, p] : index_) {
+        const std::uint32_t begin = base + p->lo;
+        const std::uint32_t end = base + p->hi;
+        if (!out.empty() && out.back().second == begin) {
+            out.back().second = end;
+        } else {
+            out.emplace_back(begin, end);
+        }
+    }
+    return out;
+}
+
+std::vector<std::uint8_t> FlashMap::read(std::uint32_t from, std::uint32_t to) const
+{
+    std::vector<std::uint8_t> out(to > from ? to - from : 0, 0xFF);
+    for (auto it = index_.lower_bound(from & ~(kPageSize - 1));
+         it != index_.end() && it->first < to; ++it) {
+        const std::uint32_t begin = std::max(it->first, from);
+        const std::uint32_t end = static_cast<std::uint32_t>(
+            std::min<std::uint64_t>(std::uint64_t{it->first} + kPageSize, to));
+        std::memcpy(out.data() + (begin - from), it->second->bytes.data() + (begin - it->first),
+                    end - begin);
+    }
+    return out;
+}
+
+FlashGeometry FlashGeometry::from(const DeviceInfo& info)
+{
+    FlashGeometry g;
+    g.apromSize = info.apromSize;
+    g.dataflashAddr = info.dataflashAddr;
+    g.dataflashSize = info.dataflashSize;
+    return g;
+}
+
+FlashImages splitFlashMap(const FlashMap& map, const FlashGeometry& g)
+{
+    const std::uint32_t apromEnd =
+        g.dataflashSize != 0 ? std::min(g.apromSize, g.dataflashAddr) : g.apromSize;
+    const std::uint32_t dataflashEnd = g.dataflashAddr + g.dataflashSize;
+    const std::uint32_t configEnd = g.configAddr + kConfigBytes;
+
+    std::uint32_t apromHi = 0;
+    std::uint32_t dataflashHi = g.dataflashAddr;
+    std::uint32_t configHi = g.configAddr;
+
+    for (auto [begin, end] : map.ranges()) {
+        // one coalesced range may run from APROM on into data flash
+        while (begin < end) {
+            std::uint32_t* hi;
+            std::uint32_t limit;
+            if (begin < apromEnd) {
+                hi = &apromHi;
+                limit = apromEnd;
+            } else if (begin >= g.dataflashAddr && begin < dataflashEnd) {
+                hi = &dataflashHi;
+                limit = dataflashEnd;
+            } else if (begin >= g.configAddr && begin < configEnd) {
+                hi = &configHi;
+                limit = configEnd;
+            } else {
+                throw Error("image data at " + hex32(begin) +
+                            " is outside APROM, data flash and CONFIG");
+            }
+            const std::uint32_t stop = std::min(end, limit);
+            *hi = std::max(*hi, stop);
+            begin = stop;
+        }
+    }
+
+    FlashImages out;
+    out.aprom = map.read(0, apromHi);
+    out.dataflash = map.read(g.dataflashAddr, dataflashHi);
+    const std::vector<std::uint8_t> config = map.read(g.configAddr, (configHi + 3) & ~3u);
+    for (std::size_t i = 0; i < config.size(); i += 4) {
+        out.config.push_back(getLe32(config.data() + i));
+    }
+    return out;
+}
+
+}  // namespace nuisp
@@ -0,0 +1,321 @@
+// SPDX-License-Identifier: Apache-2.0
+#include "nuisp/gang.hpp"
+
+#include "nuisp/protocol_core.hpp"
+#include "nuisp/serial_port.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+namespace nuisp {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+enum class Phase
+{
+    Connect,  // CMD_CONNECT every connectRetry until answered
+    Settle,   // let late CONNECT answers drain
+    Sync,     // W20B: SYNC_PACKNO stops its run-APROM timer
+    Program,
+    Verify,
+    Done,
+};
+
+}  // namespace
+
+struct GangProgrammer::Port
+{
+    Port(Variant variant, const SessionOptions& options) : core(variant, options) {}
+
+    std::unique_ptr<SerialPort> serial;
+    PortResult result;
+    Phase phase = Phase::Connect;
+    ProtocolCore core;
+
+    Frame rx{};
+    std::size_t rxLen = 0;
+
+    Clock::time_point deadline;
+    Clock::time_point connectEnd;
+    Clock::time_point begin;
+
+    std::size_t frame = 0;  // current cache frame
+    std::size_t done = 0;   // image bytes programmed
+};
+
+GangProgrammer::GangProgrammer(const std::vector<std::string>& ports, PacketCache cache,
+                               GangOptions options)
+    : cache_(std::move(cache)), options_(options)
+{
+    if (cache_.command() != cmd::UpdateAprom) {
+        throw Error("gang programming needs an APROM packet cache");
+    }
+    for (const std::string& path : ports) {
+        auto port = std::make_unique<Port>(cache_.variant(), options_.session);
+        port->result.path = path;
+        try {
+            port->serial = std::make_unique<SerialPort>(path, options_.baud);
+        } catch (const Error& e) {
+            port->result.error = e.what();
+            port->phase = Phase::Done;
+        }
+        ports_.push_back(std::move(port));
+    }
+}
+
+GangProgrammer::~GangProgrammer()
+{
+    if (epfd_ >= 0) {
+        ::close(epfd_);
+    }
+}
+
+void GangProgrammer::send(Port& port, const Frame& frame, std::chrono::milliseconds timeout)
+{
+    port.rxLen = 0;
+    port.serial->write(frame);
+    port.deadline = Clock::now() + timeout;
+}
+
+void GangProgrammer::start(Port& port)
+{
+    port.phase = Phase::Connect;
+    port.connectEnd = Clock::now() + options_.connectWindow;
+    send(port, ProtocolCore::connectFrame(), options_.session.connectRetry);
+}
+
+void GangProgrammer::startProgram(Port& port)
+{
+    port.phase = Phase::Program;
+    port.frame = 0;
+    port.done = 0;
+    sendNextData(port);
+}
+
+void GangProgrammer::sendNextData(Port& port)
+{
+    port.core.data(cache_.frame(port.frame), cache_.expect(port.frame).checksum,
+                   port.frame == 0 ? options_.session.eraseTimeout
+                                   : options_.session.responseTimeout);
+    step(port);
+}
+
+void GangProgrammer::sendReadFlash(Port& port)
+{
+    port.phase = Phase::Verify;
+    // verification is a lookup: the chunk CRC was checked against the data
+    // already, compare it with the one the cache holds for this offset
+    port.core.readFlash(
+        0, cache_.imageSize(),
+        [this, &port](std::size_t offset, std::span<const std::uint8_t> chunk, const Frame& r) {
+            const std::size_t i = offset / kReadFlashChunk;
+            if (offset % kReadFlashChunk != 0 || i >= cache_.readChunks() ||
+                getLe16(r.data() + kReadFlashCrc) != cache_.readCrc(i) ||
+                chunk.size() != std::min<std::size_t>(kReadFlashChunk, cache_.imageSize() - offset)) {
+                throw Error("verify failed near offset " + std::to_string(offset));
+            }
+            port.core.stats().payloadBytes += chunk.size();
+        });
+    step(port);
+}
+
+void GangProgrammer::step(Port& port)
+{
+    if (port.core.busy()) {
+        send(port, port.core.next(), port.core.timeout());
+        return;
+    }
+    switch (port.phase) {
+    case Phase::Sync:
+        startProgram(port);
+        return;
+    case Phase::Program: {
+        const Frame& r = port.core.response();
+        port.done += cache_.frameBytes(port.frame);
+        port.core.stats().payloadBytes += cache_.frameBytes(port.frame);
+        if (cache_.variant() == Variant::W20B &&
+            getLe16(r.data() + 8) != cache_.expect(port.frame).programmedSum) {
+            finish(port, "programmed byte sum mismatch at offset " + std::to_string(port.done));
+            return;
+        }
+        if (++port.frame < cache_.frameCount()) {
+            sendNextData(port);
+        } else {
+            afterData(port);
+        }
+        return;
+    }
+    default:
+        afterData(port);
+        return;
+    }
+}
+
+void GangProgrammer::afterData(Port& port)
+{
+    if (port.phase == Phase::Program && options_.verify && cache_.variant() == Variant::Delta) {
+        sendReadFlash(port);
+        return;
+    }
+    if (options_.run) {
+        port.serial->write(port.core.runAprom());
+    }
+    finish(port, {});
+}
+
+void GangProgrammer::finish(Port& port, std::string error)
+{
+    if (port.phase == Phase::Done) {
+        return;
+    }
+    if (port.phase != Phase::Connect) {
+        port.result.elapsed = Clock::now() - port.begin;
+    }
+    port.phase = Phase::Done;
+    port.result.ok = error.empty();
+    port.result.error = std::move(error);
+    port.result.stats = port.core.stats();
+    ::epoll_ctl(epfd_, EPOLL_CTL_DEL, port.serial->fd(), nullptr);
+    --active_;
+    if (onFinished_) {
+        onFinished_(port.result);
+    }
+}
+
+void GangProgrammer::onReadable(Port& port)
+{
+    port.rxLen += port.serial->read(std::span(port.rx).subspan(port.rxLen),
+                                    std::chrono::milliseconds(0));
+    if (port.rxLen == kFrameSize) {
+        port.rxLen = 0;
+        onFrame(port);
+    }
+}
+
+void GangProgrammer::onFrame(Port& port)
+{
+    switch (port.phase) {
+    case Phase::Connect:
+        // any CONNECT answers as packet 1, so an earlier one will do
+        if (port.core.connected(port.rx)) {
+            port.begin = Clock::now();
+            port.phase = Phase::Settle;
+            port.deadline = port.begin + options_.session.connectRetry;
+        }
+        return;
+    case Phase::Settle:
+        return;  // answer to an earlier CONNECT
+    default:
+        // a corrupted answer goes through CMD_RESEND_PACKET like a bad checksum
+        port.core.onResponse(&port.rx);
+        step(port);
+        return;
+    }
+}
+
+void GangProgrammer::onTimeout(Port& port)
+{
+    port.serial->discardInput();
+    switch (port.phase) {
+    case Phase::Connect:
+        if (Clock::now() >= port.connectEnd) {
+            finish(port, "bootloader did not answer CMD_CONNECT");
+            return;
+        }
+        send(port, ProtocolCore::connectFrame(), options_.session.connectRetry);
+        return;
+    case Phase::Settle:
+        if (cache_.variant() == Variant::W20B) {
+            port.phase = Phase::Sync;
+            port.core.syncPackno();
+            step(port);
+            return;
+        }
+        startProgram(port);
+        return;
+    default:
+        port.core.onResponse(nullptr);
+        step(port);
+        return;
+    }
+}
+
+std::vector<PortResult> GangProgrammer::run(const std::function<void(const PortResult&)>& onFinished)
+{
+    onFinished_ = onFinished;
+    epfd_ = ::epoll_create1(EPOLL_CLOEXEC);
+    if (epfd_ < 0) {
+        throw Error(std::string("epoll_create1: ") + std::strerror(errno));
+    }
+
+    // run one port's handler; an I/O error ends that port, not the station
+    auto guarded = [this](Port& port, auto&& handler) {
+        try {
+            handler();
+        } catch (const std::exception& e) {
+            finish(port, e.what());
+        }
+    };
+
+    for (std::uint32_t i = 0; i < ports_.size(); ++i) {
+        Port& port = *ports_[i];
+        if (port.phase == Phase::Done) {
+            if (onFinished_) {
+                onFinished_(port.result);
+            }
+            continue;
+        }
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.u32 = i;
+        if (::epoll_ctl(epfd_, EPOLL_CTL_ADD, port.serial->fd(), &ev) != 0) {
+            throw Error("epoll_ctl " + port.result.path + ": " + std::strerror(errno));
+        }
+        ++active_;
+        guarded(port, [&] { start(port); });
+    }
+
+    std::vector<epoll_event> events(std::max<std::size_t>(ports_.size(), 1));
+    while (active_ > 0) {
+        auto next = Clock::time_point::max();
+        for (const auto& port : ports_) {
+            if (port->phase != Phase::Done) {
+                next = std::min(next, port->deadline);
+            }
+        }
+        const auto wait = std::chrono::ceil<std::chrono::milliseconds>(next - Clock::now());
+        const int n = ::epoll_wait(epfd_, events.data(), static_cast<int>(events.size()),
+                                   static_cast<int>(std::max<std::int64_t>(wait.count(), 0)));
+        if (n < 0 && errno != EINTR) {
+            throw Error(std::string("epoll_wait: ") + std::strerror(errno));
+        }
+
+        for (int i = 0; i < n; ++i) {
+            Port& port = *ports_[events[i].data.u32];
+            if (port.phase != Phase::Done) {
+                guarded(port, [&] { onReadable(port); });
+            }
+        }
+
+        const auto now = Clock::now();
+        for (const auto& port : ports_) {
+            if (port->phase != Phase::Done && port->deadline <= now) {
+                guarded(*port, [&] { onTimeout(*port); });
+            }
+        }
+    }
+
+    std::vector<PortResult> results;
+    results.reserve(ports_.size());
+    for (const auto& port : ports_) {
+        results.push_back(port->result);
+    }
+    return results;
+}
+
+}  // namespace nuisp
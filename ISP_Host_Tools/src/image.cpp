@@ -0,0 +1,285 @@
+// SPDX-License-Identifier: Apache-2.0
+#include "nuisp/image.hpp"
+
+#include "nuisp/link.hpp"
+#include "nuisp/mapped_file.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <elf.h>
+#include <fstream>
+#include <iterator>
+
+namespace nuisp {
+
+namespace {
+
+bool endsWith(const std::string& s, const std::string& suffix)
+{
+    return s.size() >= suffix.size() &&
+           std::equal(suffix.rbegin(), suffix.rend(), s.rbegin(),
+                      [](char a, char b) { return a == std::tolower(static_cast<unsigned char>(b)); });
+}
+
+int hexNibble(std::uint8_t c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    return -1;
+}
+
+// One text line of the mapped file at a time, without copying it.
+class LineReader
+{
+public:
+    LineReader(std::span<const std::uint8_t> text, const std::string& path)
+        : p_(text.data()), end_(text.data() + text.size()), path_(path)
+    {
+    }
+
+    // Next line with trailing CR and blanks stripped; false at the end.
+    bool next(std::span<const std::uint8_t>& line)
+    {
+        if (p_ == end_) {
+            return false;
+        }
+        const std::uint8_t* eol = std::find(p_, end_, '\n');
+        const std::uint8_t* last = eol;
+        while (last != p_ && (last[-1] == '\r' || last[-1] == ' ' || last[-1] == '\t')) {
+            --last;
+        }
+        line = {p_, last};
+        p_ = eol == end_ ? end_ : eol + 1;
+        ++lineNo_;
+        return true;
+    }
+
+    [[noreturn]] void fail(const char* what) const
+    {
+        throw Error(path_ + ":" + std::to_string(lineNo_) + ": " + what);
+    }
+
+    // Hex pairs into out; false on a bad digit.
+    static bool decode(std::span<const std::uint8_t> hex, std::uint8_t* out)
+    {
+        for (std::size_t i = 0; i < hex.size() / 2; ++i) {
+            const int hi = hexNibble(hex[2 * i]);
+            const int lo = hexNibble(hex[2 * i + 1]);
+            if (hi < 0 || lo < 0) {
+                return false;
+            }
+            out[i] = static_cast<std::uint8_t>(hi << 4 | lo);
+        }
+        return true;
+    }
+
+private:
+    const std::uint8_t* p_;
+    const std::uint8_t* end_;
+    const std::string& path_;
+    unsigned lineNo_ = 0;
+};
+
+void parseIntelHex(std::span<const std::uint8_t> text, const std::string& path, FlashMap& map)
+{
+    LineReader lines(text, path);
+    std::span<const std::uint8_t> line;
+    std::uint8_t rec[255 + 5];
+    std::uint32_t upper = 0;
+
+    while (lines.next(line)) {
+        if (line.empty()) {
+            continue;
+        }
+        const std::size_t n = (line.size() - 1) / 2;
+        if (line[0] != ':' || line.size() < 11 || (line.size() - 1) % 2 != 0 || n > sizeof(rec)) {
+            lines.fail("malformed record");
+        }
+        if (!LineReader::decode(line.subspan(1), rec)) {
+            lines.fail("bad hex digit");
+        }
+        std::uint8_t sum = 0;
+        for (std::size_t i = 0; i < n; ++i) {
+            sum = static_cast<std::uint8_t>(sum + rec[i]);
+        }
+        if (sum != 0 || n != rec[0] + 5u) {
+            lines.fail("checksum or length mismatch");
+        }
+
+        const std::uint32_t offset = static_cast<std::uint32_t>(rec[1] << 8 | rec[2]);
+        const std::uint8_t* data = rec + 4;
+        switch (rec[3]) {
+        case 0x00:
+            map.write(upper + offset, {data, rec[0]});
+            break;
+        case 0x01:
+            return;
+        case 0x02:  // extended segment address
+            upper = static_cast<std::uint32_t>(data[0] << 8 | data[1]) << 4;
+            break;
+        case 0x04:  // extended linear address
+            upper = static_cast<std::uint32_t>(data[0] << 8 | data[1]) << 16;
+            break;
+        default:  // start address records
+            break;
+        }
+    }
+}
+
+void parseSrec(std::span<const std::uint8_t> text, const std::string& path, FlashMap& map)
+{
+    LineReader lines(text, path);
+    std::span<const std::uint8_t> line;
+    std::uint8_t rec[255 + 1];
+
+    while (lines.next(line)) {
+        if (line.empty()) {
+            continue;
+        }
+        if (line[0] != 'S' || line.size() < 4 || line.size() % 2 != 0 || line[1] < '0' ||
+            line[1] > '9') {
+            lines.fail("malformed record");
+        }
+        // count, address, data, checksum
+        const std::size_t n = (line.size() - 2) / 2;
+        if (n > sizeof(rec) || !LineReader::decode(line.subspan(2), rec)) {
+            lines.fail("bad hex digit or record too long");
+        }
+        std::uint8_t sum = 0;
+        for (std::size_t i = 0; i < n; ++i) {
+            sum = static_cast<std::uint8_t>(sum + rec[i]);
+        }
+        if (sum != 0xFF || n != rec[0] + 1u) {
+            lines.fail("checksum or length mismatch");
+        }
+
+        const unsigned type = line[1] - '0';
+        if (type >= 7) {  // S7/S8/S9 start address, last record
+            return;
+        }
+        if (type < 1 || type > 3) {  // S0 header, S5/S6 record count
+            continue;
+        }
+        const std::size_t addrLen = type + 1;
+        if (rec[0] < addrLen + 1) {
+            lines.fail("record shorter than its address");
+        }
+        std::uint32_t address = 0;
+        for (std::size_t i = 0; i < addrLen; ++i) {
+            address = address << 8 | rec[1 + i];
+        }
+        map.write(address, {rec + 1 + addrLen, rec[0] - addrLen - 1});
+    }
+}
+
+template<typename T>
+T readStruct(std::span<const std::uint8_t> file, std::uint64_t offset, const std::string& path)
+{
+    if (offset > file.size() || file.size() - offset < sizeof(T)) {
+        throw Error(path + ": truncated ELF");
+    }
+    T v;
+    std::memcpy(&v, file.data() + offset, sizeof(T));
+    return v;
+}
+
+void parseElf(std::span<const std::uint8_t> file, const std::string& path, FlashMap& map)
+{
+    const auto eh = readStruct<Elf32_Ehdr>(file, 0, path);
+    if (std::memcmp(eh.e_ident, ELFMAG, SELFMAG) != 0) {
+        throw Error(path + ": not an ELF file");
+    }
+    if (eh.e_ident[EI_CLASS] != ELFCLASS32 || eh.e_ident[EI_DATA] != ELFDATA2LSB) {
+        throw Error(path + ": only 32-bit little-endian ELF is supported");
+    }
+    if (eh.e_phnum == 0 || eh.e_phentsize < sizeof(Elf32_Phdr)) {
+        throw Error(path + ": ELF has no program headers");
+    }
+
+    for (unsigned i = 0; i < eh.e_phnum; ++i) {
+        const auto ph = readStruct<Elf32_Phdr>(
+            file, std::uint64_t{eh.e_phoff} + std::uint64_t{i} * eh.e_phentsize, path);
+        if (ph.p_type != PT_LOAD || ph.p_filesz == 0) {
+            continue;
+        }
+        if (ph.p_offset > file.size() || file.size() - ph.p_offset < ph.p_filesz) {
+            throw Error(path + ": truncated ELF segment");
+        }
+        // the load address, where initialised data sits in flash
+        map.write(ph.p_paddr, file.subspan(ph.p_offset, ph.p_filesz));
+    }
+}
+
+}  // namespace
+
+ImageFormat imageFormat(const std::string& path)
+{
+    if (endsWith(path, ".hex") || endsWith(path, ".ihx")) {
+        return ImageFormat::IntelHex;
+    }
+    for (const char* ext : {".srec", ".s19", ".s28", ".s37", ".mot"}) {
+        if (endsWith(path, ext)) {
+            return ImageFormat::Srec;
+        }
+    }
+    if (endsWith(path, ".elf") || endsWith(path, ".axf")) {
+        return ImageFormat::Elf;
+    }
+    char magic[SELFMAG] = {};
+    std::ifstream in(path, std::ios::binary);
+    if (in.read(magic, SELFMAG) && std::memcmp(magic, ELFMAG, SELFMAG) == 0) {
+        return ImageFormat::Elf;
+    }
+    return ImageFormat::Binary;
+}
+
+std::vector<std::uint8_t> loadBinaryFile(const std::string& path)
+{
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        throw Error("cannot open " + path);
+    }
+    return std::vector<std::uint8_t>(std::istreambuf_iterator<char>(in),
+                                     std::istreambuf_iterator<char>());
+}
+
+FlashMap loadFlashMap(const std::string& path)
+{
+    const ImageFormat format = imageFormat(path);
+    const MappedFile file(path);
+    FlashMap map;
+    switch (format) {
+    case ImageFormat::IntelHex: parseIntelHex(file.bytes(), path, map); break;
+    case ImageFormat::Srec: parseSrec(file.bytes(), path, map); break;
+    case ImageFormat::Elf: parseElf(file.bytes(), path, map); break;
+    case ImageFormat::Binary: throw Error(path + ": a raw binary has no addresses");
+    }
+    if (map.empty()) {
+        throw Error(path + ": no data records");
+    }
+    return map;
+}
+
+std::vector<std::uint8_t> loadImageFile(const std::string& path)
+{
+    if (imageFormat(path) == ImageFormat::Binary) {
+        return loadBinaryFile(path);
+    }
+    const FlashMap map = loadFlashMap(path);
+    const auto ranges = map.ranges();
+    const std::uint32_t base = ranges.front().first & ~(FlashMap::kPageSize - 1);
+    return map.read(base, ranges.back().second);
+}
+
+std::size_t trimmedSize(std::span<const std::uint8_t> image)
+{
+    std::size_t n = image.size();
+    while (n > 0 && image[n - 1] == 0xFF) {
+        --n;
+    }
+    return std::min((n + 3) & ~std::size_t{3}, image.size());
+}
+
+}  // namespace nuisp
@@ -0,0 +1,55 @@
+// SPDX-License-Identifier: Apache-2.0
+#include "nuisp/impaired_link.hpp"
+
+#include <thread>
+
+namespace nuisp {
+
+ImpairedLink::ImpairedLink(Link& inner, Impairment impairment)
+    : inner_(inner), impairment_(impairment), rng_(impairment.seed)
+{
+}
+
+std::uint64_t ImpairedLink::corrupt(std::span<std::uint8_t> data)
+{
+    if (impairment_.byteErrorRate <= 0.0) {
+        return 0;
+    }
+    std::bernoulli_distribution hit(impairment_.byteErrorRate);
+    std::uniform_int_distribution<int> bit(0, 7);
+    std::uint64_t n = 0;
+    for (std::uint8_t& b : data) {
+        if (hit(rng_)) {
+            b ^= static_cast<std::uint8_t>(1u << bit(rng_));
+            ++n;
+        }
+    }
+    return n;
+}
+
+void ImpairedLink::write(std::span<const std::uint8_t> data)
+{
+    if (impairment_.latency.count() > 0) {
+        std::this_thread::sleep_for(impairment_.latency);
+    }
+    scratch_.assign(data.begin(), data.end());
+    stats_.corruptedOut += corrupt(scratch_);
+    stats_.bytesOut += scratch_.size();
+    inner_.write(scratch_);
+}
+
+std::size_t ImpairedLink::read(std::span<std::uint8_t> data, std::chrono::milliseconds timeout)
+{
+    const std::size_t n = inner_.read(data, timeout);
+    if (n == 0) {
+        return 0;
+    }
+    if (impairment_.latency.count() > 0) {
+        std::this_thread::sleep_for(impairment_.latency);
+    }
+    stats_.corruptedIn += corrupt(data.first(n));
+    stats_.bytesIn += n;
+    return n;
+}
+
+}  // namespace nuisp
@@ -0,0 +1,40 @@
+// SPDX-License-Identifier: Apache-2.0
+#include "nuisp/mapped_file.hpp"
+
+#include "nuisp/link.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace nuisp {
+
+MappedFile::MappedFile(const std::string& path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw Error("open " + path + ": " + std::strerror(errno));
+    }
+    struct stat st{};
+    if (::fstat(fd, &st) != 0 || st.st_size == 0) {
+        ::close(fd);
+        throw Error("empty or unreadable image " + path);
+    }
+    size_ = static_cast<std::size_t>(st.st_size);
+    void* p = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) {
+        throw Error("mmap " + path + ": " + std::strerror(errno));
+    }
+    data_ = static_cast<const std::uint8_t*>(p);
+}
+
+MappedFile::~MappedFile()
+{
+    ::munmap(const_cast<std::uint8_t*>(data_), size_);
+}
+
+}  // namespace nuisp
@@ -0,0 +1,173 @@
+// SPDX-License-Identifier: Apache-2.0
+#include "nuisp/packet_cache.hpp"
+
+#include "nuisp/image.hpp"
+#include "nuisp/link.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace nuisp {
+
+namespace {
+
+constexpr char kMagic[4] = {'N', 'U', 'P', 'C'};
+constexpr std::size_t kHeaderSize = 64;
+
+enum HeaderField : std::size_t
+{
+    kVersion = 4,
+    kVariant = 8,
+    kCommand = 12,
+    kImageSize = 16,
+    kImageCrc32 = 20,
+    kFrameCount = 24,
+    kPageCount = 28,
+    kReadChunks = 32,
+    kFramesOffset = 36,
+    kExpectOffset = 40,
+    kPageCrcOffset = 44,
+    kReadCrcOffset = 48,
+};
+
+std::size_t countFrames(std::size_t size)
+{
+    return size <= kFirstDataSize ? 1 : 1 + (size - kFirstDataSize + kNextDataSize - 1) / kNextDataSize;
+}
+
+}  // namespace
+
+std::vector<std::uint8_t> buildPacketCache(Variant variant, std::uint32_t command,
+                                           std::span<const std::uint8_t> image)
+{
+    image = image.first(trimmedSize(image));
+    if (image.empty()) {
+        throw Error("image is blank");
+    }
+    if (variant == Variant::W20B && (command != cmd::UpdateAprom || image.size() > 0xFFFF)) {
+        throw Error("W20B bootloader only programs APROM images below 64 KB");
+    }
+
+    const std::size_t frames = countFrames(image.size());
+    const std::size_t pages = (image.size() + kFlashPageSize - 1) / kFlashPageSize;
+    const std::size_t chunks = (image.size() + kReadFlashChunk - 1) / kReadFlashChunk;
+
+    const std::size_t framesOffset = kHeaderSize;
+    const std::size_t expectOffset = framesOffset + frames * kFrameSize;
+    const std::size_t pageCrcOffset = expectOffset + frames * 4;
+    const std::size_t readCrcOffset = pageCrcOffset + pages * 4;
+    std::vector<std::uint8_t> out(readCrcOffset + chunks * 2);
+
+    std::uint8_t* h = out.data();
+    std::memcpy(h, kMagic, sizeof(kMagic));
+    putLe32(h + kVersion, kPacketCacheVersion);
+    putLe32(h + kVariant, static_cast<std::uint32_t>(variant));
+    putLe32(h + kCommand, command);
+    putLe32(h + kImageSize, static_cast<std::uint32_t>(image.size()));
+    putLe32(h + kImageCrc32, crc32(image));
+    putLe32(h + kFrameCount, static_cast<std::uint32_t>(frames));
+    putLe32(h + kPageCount, static_cast<std::uint32_t>(pages));
+    putLe32(h + kReadChunks, static_cast<std::uint32_t>(chunks));
+    putLe32(h + kFramesOffset, static_cast<std::uint32_t>(framesOffset));
+    putLe32(h + kExpectOffset, static_cast<std::uint32_t>(expectOffset));
+    putLe32(h + kPageCrcOffset, static_cast<std::uint32_t>(pageCrcOffset));
+    putLe32(h + kReadCrcOffset, static_cast<std::uint32_t>(readCrcOffset));
+
+    std::size_t done = 0;
+    std::uint32_t sum = 0;
+    for (std::size_t i = 0; i < frames; ++i) {
+        Frame frame;
+        const std::size_t n = makeDataFrame(frame, command, image, done);
+        for (std::size_t k = 0; k < n; ++k) {
+            sum += image[done + k];
+        }
+        done += n;
+        std::copy(frame.begin(), frame.end(), out.begin() + framesOffset + i * kFrameSize);
+        putLe16(out.data() + expectOffset + 4 * i, frameChecksum(frame));
+        putLe16(out.data() + expectOffset + 4 * i + 2, static_cast<std::uint16_t>(sum));
+    }
+
+    std::vector<std::uint8_t> page(kFlashPageSize);
+    for (std::size_t i = 0; i < pages; ++i) {
+        const std::size_t off = i * kFlashPageSize;
+        const std::size_t n = std::min<std::size_t>(kFlashPageSize, image.size() - off);
+        std::fill(std::copy_n(image.begin() + off, n, page.begin()), page.end(), 0xFF);
+        putLe32(out.data() + pageCrcOffset + 4 * i, crc32(page));
+    }
+
+    for (std::size_t i = 0; i < chunks; ++i) {
+        const std::size_t off = i * kReadFlashChunk;
+        putLe16(out.data() + readCrcOffset + 2 * i,
+                crc16Ccitt(image.subspan(off, std::min(kReadFlashChunk, image.size() - off))));
+    }
+    return out;
+}
+
+PacketCache PacketCache::open(const std::string& path)
+{
+    PacketCache cache;
+    cache.file_ = std::make_shared<MappedFile>(path);
+    cache.bytes_ = cache.file_->bytes();
+    cache.parse();
+    return cache;
+}
+
+PacketCache PacketCache::build(Variant variant, std::uint32_t command,
+                               std::span<const std::uint8_t> image)
+{
+    PacketCache cache;
+    cache.buffer_ =
+        std::make_shared<std::vector<std::uint8_t>>(buildPacketCache(variant, command, image));
+    cache.bytes_ = *cache.buffer_;
+    cache.parse();
+    return cache;
+}
+
+void PacketCache::parse()
+{
+    const std::uint8_t* h = bytes_.data();
+    if (bytes_.size() < kHeaderSize || std::memcmp(h, kMagic, sizeof(kMagic)) != 0) {
+        throw Error("not a packet cache");
+    }
+    if (getLe32(h + kVersion) != kPacketCacheVersion) {
+        throw Error("packet cache version " + std::to_string(getLe32(h + kVersion)) +
+                    " not supported");
+    }
+
+    variant_ = static_cast<Variant>(getLe32(h + kVariant));
+    command_ = getLe32(h + kCommand);
+    imageSize_ = getLe32(h + kImageSize);
+    imageCrc32_ = getLe32(h + kImageCrc32);
+    frameCount_ = getLe32(h + kFrameCount);
+    pageCount_ = getLe32(h + kPageCount);
+    readChunks_ = getLe32(h + kReadChunks);
+
+    // every table must lie inside the file and agree with the image size
+    auto table = [&](std::size_t field, std::size_t count, std::size_t entry) {
+        const std::size_t off = getLe32(h + field);
+        if (off < kHeaderSize || off > bytes_.size() || count * entry > bytes_.size() - off) {
+            throw Error("truncated packet cache");
+        }
+        return h + off;
+    };
+    if (imageSize_ == 0 || frameCount_ != countFrames(imageSize_) ||
+        pageCount_ != (imageSize_ + kFlashPageSize - 1) / kFlashPageSize ||
+        readChunks_ != (imageSize_ + kReadFlashChunk - 1) / kReadFlashChunk) {
+        throw Error("inconsistent packet cache header");
+    }
+    frames_ = table(kFramesOffset, frameCount_, kFrameSize);
+    expect_ = table(kExpectOffset, frameCount_, 4);
+    pageCrc_ = table(kPageCrcOffset, pageCount_, 4);
+    readCrc_ = table(kReadCrcOffset, readChunks_, 2);
+}
+
+std::size_t PacketCache::frameBytes(std::size_t i) const
+{
+    if (i == 0) {
+        return std::min<std::size_t>(kFirstDataSize, imageSize_);
+    }
+    const std::size_t off = kFirstDataSize + (i - 1) * kNextDataSize;
+    return std::min<std::size_t>(kNextDataSize, imageSize_ - off);
+}
+
+}  // namespace nuisp
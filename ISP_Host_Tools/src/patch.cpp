@@ -0,0 +1,372 @@
+// SPDX-License-Identifier: Apache-2.0
+#include "nuisp/patch.hpp"
+
+#include "nuisp/image.hpp"
+#include "nuisp/link.hpp"
+#include "nuisp/packet_cache.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <fstream>
+#include <initializer_list>
+#include <optional>
+#include <unordered_map>
+
+namespace nuisp {
+
+namespace {
+
+constexpr char kMagic[4] = {'N', 'U', 'P', 'D'};
+constexpr std::size_t kHeaderSize = 32;
+
+enum HeaderField : std::size_t
+{
+    kVersion = 4,
+    kBaseSize = 8,
+    kBaseCrc = 12,
+    kImageSize = 16,
+    kImageCrc = 20,
+    kPages = 24,
+    kStreamSize = 28,
+};
+
+// Op encoding of isp_user.h
+constexpr std::uint8_t kOpCopy = 0x80;
+constexpr std::uint8_t kOpFill = 0xC0;
+constexpr std::size_t kMaxInsert = 128;
+constexpr std::uint32_t kMaxSource = 1u << 24;
+// Below these an INSERT of the same bytes is as short
+constexpr std::size_t kMinCopy = 7;
+constexpr std::size_t kMinFill = 4;
+// Index hits tried per position; runs of one value are left to FILL
+constexpr std::size_t kMaxCandidates = 32;
+
+using PageBytes = std::span<const std::uint8_t, kFlashPageSize>;
+
+std::vector<std::uint8_t> padToPages(std::span<const std::uint8_t> image, std::size_t pages)
+{
+    std::vector<std::uint8_t> out(pages * kFlashPageSize, 0xFF);
+    std::copy_n(image.begin(), std::min(image.size(), out.size()), out.begin());
+    return out;
+}
+
+std::size_t pagesOf(std::size_t size)
+{
+    return (size + kFlashPageSize - 1) / kFlashPageSize;
+}
+
+std::uint32_t key(const std::uint8_t* p)
+{
+    return getLe32(p);
+}
+
+// Where in the base a stretch of the new page can be copied from.
+class Matcher
+{
+public:
+    explicit Matcher(std::span<const std::uint8_t> base) : base_(base)
+    {
+        for (std::size_t i = 0; i + 4 <= base.size(); ++i) {
+            auto& hits = index_[key(base.data() + i)];
+            if (hits.size() < kMaxCandidates) {
+                hits.push_back(static_cast<std::uint32_t>(i));
+            }
+        }
+    }
+
+    // Longest run of page[pos..] found at src without touching a page
+    // already rewritten.
+    std::size_t extend(PageBytes page, std::size_t pos, std::uint32_t src,
+                       const std::vector<bool>& written) const
+    {
+        std::size_t n = 0;
+        while (pos + n < page.size() && src + n < base_.size() &&
+               !written[(src + n) / kFlashPageSize] && base_[src + n] == page[pos + n]) {
+            ++n;
+        }
+        return n;
+    }
+
+    std::size_t best(PageBytes page, std::size_t pos, std::initializer_list<std::uint32_t> hints,
+                     const std::vector<bool>& written, std::uint32_t& src) const
+    {
+        std::size_t len = 0;
+        auto consider = [&](std::uint32_t at) {
+            const std::size_t n = extend(page, pos, at, written);
+            if (n > len) {
+                len = n;
+                src = at;
+            }
+        };
+        for (std::uint32_t at : hints) {
+            consider(at);
+        }
+        if (pos + 4 <= page.size()) {
+            if (auto it = index_.find(key(page.data() + pos)); it != index_.end()) {
+                for (std::uint32_t at : it->second) {
+                    consider(at);
+                }
+            }
+        }
+        return len;
+    }
+
+private:
+    std::span<const std::uint8_t> base_;
+    std::unordered_map<std::uint32_t, std::vector<std::uint32_t>> index_;
+};
+
+void putInsert(std::vector<std::uint8_t>& out, std::span<const std::uint8_t> bytes)
+{
+    while (!bytes.empty()) {
+        const std::size_t n = std::min(bytes.size(), kMaxInsert);
+        out.push_back(static_cast<std::uint8_t>(n - 1));
+        out.insert(out.end(), bytes.begin(), bytes.begin() + static_cast<std::ptrdiff_t>(n));
+        bytes = bytes.subspan(n);
+    }
+}
+
+void putLength(std::vector<std::uint8_t>& out, std::uint8_t op, std::size_t len)
+{
+    out.push_back(static_cast<std::uint8_t>(op | (len - 1) >> 8));
+    out.push_back(static_cast<std::uint8_t>(len - 1));
+}
+
+// Page record for page number index of image, reading the base only where
+// no page was rewritten yet.
+void encodePage(std::vector<std::uint8_t>& out, const Matcher& matcher, PageBytes page,
+                std::uint32_t index, const std::vector<bool>& written)
+{
+    out.push_back(static_cast<std::uint8_t>(index));
+    out.push_back(static_cast<std::uint8_t>(index >> 8));
+
+    const std::uint32_t address = index * kFlashPageSize;
+    std::size_t pos = 0;
+    std::size_t literal = 0;
+    // where the last copy would continue; stays in step across short edits
+    std::optional<std::uint32_t> next;
+
+    while (pos < page.size()) {
+        std::size_t run = 1;
+        while (pos + run < page.size() && page[pos + run] == page[pos]) {
+            ++run;
+        }
+        std::uint32_t src = 0;
+        const std::size_t copy =
+            next ? matcher.best(page, pos, {*next, address + static_cast<std::uint32_t>(pos)},
+                                written, src)
+                 : matcher.best(page, pos, {address + static_cast<std::uint32_t>(pos)}, written,
+                                src);
+
+        std::size_t step = 1;
+        if (copy >= kMinCopy && copy > run) {
+            putInsert(out, page.subspan(literal, pos - literal));
+            putLength(out, kOpCopy, copy);
+            out.push_back(static_cast<std::uint8_t>(src));
+            out.push_back(static_cast<std::uint8_t>(src >> 8));
+            out.push_back(static_cast<std::uint8_t>(src >> 16));
+            next = src;
+            step = copy;
+            literal = pos + copy;
+        } else if (run >= kMinFill) {
+            putInsert(out, page.subspan(literal, pos - literal));
+            putLength(out, kOpFill, run);
+            out.push_back(page[pos]);
+            step = run;
+            literal = pos + run;
+        }
+        if (next) {
+            *next += static_cast<std::uint32_t>(step);
+        }
+        pos += step;
+    }
+    putInsert(out, page.subspan(literal, pos - literal));
+}
+
+std::vector<std::uint8_t> encode(const Matcher& matcher, std::span<const std::uint8_t> image,
+                                 const std::vector<std::uint32_t>& order, std::size_t pages)
+{
+    std::vector<std::uint8_t> out;
+    std::vector<bool> written(pages, false);
+    for (std::uint32_t index : order) {
+        encodePage(out, matcher,
+                   PageBytes(image.data() + std::size_t{index} * kFlashPageSize, kFlashPageSize),
+                   index, written);
+        written[index] = true;
+    }
+    return out;
+}
+
+}  // namespace
+
+Patch makePatch(std::span<const std::uint8_t> base, std::span<const std::uint8_t> image)
+{
+    base = base.first(trimmedSize(base));
+    image = image.first(trimmedSize(image));
+    if (base.empty() || image.empty()) {
+        throw Error("cannot patch from or to a blank image");
+    }
+
+    Patch patch;
+    const std::size_t basePages = pagesOf(base.size());
+    const std::size_t imagePages = pagesOf(image.size());
+    // pages the old image used past the new one's end are erased too
+    const std::size_t pages = std::max(basePages, imagePages);
+    if (basePages * kFlashPageSize > kMaxSource || pages > 0x10000) {
+        throw Error("image too large for CMD_APPLY_PATCH");
+    }
+    const std::vector<std::uint8_t> from = padToPages(base, basePages);
+    const std::vector<std::uint8_t> to = padToPages(image, pages);
+    const std::vector<std::uint8_t> old = padToPages(base, pages);
+
+    patch.baseSize = static_cast<std::uint32_t>(from.size());
+    patch.baseCrc = crc32(from);
+    patch.imageSize = static_cast<std::uint32_t>(imagePages * kFlashPageSize);
+    patch.imageCrc = crc32(std::span(to).first(patch.imageSize));
+
+    std::vector<std::uint32_t> changed;
+    for (std::size_t i = 0; i < pages; ++i) {
+        if (!std::equal(to.begin() + static_cast<std::ptrdiff_t>(i * kFlashPageSize),
+                        to.begin() + static_cast<std::ptrdiff_t>((i + 1) * kFlashPageSize),
+                        old.begin() + static_cast<std::ptrdiff_t>(i * kFlashPageSize))) {
+            changed.push_back(static_cast<std::uint32_t>(i));
+        }
+    }
+    patch.pages = static_cast<std::uint32_t>(changed.size());
+
+    const Matcher matcher(from);
+    patch.stream = encode(matcher, to, changed, pages);
+    std::reverse(changed.begin(), changed.end());
+    std::vector<std::uint8_t> down = encode(matcher, to, changed, pages);
+    if (down.size() < patch.stream.size()) {
+        patch.stream = std::move(down);
+    }
+
+    std::vector<std::uint8_t> rebuilt = replayPatch(from, patch);
+    rebuilt.resize(to.size(), 0xFF);
+    if (rebuilt != to) {
+        throw Error("patch does not rebuild the image");
+    }
+    return patch;
+}
+
+std::vector<std::uint8_t> replayPatch(std::span<const std::uint8_t> base, const Patch& patch)
+{
+    std::vector<std::uint8_t> flash = padToPages(base, pagesOf(base.size()));
+    const std::span<const std::uint8_t> s = patch.stream;
+    std::size_t i = 0;
+    auto need = [&](std::size_t n) {
+        if (s.size() - i < n) {
+            throw Error("patch stream ends inside a record");
+        }
+    };
+
+    while (i < s.size()) {
+        need(2);
+        const std::size_t address = std::size_t{getLe16(s.data() + i)} * kFlashPageSize;
+        i += 2;
+        std::array<std::uint8_t, kFlashPageSize> page;
+        std::size_t fill = 0;
+        while (fill < page.size()) {
+            need(1);
+            const std::uint8_t op = s[i];
+            std::size_t len;
+            if (op < kOpCopy) {
+                len = op + 1u;
+                need(1 + len);
+            } else {
+                need(op < kOpFill ? 5 : 3);
+                len = ((op & 0x3Fu) << 8 | s[i + 1]) + 1u;
+            }
+            if (len > page.size() - fill) {
+                throw Error("patch op runs past its page");
+            }
+            if (op < kOpCopy) {
+                std::copy_n(s.begin() + static_cast<std::ptrdiff_t>(i + 1), len,
+                            page.begin() + static_cast<std::ptrdiff_t>(fill));
+                i += 1 + len;
+            } else if (op < kOpFill) {
+                const std::uint32_t src = s[i + 2] | s[i + 3] << 8 | s[i + 4] << 16;
+                if (src > patch.baseSize || len > patch.baseSize - src || src + len > flash.size()) {
+                    throw Error("patch copies from outside its base");
+                }
+                std::copy_n(flash.begin() + src, len,
+                            page.begin() + static_cast<std::ptrdiff_t>(fill));
+                i += 5;
+            } else {
+                std::fill_n(page.begin() + static_cast<std::ptrdiff_t>(fill), len, s[i + 2]);
+                i += 3;
+            }
+            fill += len;
+        }
+        if (flash.size() < address + page.size()) {
+            flash.resize(address + page.size(), 0xFF);
+        }
+        std::copy(page.begin(), page.end(), flash.begin() + static_cast<std::ptrdiff_t>(address));
+    }
+    return flash;
+}
+
+std::vector<std::uint8_t> serializePatch(const Patch& patch)
+{
+    std::vector<std::uint8_t> out(kHeaderSize + patch.stream.size());
+    std::uint8_t* h = out.data();
+    std::memcpy(h, kMagic, sizeof(kMagic));
+    putLe32(h + kVersion, kPatchVersion);
+    putLe32(h + kBaseSize, patch.baseSize);
+    putLe32(h + kBaseCrc, patch.baseCrc);
+    putLe32(h + kImageSize, patch.imageSize);
+    putLe32(h + kImageCrc, patch.imageCrc);
+    putLe32(h + kPages, patch.pages);
+    putLe32(h + kStreamSize, static_cast<std::uint32_t>(patch.stream.size()));
+    std::copy(patch.stream.begin(), patch.stream.end(), out.begin() + kHeaderSize);
+    return out;
+}
+
+Patch parsePatch(std::span<const std::uint8_t> bytes)
+{
+    if (bytes.size() < kHeaderSize || std::memcmp(bytes.data(), kMagic, sizeof(kMagic)) != 0) {
+        throw Error("not a patch file");
+    }
+    const std::uint8_t* h = bytes.data();
+    if (getLe32(h + kVersion) != kPatchVersion) {
+        throw Error("patch file version " + std::to_string(getLe32(h + kVersion)) +
+                    " not supported");
+    }
+    Patch patch;
+    patch.baseSize = getLe32(h + kBaseSize);
+    patch.baseCrc = getLe32(h + kBaseCrc);
+    patch.imageSize = getLe32(h + kImageSize);
+    patch.imageCrc = getLe32(h + kImageCrc);
+    patch.pages = getLe32(h + kPages);
+    if (getLe32(h + kStreamSize) != bytes.size() - kHeaderSize ||
+        (patch.baseSize | patch.imageSize) % kFlashPageSize != 0) {
+        throw Error("patch file truncated or corrupt");
+    }
+    patch.stream.assign(bytes.begin() + kHeaderSize, bytes.end());
+    return patch;
+}
+
+Patch loadPatchFile(const std::string& path)
+{
+    const std::vector<std::uint8_t> bytes = loadBinaryFile(path);
+    try {
+        return parsePatch(bytes);
+    } catch (const Error& e) {
+        throw Error(path + ": " + e.what());
+    }
+}
+
+void savePatchFile(const std::string& path, const Patch& patch)
+{
+    const std::vector<std::uint8_t> bytes = serializePatch(patch);
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char*>(bytes.data()),
+              static_cast<std::streamsize>(bytes.size()));
+    if (!out) {
+        throw Error("cannot write " + path);
+    }
+}
+
+}  // namespace nuisp
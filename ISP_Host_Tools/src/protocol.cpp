@@ -0,0 +1,97 @@
+// SPDX-License-Identifier: Apache-2.0
+#include "nuisp/protocol.hpp"
+
+#include <algorithm>
+
+namespace nuisp {
+
+std::uint16_t frameChecksum(std::span<const std::uint8_t> bytes)
+{
+    std::uint16_t sum = 0;
+    for (std::uint8_t b : bytes) {
+        sum = static_cast<std::uint16_t>(sum + b);
+    }
+    return sum;
+}
+
+std::uint16_t crc16Ccitt(std::span<const std::uint8_t> bytes)
+{
+    std::uint16_t crc = 0xFFFF;
+    for (std::uint8_t b : bytes) {
+        crc ^= static_cast<std::uint16_t>(b << 8);
+        for (int i = 0; i < 8; ++i) {
+            crc = (crc & 0x8000) ? static_cast<std::uint16_t>((crc << 1) ^ 0x1021)
+                                 : static_cast<std::uint16_t>(crc << 1);
+        }
+    }
+    return crc;
+}
+
+std::uint32_t crc32(std::span<const std::uint8_t> bytes)
+{
+    std::uint32_t crc = 0xFFFFFFFF;
+    for (std::uint8_t b : bytes) {
+        crc ^= b;
+        for (int i = 0; i < 8; ++i) {
+            crc = (crc >> 1) ^ (0xEDB88320 & (0U - (crc & 1)));
+        }
+    }
+    return ~crc;
+}
+
+Frame makeFrame(std::uint32_t command, std::uint32_t packno)
+{
+    Frame f{};
+    putLe32(f.data(), command);
+    putLe32(f.data() + 4, packno);
+    return f;
+}
+
+bool responsePacknoMatches(Variant variant, const Frame& response, std::uint32_t sentPackno)
+{
+    if (variant == Variant::W20B) {
+        return getLe16(response.data() + 4) == static_cast<std::uint16_t>(sentPackno + 1);
+    }
+    return getLe32(response.data() + 4) == sentPackno + 1;
+}
+
+std::size_t makeDataFrame(Frame& frame, std::uint32_t command,
+                          std::span<const std::uint8_t> image, std::size_t offset)
+{
+    std::size_t n;
+    if (offset == 0) {
+        frame = makeFrame(command, 0);
+        putLe32(frame.data() + 8, 0);
+        putLe32(frame.data() + 12, static_cast<std::uint32_t>(image.size()));
+        n = std::min(kFirstDataSize, image.size());
+        std::copy_n(image.begin(), n, frame.begin() + kFirstDataOffset);
+    } else {
+        frame = makeFrame(0, 0);
+        n = std::min(kNextDataSize, image.size() - offset);
+        std::copy_n(image.begin() + static_cast<std::ptrdiff_t>(offset), n,
+                    frame.begin() + kNextDataOffset);
+    }
+    return n;
+}
+
+ReadFlashStatus checkReadFlash(const Frame& sent, const Frame& response,
+                               std::span<const std::uint8_t>& chunk)
+{
+    if (getLe16(response.data()) != frameChecksum(sent)) {
+        return ReadFlashStatus::Corrupted;
+    }
+    const std::uint16_t len = getLe16(response.data() + kReadFlashLen);
+    if (len == kReadFlashRejected) {
+        return ReadFlashStatus::Rejected;
+    }
+    if (len > kReadFlashChunk) {
+        return ReadFlashStatus::Corrupted;
+    }
+    chunk = std::span<const std::uint8_t>(response.data() + kReadFlashData, len);
+    if (crc16Ccitt(chunk) != getLe16(response.data() + kReadFlashCrc)) {
+        return ReadFlashStatus::Corrupted;
+    }
+    return ReadFlashStatus::Ok;
+}
+
+}  // namespace nuisp
@@ -0,0 +1,336 @@
+// SPDX-License-Identifier: Apache-2.0
+#include "nuisp/protocol_core.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+
+namespace nuisp {
+
+namespace {
+
+bool checksumMatches(const Frame& sent, const Frame& response)
+{
+    return getLe16(response.data()) == frameChecksum(sent);
+}
+
+std::string hex32(std::uint32_t v)
+{
+    char buf[16];
+    std::snprintf(buf, sizeof(buf), "0x%08X", v);
+    return buf;
+}
+
+}  // namespace
+
+ProtocolCore::ProtocolCore(Variant variant, SessionOptions options)
+    : variant_(variant), options_(options)
+{
+}
+
+bool ProtocolCore::connected(const Frame& response)
+{
+    if (!responsePacknoMatches(variant_, response, 1) ||
+        !checksumMatches(connectFrame(), response)) {
+        return false;
+    }
+    op_ = Op::None;
+    packno_ = 3;
+    unanswered_ = 0;
+    lastData_.reset();
+    rolledBack_ = false;
+    ++stats_.frames;
+    return true;
+}
+
+void ProtocolCore::request(const Frame& frame, std::chrono::milliseconds timeout)
+{
+    out_ = frame;
+    putLe32(out_.data() + 4, packno_);
+    timeout_ = timeout;
+    sentPackno_ = packno_;
+    // the packet number advances whatever the reply: the device may have
+    // seen the frame even if its answer got lost
+    packno_ += 2;
+    skipped_ = 0;
+}
+
+ProtocolCore::Reply ProtocolCore::classify(const Frame* response)
+{
+    if (!response) {
+        ++unanswered_;
+        return Reply::Missing;
+    }
+    // the device counts the frames it received, so after unanswered ones
+    // its packet number says how many of them never arrived
+    while (!responsePacknoMatches(variant_, *response, sentPackno_ - 2 * skipped_)) {
+        if (++skipped_ > unanswered_) {
+            skipped_ = 0;
+            return Reply::Corrupted;
+        }
+    }
+    packno_ -= 2 * skipped_;
+    unanswered_ = 0;
+    ++stats_.frames;
+    return Reply::Ok;
+}
+
+void ProtocolCore::onResponse(const Frame* response)
+{
+    const Reply reply = classify(response);
+    switch (op_) {
+    case Op::Command:
+        onCommand(reply, response);
+        break;
+    case Op::Data:
+        onData(reply, response);
+        break;
+    case Op::Resend:
+        onResend(reply);
+        break;
+    case Op::ReadFlash:
+        onReadFlash(reply, response);
+        break;
+    case Op::None:
+        break;
+    }
+}
+
+Frame ProtocolCore::runAprom()
+{
+    op_ = Op::None;
+    ++stats_.frames;
+    return makeFrame(cmd::RunAprom, packno_);
+}
+
+void ProtocolCore::command(std::uint32_t command, std::span<const std::uint8_t> payload,
+                           std::chrono::milliseconds timeout)
+{
+    if (payload.size() > kFrameSize - 8) {
+        throw Error("payload too large");
+    }
+    request_ = makeFrame(command, 0);
+    std::copy(payload.begin(), payload.end(), request_.begin() + 8);
+    requestTimeout_ = timeout;
+    attempt_ = 0;
+    op_ = Op::Command;
+    request(request_, requestTimeout_);
+}
+
+void ProtocolCore::syncPackno()
+{
+    std::uint8_t sync[4];
+    putLe32(sync, packno_);
+    command(cmd::SyncPackno, sync, options_.responseTimeout);
+}
+
+void ProtocolCore::onCommand(Reply reply, const Frame* response)
+{
+    if (reply == Reply::Ok && checksumMatches(out_, *response)) {
+        response_ = *response;
+        op_ = Op::None;
+        return;
+    }
+    // Delta commands set state rather than step it and are safe to
+    // repeat, except CMD_SET_SPEED (see Session::setSpeed())
+    const std::uint32_t command = getLe32(request_.data());
+    if (variant_ != Variant::Delta || command == cmd::SetSpeed ||
+        attempt_ == options_.maxResends) {
+        op_ = Op::None;
+        if (reply == Reply::Missing) {
+            throw TimeoutError("no response to packet " + std::to_string(sentPackno_));
+        }
+        throw Error("checksum mismatch on command " + hex32(command));
+    }
+    ++attempt_;
+    request(request_, requestTimeout_);
+}
+
+void ProtocolCore::data(std::span<const std::uint8_t, kFrameSize> frame, std::uint16_t checksum,
+                        std::chrono::milliseconds timeout)
+{
+    std::copy(frame.begin(), frame.end(), pending_[0].frame.begin());
+    pending_[0].checksum = checksum;
+    queued_ = 1;
+    dataTimeout_ = timeout;
+    attempt_ = 0;
+    sendData();
+}
+
+void ProtocolCore::sendData()
+{
+    const DataFrame& next = pending_[queued_ - 1];
+    const bool command = getLe32(next.frame.data()) != 0;
+    op_ = Op::Data;
+    // a replayed first frame erases again
+    request(next.frame, command && queued_ > 1 ? options_.eraseTimeout : dataTimeout_);
+    dataPackno_ = sentPackno_;
+}
+
+void ProtocolCore::sendResend()
+{
+    resendBefore_ = unanswered_;
+    op_ = Op::Resend;
+    request(makeFrame(cmd::ResendPacket, 0), options_.responseTimeout);
+}
+
+void ProtocolCore::onData(Reply reply, const Frame* response)
+{
+    const DataFrame& next = pending_[queued_ - 1];
+    if (reply == Reply::Ok && getLe16(response->data()) ==
+                                  static_cast<std::uint16_t>(next.checksum + packnoSum(sentPackno_))) {
+        lastData_ = next;
+        rolledBack_ = false;
+        ++attempt_;
+        if (--queued_ == 0) {
+            response_ = *response;
+            op_ = Op::None;
+        } else {
+            sendData();
+        }
+        return;
+    }
+    if (variant_ != Variant::Delta || attempt_ == options_.maxResends) {
+        op_ = Op::None;
+        if (reply == Reply::Missing) {
+            throw TimeoutError("no response to packet " + std::to_string(sentPackno_));
+        }
+        throw Error("checksum mismatch on data packet " + std::to_string(sentPackno_));
+    }
+    ++attempt_;
+    // a command frame starts the transfer over, whether it arrived or not
+    if (reply == Reply::Missing && getLe32(next.frame.data()) != 0) {
+        sendData();
+        return;
+    }
+    // Delta: the device wrote the frame but the read-back differs, or the
+    // frame or its answer was corrupted or lost; roll it back and send it
+    // again
+    resendLost_ = unanswered_;
+    resendAttempt_ = 0;
+    sendResend();
+}
+
+void ProtocolCore::onResend(Reply reply)
+{
+    if (reply == Reply::Missing) {
+        // dropped on the way in, or answered and rolled back already:
+        // a repeated CMD_RESEND_PACKET does not roll back further
+        if (resendAttempt_ == options_.maxResends) {
+            op_ = Op::None;
+            throw TimeoutError("no response to CMD_RESEND_PACKET");
+        }
+        ++resendAttempt_;
+        sendResend();
+        return;
+    }
+    // the device drops frames with an unknown command word, so any answer
+    // means it rolled back, even if a payload byte was hit
+    ++stats_.resends;
+    bool seen;
+    if (resendLost_ == 0 || (reply == Reply::Ok && skipped_ == 0)) {
+        seen = true;
+    } else if (reply == Reply::Ok && skipped_ == resendBefore_) {
+        seen = false;
+    } else {
+        op_ = Op::None;
+        throw Error("cannot tell which data packet the device rolled back");
+    }
+    // if it never saw the frame it rolled back the one before instead,
+    // unless that was rolled back already
+    if (!seen && !rolledBack_) {
+        if (!lastData_ || queued_ == 2) {
+            op_ = Op::None;
+            throw Error("device missed data packet " + std::to_string(dataPackno_));
+        }
+        pending_[queued_++] = *lastData_;
+    }
+    rolledBack_ = true;
+    sendData();
+}
+
+void ProtocolCore::readFlash(std::uint32_t address, std::size_t size, ChunkCheck check)
+{
+    if (variant_ != Variant::Delta) {
+        throw Error("W20B bootloader has no read-back; program() already checks the byte sum");
+    }
+    readAddress_ = address;
+    readSize_ = size;
+    readDone_ = 0;
+    readFirst_ = true;
+    check_ = std::move(check);
+    attempt_ = 0;
+    if (size == 0) {
+        op_ = Op::None;
+        return;
+    }
+    Frame frame = makeFrame(cmd::ReadFlash, 0);
+    putLe32(frame.data() + 8, address);
+    putLe32(frame.data() + 12, static_cast<std::uint32_t>(size));
+    op_ = Op::ReadFlash;
+    request(frame, options_.responseTimeout);
+}
+
+void ProtocolCore::readAgain(const Frame& frame)
+{
+    if (++attempt_ > options_.maxResends) {
+        op_ = Op::None;
+        throw Error("CMD_READ_FLASH chunk corrupted at " +
+                    hex32(readAddress_ + static_cast<std::uint32_t>(readDone_)));
+    }
+    if (getLe32(frame.data()) == cmd::ResendPacket) {
+        ++stats_.resends;
+    }
+    request(frame, options_.responseTimeout);
+}
+
+void ProtocolCore::onReadFlash(Reply reply, const Frame* response)
+{
+    std::span<const std::uint8_t> chunk;
+    const ReadFlashStatus status =
+        reply == Reply::Ok ? checkReadFlash(out_, *response, chunk) : ReadFlashStatus::Corrupted;
+
+    if (status != ReadFlashStatus::Ok) {
+        if (readFirst_ && status == ReadFlashStatus::Rejected) {
+            op_ = Op::None;
+            throw Error("device refused CMD_READ_FLASH (locked, unaligned or out of range)");
+        }
+        // re-issue the request, or have the device read the last chunk again
+        readAgain(readFirst_ ? out_ : makeFrame(cmd::ResendPacket, 0));
+        return;
+    }
+    const std::uint32_t at = getLe32(response->data() + kReadFlashAddr);
+    const std::uint32_t expected = readAddress_ + static_cast<std::uint32_t>(readDone_);
+    if (readFirst_ && at != readAddress_) {
+        op_ = Op::None;
+        throw Error("firmware does not support CMD_READ_FLASH");
+    }
+    if (at != expected) {
+        // the device missed the last request, so CMD_RESEND_PACKET read
+        // the chunk before it again; otherwise the address got corrupted
+        readAgain(at + chunk.size() == expected ? makeFrame(0, 0)
+                                                : makeFrame(cmd::ResendPacket, 0));
+        return;
+    }
+    if (chunk.empty()) {
+        op_ = Op::None;
+        throw Error("device ended the read early at " + hex32(expected));
+    }
+
+    try {
+        check_(readDone_, chunk, *response);
+    } catch (...) {
+        op_ = Op::None;
+        throw;
+    }
+    readDone_ += chunk.size();
+    attempt_ = 0;
+    readFirst_ = false;
+    if (readDone_ < readSize_) {
+        request(makeFrame(0, 0), options_.responseTimeout);
+    } else {
+        op_ = Op::None;
+    }
+}
+
+}  // namespace nuisp
@@ -0,0 +1,169 @@
+// SPDX-License-Identifier: Apache-2.0
+#include "nuisp/serial_port.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+namespace nuisp {
+
+namespace {
+
+[[noreturn]] void throwErrno(const std::string& what)
+{
+    throw Error(what + ": " + std::strerror(errno));
+}
+
+constexpr struct
+{
+    std::uint32_t baud;
+    speed_t speed;
+} kSpeeds[] = {
+    {9600, B9600},       {19200, B19200},     {38400, B38400},     {57600, B57600},
+    {115200, B115200},   {230400, B230400},   {460800, B460800},   {500000, B500000},
+    {576000, B576000},   {921600, B921600},   {1000000, B1000000}, {1152000, B1152000},
+    {1500000, B1500000}, {2000000, B2000000}, {3000000, B3000000},
+};
+
+speed_t toSpeed(std::uint32_t baud)
+{
+    for (const auto& s : kSpeeds) {
+        if (s.baud == baud) {
+            return s.speed;
+        }
+    }
+    throw Error("unsupported baud rate " + std::to_string(baud));
+}
+
+}  // namespace
+
+std::uint32_t baudFromSpeed(unsigned int speed)
+{
+    for (const auto& s : kSpeeds) {
+        if (s.speed == speed) {
+            return s.baud;
+        }
+    }
+    return 0;
+}
+
+SerialPort::SerialPort(const std::string& path, std::uint32_t baud) : path_(path)
+{
+    fd_ = ::open(path.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if (fd_ < 0) {
+        throwErrno("open " + path);
+    }
+
+    termios tio{};
+    if (::tcgetattr(fd_, &tio) != 0) {
+        int e = errno;
+        ::close(fd_);
+        errno = e;
+        throwErrno("tcgetattr " + path);
+    }
+    ::cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cflag &= ~(CSTOPB | CRTSCTS);
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 0;
+    ::cfsetspeed(&tio, toSpeed(baud));
+    if (::tcsetattr(fd_, TCSANOW, &tio) != 0) {
+        int e = errno;
+        ::close(fd_);
+        errno = e;
+        throwErrno("tcsetattr " + path);
+    }
+    ::tcflush(fd_, TCIOFLUSH);
+}
+
+SerialPort::~SerialPort()
+{
+    if (fd_ >= 0) {
+        ::close(fd_);
+    }
+}
+
+void SerialPort::write(std::span<const std::uint8_t> data)
+{
+    while (!data.empty()) {
+        ssize_t n = ::write(fd_, data.data(), data.size());
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN) {
+                pollfd pfd{fd_, POLLOUT, 0};
+                ::poll(&pfd, 1, 100);
+                continue;
+            }
+            throwErrno("write " + path_);
+        }
+        data = data.subspan(static_cast<std::size_t>(n));
+    }
+}
+
+std::size_t SerialPort::read(std::span<std::uint8_t> data, std::chrono::milliseconds timeout)
+{
+    using Clock = std::chrono::steady_clock;
+    const auto deadline = Clock::now() + timeout;
+    std::size_t got = 0;
+
+    while (got < data.size()) {
+        // a zero timeout still picks up what is already buffered
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now());
+        if (left.count() < 0) {
+            left = std::chrono::milliseconds(0);
+        }
+        pollfd pfd{fd_, POLLIN, 0};
+        int r = ::poll(&pfd, 1, static_cast<int>(left.count()));
+        if (r < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throwErrno("poll " + path_);
+        }
+        if (r == 0) {
+            break;
+        }
+        ssize_t n = ::read(fd_, data.data() + got, data.size() - got);
+        if (n < 0) {
+            if (errno == EINTR || errno == EAGAIN) {
+                continue;
+            }
+            throwErrno("read " + path_);
+        }
+        if (n == 0) {
+            // pty master with no slave open yet
+            if (pfd.revents & POLLHUP) {
+                break;
+            }
+            continue;
+        }
+        got += static_cast<std::size_t>(n);
+    }
+    return got;
+}
+
+void SerialPort::discardInput()
+{
+    ::tcflush(fd_, TCIFLUSH);
+}
+
+void SerialPort::setBaudRate(std::uint32_t baud)
+{
+    termios tio{};
+    if (::tcgetattr(fd_, &tio) != 0) {
+        throwErrno("tcgetattr " + path_);
+    }
+    ::cfsetspeed(&tio, toSpeed(baud));
+    // let the last frame leave at the old rate
+    ::tcdrain(fd_);
+    if (::tcsetattr(fd_, TCSANOW, &tio) != 0) {
+        throwErrno("tcsetattr " + path_);
+    }
+}
+
+}  // namespace nuisp
@@ -0,0 +1,343 @@
+// SPDX-License-Identifier: Apache-2.0
+#include "nuisp/session.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <thread>
+
+namespace nuisp {
+
+namespace {
+
+bool checksumMatches(const Frame& sent, const Frame& response)
+{
+    return getLe16(response.data()) == frameChecksum(sent);
+}
+
+std::string hex32(std::uint32_t v)
+{
+    char buf[16];
+    std::snprintf(buf, sizeof(buf), "0x%08X", v);
+    return buf;
+}
+
+}  // namespace
+
+Session::Session(Link& link, Variant variant, SessionOptions options)
+    : link_(link), core_(variant, options)
+{
+}
+
+const Frame* Session::exchange(Frame& response)
+{
+    link_.write(core_.next());
+    if (link_.read(response, core_.timeout()) != kFrameSize) {
+        // a late answer must not pass for the next one
+        link_.discardInput();
+        return nullptr;
+    }
+    return &response;
+}
+
+void Session::drive()
+{
+    while (core_.busy()) {
+        Frame response{};
+        core_.onResponse(exchange(response));
+    }
+}
+
+Frame Session::transact(std::uint32_t command, std::span<const std::uint8_t> payload,
+                        std::chrono::milliseconds timeout)
+{
+    core_.command(command, payload, timeout);
+    drive();
+    return core_.response();
+}
+
+void Session::connect(std::chrono::milliseconds window)
+{
+    using Clock = std::chrono::steady_clock;
+    const SessionOptions& options = core_.options();
+    const auto deadline = Clock::now() + window;
+
+    do {
+        link_.write(ProtocolCore::connectFrame());
+
+        Frame response{};
+        if (link_.read(response, options.connectRetry) == kFrameSize &&
+            core_.connected(response)) {
+            // an earlier attempt may still be answered, do not mistake it for the next response
+            std::this_thread::sleep_for(options.connectRetry);
+            link_.discardInput();
+            if (core_.variant() == Variant::W20B) {
+                // W20B boots APROM ~200 ms after the first CONNECT unless
+                // a second CONNECT or a SYNC_PACKNO follows
+                core_.syncPackno();
+                drive();
+            }
+            return;
+        }
+        link_.discardInput();
+    } while (Clock::now() < deadline);
+
+    throw TimeoutError("bootloader did not answer CMD_CONNECT");
+}
+
+std::uint8_t Session::firmwareVersion()
+{
+    return transact(cmd::GetFwVer, {}, core_.options().responseTimeout)[8];
+}
+
+std::uint32_t Session::deviceId()
+{
+    // W20B packs DID low/high, PID low/high into the same four bytes
+    return getLe32(transact(cmd::GetDeviceId, {}, core_.options().responseTimeout).data() + 8);
+}
+
+std::array<std::uint32_t, 4> Session::readConfig()
+{
+    Frame r = transact(cmd::ReadConfig, {}, core_.options().responseTimeout);
+    return {getLe32(r.data() + 8), getLe32(r.data() + 12), getLe32(r.data() + 16),
+            getLe32(r.data() + 20)};
+}
+
+std::optional<DeviceInfo> Session::deviceInfo()
+{
+    if (core_.variant() != Variant::Delta) {
+        return std::nullopt;
+    }
+
+    Frame r = transact(cmd::GetDeviceInfo, {}, core_.options().responseTimeout);
+    DeviceInfo info;
+    info.fwVersion = getLe32(r.data() + 8);
+    info.capabilities = getLe32(r.data() + 48);
+    // older firmware ignores the command and answers with CONFIG0 at offset 8
+    if ((info.fwVersion >> 8) != 0 || !(info.capabilities & cap::DeviceInfo)) {
+        return std::nullopt;
+    }
+    info.pdid = getLe32(r.data() + 12);
+    info.config0 = getLe32(r.data() + 16);
+    info.config1 = getLe32(r.data() + 20);
+    info.apromSize = getLe32(r.data() + 24);
+    info.dataflashAddr = getLe32(r.data() + 28);
+    info.dataflashSize = getLe32(r.data() + 32);
+    for (std::size_t i = 0; i < info.uid.size(); ++i) {
+        info.uid[i] = getLe32(r.data() + 36 + 4 * i);
+    }
+    return info;
+}
+
+bool Session::setSpeed(std::uint32_t baud, std::uint32_t gapUs)
+{
+    if (core_.variant() != Variant::Delta) {
+        throw Error("W20B bootloader runs at a fixed 38400 baud");
+    }
+
+    Frame frame = makeFrame(cmd::SetSpeed, 0);
+    putLe32(frame.data() + 8, baud);
+    putLe32(frame.data() + 12, gapUs);
+
+    for (unsigned attempt = 0;; ++attempt) {
+        core_.request(frame, core_.options().responseTimeout);
+        Frame r{};
+        const Frame* answer = exchange(r);
+        const ProtocolCore::Reply reply = core_.classify(answer);
+        const bool accepted = answer && getLe32(r.data() + kSpeedAccepted) == 1;
+        // the device answers at the old rate and switches after the last byte
+        if (reply == ProtocolCore::Reply::Ok && checksumMatches(core_.next(), r)) {
+            if (accepted && baud != 0) {
+                link_.setBaudRate(baud);
+            }
+            return accepted;
+        }
+        // any answer means the device took the command; if it says it
+        // switched, check that the settings it took were the ones sent
+        if (accepted) {
+            if (baud != 0) {
+                link_.setBaudRate(baud);
+            }
+            try {
+                firmwareVersion();
+            } catch (const Error&) {
+                throw TimeoutError("no answer at the new rate after CMD_SET_SPEED");
+            }
+            return true;
+        }
+        // dropped on the way in, or declined: still at the old rate
+        if (attempt == core_.options().maxResends) {
+            if (!answer) {
+                throw TimeoutError("no response to packet " +
+                                   std::to_string(getLe32(core_.next().data() + 4)));
+            }
+            throw Error("checksum mismatch on command " + hex32(cmd::SetSpeed));
+        }
+    }
+}
+
+void Session::eraseAll()
+{
+    transact(cmd::EraseAll, {}, core_.options().eraseTimeout);
+}
+
+std::array<std::uint32_t, 4> Session::updateConfig(const std::array<std::uint32_t, 4>& config)
+{
+    std::uint8_t payload[16];
+    for (std::size_t i = 0; i < config.size(); ++i) {
+        putLe32(payload + 4 * i, config[i]);
+    }
+    // erases the CONFIG page first
+    Frame r = transact(cmd::UpdateConfig, payload, core_.options().eraseTimeout);
+    return {getLe32(r.data() + 8), getLe32(r.data() + 12), getLe32(r.data() + 16),
+            getLe32(r.data() + 20)};
+}
+
+void Session::program(Target target, std::span<const std::uint8_t> image, const Progress& progress)
+{
+    const std::uint32_t command =
+        target == Target::Aprom ? cmd::UpdateAprom : cmd::UpdateDataflash;
+    program(PacketCache::build(core_.variant(), command, image), progress);
+}
+
+void Session::program(const PacketCache& cache, const Progress& progress)
+{
+    if (cache.variant() != core_.variant()) {
+        throw Error("packet cache was built for the other bootloader");
+    }
+
+    std::size_t done = 0;
+    for (std::size_t i = 0; i < cache.frameCount(); ++i) {
+        const FrameExpect expect = cache.expect(i);
+        core_.data(cache.frame(i), expect.checksum,
+                   i == 0 ? core_.options().eraseTimeout : core_.options().responseTimeout);
+        drive();
+        const Frame& r = core_.response();
+        done += cache.frameBytes(i);
+        // W20B answers each data frame with the 16-bit sum of the bytes it programmed
+        if (core_.variant() == Variant::W20B && getLe16(r.data() + 8) != expect.programmedSum) {
+            throw Error("programmed byte sum mismatch at offset " + std::to_string(done));
+        }
+        core_.stats().payloadBytes += cache.frameBytes(i);
+        if (progress) {
+            progress(done, cache.imageSize());
+        }
+    }
+}
+
+void Session::readBack(std::uint32_t address, std::size_t size,
+                       const ProtocolCore::ChunkCheck& check, const Progress& progress)
+{
+    core_.readFlash(address, size,
+                    [&](std::size_t offset, std::span<const std::uint8_t> chunk, const Frame& r) {
+                        check(offset, chunk, r);
+                        core_.stats().payloadBytes += chunk.size();
+                        if (progress) {
+                            progress(std::min(offset + chunk.size(), size), size);
+                        }
+                    });
+    drive();
+}
+
+void Session::verify(std::uint32_t address, std::span<const std::uint8_t> image,
+                     const Progress& progress)
+{
+    readBack(address, image.size(),
+             [&](std::size_t offset, std::span<const std::uint8_t> chunk, const Frame&) {
+                 for (std::size_t i = 0; i < chunk.size() && offset + i < image.size(); ++i) {
+                     if (chunk[i] != image[offset + i]) {
+                         throw Error("verify failed at " +
+                                     hex32(address + static_cast<std::uint32_t>(offset + i)));
+                     }
+                 }
+             },
+             progress);
+}
+
+void Session::verify(std::uint32_t address, const PacketCache& cache, const Progress& progress)
+{
+    verify(address, cache, 0, cache.imageSize(), progress);
+}
+
+void Session::verify(std::uint32_t address, const PacketCache& cache, std::size_t offset,
+                     std::size_t size, const Progress& progress)
+{
+    if (offset % kReadFlashChunk != 0 || offset > cache.imageSize() ||
+        size > cache.imageSize() - offset ||
+        ((offset + size) % kReadFlashChunk != 0 && offset + size != cache.imageSize())) {
+        throw Error("verify range outside the image");
+    }
+    readBack(address + static_cast<std::uint32_t>(offset), size,
+             [&](std::size_t done, std::span<const std::uint8_t> chunk, const Frame& r) {
+                 const std::size_t at = offset + done;
+                 const std::size_t i = at / kReadFlashChunk;
+                 if (at % kReadFlashChunk != 0 || i >= cache.readChunks() ||
+                     getLe16(r.data() + kReadFlashCrc) != cache.readCrc(i) ||
+                     chunk.size() != std::min<std::size_t>(kReadFlashChunk, size - done)) {
+                     throw Error("verify failed in chunk at " +
+                                 hex32(address + static_cast<std::uint32_t>(at)));
+                 }
+             },
+             progress);
+}
+
+void Session::applyPatch(const Patch& patch, const Progress& progress)
+{
+    if (core_.variant() != Variant::Delta) {
+        throw Error("W20B bootloader has no CMD_APPLY_PATCH");
+    }
+
+    const std::span<const std::uint8_t> stream = patch.stream;
+    Frame frame = makeFrame(cmd::ApplyPatch, 0);
+    putLe32(frame.data() + 8, patch.baseSize);
+    putLe32(frame.data() + 12, patch.baseCrc);
+    putLe32(frame.data() + 16, patch.imageSize);
+    putLe32(frame.data() + 20, static_cast<std::uint32_t>(stream.size()));
+    std::size_t offset = 8 + kPatchHeaderSize;
+    std::size_t done = 0;
+
+    // one frame past the stream, which writes the last page
+    for (bool first = true;; first = false) {
+        const std::size_t n = std::min(kFrameSize - offset, stream.size() - done);
+        std::copy_n(stream.begin() + static_cast<std::ptrdiff_t>(done), n, frame.begin() + offset);
+        // any frame may erase and write pages, the first one CRCs the base
+        core_.data(frame, frameChecksum(frame), core_.options().eraseTimeout);
+        drive();
+        const Frame& r = core_.response();
+        done += n;
+        core_.stats().payloadBytes += n;
+
+        const std::uint32_t remain = getLe32(r.data() + kPatchRemain);
+        if (remain == kPatchRejected && first) {
+            throw Error("device refused the patch: APROM does not hold its base image, or "
+                        "the image does not fit");
+        }
+        if (remain == kPatchRejected) {
+            throw Error("device rejected the patch at stream byte " + std::to_string(done) +
+                        ", APROM needs a full program");
+        }
+        if (remain != stream.size() - done) {
+            throw Error("device expects " + std::to_string(remain) + " more patch bytes, not " +
+                        std::to_string(stream.size() - done));
+        }
+        if (progress) {
+            progress(done, stream.size());
+        }
+        if (done == stream.size() && n == 0) {
+            const std::uint32_t crc = getLe32(r.data() + kPatchCrc);
+            if (crc != patch.imageCrc) {
+                throw Error("patched APROM has CRC-32 " + hex32(crc) + ", the image " +
+                            hex32(patch.imageCrc));
+            }
+            return;
+        }
+        frame = makeFrame(0, 0);
+        offset = 8;
+    }
+}
+
+void Session::run()
+{
+    link_.write(core_.runAprom());
+}
+
+}  // namespace nuisp
@@ -0,0 +1,216 @@
+// SPDX-License-Identifier: Apache-2.0
+//
+// EpollExecutor, IoAwait and AsyncSession cancellation and deadlines.
+#include "nuisp/async.hpp"
+#include "nuisp/async_session.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <thread>
+#include <unistd.h>
+
+using namespace nuisp;
+using namespace std::chrono_literals;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+int failures = 0;
+
+#define CHECK(cond)                                                                    \
+    do {                                                                               \
+        if (!(cond)) {                                                                 \
+            std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            ++failures;                                                                \
+        }                                                                              \
+    } while (0)
+
+// Passes waits on to an EpollExecutor and remembers them.
+class CountingExecutor : public IoExecutor
+{
+public:
+    explicit CountingExecutor(EpollExecutor& inner) : inner_(inner) {}
+
+    void start(Wait& w) override
+    {
+        inner_.start(w);
+        ++starts;
+        lastId = w.id;
+    }
+    void cancel(std::uint64_t id) override { inner_.cancel(id); }
+
+    unsigned starts = 0;
+    std::uint64_t lastId = 0;
+
+private:
+    EpollExecutor& inner_;
+};
+
+struct Pipe
+{
+    Pipe()
+    {
+        if (::pipe2(fd, O_NONBLOCK | O_CLOEXEC) != 0) {
+            std::perror("pipe2");
+            std::exit(2);
+        }
+    }
+    ~Pipe()
+    {
+        ::close(fd[0]);
+        ::close(fd[1]);
+    }
+    int fd[2];
+};
+
+// A device that never answers: writes vanish, reads find nothing.
+class SilentLink : public Link
+{
+public:
+    void write(std::span<const std::uint8_t> data) override { written += data.size(); }
+    std::size_t read(std::span<std::uint8_t> data, std::chrono::milliseconds) override
+    {
+        const ssize_t n = ::read(rx_.fd[0], data.data(), data.size());
+        return n > 0 ? static_cast<std::size_t>(n) : 0;
+    }
+    void discardInput() override {}
+    void setBaudRate(std::uint32_t) override {}
+    int pollFd() const override { return rx_.fd[0]; }
+
+    std::size_t written = 0;
+
+private:
+    Pipe rx_;
+};
+
+void cancelBeforeSuspend()
+{
+    EpollExecutor loop;
+    CountingExecutor counting(loop);
+    std::stop_source stop;
+    stop.request_stop();
+
+    WaitResult result = WaitResult::Ready;
+    const auto begin = Clock::now();
+    syncWait(loop, [](IoExecutor& e, std::stop_token token, WaitResult& out) -> Task<> {
+        out = co_await IoAwait(e, -1, false, Clock::now() + 10s, token);
+    }(counting, stop.get_token(), result));
+
+    CHECK(result == WaitResult::Cancelled);
+    // resumed without ever reaching the executor
+    CHECK(counting.starts == 0);
+    CHECK(Clock::now() - begin < 1s);
+}
+
+void cancelWhileSuspended()
+{
+    EpollExecutor loop;
+    std::stop_source stop;
+    std::thread canceller([&] {
+        std::this_thread::sleep_for(20ms);
+        stop.request_stop();
+    });
+
+    const auto begin = Clock::now();
+    const WaitResult result = syncWait(loop, sleepFor(loop, 10s, stop.get_token()));
+    canceller.join();
+
+    CHECK(result == WaitResult::Cancelled);
+    CHECK(Clock::now() - begin < 5s);
+}
+
+void cancelAfterComplete()
+{
+    EpollExecutor loop;
+    CountingExecutor counting(loop);
+    std::stop_source stop;
+    WaitResult first = WaitResult::Cancelled;
+    WaitResult second = WaitResult::Cancelled;
+
+    syncWait(loop, [](CountingExecutor& e, std::stop_source& stop, WaitResult& first,
+                      WaitResult& second) -> Task<> {
+        first = co_await sleepFor(e, 1ms, stop.get_token());
+        // both come too late for the finished wait and must not leak into
+        // the next one
+        stop.request_stop();
+        e.cancel(e.lastId);
+        second = co_await sleepFor(e, 1ms);
+    }(counting, stop, first, second));
+
+    CHECK(first == WaitResult::Ready);
+    CHECK(second == WaitResult::Ready);
+    CHECK(counting.starts == 2);
+}
+
+void deadlineExpiry()
+{
+    EpollExecutor loop;
+    Pipe pipe;
+
+    const auto begin = Clock::now();
+    const WaitResult idle = syncWait(loop, [](IoExecutor& e, int fd) -> Task<WaitResult> {
+        co_return co_await IoAwait(e, fd, false, Clock::now() + 30ms, {});
+    }(loop, pipe.fd[0]));
+    CHECK(idle == WaitResult::Timeout);
+    CHECK(Clock::now() - begin >= 30ms);
+
+    // readiness before the deadline wins
+    const std::uint8_t byte = 0;
+    CHECK(::write(pipe.fd[1], &byte, 1) == 1);
+    const WaitResult ready = syncWait(loop, [](IoExecutor& e, int fd) -> Task<WaitResult> {
+        co_return co_await IoAwait(e, fd, false, Clock::now() + 10s, {});
+    }(loop, pipe.fd[0]));
+    CHECK(ready == WaitResult::Ready);
+}
+
+void sessionDeadline()
+{
+    EpollExecutor loop;
+    SilentLink link;
+    SessionOptions options;
+    options.responseTimeout = 10s;
+    AsyncSession session(loop, link, Variant::Delta, options);
+
+    // the operation deadline cuts the 10 s frame timeout short
+    const auto begin = Clock::now();
+    bool timedOut = false;
+    try {
+        syncWait(loop, session.transact(cmd::GetFwVer, {}, options.responseTimeout, {},
+                                        Clock::now() + 50ms));
+    } catch (const TimeoutError&) {
+        timedOut = true;
+    }
+    CHECK(timedOut);
+    CHECK(Clock::now() - begin >= 50ms);
+    CHECK(Clock::now() - begin < 5s);
+    CHECK(link.written == kFrameSize);
+
+    // and a stop ends it as CancelledError
+    std::stop_source stop;
+    stop.request_stop();
+    bool cancelled = false;
+    try {
+        syncWait(loop, session.eraseAll(stop.get_token()));
+    } catch (const CancelledError&) {
+        cancelled = true;
+    }
+    CHECK(cancelled);
+}
+
+}  // namespace
+
+int main()
+{
+    cancelBeforeSuspend();
+    cancelWhileSuspended();
+    cancelAfterComplete();
+    deadlineExpiry();
+    sessionDeadline();
+
+    if (failures) {
+        std::fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
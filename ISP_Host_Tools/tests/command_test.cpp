@@ -0,0 +1,239 @@
+// SPDX-License-Identifier: Apache-2.0
+//
+// Bootloader commands against the simulator, which runs the KN44490A
+// sources: what nuisp info asks, CMD_READ_CONFIG, CMD_READ_FLASH on a
+// locked part, CMD_SET_SPEED out of the UART's range and a
+// CMD_WRITE_DATAFLASH_AT round trip.
+//
+// usage: nuisp_command_test path/to/nuisp-sim-m2003 path/to/nuisp
+#include "nuisp/protocol.hpp"
+#include "nuisp/serial_port.hpp"
+#include "nuisp/session.hpp"
+#include "simulator.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace nuisp;
+using namespace std::chrono_literals;
+
+namespace {
+
+int failures = 0;
+
+#define CHECK(cond)                                                                    \
+    do {                                                                               \
+        if (!(cond)) {                                                                 \
+            std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            ++failures;                                                                \
+        }                                                                              \
+    } while (0)
+
+using Bytes = std::vector<std::uint8_t>;
+
+constexpr std::uint32_t kDataflash = 0x7000;  // CONFIG1 the simulator defaults to
+constexpr std::uint16_t kReadRejected = 0xFFFF;
+constexpr std::uint32_t kDfAtRemain = 24;
+constexpr std::uint32_t kDfAtRejected = 0xFFFFFFFF;
+
+const char* g_sim;
+const char* g_cli;
+
+// Runs the nuisp CLI, returns its exit status and standard output.
+int runCli(const std::vector<std::string>& args, std::string& out)
+{
+    int fd[2];
+    if (::pipe(fd) != 0) {
+        std::perror("pipe");
+        std::exit(2);
+    }
+    std::vector<std::string> all{g_cli};
+    all.insert(all.end(), args.begin(), args.end());
+    std::vector<char*> argv;
+    for (std::string& a : all) {
+        argv.push_back(a.data());
+    }
+    argv.push_back(nullptr);
+
+    const pid_t pid = ::fork();
+    if (pid == 0) {
+        ::dup2(fd[1], STDOUT_FILENO);
+        ::close(fd[0]);
+        ::close(fd[1]);
+        ::execv(g_cli, argv.data());
+        std::perror(g_cli);
+        ::_exit(127);
+    }
+    ::close(fd[1]);
+    char buf[256];
+    ssize_t n;
+    while ((n = ::read(fd[0], buf, sizeof(buf))) > 0) {
+        out.append(buf, static_cast<std::size_t>(n));
+    }
+    ::close(fd[0]);
+    int status = 0;
+    ::waitpid(pid, &status, 0);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// nuisp info: CMD_GET_FWVER, CMD_GET_DEVICEID, CMD_READ_CONFIG and
+// CMD_GET_DEVICE_INFO in one session
+void info()
+{
+    Simulator sim(g_sim);
+    std::string out;
+    CHECK(runCli({"-p", sim.link(), "-q", "info"}, out) == 0);
+    CHECK(out.find("device id         0x00220003") != std::string::npos);
+    CHECK(out.find("config            0xFFFFFFFE 0x00007000") != std::string::npos);
+    CHECK(out.find("capabilities") != std::string::npos);
+}
+
+// CMD_READ_CONFIG answered, and again after other commands
+void readConfig()
+{
+    Simulator sim(g_sim, {"--config0", "0xFFFFFF7E", "--config1", "0x6000"});
+    SerialPort port(sim.link(), 38400);
+    Session session(port, Variant::Delta);
+    session.connect(5s);
+
+    for (int i = 0; i < 2; ++i) {
+        const std::array<std::uint32_t, 4> config = session.readConfig();
+        CHECK(config[0] == 0xFFFFFF7E);
+        CHECK(config[1] == 0x6000);
+        session.firmwareVersion();
+    }
+}
+
+Bytes pattern(std::size_t size, std::uint8_t seed)
+{
+    Bytes bytes(size);
+    for (std::uint8_t& b : bytes) {
+        b = seed;
+        seed = static_cast<std::uint8_t>(seed * 5 + 1);
+    }
+    return bytes;
+}
+
+Frame request(Session& session, std::uint32_t command, std::span<const std::uint8_t> payload)
+{
+    return session.transact(command, payload, 1s);
+}
+
+// CMD_READ_FLASH of [address, address + 16): the chunk length, RDFLASH_REJECTED
+// if refused
+std::uint16_t readLength(Session& session, std::uint32_t address)
+{
+    std::uint8_t payload[8];
+    putLe32(payload, address);
+    putLe32(payload + 4, 16);
+    const Frame r = request(session, cmd::ReadFlash, payload);
+    return static_cast<std::uint16_t>(r[kReadFlashLen] | r[kReadFlashLen + 1] << 8);
+}
+
+// A locked part reads nothing back until CMD_ERASE_ALL has cleared it;
+// CMD_UPDATE_APROM leaves the data flash and must not open it
+void lockedReadFlash()
+{
+    Simulator sim(g_sim, {"--config0", "0xFFFFFFFC"});
+    SerialPort port(sim.link(), 38400);
+    Session session(port, Variant::Delta);
+    session.connect(5s);
+
+    CHECK(readLength(session, 0) == kReadRejected);
+    CHECK(readLength(session, kDataflash) == kReadRejected);
+
+    session.program(Target::Aprom, pattern(1024, 1));
+    CHECK(readLength(session, 0) == kReadRejected);
+    CHECK(readLength(session, kDataflash) == kReadRejected);
+
+    session.eraseAll();
+    CHECK(readLength(session, 0) == 16);
+    CHECK(readLength(session, kDataflash) == 16);
+}
+
+// Rates and gaps the UART cannot take are declined and the link stays as it
+// was; one it can take still switches
+void setSpeedRange()
+{
+    Simulator sim(g_sim);
+    SerialPort port(sim.link(), 38400);
+    Session session(port, Variant::Delta);
+    session.connect(5s);
+
+    CHECK(!session.setSpeed(100));
+    CHECK(!session.setSpeed(0xFFFFFFFF));
+    CHECK(!session.setSpeed(0, 2000000));
+    CHECK(session.readConfig()[1] == kDataflash);
+
+    CHECK(session.setSpeed(115200, 500));
+    CHECK(session.readConfig()[1] == kDataflash);
+}
+
+// CMD_WRITE_DATAFLASH_AT across a page edge, then read back with the bytes
+// around it untouched
+void dataflashWriteAt()
+{
+    Simulator sim(g_sim);
+    SerialPort port(sim.link(), 38400);
+    Session session(port, Variant::Delta);
+    session.connect(5s);
+
+    const Bytes before = pattern(2048, 3);
+    session.program(Target::Dataflash, before);
+
+    // misaligned offsets are refused
+    std::uint8_t bad[8];
+    putLe32(bad, 2);
+    putLe32(bad + 4, 4);
+    CHECK(getLe32(request(session, cmd::WriteDataflashAt, bad).data() + kDfAtRemain) ==
+          kDfAtRejected);
+
+    const std::uint32_t offset = 0x1F0;
+    const Bytes data = pattern(100, 7);
+    Bytes first(56);
+    putLe32(first.data(), offset);
+    putLe32(first.data() + 4, static_cast<std::uint32_t>(data.size()));
+    std::copy_n(data.begin(), 48, first.begin() + 8);
+    CHECK(getLe32(request(session, cmd::WriteDataflashAt, first).data() + kDfAtRemain) == 52);
+
+    // a continuation frame carries command word 0
+    const Bytes rest(data.begin() + 48, data.end());
+    CHECK(getLe32(request(session, 0, rest).data() + kDfAtRemain) == 0);
+
+    Bytes expected(before.begin(), before.end());
+    std::copy_n(data.data(), data.size(), expected.data() + offset);
+    CHECK(sim.flash(kDataflash, expected.size()) == expected);
+    session.verify(kDataflash, expected);
+}
+
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    if (argc != 3) {
+        std::fprintf(stderr, "usage: %s path/to/nuisp-sim-m2003 path/to/nuisp\n", argv[0]);
+        return 2;
+    }
+    g_sim = argv[1];
+    g_cli = argv[2];
+
+    try {
+        info();
+        readConfig();
+        lockedReadFlash();
+        setSpeedRange();
+        dataflashWriteAt();
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+
+    if (failures) {
+        std::fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
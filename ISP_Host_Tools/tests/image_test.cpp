@@ -0,0 +1,329 @@
+// SPDX-License-Identifier: Apache-2.0
+//
+// Intel HEX, S-record and ELF loaders: address records, checksums,
+// overlapping and sparse data, and ELF segments with a .bss tail.
+#include "nuisp/image.hpp"
+#include "nuisp/link.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <elf.h>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+using namespace nuisp;
+
+namespace {
+
+int failures = 0;
+
+#define CHECK(cond)                                                                    \
+    do {                                                                               \
+        if (!(cond)) {                                                                 \
+            std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            ++failures;                                                                \
+        }                                                                              \
+    } while (0)
+
+using Bytes = std::vector<std::uint8_t>;
+using Ranges = std::vector<std::pair<std::uint32_t, std::uint32_t>>;
+
+// Files in a directory that goes away with it.
+class TempDir
+{
+public:
+    TempDir()
+    {
+        char templ[] = "/tmp/nuisp-image-XXXXXX";
+        if (!::mkdtemp(templ)) {
+            std::perror("mkdtemp");
+            std::exit(2);
+        }
+        path_ = templ;
+    }
+    ~TempDir()
+    {
+        for (const std::string& f : files_) {
+            ::unlink(f.c_str());
+        }
+        ::rmdir(path_.c_str());
+    }
+
+    std::string write(const std::string& name, const void* data, std::size_t size)
+    {
+        const std::string file = path_ + "/" + name;
+        std::ofstream(file, std::ios::binary).write(static_cast<const char*>(data),
+                                                    static_cast<std::streamsize>(size));
+        files_.push_back(file);
+        return file;
+    }
+    std::string write(const std::string& name, const std::string& text)
+    {
+        return write(name, text.data(), text.size());
+    }
+
+private:
+    std::string path_;
+    std::vector<std::string> files_;
+};
+
+std::string hexBytes(const Bytes& bytes)
+{
+    std::string s;
+    char buf[3];
+    for (std::uint8_t b : bytes) {
+        std::snprintf(buf, sizeof(buf), "%02X", b);
+        s += buf;
+    }
+    return s;
+}
+
+// ":LLAAAATT...CC"; corrupt adds one to the checksum
+std::string hexRecord(std::uint8_t type, std::uint16_t offset, const Bytes& data,
+                      bool corrupt = false)
+{
+    Bytes rec{static_cast<std::uint8_t>(data.size()), static_cast<std::uint8_t>(offset >> 8),
+              static_cast<std::uint8_t>(offset), type};
+    rec.insert(rec.end(), data.begin(), data.end());
+    std::uint8_t sum = 0;
+    for (std::uint8_t b : rec) {
+        sum = static_cast<std::uint8_t>(sum + b);
+    }
+    rec.push_back(static_cast<std::uint8_t>(-sum + (corrupt ? 1 : 0)));
+    return ":" + hexBytes(rec) + "\r\n";
+}
+
+// "Sn" with the address width of its type; corrupt adds one to the checksum
+std::string srecRecord(char type, std::uint32_t address, const Bytes& data, bool corrupt = false)
+{
+    const std::size_t addrLen = type == '2' || type == '8' ? 3 : type == '3' || type == '7' ? 4 : 2;
+    Bytes rec{static_cast<std::uint8_t>(addrLen + data.size() + 1)};
+    for (std::size_t i = addrLen; i-- > 0;) {
+        rec.push_back(static_cast<std::uint8_t>(address >> (8 * i)));
+    }
+    rec.insert(rec.end(), data.begin(), data.end());
+    std::uint8_t sum = 0;
+    for (std::uint8_t b : rec) {
+        sum = static_cast<std::uint8_t>(sum + b);
+    }
+    rec.push_back(static_cast<std::uint8_t>(~sum + (corrupt ? 1 : 0)));
+    return std::string("S") + type + hexBytes(rec) + "\n";
+}
+
+// True if f throws an Error whose message contains what.
+bool throwsWith(const std::function<void()>& f, const std::string& what)
+{
+    try {
+        f();
+    } catch (const Error& e) {
+        if (std::string(e.what()).find(what) != std::string::npos) {
+            return true;
+        }
+        std::fprintf(stderr, "unexpected error: %s\n", e.what());
+        return false;
+    }
+    return false;
+}
+
+void hexExtendedAddress()
+{
+    TempDir dir;
+    const std::string path = dir.write(
+        "ext.hex", hexRecord(0x00, 0x0010, {0x01, 0x02}) +
+                       // extended segment address: 0x1000 << 4
+                       hexRecord(0x02, 0, {0x10, 0x00}) + hexRecord(0x00, 0x0004, {0x11, 0x12}) +
+                       // extended linear address: CONFIG0 at 0x00300000
+                       hexRecord(0x04, 0, {0x00, 0x30}) +
+                       hexRecord(0x00, 0x0000, {0xFE, 0xFF, 0xFF, 0xFF}) +
+                       // start linear address, ignored
+                       hexRecord(0x05, 0, {0x00, 0x00, 0x01, 0x01}) + hexRecord(0x01, 0, {}) +
+                       // past the end of file record
+                       hexRecord(0x00, 0x0100, {0xAA}));
+
+    const FlashMap map = loadFlashMap(path);
+    CHECK((map.ranges() == Ranges{{0x10, 0x12}, {0x10004, 0x10006}, {0x300000, 0x300004}}));
+    CHECK((map.read(0x10, 0x12) == Bytes{0x01, 0x02}));
+    CHECK((map.read(0x10004, 0x10006) == Bytes{0x11, 0x12}));
+    CHECK((map.read(0x300000, 0x300004) == Bytes{0xFE, 0xFF, 0xFF, 0xFF}));
+}
+
+void hexErrors()
+{
+    TempDir dir;
+    const std::string good = hexRecord(0x00, 0, {0x01, 0x02, 0x03, 0x04});
+
+    const std::string checksum = dir.write("sum.hex", good + hexRecord(0x00, 4, {0x05}, true));
+    CHECK(throwsWith([&] { loadFlashMap(checksum); }, "sum.hex:2: checksum or length mismatch"));
+
+    // the count says 2 bytes, the record carries 1
+    const std::string length = dir.write("len.hex", ":0200000001FD\n");
+    CHECK(throwsWith([&] { loadFlashMap(length); }, "len.hex:1: checksum or length mismatch"));
+
+    const std::string digit = dir.write("digit.hex", good + ":01000400G5F6\n");
+    CHECK(throwsWith([&] { loadFlashMap(digit); }, "digit.hex:2: bad hex digit"));
+
+    const std::string colon = dir.write("colon.hex", "\n" + good.substr(1));
+    CHECK(throwsWith([&] { loadFlashMap(colon); }, "colon.hex:2: malformed record"));
+
+    const std::string empty = dir.write("empty.hex", hexRecord(0x01, 0, {}));
+    CHECK(throwsWith([&] { loadFlashMap(empty); }, "no data records"));
+}
+
+void hexOverlapAndGaps()
+{
+    TempDir dir;
+    // the second record overwrites the middle of the first; the third
+    // straddles a page edge; the fourth sits alone three pages on
+    const std::string path = dir.write(
+        "sparse.hex", hexRecord(0x00, 0x0200, {0x10, 0x11, 0x12, 0x13, 0x14, 0x15}) +
+                          hexRecord(0x00, 0x0202, {0x22, 0x23}) +
+                          hexRecord(0x00, 0x03FE, {0x30, 0x31, 0x32, 0x33}) +
+                          hexRecord(0x00, 0x0A00, {0x40}) + hexRecord(0x01, 0, {}));
+
+    const FlashMap map = loadFlashMap(path);
+    CHECK(map.pageCount() == 3);
+    // a page's range runs from its lowest to its highest written byte
+    CHECK((map.ranges() == Ranges{{0x200, 0x402}, {0xA00, 0xA01}}));
+    CHECK((map.read(0x200, 0x206) == Bytes{0x10, 0x11, 0x22, 0x23, 0x14, 0x15}));
+    CHECK((map.read(0x3FC, 0x404) == Bytes{0xFF, 0xFF, 0x30, 0x31, 0x32, 0x33, 0xFF, 0xFF}));
+
+    // flat: from the page holding the lowest address, gaps erased
+    const Bytes flat = loadImageFile(path);
+    CHECK(flat.size() == 0xA01 - 0x200);
+    CHECK(flat[0] == 0x10 && flat[2] == 0x22);
+    CHECK(flat[0x206 - 0x200] == 0xFF);
+    CHECK(flat[0x400 - 0x200] == 0x32);
+    CHECK(flat[0x9FF - 0x200] == 0xFF && flat.back() == 0x40);
+    CHECK(trimmedSize(flat) == flat.size());
+}
+
+void srecRecords()
+{
+    TempDir dir;
+    const std::string path = dir.write(
+        "app.s37", srecRecord('0', 0, {'a', 'p', 'p'}) +
+                       srecRecord('1', 0x0100, {0x01, 0x02, 0x03}) +
+                       srecRecord('2', 0x012345, {0x21, 0x22}) +
+                       srecRecord('3', 0x00300004, {0x5A, 0xA5, 0xFF, 0xFF}) +
+                       // S5 record count, ignored
+                       srecRecord('5', 3, {}) +
+                       // overwrites the S1 data
+                       srecRecord('3', 0x00000101, {0x12}) + srecRecord('7', 0, {}) +
+                       srecRecord('1', 0x0200, {0xEE}));
+
+    const FlashMap map = loadFlashMap(path);
+    CHECK((map.ranges() == Ranges{{0x100, 0x103}, {0x12345, 0x12347}, {0x300004, 0x300008}}));
+    CHECK((map.read(0x100, 0x103) == Bytes{0x01, 0x12, 0x03}));
+    CHECK((map.read(0x12345, 0x12347) == Bytes{0x21, 0x22}));
+    CHECK((map.read(0x300004, 0x300008) == Bytes{0x5A, 0xA5, 0xFF, 0xFF}));
+
+    const std::string checksum =
+        dir.write("sum.s19", srecRecord('1', 0, {0x01}) + srecRecord('1', 1, {0x02}, true));
+    CHECK(throwsWith([&] { loadFlashMap(checksum); }, "sum.s19:2: checksum or length mismatch"));
+
+    // count 2 leaves no room for an S2 record's 3 address bytes
+    const std::string shortAddr = dir.write("short.s28", "S20201FC\n");
+    CHECK(throwsWith([&] { loadFlashMap(shortAddr); }, "short.s28:1: record shorter than its address"));
+
+    const std::string odd = dir.write("odd.srec", "S10401000\n");
+    CHECK(throwsWith([&] { loadFlashMap(odd); }, "odd.srec:1: malformed record"));
+}
+
+struct ElfSegment
+{
+    std::uint32_t type;
+    std::uint32_t vaddr;
+    std::uint32_t paddr;
+    Bytes data;
+    std::uint32_t memsz;
+};
+
+Bytes makeElf(const std::vector<ElfSegment>& segments)
+{
+    Elf32_Ehdr eh{};
+    std::memcpy(eh.e_ident, ELFMAG, SELFMAG);
+    eh.e_ident[EI_CLASS] = ELFCLASS32;
+    eh.e_ident[EI_DATA] = ELFDATA2LSB;
+    eh.e_ident[EI_VERSION] = EV_CURRENT;
+    eh.e_type = ET_EXEC;
+    eh.e_machine = EM_ARM;
+    eh.e_version = EV_CURRENT;
+    eh.e_phoff = sizeof(Elf32_Ehdr);
+    eh.e_ehsize = sizeof(Elf32_Ehdr);
+    eh.e_phentsize = sizeof(Elf32_Phdr);
+    eh.e_phnum = static_cast<Elf32_Half>(segments.size());
+
+    Bytes file(sizeof(eh) + segments.size() * sizeof(Elf32_Phdr));
+    std::memcpy(file.data(), &eh, sizeof(eh));
+    for (std::size_t i = 0; i < segments.size(); ++i) {
+        const ElfSegment& s = segments[i];
+        Elf32_Phdr ph{};
+        ph.p_type = s.type;
+        ph.p_offset = static_cast<Elf32_Off>(file.size());
+        ph.p_vaddr = s.vaddr;
+        ph.p_paddr = s.paddr;
+        ph.p_filesz = static_cast<Elf32_Word>(s.data.size());
+        ph.p_memsz = s.memsz;
+        ph.p_flags = PF_R;
+        std::memcpy(file.data() + sizeof(eh) + i * sizeof(ph), &ph, sizeof(ph));
+        file.insert(file.end(), s.data.begin(), s.data.end());
+    }
+    return file;
+}
+
+void elfSegments()
+{
+    TempDir dir;
+    const Bytes elf = makeElf({
+        // .text
+        {PT_LOAD, 0x0000, 0x0000, {0x00, 0x10, 0x00, 0x20, 0x09, 0x01, 0x00, 0x00}, 8},
+        // .data runs at 0x20000000 and loads behind .text; its .bss tail
+        // (p_filesz < p_memsz) is zeroed by the startup code, not programmed
+        {PT_LOAD, 0x20000000, 0x0200, {0xD0, 0xD1, 0xD2, 0xD3}, 0x40},
+        // .bss alone: nothing to program
+        {PT_LOAD, 0x20000040, 0x20000040, {}, 0x100},
+        {PT_NOTE, 0, 0x0400, {0xEE, 0xEE, 0xEE, 0xEE}, 4},
+    });
+    const std::string path = dir.write("app.axf", elf.data(), elf.size());
+
+    CHECK(imageFormat(path) == ImageFormat::Elf);
+    const FlashMap map = loadFlashMap(path);
+    CHECK((map.ranges() == Ranges{{0x0, 0x8}, {0x200, 0x204}}));
+    CHECK((map.read(0x200, 0x208) == Bytes{0xD0, 0xD1, 0xD2, 0xD3, 0xFF, 0xFF, 0xFF, 0xFF}));
+
+    // found by its magic without an ELF extension
+    const std::string bare = dir.write("app", elf.data(), elf.size());
+    CHECK(imageFormat(bare) == ImageFormat::Elf);
+    CHECK(loadImageFile(bare).size() == 0x204);
+
+    Bytes truncated = elf;
+    truncated.resize(truncated.size() - 6);
+    const std::string cut = dir.write("cut.elf", truncated.data(), truncated.size());
+    CHECK(throwsWith([&] { loadFlashMap(cut); }, "truncated ELF segment"));
+
+    Bytes wide = elf;
+    wide[EI_CLASS] = ELFCLASS64;
+    const std::string elf64 = dir.write("wide.elf", wide.data(), wide.size());
+    CHECK(throwsWith([&] { loadFlashMap(elf64); }, "only 32-bit little-endian ELF"));
+}
+
+}  // namespace
+
+int main()
+{
+    hexExtendedAddress();
+    hexErrors();
+    hexOverlapAndGaps();
+    srecRecords();
+    elfSegments();
+
+    if (failures) {
+        std::fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,304 @@
+// SPDX-License-Identifier: Apache-2.0
+//
+// CMD_APPLY_PATCH round trips through the simulator's decoder, behind the
+// bootloader's framing and resend handling: hand-made streams with every
+// op kind, COPY sources across page edges and from the page being rebuilt,
+// records split at every frame offset, and makePatch() output. The flash
+// file shows the last page waiting for the frame past the stream.
+//
+// usage: nuisp_patch_test path/to/nuisp-sim-m2003
+#include "nuisp/patch.hpp"
+#include "nuisp/protocol.hpp"
+#include "nuisp/serial_port.hpp"
+#include "nuisp/session.hpp"
+#include "simulator.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+using namespace nuisp;
+using namespace std::chrono_literals;
+
+namespace {
+
+int failures = 0;
+
+#define CHECK(cond)                                                                    \
+    do {                                                                               \
+        if (!(cond)) {                                                                 \
+            std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            ++failures;                                                                \
+        }                                                                              \
+    } while (0)
+
+using Bytes = std::vector<std::uint8_t>;
+
+constexpr std::size_t kPage = 512;
+
+Bytes randomBytes(std::size_t size, std::uint32_t seed)
+{
+    Bytes bytes(size);
+    for (std::uint8_t& b : bytes) {
+        seed = seed * 1664525 + 1013904223;
+        b = static_cast<std::uint8_t>(seed >> 24);
+    }
+    return bytes;
+}
+
+// A patch stream built op by op, next to the flash it leaves behind. Each
+// record rewrites its page only once the next one starts, so a COPY reads
+// the page being rebuilt as it was.
+class Stream
+{
+public:
+    explicit Stream(Bytes base) : base_(base), flash_(std::move(base)) {}
+
+    void page(std::uint16_t page)
+    {
+        commit();
+        page_ = page;
+        built_.clear();
+        stream_.push_back(static_cast<std::uint8_t>(page));
+        stream_.push_back(static_cast<std::uint8_t>(page >> 8));
+    }
+
+    void insert(const Bytes& bytes)
+    {
+        stream_.push_back(static_cast<std::uint8_t>(bytes.size() - 1));
+        stream_.insert(stream_.end(), bytes.begin(), bytes.end());
+        built_.insert(built_.end(), bytes.begin(), bytes.end());
+    }
+
+    void copy(std::uint32_t src, std::size_t len)
+    {
+        op(0x80, len);
+        stream_.push_back(static_cast<std::uint8_t>(src));
+        stream_.push_back(static_cast<std::uint8_t>(src >> 8));
+        stream_.push_back(static_cast<std::uint8_t>(src >> 16));
+        const auto from = flash_.begin() + src;
+        built_.insert(built_.end(), from, from + static_cast<std::ptrdiff_t>(len));
+    }
+
+    void fill(std::uint8_t value, std::size_t len)
+    {
+        op(0xC0, len);
+        stream_.push_back(value);
+        built_.insert(built_.end(), len, value);
+    }
+
+    // The patch and the flash it should leave
+    std::pair<Patch, Bytes> finish(std::size_t imageSize)
+    {
+        commit();
+        Patch patch;
+        patch.baseSize = static_cast<std::uint32_t>(base_.size());
+        patch.baseCrc = crc32(base_);
+        patch.imageSize = static_cast<std::uint32_t>(imageSize);
+        patch.imageCrc = crc32(std::span(flash_).first(imageSize));
+        patch.pages = pages_;
+        patch.stream = stream_;
+        return {patch, flash_};
+    }
+
+private:
+    void op(std::uint8_t kind, std::size_t len)
+    {
+        stream_.push_back(static_cast<std::uint8_t>(kind | (len - 1) >> 8));
+        stream_.push_back(static_cast<std::uint8_t>(len - 1));
+    }
+
+    void commit()
+    {
+        if (built_.empty()) {
+            return;
+        }
+        if (built_.size() != kPage) {
+            std::fprintf(stderr, "page record of %zu bytes\n", built_.size());
+            std::exit(2);
+        }
+        const std::size_t at = page_ * kPage;
+        flash_.resize(std::max(flash_.size(), at + kPage), 0xFF);
+        std::copy(built_.begin(), built_.end(), flash_.begin() + static_cast<std::ptrdiff_t>(at));
+        built_.clear();
+        ++pages_;
+    }
+
+    Bytes base_;
+    Bytes flash_;
+    Bytes stream_;
+    Bytes built_;
+    std::size_t page_ = 0;
+    std::uint32_t pages_ = 0;
+};
+
+// Programs base, applies patch and checks the flash against expected both
+// before the frame past the stream, with only lastPage still old, and after.
+void roundTrip(Session& session, const Simulator& sim, const Bytes& base, const Patch& patch,
+               const Bytes& expected, std::size_t lastPage)
+{
+    session.program(Target::Aprom, base);
+    // erased past the base
+    Bytes old = base;
+    old.resize(expected.size(), 0xFF);
+
+    bool streamSent = false;
+    session.applyPatch(patch, [&](std::size_t done, std::size_t total) {
+        if (done != total || streamSent) {
+            return;
+        }
+        streamSent = true;
+        const Bytes flash = sim.flash(0, expected.size());
+        const auto page = static_cast<std::ptrdiff_t>(lastPage * kPage);
+        // the decoder has the whole last page and has not written it
+        CHECK(std::equal(flash.begin() + page, flash.begin() + page + kPage,
+                         old.begin() + page));
+        Bytes rest = expected;
+        std::copy_n(old.begin() + page, kPage, rest.begin() + page);
+        CHECK(flash == rest);
+    });
+    CHECK(streamSent);
+
+    const Bytes flash = sim.flash(0, expected.size());
+    CHECK(flash == expected);
+    CHECK(crc32(std::span(flash).first(patch.imageSize)) == patch.imageCrc);
+    CHECK(replayPatch(base, patch) == expected);
+}
+
+// Four pages rebuilt to six. The first record gets shift more INSERT ops,
+// one more stream byte each, so the later op headers land on every offset
+// of a frame edge in turn.
+std::pair<Patch, Bytes> handMade(const Bytes& base, std::size_t shift)
+{
+    Stream s(base);
+
+    // a new page past the base, its ops only there to move the rest
+    s.page(5);
+    const std::size_t ops = 4 + shift;
+    const Bytes filler = randomBytes(kPage, 11);
+    for (std::size_t i = 0, at = 0; i < ops; ++i) {
+        const std::size_t n = i + 1 == ops ? kPage - at : kPage / ops;
+        s.insert(Bytes(filler.begin() + static_cast<std::ptrdiff_t>(at),
+                       filler.begin() + static_cast<std::ptrdiff_t>(at + n)));
+        at += n;
+    }
+
+    s.page(0);
+    s.copy(0x180, 100);  // the page being rebuilt
+    s.insert(randomBytes(128, 12));
+    s.fill(0x5A, 200);
+    s.copy(0x3F0, 84);  // page 1 into page 2
+
+    s.page(1);
+    s.copy(0x5F0, 40);  // page 2 into page 3
+    s.insert({0xA5});
+    s.copy(0x200, 300);  // the page being rebuilt
+    s.fill(0x00, 171);
+
+    s.page(4);
+    s.fill(0x3C, 512);
+
+    // page 2 stays, page 3 is the last record
+    s.page(3);
+    for (std::uint32_t i = 0; i < 3; ++i) {
+        s.insert(randomBytes(128, 13 + i));
+    }
+    s.copy(0x600, 128);  // the page being rebuilt, from its start
+
+    return s.finish(6 * kPage);
+}
+
+void handMadeStreams(Session& session, const Simulator& sim)
+{
+    Bytes base = randomBytes(4 * kPage, 10);
+    base.back() = 0x00;  // no trailing 0xFF for program() to drop
+
+    // the stream length for shift 0 decides which shift ends it on a frame
+    const std::size_t first = kFrameSize - 8 - kPatchHeaderSize;
+    const std::size_t cont = kFrameSize - 8;
+    const std::size_t len = handMade(base, 0).first.stream.size();
+    const std::size_t exact = (cont - (len - first) % cont) % cont;
+
+    for (std::size_t shift : {std::size_t{0}, std::size_t{1}, std::size_t{2}, std::size_t{3},
+                              std::size_t{4}, exact}) {
+        const auto [patch, expected] = handMade(base, shift);
+        CHECK(patch.pages == 5);
+        if (shift == exact) {
+            CHECK((patch.stream.size() - first) % cont == 0);
+        }
+        roundTrip(session, sim, base, patch, expected, 3);
+    }
+}
+
+// makePatch() on code moved by an insertion, with a zeroed table and a new
+// tail
+void madePatch(Session& session, const Simulator& sim)
+{
+    Bytes base = randomBytes(12 * kPage, 20);
+    base.back() = 0x00;
+    Bytes image = base;
+    const Bytes inserted = randomBytes(37, 21);
+    image.insert(image.begin() + 0x500, inserted.begin(), inserted.end());
+    std::fill_n(image.begin() + 0x1000, 300, 0x00);
+    const Bytes tail = randomBytes(700, 22);
+    image.insert(image.end(), tail.begin(), tail.end());
+
+    const Patch patch = makePatch(base, image);
+    const Bytes expected = replayPatch(base, patch);
+    Bytes padded = image;
+    padded.resize(patch.imageSize, 0xFF);
+    CHECK(std::equal(padded.begin(), padded.end(), expected.begin()));
+
+    // the last record is the last page written
+    const std::size_t lastPage = [&] {
+        std::size_t at = 0;
+        std::size_t page = 0;
+        for (std::uint32_t i = 0; i < patch.pages; ++i) {
+            page = patch.stream[at] | patch.stream[at + 1] << 8;
+            at += 2;
+            for (std::size_t built = 0; built < kPage;) {
+                const std::uint8_t op = patch.stream[at];
+                if (op < 0x80) {
+                    built += op + 1;
+                    at += 1 + op + 1;
+                } else {
+                    built += ((op & 0x3F) << 8 | patch.stream[at + 1]) + 1;
+                    at += op < 0xC0 ? 5 : 3;
+                }
+            }
+        }
+        return page;
+    }();
+    roundTrip(session, sim, base, patch, expected, lastPage);
+}
+
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    if (argc != 2) {
+        std::fprintf(stderr, "usage: %s path/to/nuisp-sim-m2003\n", argv[0]);
+        return 2;
+    }
+
+    try {
+        Simulator sim(argv[1]);
+        SerialPort port(sim.link(), 38400);
+        Session session(port, Variant::Delta);
+        session.connect(5s);
+
+        handMadeStreams(session, sim);
+        madePatch(session, sim);
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+
+    if (failures) {
+        std::fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+    return 0;
+}
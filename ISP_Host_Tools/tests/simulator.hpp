@@ -0,0 +1,91 @@
+// SPDX-License-Identifier: Apache-2.0
+//
+// nuisp-sim-m2003 on a pty for the tests, its flash in a file they can read.
+#pragma once
+
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+class Simulator
+{
+public:
+    // options go to the simulator after -s 0, --link and --flash
+    explicit Simulator(const char* program, std::vector<std::string> options = {})
+    {
+        char templ[] = "/tmp/nuisp-sim-XXXXXX";
+        if (!::mkdtemp(templ)) {
+            std::perror("mkdtemp");
+            std::exit(2);
+        }
+        dir_ = templ;
+        link_ = dir_ + "/dev";
+        flash_ = dir_ + "/flash.bin";
+
+        std::vector<std::string> args{program, "-s", "0", "--link", link_, "--flash", flash_};
+        args.insert(args.end(), options.begin(), options.end());
+        std::vector<char*> argv;
+        for (std::string& a : args) {
+            argv.push_back(a.data());
+        }
+        argv.push_back(nullptr);
+
+        pid_ = ::fork();
+        if (pid_ < 0) {
+            std::perror("fork");
+            std::exit(2);
+        }
+        if (pid_ == 0) {
+            // it prints the link path
+            const int null = ::open("/dev/null", O_WRONLY);
+            ::dup2(null, STDOUT_FILENO);
+            ::execv(program, argv.data());
+            std::perror(program);
+            ::_exit(127);
+        }
+        for (int i = 0; i < 500 && ::access(link_.c_str(), F_OK) != 0; ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+    ~Simulator()
+    {
+        ::kill(pid_, SIGTERM);
+        ::waitpid(pid_, nullptr, 0);
+        ::unlink(link_.c_str());
+        ::unlink(flash_.c_str());
+        ::rmdir(dir_.c_str());
+    }
+
+    Simulator(const Simulator&) = delete;
+    Simulator& operator=(const Simulator&) = delete;
+
+    const std::string& link() const { return link_; }
+
+    // Flash from offset, as the file holds it: APROM at 0
+    std::vector<std::uint8_t> flash(std::size_t offset, std::size_t size) const
+    {
+        std::vector<std::uint8_t> bytes(size);
+        const int fd = ::open(flash_.c_str(), O_RDONLY);
+        if (fd < 0 || ::pread(fd, bytes.data(), size, static_cast<off_t>(offset)) !=
+                          static_cast<ssize_t>(size)) {
+            std::perror(flash_.c_str());
+            std::exit(2);
+        }
+        ::close(fd);
+        return bytes;
+    }
+
+private:
+    pid_t pid_ = -1;
+    std::string dir_;
+    std::string link_;
+    std::string flash_;
+};
@@ -0,0 +1,699 @@
+// SPDX-License-Identifier: Apache-2.0
+//
+// nuisp-bench: time complete update sessions (connect, erase, program,
+// verify, run) against the bootloader simulators and print one record per
+// run as JSON Lines or CSV.
+//
+//   nuisp-bench -V delta -b 38400,115200,460800 -n 4k,16k
+//   nuisp-bench -V both -n 8k -e 0,0.0005 -L 0,2000 -r 3 -o csv > sweep.csv
+//   nuisp-bench -V both -n 2k,8k --baseline bench/throughput.csv
+//
+// Every combination of the list options is run; each run gets a fresh
+// simulator started with --exit-on-run, so flash state never carries over.
+// With --baseline the records are checked against a saved CSV sweep:
+// bytes/s may not drop by more than --tolerance, and error-free runs must
+// take the same number of frames.
+#include "nuisp/impaired_link.hpp"
+#include "nuisp/packet_cache.hpp"
+#include "nuisp/serial_port.hpp"
+#include "nuisp/session.hpp"
+
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <getopt.h>
+#include <map>
+#include <optional>
+#include <poll.h>
+#include <random>
+#include <string>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace nuisp;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr std::uint32_t kDefaultBaud = 38400;
+constexpr std::size_t kM2003Aprom = 0x8000;   // simulator default
+constexpr std::size_t kMs51Aprom = 12 * 1024;  // 16 KB less the 4 KB LDROM
+constexpr std::chrono::milliseconds kConnectWindow{5000};
+constexpr std::chrono::milliseconds kExitWait{3000};
+
+enum LongOnly
+{
+    kSimM2003 = 256,
+    kSimMs51,
+    kSeed,
+    kBaseline,
+    kUpdateBaseline,
+};
+
+void usage()
+{
+    std::fprintf(stderr,
+                 "usage: nuisp-bench [options]\n"
+                 "\n"
+                 "Runs full update sessions against nuisp-sim-m2003 (Delta) and\n"
+                 "nuisp-sim-ms51 (W20B) and reports per-phase times. LIST options take\n"
+                 "comma-separated values; every combination is run.\n"
+                 "\n"
+                 "options:\n"
+                 "  -V, --variant V         delta, w20b or both (default both)\n"
+                 "  -b, --baud LIST         bit rates (default 38400); Delta switches with\n"
+                 "                          CMD_SET_SPEED after connecting, W20B runs at\n"
+                 "                          38400 only\n"
+                 "  -n, --size LIST         image sizes, k suffix for KiB (default 4k)\n"
+                 "  -F, --fill LIST         fraction of 32-bit words that are not blank\n"
+                 "                          (default 1)\n"
+                 "  -L, --latency-us LIST   one-way delay added per write and read (default 0)\n"
+                 "  -e, --error-rate LIST   probability of a flipped bit per byte, both\n"
+                 "                          directions (default 0)\n"
+                 "  -r, --repeat N          runs per combination (default 1)\n"
+                 "  -s, --time-scale S      simulator time scale, 0 = as fast as possible;\n"
+                 "                          bit rates only matter at 1 (default 1)\n"
+                 "  -o, --format FMT        jsonl or csv (default jsonl)\n"
+                 "      --seed N            image and bit error seed (default 1)\n"
+                 "      --baseline FILE     compare with a sweep saved with -o csv; exit 1\n"
+                 "                          on a regression\n"
+                 "  -t, --tolerance PCT     bytes/s drop allowed against the baseline\n"
+                 "                          (default 10)\n"
+                 "      --update-baseline   write this sweep to the --baseline file instead\n"
+                 "      --sim-m2003 PATH    Delta simulator (default: next to nuisp-bench)\n"
+                 "      --sim-ms51 PATH     W20B simulator (default: next to nuisp-bench)\n"
+                 "  -v, --verbose           pass the simulators' log through to stderr\n");
+}
+
+template<typename T, typename Parse>
+std::vector<T> parseList(const char* arg, Parse parse)
+{
+    std::vector<T> out;
+    std::string s(arg);
+    std::size_t pos = 0;
+    while (pos <= s.size()) {
+        const std::size_t comma = std::min(s.find(',', pos), s.size());
+        out.push_back(parse(s.substr(pos, comma - pos)));
+        pos = comma + 1;
+    }
+    return out;
+}
+
+std::size_t parseSize(const std::string& s)
+{
+    char* end = nullptr;
+    std::size_t n = std::strtoul(s.c_str(), &end, 0);
+    if (*end == 'k' || *end == 'K') {
+        n *= 1024;
+    }
+    return n;
+}
+
+std::string selfDir()
+{
+    char buf[4096];
+    const ssize_t n = ::readlink("/proc/self/exe", buf, sizeof(buf) - 1);
+    if (n <= 0) {
+        return ".";
+    }
+    std::string path(buf, static_cast<std::size_t>(n));
+    return path.substr(0, path.rfind('/'));
+}
+
+// A simulator child on its own pty; killed on destruction if still running.
+class Simulator
+{
+public:
+    Simulator(const std::string& exe, const std::vector<std::string>& args, bool verbose)
+    {
+        int out[2];
+        if (::pipe2(out, O_CLOEXEC) != 0) {
+            throw Error(std::string("pipe: ") + std::strerror(errno));
+        }
+        pid_ = ::fork();
+        if (pid_ < 0) {
+            throw Error(std::string("fork: ") + std::strerror(errno));
+        }
+        if (pid_ == 0) {
+            ::dup2(out[1], STDOUT_FILENO);
+            if (!verbose) {
+                const int null = ::open("/dev/null", O_WRONLY);
+                ::dup2(null, STDERR_FILENO);
+            }
+            std::vector<char*> argv{const_cast<char*>(exe.c_str())};
+            for (const std::string& a : args) {
+                argv.push_back(const_cast<char*>(a.c_str()));
+            }
+            argv.push_back(nullptr);
+            ::execv(exe.c_str(), argv.data());
+            std::fprintf(stderr, "nuisp-bench: %s: %s\n", exe.c_str(), std::strerror(errno));
+            ::_exit(127);
+        }
+        ::close(out[1]);
+
+        // the simulator prints the pty slave path once it is ready
+        char c;
+        pollfd pfd{out[0], POLLIN, 0};
+        while (::poll(&pfd, 1, 5000) == 1 && ::read(out[0], &c, 1) == 1 && c != '\n') {
+            pty_ += c;
+        }
+        ::close(out[0]);
+        if (pty_.empty()) {
+            throw Error(exe + " did not start");
+        }
+    }
+
+    ~Simulator()
+    {
+        if (pid_ > 0 && !wait(std::chrono::milliseconds(0))) {
+            ::kill(pid_, SIGTERM);
+            if (!wait(std::chrono::milliseconds(500))) {
+                ::kill(pid_, SIGKILL);
+                ::waitpid(pid_, nullptr, 0);
+            }
+        }
+    }
+
+    Simulator(const Simulator&) = delete;
+    Simulator& operator=(const Simulator&) = delete;
+
+    const std::string& pty() const { return pty_; }
+
+    // True once the child has exited.
+    bool wait(std::chrono::milliseconds timeout)
+    {
+        const auto deadline = Clock::now() + timeout;
+        for (;;) {
+            if (::waitpid(pid_, nullptr, WNOHANG) == pid_) {
+                pid_ = -1;
+                return true;
+            }
+            if (Clock::now() >= deadline) {
+                return false;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+    }
+
+private:
+    pid_t pid_ = -1;
+    std::string pty_;
+};
+
+struct Params
+{
+    Variant variant = Variant::Delta;
+    std::uint32_t baud = kDefaultBaud;
+    std::size_t size = 0;
+    double fill = 1.0;
+    long latencyUs = 0;
+    double errorRate = 0.0;
+    unsigned run = 0;
+};
+
+struct Result
+{
+    bool ok = false;
+    std::string error;
+    double total = 0.0;
+    std::optional<double> connect, speed, erase, program, verify, run;
+    SessionStats session;
+    ImpairmentStats link;
+};
+
+// Blank flash with a fraction of the words set to random data, the same
+// image for the same size, fill and seed.
+std::vector<std::uint8_t> makeImage(std::size_t size, double fill, std::uint32_t seed)
+{
+    std::mt19937 rng(seed ^ static_cast<std::uint32_t>(size));
+    std::bernoulli_distribution used(fill);
+    std::vector<std::uint8_t> image(size, 0xFF);
+    for (std::size_t i = 0; i < size; i += 4) {
+        if (used(rng)) {
+            const std::uint32_t w = rng();
+            for (std::size_t j = 0; j < 4 && i + j < size; ++j) {
+                image[i + j] = static_cast<std::uint8_t>(w >> (8 * j));
+            }
+        }
+    }
+    return image;
+}
+
+template<typename F>
+double timed(F&& f)
+{
+    const auto t0 = Clock::now();
+    f();
+    return std::chrono::duration<double>(Clock::now() - t0).count();
+}
+
+Result runOnce(const Params& p, const PacketCache& cache, const std::string& exe,
+               std::vector<std::string> simArgs, std::uint32_t seed, bool verbose)
+{
+    Result r;
+    Simulator sim(exe, simArgs, verbose);
+    try {
+        SerialPort port(sim.pty(), kDefaultBaud);
+        Impairment impairment;
+        impairment.latency = std::chrono::microseconds(p.latencyUs);
+        impairment.byteErrorRate = p.errorRate;
+        impairment.seed = seed + p.run;
+        ImpairedLink link(port, impairment);
+        Session session(link, p.variant);
+
+        try {
+            r.connect = timed([&] { session.connect(kConnectWindow); });
+            if (p.baud != kDefaultBaud) {
+                r.speed = timed([&] {
+                    if (!session.setSpeed(p.baud)) {
+                        throw Error("device declined CMD_SET_SPEED");
+                    }
+                });
+            }
+            r.erase = timed([&] { session.eraseAll(); });
+            r.program = timed([&] { session.program(cache); });
+            if (p.variant == Variant::Delta) {
+                r.verify = timed([&] { session.verify(0, cache); });
+            }
+            r.run = timed([&] { session.run(); });
+            r.ok = true;
+        } catch (const std::exception& e) {
+            r.error = e.what();
+        }
+        r.session = session.stats();
+        r.link = link.stats();
+    } catch (const std::exception& e) {
+        r.error = e.what();
+    }
+
+    for (const auto& phase : {r.connect, r.speed, r.erase, r.program, r.verify, r.run}) {
+        r.total += phase.value_or(0.0);
+    }
+    // with --exit-on-run the simulator leaves once CMD_RUN_APROM is in
+    if (r.ok && !sim.wait(kExitWait)) {
+        r.ok = false;
+        r.error = "simulator did not leave the bootloader";
+    }
+    return r;
+}
+
+std::string jsonString(const std::string& s)
+{
+    std::string out = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+        }
+        out += (static_cast<unsigned char>(c) < 0x20) ? ' ' : c;
+    }
+    return out + '"';
+}
+
+std::string seconds(const std::optional<double>& v, bool json)
+{
+    if (!v) {
+        return json ? "null" : "";
+    }
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%.6f", *v);
+    return buf;
+}
+
+const char* kColumns[] = {
+    "variant", "baud", "frame", "size", "fill", "latency_us", "error_rate", "time_scale",
+    "run", "ok", "error", "seconds", "bytes_per_s", "connect_s", "speed_s", "erase_s",
+    "program_s", "verify_s", "run_s", "frames", "resends", "corrupted_out", "corrupted_in",
+};
+
+// The record's columns as printed, numbers without JSON quoting.
+std::vector<std::string> fields(const Params& p, double timeScale, const Result& r, bool json)
+{
+    const double rate = r.ok && r.total > 0 ? static_cast<double>(p.size) / r.total : 0.0;
+    char num[64];
+    std::vector<std::string> v;
+    v.push_back(p.variant == Variant::Delta ? "delta" : "w20b");
+    v.push_back(std::to_string(p.baud));
+    v.push_back(std::to_string(kFrameSize));
+    v.push_back(std::to_string(p.size));
+    std::snprintf(num, sizeof(num), "%g", p.fill);
+    v.push_back(num);
+    v.push_back(std::to_string(p.latencyUs));
+    std::snprintf(num, sizeof(num), "%g", p.errorRate);
+    v.push_back(num);
+    std::snprintf(num, sizeof(num), "%g", timeScale);
+    v.push_back(num);
+    v.push_back(std::to_string(p.run));
+    v.push_back(r.ok ? "true" : "false");
+    v.push_back(r.error);
+    v.push_back(seconds(r.total, json));
+    std::snprintf(num, sizeof(num), "%.1f", rate);
+    v.push_back(num);
+    for (const auto& phase : {r.connect, r.speed, r.erase, r.program, r.verify, r.run}) {
+        v.push_back(seconds(phase, json));
+    }
+    v.push_back(std::to_string(r.session.frames));
+    v.push_back(std::to_string(r.session.resends));
+    v.push_back(std::to_string(r.link.corruptedOut));
+    v.push_back(std::to_string(r.link.corruptedIn));
+    return v;
+}
+
+// Columns that name a combination, and the ones compared with a baseline
+constexpr std::size_t kKeyColumns[] = {0, 1, 3, 4, 5, 6, 7};
+constexpr std::size_t kErrorRateColumn = 6;
+constexpr std::size_t kOkColumn = 9;
+constexpr std::size_t kRateColumn = 12;
+constexpr std::size_t kFramesColumn = 19;
+
+std::string csvHeader()
+{
+    std::string line;
+    for (std::size_t i = 0; i < std::size(kColumns); ++i) {
+        line += i ? "," : "";
+        line += kColumns[i];
+    }
+    return line;
+}
+
+std::string recordKey(const std::vector<std::string>& v)
+{
+    std::string key;
+    for (std::size_t i : kKeyColumns) {
+        key += key.empty() ? "" : " ";
+        key += std::string(kColumns[i]) + "=" + v[i];
+    }
+    return key;
+}
+
+// Splits a line as emit() writes it: only the error text is quoted.
+std::vector<std::string> splitCsv(const std::string& line)
+{
+    std::vector<std::string> out(1);
+    bool quoted = false;
+    for (std::size_t i = 0; i < line.size(); ++i) {
+        const char c = line[i];
+        if (quoted && c == '\\' && i + 1 < line.size()) {
+            out.back() += line[++i];
+        } else if (c == '"') {
+            quoted = !quoted;
+        } else if (c == ',' && !quoted) {
+            out.emplace_back();
+        } else {
+            out.back() += c;
+        }
+    }
+    return out;
+}
+
+// Successful runs of one combination; repeats are averaged.
+struct Reference
+{
+    double rate = 0.0;
+    unsigned runs = 0;
+    std::string frames;
+    bool clean = false;  // no bit errors, so the frame count is exact
+};
+
+std::map<std::string, Reference> summarize(const std::vector<std::vector<std::string>>& records)
+{
+    std::map<std::string, Reference> out;
+    for (const auto& v : records) {
+        if (v[kOkColumn] != "true") {
+            continue;
+        }
+        Reference& ref = out[recordKey(v)];
+        ref.rate += std::strtod(v[kRateColumn].c_str(), nullptr);
+        ref.runs++;
+        ref.frames = v[kFramesColumn];
+        ref.clean = std::strtod(v[kErrorRateColumn].c_str(), nullptr) == 0.0;
+    }
+    for (auto& [key, ref] : out) {
+        ref.rate /= ref.runs;
+    }
+    return out;
+}
+
+std::vector<std::vector<std::string>> loadRecords(const std::string& path)
+{
+    std::ifstream in(path);
+    if (!in) {
+        throw Error(path + ": " + std::strerror(errno));
+    }
+    std::string line;
+    if (!std::getline(in, line) || line != csvHeader()) {
+        throw Error(path + " is not a nuisp-bench -o csv sweep of this version");
+    }
+    std::vector<std::vector<std::string>> records;
+    while (std::getline(in, line)) {
+        if (line.empty()) {
+            continue;
+        }
+        records.push_back(splitCsv(line));
+        if (records.back().size() != std::size(kColumns)) {
+            throw Error(path + ": malformed record '" + line + "'");
+        }
+    }
+    return records;
+}
+
+void saveRecords(const std::string& path, const std::vector<std::vector<std::string>>& records)
+{
+    std::ofstream out(path, std::ios::trunc);
+    out << csvHeader() << '\n';
+    for (const auto& v : records) {
+        for (std::size_t i = 0; i < v.size(); ++i) {
+            out << (i ? "," : "") << (i == 10 ? jsonString(v[i]) : v[i]);
+        }
+        out << '\n';
+    }
+    if (!out.flush()) {
+        throw Error(path + ": write failed");
+    }
+}
+
+// Prints each regression and returns how many there were.
+unsigned compare(const std::vector<std::vector<std::string>>& records, const std::string& path,
+                 double tolerance)
+{
+    const std::map<std::string, Reference> base = summarize(loadRecords(path));
+    unsigned regressions = 0, matched = 0;
+    for (const auto& [key, now] : summarize(records)) {
+        const auto it = base.find(key);
+        if (it == base.end()) {
+            std::fprintf(stderr, "nuisp-bench: %s: not in %s\n", key.c_str(), path.c_str());
+            continue;
+        }
+        const Reference& ref = it->second;
+        const double change = ref.rate > 0 ? (now.rate / ref.rate - 1.0) * 100.0 : 0.0;
+        matched++;
+        if (change < -tolerance) {
+            std::fprintf(stderr, "nuisp-bench: %s: %.1f bytes/s, baseline %.1f (%+.1f%%)\n",
+                         key.c_str(), now.rate, ref.rate, change);
+            regressions++;
+        } else if (now.clean && now.frames != ref.frames) {
+            std::fprintf(stderr, "nuisp-bench: %s: %s frames, baseline %s\n", key.c_str(),
+                         now.frames.c_str(), ref.frames.c_str());
+            regressions++;
+        }
+    }
+    std::fprintf(stderr, "nuisp-bench: %u of %u combinations within %g%% of %s\n",
+                 matched - regressions, matched, tolerance, path.c_str());
+    return regressions;
+}
+
+void emit(const std::vector<std::string>& v, bool json)
+{
+    std::string line;
+    for (std::size_t i = 0; i < v.size(); ++i) {
+        if (json) {
+            line += i == 0 ? "{" : ",";
+            line += jsonString(kColumns[i]) + ":";
+            line += (i == 0 || i == 10) ? jsonString(v[i]) : v[i];
+        } else {
+            line += i == 0 ? "" : ",";
+            // CSV: quote the error text, the only free-form column
+            line += i == 10 ? jsonString(v[i]) : v[i];
+        }
+    }
+    std::printf("%s%s\n", line.c_str(), json ? "}" : "");
+    std::fflush(stdout);
+}
+
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    static const option longOptions[] = {
+        {"variant", required_argument, nullptr, 'V'},
+        {"baud", required_argument, nullptr, 'b'},
+        {"size", required_argument, nullptr, 'n'},
+        {"fill", required_argument, nullptr, 'F'},
+        {"latency-us", required_argument, nullptr, 'L'},
+        {"error-rate", required_argument, nullptr, 'e'},
+        {"repeat", required_argument, nullptr, 'r'},
+        {"time-scale", required_argument, nullptr, 's'},
+        {"format", required_argument, nullptr, 'o'},
+        {"seed", required_argument, nullptr, kSeed},
+        {"baseline", required_argument, nullptr, kBaseline},
+        {"tolerance", required_argument, nullptr, 't'},
+        {"update-baseline", no_argument, nullptr, kUpdateBaseline},
+        {"sim-m2003", required_argument, nullptr, kSimM2003},
+        {"sim-ms51", required_argument, nullptr, kSimMs51},
+        {"verbose", no_argument, nullptr, 'v'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+
+    auto toBaud = [](const std::string& s) {
+        return static_cast<std::uint32_t>(std::strtoul(s.c_str(), nullptr, 0));
+    };
+    auto toDouble = [](const std::string& s) { return std::strtod(s.c_str(), nullptr); };
+    auto toLong = [](const std::string& s) { return std::strtol(s.c_str(), nullptr, 0); };
+
+    std::vector<Variant> variants{Variant::Delta, Variant::W20B};
+    std::vector<std::uint32_t> bauds{kDefaultBaud};
+    std::vector<std::size_t> sizes{4096};
+    std::vector<double> fills{1.0};
+    std::vector<long> latencies{0};
+    std::vector<double> errorRates{0.0};
+    unsigned repeat = 1;
+    double timeScale = 1.0;
+    bool json = true;
+    bool verbose = false;
+    std::uint32_t seed = 1;
+    std::string baseline;
+    double tolerance = 10.0;
+    bool updateBaseline = false;
+    std::string simM2003 = selfDir() + "/nuisp-sim-m2003";
+    std::string simMs51 = selfDir() + "/nuisp-sim-ms51";
+
+    int c;
+    while ((c = getopt_long(argc, argv, "V:b:n:F:L:e:r:s:o:t:vh", longOptions, nullptr)) != -1) {
+        switch (c) {
+        case 'V':
+            if (std::strcmp(optarg, "delta") == 0) {
+                variants = {Variant::Delta};
+            } else if (std::strcmp(optarg, "w20b") == 0) {
+                variants = {Variant::W20B};
+            } else if (std::strcmp(optarg, "both") != 0) {
+                usage();
+                return 2;
+            }
+            break;
+        case 'b': bauds = parseList<std::uint32_t>(optarg, toBaud); break;
+        case 'n': sizes = parseList<std::size_t>(optarg, parseSize); break;
+        case 'F': fills = parseList<double>(optarg, toDouble); break;
+        case 'L': latencies = parseList<long>(optarg, toLong); break;
+        case 'e': errorRates = parseList<double>(optarg, toDouble); break;
+        case 'r': repeat = static_cast<unsigned>(std::strtoul(optarg, nullptr, 0)); break;
+        case 's': timeScale = std::strtod(optarg, nullptr); break;
+        case 'o':
+            if (std::strcmp(optarg, "jsonl") == 0 || std::strcmp(optarg, "csv") == 0) {
+                json = optarg[0] == 'j';
+            } else {
+                usage();
+                return 2;
+            }
+            break;
+        case 't': tolerance = std::strtod(optarg, nullptr); break;
+        case kSeed: seed = static_cast<std::uint32_t>(std::strtoul(optarg, nullptr, 0)); break;
+        case kBaseline: baseline = optarg; break;
+        case kUpdateBaseline: updateBaseline = true; break;
+        case kSimM2003: simM2003 = optarg; break;
+        case kSimMs51: simMs51 = optarg; break;
+        case 'v': verbose = true; break;
+        default: usage(); return c == 'h' ? 0 : 2;
+        }
+    }
+    if (optind != argc || repeat == 0 || (updateBaseline && baseline.empty())) {
+        usage();
+        return 2;
+    }
+
+    // a session that stops half way leaves the simulator waiting on the pty
+    std::signal(SIGPIPE, SIG_IGN);
+
+    if (!json) {
+        std::printf("%s\n", csvHeader().c_str());
+    }
+
+    char scale[32];
+    std::snprintf(scale, sizeof(scale), "%g", timeScale);
+    bool skippedBaud = false, skippedSize = false;
+    unsigned failed = 0;
+    std::vector<std::vector<std::string>> records;
+
+    for (Variant variant : variants) {
+        const bool delta = variant == Variant::Delta;
+        for (std::size_t size : sizes) {
+            if (size == 0 || (!delta && size > kMs51Aprom)) {
+                skippedSize |= size != 0;
+                continue;
+            }
+            std::vector<std::string> simArgs{"-x", "-s", scale};
+            if (delta && size > kM2003Aprom) {
+                simArgs.push_back("--aprom-size");
+                simArgs.push_back(std::to_string((size + 511) / 512 * 512));
+            }
+            for (double fill : fills) {
+                const PacketCache cache =
+                    PacketCache::build(variant, cmd::UpdateAprom, makeImage(size, fill, seed));
+                for (std::uint32_t baud : bauds) {
+                    if (!delta && baud != kDefaultBaud) {
+                        skippedBaud = true;
+                        continue;
+                    }
+                    for (long latency : latencies) {
+                        for (double errorRate : errorRates) {
+                            for (unsigned run = 0; run < repeat; ++run) {
+                                const Params p{variant, baud, size, fill, latency, errorRate, run};
+                                Result r;
+                                try {
+                                    r = runOnce(p, cache, delta ? simM2003 : simMs51, simArgs,
+                                                seed, verbose);
+                                } catch (const std::exception& e) {
+                                    r.error = e.what();
+                                }
+                                failed += r.ok ? 0 : 1;
+                                emit(fields(p, timeScale, r, json), json);
+                                records.push_back(fields(p, timeScale, r, false));
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    if (skippedBaud) {
+        std::fprintf(stderr, "nuisp-bench: W20B runs at 38400 baud only, other rates skipped\n");
+    }
+    if (skippedSize) {
+        std::fprintf(stderr, "nuisp-bench: W20B APROM is 12 KB, larger images skipped\n");
+    }
+    if (failed != 0) {
+        return 1;
+    }
+
+    try {
+        if (updateBaseline) {
+            saveRecords(baseline, records);
+            std::fprintf(stderr, "nuisp-bench: %zu records written to %s\n", records.size(),
+                         baseline.c_str());
+        } else if (!baseline.empty() && compare(records, baseline, tolerance) != 0) {
+            return 1;
+        }
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "nuisp-bench: %s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
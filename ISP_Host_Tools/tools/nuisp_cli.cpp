@@ -0,0 +1,320 @@
+// SPDX-License-Identifier: Apache-2.0
+//
+// nuisp: command-line ISP programmer for the Delta (KN44490A) and W20B
+// LDROM bootloaders.
+//
+//   nuisp -p /dev/ttyUSB0 info
+//   nuisp -p /dev/ttyUSB0 erase program app.bin verify app.bin run
+#include "nuisp/adaptive.hpp"
+#include "nuisp/capture.hpp"
+#include "nuisp/flash_map.hpp"
+#include "nuisp/image.hpp"
+#include "nuisp/packet_cache.hpp"
+#include "nuisp/patch.hpp"
+#include "nuisp/serial_port.hpp"
+#include "nuisp/session.hpp"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <getopt.h>
+#include <optional>
+#include <string>
+#include <vector>
+
+using namespace nuisp;
+
+namespace {
+
+void usage()
+{
+    std::fprintf(stderr,
+                 "usage: nuisp -p PORT [options] COMMAND...\n"
+                 "\n"
+                 "options:\n"
+                 "  -p, --port PATH         serial port or pty\n"
+                 "  -b, --baud RATE         bit rate (default 38400)\n"
+                 "  -w, --w20b              W20B (MS51) bootloader instead of Delta\n"
+                 "  -c, --connect-ms MS     how long to retry CMD_CONNECT (default 5000)\n"
+                 "  -d, --dataflash         program/verify data flash instead of APROM\n"
+                 "  -q, --quiet             no progress output\n"
+                 "  -C, --capture FILE      record every frame with timestamps, for nuisp-trace\n"
+                 "  -A, --adapt             adapt bit rate and frame gap to the link's error\n"
+                 "                          rate (Delta with CMD_SET_SPEED); -b is the\n"
+                 "                          bootloader's power-on rate\n"
+                 "  -S, --adapt-state FILE  keep the station's adaptation state in FILE\n"
+                 "  -k, --config            also write the CONFIG words an ELF, HEX or\n"
+                 "                          S-record image sets\n"
+                 "\n"
+                 "commands, run in order after connecting:\n"
+                 "  info                    firmware version, device ID, CONFIG, device info\n"
+                 "  erase                   erase APROM and data flash\n"
+                 "  program FILE            program a .bin, .hex, .srec, .elf or .nupc image,\n"
+                 "                          verified frame by frame; addressed images go to\n"
+                 "                          APROM and data flash as the device reports them\n"
+                 "  verify FILE             read back and compare (Delta)\n"
+                 "  patch FILE.nupd         rebuild APROM from a nuisp-diff patch against\n"
+                 "                          the image installed now (simulator only)\n"
+                 "  run                     leave the bootloader and boot APROM\n");
+}
+
+struct Part
+{
+    const char* region;
+    std::uint32_t address;
+    PacketCache cache;
+};
+
+void printProgress(std::size_t done, std::size_t total)
+{
+    std::fprintf(stderr, "\r  %zu / %zu bytes", done, total);
+    if (done == total) {
+        std::fprintf(stderr, "\n");
+    }
+}
+
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    static const option longOptions[] = {
+        {"port", required_argument, nullptr, 'p'},
+        {"baud", required_argument, nullptr, 'b'},
+        {"w20b", no_argument, nullptr, 'w'},
+        {"connect-ms", required_argument, nullptr, 'c'},
+        {"dataflash", no_argument, nullptr, 'd'},
+        {"quiet", no_argument, nullptr, 'q'},
+        {"capture", required_argument, nullptr, 'C'},
+        {"adapt", no_argument, nullptr, 'A'},
+        {"adapt-state", required_argument, nullptr, 'S'},
+        {"config", no_argument, nullptr, 'k'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+
+    std::string port, capturePath, statePath;
+    std::uint32_t baud = 38400;
+    Variant variant = Variant::Delta;
+    long connectMs = 5000;
+    Target target = Target::Aprom;
+    bool quiet = false;
+    bool adapt = false;
+    bool writeConfig = false;
+
+    int c;
+    while ((c = getopt_long(argc, argv, "p:b:wc:dqC:AS:kh", longOptions, nullptr)) != -1) {
+        switch (c) {
+        case 'p': port = optarg; break;
+        case 'b': baud = static_cast<std::uint32_t>(std::strtoul(optarg, nullptr, 0)); break;
+        case 'w': variant = Variant::W20B; break;
+        case 'c': connectMs = std::strtol(optarg, nullptr, 0); break;
+        case 'd': target = Target::Dataflash; break;
+        case 'q': quiet = true; break;
+        case 'C': capturePath = optarg; break;
+        case 'A': adapt = true; break;
+        case 'S': statePath = optarg; adapt = true; break;
+        case 'k': writeConfig = true; break;
+        default: usage(); return c == 'h' ? 0 : 2;
+        }
+    }
+
+    std::vector<std::string> commands(argv + optind, argv + argc);
+    if (port.empty() || commands.empty()) {
+        usage();
+        return 2;
+    }
+
+    std::optional<LinkTuner> tuner;
+    try {
+        if (adapt) {
+            // the default ladder above the power-on rate
+            TunerPolicy policy;
+            std::erase_if(policy.rates, [&](std::uint32_t r) { return r <= baud; });
+            policy.rates.insert(policy.rates.begin(), baud);
+            policy.startRate = std::min<std::size_t>(policy.startRate, policy.rates.size() - 1);
+            tuner.emplace(policy);
+            if (!statePath.empty()) {
+                tuner->load(statePath);
+            }
+        }
+
+        SerialPort serial(port, baud);
+        std::optional<CaptureWriter> capture;
+        std::optional<CaptureLink> captured;
+        Link* link = &serial;
+        if (!capturePath.empty()) {
+            link = &captured.emplace(serial, capture.emplace(capturePath, baud));
+        }
+        Session session(*link, variant);
+        std::optional<AdaptiveSession> adaptive;
+        if (tuner) {
+            adaptive.emplace(session, *tuner);
+        }
+        const Progress progress = quiet ? Progress{} : Progress{printProgress};
+        const auto start = std::chrono::steady_clock::now();
+
+        if (adaptive) {
+            adaptive->connect(std::chrono::milliseconds(connectMs));
+        } else {
+            session.connect(std::chrono::milliseconds(connectMs));
+        }
+        std::optional<DeviceInfo> info = session.deviceInfo();
+
+        for (std::size_t i = 0; i < commands.size(); ++i) {
+            const std::string& cmd = commands[i];
+
+            if (cmd == "info") {
+                std::printf("firmware version  0x%02X\n", session.firmwareVersion());
+                std::printf("device id         0x%08X\n", session.deviceId());
+                auto config = session.readConfig();
+                std::printf("config            0x%08X 0x%08X\n", config[0], config[1]);
+                if (info) {
+                    std::printf("aprom size        %u\n", info->apromSize);
+                    std::printf("data flash        0x%08X, %u bytes\n", info->dataflashAddr,
+                                info->dataflashSize);
+                    std::printf("uid               %08X %08X %08X\n", info->uid[0], info->uid[1],
+                                info->uid[2]);
+                    std::printf("capabilities      0x%08X\n", info->capabilities);
+                }
+            } else if (cmd == "erase") {
+                if (adaptive) {
+                    adaptive->eraseAll();
+                } else {
+                    session.eraseAll();
+                }
+            } else if (cmd == "program" || cmd == "verify") {
+                if (++i == commands.size()) {
+                    usage();
+                    return 2;
+                }
+                const std::string& file = commands[i];
+                std::vector<Part> parts;
+                std::vector<std::uint32_t> config;
+                if (target == Target::Aprom && info && !file.ends_with(".nupc") &&
+                    imageFormat(file) != ImageFormat::Binary) {
+                    // addressed image: let the device's geometry say where each part goes
+                    FlashImages images =
+                        splitFlashMap(loadFlashMap(file), FlashGeometry::from(*info));
+                    if (!images.aprom.empty()) {
+                        parts.push_back({"APROM", 0,
+                                         PacketCache::build(variant, cmd::UpdateAprom,
+                                                            images.aprom)});
+                    }
+                    if (!images.dataflash.empty()) {
+                        parts.push_back({"data flash", info->dataflashAddr,
+                                         PacketCache::build(variant, cmd::UpdateDataflash,
+                                                            images.dataflash)});
+                    }
+                    config = std::move(images.config);
+                } else {
+                    const std::uint32_t command =
+                        target == Target::Aprom ? cmd::UpdateAprom : cmd::UpdateDataflash;
+                    PacketCache cache =
+                        file.ends_with(".nupc")
+                            ? PacketCache::open(file)
+                            : PacketCache::build(variant, command, loadImageFile(file));
+                    if (cache.command() != command) {
+                        throw Error(file + " was packed for the other flash region");
+                    }
+                    std::uint32_t address = 0;
+                    if (target == Target::Dataflash) {
+                        if (!info && cmd == "verify") {
+                            throw Error("data flash address unknown, firmware lacks CMD_GET_DEVICE_INFO");
+                        }
+                        address = info ? info->dataflashAddr : 0;
+                    }
+                    parts.push_back({target == Target::Aprom ? "APROM" : "data flash", address,
+                                     std::move(cache)});
+                }
+
+                for (const Part& part : parts) {
+                    if (!quiet) {
+                        std::fprintf(stderr, "%s %s (%s)\n", cmd.c_str(), file.c_str(),
+                                     part.region);
+                    }
+                    if (cmd == "program" && adaptive) {
+                        adaptive->program(part.cache, progress);
+                    } else if (cmd == "program") {
+                        session.program(part.cache, progress);
+                    } else if (adaptive) {
+                        adaptive->verify(part.address, part.cache, progress);
+                    } else {
+                        session.verify(part.address, part.cache, progress);
+                    }
+                }
+
+                if (!config.empty() && !writeConfig) {
+                    std::fprintf(stderr, "%s sets CONFIG, left alone without --config\n",
+                                 file.c_str());
+                } else if (!config.empty()) {
+                    std::array<std::uint32_t, 4> want = session.readConfig();
+                    std::copy_n(config.begin(), std::min(config.size(), want.size()), want.begin());
+                    const std::array<std::uint32_t, 4> got =
+                        cmd == "program" ? session.updateConfig(want) : session.readConfig();
+                    for (std::size_t w = 0; w < std::min(config.size(), got.size()); ++w) {
+                        if (got[w] != want[w]) {
+                            char msg[96];
+                            std::snprintf(msg, sizeof(msg),
+                                          "CONFIG%zu reads 0x%08X, image sets 0x%08X", w, got[w],
+                                          want[w]);
+                            throw Error(msg);
+                        }
+                    }
+                }
+            } else if (cmd == "patch") {
+                if (++i == commands.size()) {
+                    usage();
+                    return 2;
+                }
+                const Patch patch = loadPatchFile(commands[i]);
+                if (!info || !(info->capabilities & cap::ApplyPatch)) {
+                    throw Error("firmware lacks CMD_APPLY_PATCH");
+                }
+                if (!quiet) {
+                    std::fprintf(stderr, "patch %s (%u pages, %zu bytes)\n", commands[i].c_str(),
+                                 patch.pages, patch.stream.size());
+                }
+                session.applyPatch(patch, progress);
+            } else if (cmd == "run") {
+                session.run();
+            } else {
+                std::fprintf(stderr, "unknown command '%s'\n", cmd.c_str());
+                return 2;
+            }
+        }
+
+        if (!quiet) {
+            const double secs =
+                std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            const SessionStats& st = session.stats();
+            std::fprintf(stderr, "%llu frames, %llu resends, %llu payload bytes in %.2f s (%.0f B/s)\n",
+                         static_cast<unsigned long long>(st.frames),
+                         static_cast<unsigned long long>(st.resends),
+                         static_cast<unsigned long long>(st.payloadBytes), secs,
+                         secs > 0 ? static_cast<double>(st.payloadBytes) / secs : 0.0);
+            if (adaptive) {
+                const TunerStats& ts = tuner->stats();
+                std::fprintf(stderr, "link at %u baud, %u steps up, %u down, %llu time-outs\n",
+                             adaptive->baud(), ts.stepsUp, ts.stepsDown,
+                             static_cast<unsigned long long>(ts.timeouts));
+            }
+        }
+        if (!statePath.empty()) {
+            tuner->save(statePath);
+        }
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "nuisp: %s\n", e.what());
+        // a failed board is worth remembering too
+        if (tuner && !statePath.empty()) {
+            try {
+                tuner->save(statePath);
+            } catch (const Error& se) {
+                std::fprintf(stderr, "nuisp: %s\n", se.what());
+            }
+        }
+        return 1;
+    }
+    return 0;
+}
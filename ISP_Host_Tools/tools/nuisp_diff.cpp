@@ -0,0 +1,71 @@
+// SPDX-License-Identifier: Apache-2.0
+//
+// nuisp-diff: binary patch from the APROM image a device runs to a new
+// one, for CMD_APPLY_PATCH (nuisp ... patch FILE.nupd).
+//
+//   nuisp-diff app-1.0.hex app-1.1.hex app-1.1.nupd
+#include "nuisp/image.hpp"
+#include "nuisp/link.hpp"
+#include "nuisp/packet_cache.hpp"
+#include "nuisp/patch.hpp"
+
+#include <cstdio>
+#include <getopt.h>
+#include <string>
+
+using namespace nuisp;
+
+namespace {
+
+void usage()
+{
+    std::fprintf(stderr, "usage: nuisp-diff OLD NEW OUT.nupd\n"
+                         "\n"
+                         "OLD is the image installed on the device, NEW the one to patch it to;\n"
+                         "either may be a .bin, .hex, .srec or .elf APROM image.\n");
+}
+
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    static const option longOptions[] = {
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+
+    int c;
+    while ((c = getopt_long(argc, argv, "h", longOptions, nullptr)) != -1) {
+        usage();
+        return c == 'h' ? 0 : 2;
+    }
+    if (argc - optind != 3) {
+        usage();
+        return 2;
+    }
+
+    try {
+        const std::vector<std::uint8_t> base = loadImageFile(argv[optind]);
+        const std::vector<std::uint8_t> image = loadImageFile(argv[optind + 1]);
+        const Patch patch = makePatch(base, image);
+        savePatchFile(argv[optind + 2], patch);
+
+        // what CMD_UPDATE_APROM would send instead
+        const PacketCache full = PacketCache::build(Variant::Delta, cmd::UpdateAprom, image);
+        const std::size_t first = kFrameSize - 8 - kPatchHeaderSize;
+        const std::size_t frames =
+            2 + (patch.stream.size() > first
+                     ? (patch.stream.size() - first + kNextDataSize - 1) / kNextDataSize
+                     : 0);
+        std::printf("base       %u bytes, crc32 0x%08X\n", patch.baseSize, patch.baseCrc);
+        std::printf("image      %u bytes, crc32 0x%08X\n", patch.imageSize, patch.imageCrc);
+        std::printf("pages      %u rewritten\n", patch.pages);
+        std::printf("stream     %zu bytes\n", patch.stream.size());
+        std::printf("frames     %zu, %zu for a full program\n",
+                    patch.stream.empty() ? std::size_t{1} : frames, full.frameCount());
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "nuisp-diff: %s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
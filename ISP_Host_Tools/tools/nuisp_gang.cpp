@@ -0,0 +1,99 @@
+// SPDX-License-Identifier: Apache-2.0
+//
+// nuisp-gang: program one APROM image onto every listed port at once.
+//
+//   nuisp-gang -i app.bin /dev/ttyUSB*
+//   nuisp-pack app.hex app.nupc && nuisp-gang -i app.nupc /dev/ttyUSB*
+#include "nuisp/gang.hpp"
+#include "nuisp/image.hpp"
+#include "nuisp/packet_cache.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <getopt.h>
+#include <string>
+#include <vector>
+
+using namespace nuisp;
+
+namespace {
+
+void usage()
+{
+    std::fprintf(stderr,
+                 "usage: nuisp-gang -i IMAGE [options] PORT...\n"
+                 "\n"
+                 "options:\n"
+                 "  -i, --image FILE        .nupc packet cache, .hex or raw APROM binary\n"
+                 "  -b, --baud RATE         bit rate (default 38400)\n"
+                 "  -w, --w20b              W20B (MS51) bootloader instead of Delta\n"
+                 "  -c, --connect-ms MS     how long each port retries CMD_CONNECT (default 5000)\n"
+                 "  -n, --no-verify         skip the CMD_READ_FLASH read-back\n"
+                 "  -r, --no-run            stay in the bootloader when done\n");
+}
+
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    static const option longOptions[] = {
+        {"image", required_argument, nullptr, 'i'},
+        {"baud", required_argument, nullptr, 'b'},
+        {"w20b", no_argument, nullptr, 'w'},
+        {"connect-ms", required_argument, nullptr, 'c'},
+        {"no-verify", no_argument, nullptr, 'n'},
+        {"no-run", no_argument, nullptr, 'r'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+
+    std::string imagePath;
+    Variant variant = Variant::Delta;
+    GangOptions options;
+
+    int c;
+    while ((c = getopt_long(argc, argv, "i:b:wc:nrh", longOptions, nullptr)) != -1) {
+        switch (c) {
+        case 'i': imagePath = optarg; break;
+        case 'b': options.baud = static_cast<std::uint32_t>(std::strtoul(optarg, nullptr, 0)); break;
+        case 'w': variant = Variant::W20B; break;
+        case 'c': options.connectWindow = std::chrono::milliseconds(std::strtol(optarg, nullptr, 0)); break;
+        case 'n': options.verify = false; break;
+        case 'r': options.run = false; break;
+        default: usage(); return c == 'h' ? 0 : 2;
+        }
+    }
+
+    std::vector<std::string> ports(argv + optind, argv + argc);
+    if (imagePath.empty() || ports.empty()) {
+        usage();
+        return 2;
+    }
+
+    std::vector<PortResult> results;
+    try {
+        PacketCache cache = imagePath.ends_with(".nupc")
+                                ? PacketCache::open(imagePath)
+                                : PacketCache::build(variant, cmd::UpdateAprom,
+                                                     loadImageFile(imagePath));
+        GangProgrammer gang(ports, std::move(cache), options);
+        results = gang.run([](const PortResult& r) {
+            std::fprintf(stderr, "%s: %s\n", r.path.c_str(), r.ok ? "done" : r.error.c_str());
+        });
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "nuisp-gang: %s\n", e.what());
+        return 2;
+    }
+
+    int failed = 0;
+    std::printf("%-24s %-6s %8s %8s %8s %10s  %s\n", "port", "result", "frames", "resends", "secs",
+                "B/s", "error");
+    for (const PortResult& r : results) {
+        std::printf("%-24s %-6s %8llu %8llu %8.2f %10.0f  %s\n", r.path.c_str(),
+                    r.ok ? "ok" : "FAIL", static_cast<unsigned long long>(r.stats.frames),
+                    static_cast<unsigned long long>(r.stats.resends), r.elapsed.count(),
+                    r.throughput(), r.error.c_str());
+        failed += r.ok ? 0 : 1;
+    }
+    return failed == 0 ? 0 : 1;
+}
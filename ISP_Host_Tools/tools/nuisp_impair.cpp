@@ -0,0 +1,508 @@
+// SPDX-License-Identifier: Apache-2.0
+//
+// nuisp-impair: pty proxy that sits between a programmer and a bootloader
+// (a real port or a simulator's pty) and damages the traffic on purpose:
+// latency, jitter, dropped bytes, flipped bits, and the way a USB-serial
+// adapter holds received bytes back until its packet fills or its latency
+// timer expires. On exit it reports goodput and how long each fault took
+// to recover from, as one JSON object on stdout.
+//
+//   nuisp-sim-m2003 -x --link /tmp/dev &
+//   nuisp-impair -d /tmp/dev --link /tmp/isp -e 0.001 --exit-idle 2000 &
+//   nuisp -p /tmp/isp program app.bin run
+#include "nuisp/capture.hpp"
+#include "nuisp/protocol.hpp"
+#include "nuisp/serial_port.hpp"
+#include "sim_host.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <getopt.h>
+#include <optional>
+#include <poll.h>
+#include <random>
+#include <string>
+#include <termios.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace nuisp;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+using Micros = std::chrono::microseconds;
+
+// A partial frame older than this is dropped: host and device both write
+// whole frames, so the next byte starts a new one (the bootloaders' own
+// bufhead/timer resync does the same)
+constexpr Micros kFrameGap{50000};
+
+volatile std::sig_atomic_t g_stop = 0;
+
+void onSignal(int)
+{
+    g_stop = 1;
+}
+
+enum LongOnly
+{
+    kUsbLatency = 256,
+    kUsbPacket,
+    kSeed,
+    kExitIdle,
+};
+
+CaptureWriter* g_capture = nullptr;
+
+void usage()
+{
+    std::fprintf(stderr,
+                 "usage: nuisp-impair -d DEVICE [options]\n"
+                 "\n"
+                 "Forwards a new pty to DEVICE with faults injected, and reports goodput\n"
+                 "and recovery times on exit (SIGINT/SIGTERM, --exit-idle, or DEVICE\n"
+                 "going away).\n"
+                 "\n"
+                 "options:\n"
+                 "  -d, --device PATH       serial port or simulator pty of the bootloader\n"
+                 "  -b, --baud RATE         initial bit rate on DEVICE (default 38400); later\n"
+                 "                          changes the programmer makes are followed\n"
+                 "  -l, --link PATH         symlink to the programmer side (default: print it)\n"
+                 "  -D, --direction DIR     to-device, to-host or both (default both) for\n"
+                 "                          the options below\n"
+                 "  -L, --latency-us US     fixed one-way delay (default 0)\n"
+                 "  -J, --jitter-us US      extra random delay, 0..US per read (default 0)\n"
+                 "  -x, --drop-rate P       probability a byte is lost\n"
+                 "  -e, --error-rate P      probability a byte has one bit flipped\n"
+                 "      --usb-latency-ms MS hold bytes to the host until a packet fills or\n"
+                 "                          MS pass since its first byte (FTDI latency\n"
+                 "                          timer; default 0 = off)\n"
+                 "      --usb-packet N      payload bytes per USB packet (default 62)\n"
+                 "      --seed N            fault seed (default 1)\n"
+                 "      --exit-idle MS      exit this long after the last byte, once\n"
+                 "                          traffic has started\n"
+                 "  -c, --capture FILE      record the traffic as the device sees it, for\n"
+                 "                          nuisp-trace\n");
+}
+
+struct Faults
+{
+    Micros latency{0};
+    Micros jitter{0};
+    double dropRate = 0.0;
+    double errorRate = 0.0;
+};
+
+// One direction of the proxy. Bytes are damaged as they are read, then
+// wait in the queue until their delivery time; a serial line never
+// reorders, so jitter only ever stretches gaps.
+struct Direction
+{
+    Faults faults;
+    int in = -1;
+    int out = -1;
+
+    std::deque<std::pair<Clock::time_point, std::uint8_t>> queue;
+    Clock::time_point lastDelivery{};
+
+    // USB-serial packet being filled (to host only)
+    std::vector<std::uint8_t> usb;
+    Clock::time_point usbFirst{};
+
+    // frame reassembly of the undamaged stream, for the exchange statistics
+    Frame frame{};
+    std::size_t fill = 0;
+    bool damaged = false;
+    Clock::time_point lastByte{};
+
+    std::uint64_t bytes = 0, dropped = 0, flipped = 0, frames = 0;
+};
+
+struct Exchanges
+{
+    std::optional<Frame> request;
+    std::uint64_t ok = 0, failed = 0, goodFrames = 0;
+
+    std::optional<Clock::time_point> faultSince;
+    std::uint64_t faults = 0;
+    std::vector<double> recoveryMs;
+};
+
+Clock::time_point g_firstByte{}, g_lastByte{};
+bool g_traffic = false;
+std::mt19937 g_rng;
+Exchanges g_ex;
+
+void noteFault(Clock::time_point t)
+{
+    if (!g_ex.faultSince) {
+        g_ex.faultSince = t;
+        ++g_ex.faults;
+    }
+}
+
+// A request is answered correctly when the response arrived undamaged and
+// carries the checksum of the request as the programmer sent it. That also
+// catches a device still out of step from an earlier fault.
+void onResponse(const Frame& response, bool damaged, Clock::time_point t)
+{
+    if (!g_ex.request) {
+        return;
+    }
+    const Frame request = *g_ex.request;
+    g_ex.request.reset();
+    if (damaged || getLe16(response.data()) != frameChecksum(request)) {
+        ++g_ex.failed;
+        return;
+    }
+    ++g_ex.ok;
+    if (g_ex.faultSince) {
+        g_ex.recoveryMs.push_back(
+            std::chrono::duration<double, std::milli>(t - *g_ex.faultSince).count());
+        g_ex.faultSince.reset();
+    }
+
+    // everything but the recovery exchange itself moved the session on
+    if (getLe32(request.data()) != cmd::ResendPacket) {
+        ++g_ex.goodFrames;
+    }
+}
+
+void frameByte(Direction& d, std::uint8_t byte, bool damaged, Clock::time_point t, bool toDevice)
+{
+    if (d.fill != 0 && t - d.lastByte > kFrameGap) {
+        d.fill = 0;
+    }
+    if (d.fill == 0) {
+        d.damaged = false;
+    }
+    d.lastByte = t;
+    d.frame[d.fill++] = byte;
+    d.damaged |= damaged;
+    if (d.fill == kFrameSize) {
+        d.fill = 0;
+        ++d.frames;
+        if (toDevice) {
+            // the previous request was never answered (or its answer lost)
+            g_ex.failed += g_ex.request ? 1 : 0;
+            g_ex.request = d.frame;
+        } else {
+            onResponse(d.frame, d.damaged, t);
+        }
+    }
+}
+
+// Read what the source has, damage it and queue it. False once the source
+// is gone.
+bool ingest(Direction& d, bool toDevice, short revents)
+{
+    std::uint8_t buf[256];
+    const ssize_t n = ::read(d.in, buf, sizeof(buf));
+    if (n < 0) {
+        return errno == EAGAIN || errno == EINTR;
+    }
+    if (n == 0) {
+        return (revents & POLLHUP) == 0;  // a raw tty with VMIN 0 reads 0 for "nothing yet"
+    }
+
+    if (g_capture && !toDevice) {
+        g_capture->data(false, {buf, static_cast<std::size_t>(n)});
+    }
+
+    const auto t = Clock::now();
+    if (!g_traffic) {
+        g_traffic = true;
+        g_firstByte = t;
+    }
+    g_lastByte = t;
+
+    std::bernoulli_distribution drop(d.faults.dropRate);
+    std::bernoulli_distribution flip(d.faults.errorRate);
+    std::uniform_int_distribution<int> bit(0, 7);
+    std::uniform_int_distribution<long> jitter(0, d.faults.jitter.count());
+
+    const auto due = std::max(d.lastDelivery, t + d.faults.latency + Micros(jitter(g_rng)));
+    for (ssize_t i = 0; i < n; ++i) {
+        const std::uint8_t sent = buf[i];
+        ++d.bytes;
+        if (d.faults.dropRate > 0.0 && drop(g_rng)) {
+            ++d.dropped;
+            noteFault(t);
+            frameByte(d, sent, true, t, toDevice);
+            continue;
+        }
+        std::uint8_t byte = sent;
+        if (d.faults.errorRate > 0.0 && flip(g_rng)) {
+            byte ^= static_cast<std::uint8_t>(1u << bit(g_rng));
+            ++d.flipped;
+            noteFault(t);
+        }
+        frameByte(d, sent, byte != sent, t, toDevice);
+        d.queue.emplace_back(due, byte);
+    }
+    d.lastDelivery = due;
+    return true;
+}
+
+void writeAll(int fd, const std::uint8_t* p, std::size_t n)
+{
+    while (n > 0) {
+        const ssize_t w = ::write(fd, p, n);
+        if (w < 0) {
+            if (errno == EAGAIN || errno == EINTR) {
+                pollfd pfd{fd, POLLOUT, 0};
+                ::poll(&pfd, 1, 10);
+                continue;
+            }
+            return;  // the other side went away; the main loop notices
+        }
+        p += w;
+        n -= static_cast<std::size_t>(w);
+    }
+}
+
+// Deliver what is due; returns the next time something will be.
+Clock::time_point deliver(Direction& d, bool toDevice, Micros usbLatency, std::size_t usbPacket)
+{
+    const auto t = Clock::now();
+    std::vector<std::uint8_t> out;
+    while (!d.queue.empty() && d.queue.front().first <= t) {
+        out.push_back(d.queue.front().second);
+        d.queue.pop_front();
+    }
+
+    auto next = d.queue.empty() ? Clock::time_point::max() : d.queue.front().first;
+    if (usbLatency.count() == 0) {
+        if (g_capture && toDevice) {
+            g_capture->data(true, out);
+        }
+        writeAll(d.out, out.data(), out.size());
+        return next;
+    }
+
+    for (std::uint8_t b : out) {
+        if (d.usb.empty()) {
+            d.usbFirst = t;
+        }
+        d.usb.push_back(b);
+        if (d.usb.size() == usbPacket) {
+            writeAll(d.out, d.usb.data(), d.usb.size());
+            d.usb.clear();
+        }
+    }
+    if (!d.usb.empty()) {
+        if (t - d.usbFirst >= usbLatency) {
+            writeAll(d.out, d.usb.data(), d.usb.size());
+            d.usb.clear();
+        } else {
+            next = std::min(next, d.usbFirst + usbLatency);
+        }
+    }
+    return next;
+}
+
+// Follow the programmer's bit rate changes (CMD_SET_SPEED) on the device.
+void followBaud(int hostSlave, SerialPort& device, speed_t& current)
+{
+    termios host;
+    if (::tcgetattr(hostSlave, &host) != 0 || ::cfgetospeed(&host) == current) {
+        return;
+    }
+    current = ::cfgetospeed(&host);
+    if (const std::uint32_t baud = baudFromSpeed(current)) {
+        device.setBaudRate(baud);
+        if (g_capture) {
+            g_capture->baud(baud);
+        }
+    }
+}
+
+void report(const Direction& up, const Direction& down)
+{
+    const double seconds =
+        g_traffic ? std::chrono::duration<double>(g_lastByte - g_firstByte).count() : 0.0;
+    const double good = static_cast<double>(g_ex.goodFrames * kFrameSize);
+    double mean = 0.0, worst = 0.0;
+    for (double ms : g_ex.recoveryMs) {
+        mean += ms;
+        worst = std::max(worst, ms);
+    }
+    if (!g_ex.recoveryMs.empty()) {
+        mean /= static_cast<double>(g_ex.recoveryMs.size());
+    }
+
+    auto dir = [](const Direction& d) {
+        char buf[160];
+        std::snprintf(buf, sizeof(buf),
+                      "{\"bytes\":%llu,\"frames\":%llu,\"dropped\":%llu,\"flipped\":%llu}",
+                      static_cast<unsigned long long>(d.bytes),
+                      static_cast<unsigned long long>(d.frames),
+                      static_cast<unsigned long long>(d.dropped),
+                      static_cast<unsigned long long>(d.flipped));
+        return std::string(buf);
+    };
+
+    std::printf("{\"seconds\":%.6f,\"to_device\":%s,\"to_host\":%s,"
+                "\"exchanges_ok\":%llu,\"exchanges_failed\":%llu,\"good_frames\":%llu,"
+                "\"goodput_bytes_per_s\":%.1f,\"efficiency\":%.4f,"
+                "\"faults\":%llu,\"recovered\":%zu,\"recovery_ms_mean\":%.3f,"
+                "\"recovery_ms_max\":%.3f,\"unrecovered\":%s}\n",
+                seconds, dir(up).c_str(), dir(down).c_str(),
+                static_cast<unsigned long long>(g_ex.ok),
+                static_cast<unsigned long long>(g_ex.failed),
+                static_cast<unsigned long long>(g_ex.goodFrames),
+                seconds > 0 ? good / seconds : 0.0,
+                up.bytes ? good / static_cast<double>(up.bytes) : 0.0,
+                static_cast<unsigned long long>(g_ex.faults), g_ex.recoveryMs.size(), mean,
+                worst, g_ex.faultSince ? "true" : "false");
+    std::fflush(stdout);
+}
+
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    static const option longOptions[] = {
+        {"device", required_argument, nullptr, 'd'},
+        {"baud", required_argument, nullptr, 'b'},
+        {"link", required_argument, nullptr, 'l'},
+        {"direction", required_argument, nullptr, 'D'},
+        {"latency-us", required_argument, nullptr, 'L'},
+        {"jitter-us", required_argument, nullptr, 'J'},
+        {"drop-rate", required_argument, nullptr, 'x'},
+        {"error-rate", required_argument, nullptr, 'e'},
+        {"usb-latency-ms", required_argument, nullptr, kUsbLatency},
+        {"usb-packet", required_argument, nullptr, kUsbPacket},
+        {"seed", required_argument, nullptr, kSeed},
+        {"exit-idle", required_argument, nullptr, kExitIdle},
+        {"capture", required_argument, nullptr, 'c'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+
+    std::string device, link, capturePath;
+    std::uint32_t baud = 38400;
+    bool toDevice = true, toHost = true;
+    Faults faults;
+    Micros usbLatency{0};
+    std::size_t usbPacket = 62;
+    std::uint32_t seed = 1;
+    std::optional<Micros> exitIdle;
+
+    int c;
+    while ((c = getopt_long(argc, argv, "d:b:l:D:L:J:x:e:c:h", longOptions, nullptr)) != -1) {
+        switch (c) {
+        case 'd': device = optarg; break;
+        case 'b': baud = static_cast<std::uint32_t>(std::strtoul(optarg, nullptr, 0)); break;
+        case 'l': link = optarg; break;
+        case 'D':
+            toDevice = std::strcmp(optarg, "to-host") != 0;
+            toHost = std::strcmp(optarg, "to-device") != 0;
+            if (!toDevice && !toHost) {
+                usage();
+                return 2;
+            }
+            break;
+        case 'L': faults.latency = Micros(std::strtol(optarg, nullptr, 0)); break;
+        case 'J': faults.jitter = Micros(std::strtol(optarg, nullptr, 0)); break;
+        case 'x': faults.dropRate = std::strtod(optarg, nullptr); break;
+        case 'e': faults.errorRate = std::strtod(optarg, nullptr); break;
+        case kUsbLatency: usbLatency = Micros(1000 * std::strtol(optarg, nullptr, 0)); break;
+        case kUsbPacket: usbPacket = std::strtoul(optarg, nullptr, 0); break;
+        case kSeed: seed = static_cast<std::uint32_t>(std::strtoul(optarg, nullptr, 0)); break;
+        case kExitIdle: exitIdle = Micros(1000 * std::strtol(optarg, nullptr, 0)); break;
+        case 'c': capturePath = optarg; break;
+        default: usage(); return c == 'h' ? 0 : 2;
+        }
+    }
+    if (optind != argc || device.empty() || usbPacket == 0) {
+        usage();
+        return 2;
+    }
+    g_rng.seed(seed);
+
+    Direction up, down;
+    if (toDevice) {
+        up.faults = faults;
+    }
+    if (toHost) {
+        down.faults = faults;
+    }
+
+    int hostSlave = -1;
+    std::optional<SerialPort> port;
+    std::optional<CaptureWriter> capture;
+    try {
+        port.emplace(device, baud);
+        if (!capturePath.empty()) {
+            g_capture = &capture.emplace(capturePath, baud);
+        }
+        std::string slave;
+        const int master = simhost::openPty(slave);
+        ::fcntl(master, F_SETFL, ::fcntl(master, F_GETFL) | O_NONBLOCK);
+        // the programmer's termios live on the slave side
+        hostSlave = ::open(slave.c_str(), O_RDONLY | O_NOCTTY | O_CLOEXEC);
+        simhost::publishPty(slave, link);
+        up.in = down.out = master;
+        up.out = down.in = port->fd();
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "nuisp-impair: %s\n", e.what());
+        return 1;
+    }
+
+    // replace the pty helper's handlers: report before leaving
+    struct sigaction sa{};
+    sa.sa_handler = onSignal;
+    ::sigaction(SIGINT, &sa, nullptr);
+    ::sigaction(SIGTERM, &sa, nullptr);
+
+    // -b stands until the programmer picks a different rate
+    termios initial{};
+    ::tcgetattr(hostSlave, &initial);
+    speed_t speed = ::cfgetospeed(&initial);
+
+    while (!g_stop) {
+        followBaud(hostSlave, *port, speed);
+
+        auto next = std::min(deliver(up, true, Micros(0), usbPacket),
+                             deliver(down, false, usbLatency, usbPacket));
+        if (exitIdle && g_traffic) {
+            const auto idleEnd = g_lastByte + *exitIdle;
+            if (up.queue.empty() && down.queue.empty() && down.usb.empty() &&
+                Clock::now() >= idleEnd) {
+                break;
+            }
+            next = std::min(next, idleEnd);
+        }
+
+        int timeout = -1;
+        if (next != Clock::time_point::max()) {
+            const auto left = std::chrono::ceil<std::chrono::milliseconds>(next - Clock::now());
+            timeout = static_cast<int>(std::max<long>(0, left.count()));
+        }
+        pollfd pfd[2] = {{up.in, POLLIN, 0}, {down.in, POLLIN, 0}};
+        if (::poll(pfd, 2, timeout) < 0) {
+            continue;  // EINTR: g_stop is checked at the top
+        }
+        if ((pfd[0].revents & (POLLIN | POLLHUP)) && !ingest(up, true, pfd[0].revents)) {
+            break;
+        }
+        if ((pfd[1].revents & (POLLIN | POLLHUP | POLLERR)) && !ingest(down, false, pfd[1].revents)) {
+            break;  // device closed: a simulator that exited on CMD_RUN_APROM
+        }
+    }
+
+    if (!link.empty()) {
+        ::unlink(link.c_str());
+    }
+    report(up, down);
+    return 0;
+}
@@ -0,0 +1,78 @@
+// SPDX-License-Identifier: Apache-2.0
+//
+// nuisp-pack: precompile an image into a .nupc packet cache once, so
+// nuisp / nuisp-gang only copy frames when flashing many boards.
+//
+//   nuisp-pack app.hex app.nupc
+#include "nuisp/image.hpp"
+#include "nuisp/link.hpp"
+#include "nuisp/packet_cache.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <getopt.h>
+#include <string>
+
+using namespace nuisp;
+
+namespace {
+
+void usage()
+{
+    std::fprintf(stderr,
+                 "usage: nuisp-pack [options] IMAGE OUT.nupc\n"
+                 "\n"
+                 "options:\n"
+                 "  -w, --w20b              W20B (MS51) bootloader instead of Delta\n"
+                 "  -d, --dataflash         CMD_UPDATE_DATAFLASH instead of CMD_UPDATE_APROM\n");
+}
+
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    static const option longOptions[] = {
+        {"w20b", no_argument, nullptr, 'w'},
+        {"dataflash", no_argument, nullptr, 'd'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+
+    Variant variant = Variant::Delta;
+    std::uint32_t command = cmd::UpdateAprom;
+
+    int c;
+    while ((c = getopt_long(argc, argv, "wdh", longOptions, nullptr)) != -1) {
+        switch (c) {
+        case 'w': variant = Variant::W20B; break;
+        case 'd': command = cmd::UpdateDataflash; break;
+        default: usage(); return c == 'h' ? 0 : 2;
+        }
+    }
+    if (argc - optind != 2) {
+        usage();
+        return 2;
+    }
+
+    try {
+        const std::vector<std::uint8_t> image = loadImageFile(argv[optind]);
+        const std::vector<std::uint8_t> packed = buildPacketCache(variant, command, image);
+        std::ofstream out(argv[optind + 1], std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(packed.data()),
+                  static_cast<std::streamsize>(packed.size()));
+        if (!out) {
+            throw Error(std::string("cannot write ") + argv[optind + 1]);
+        }
+
+        const PacketCache cache = PacketCache::open(argv[optind + 1]);
+        std::printf("image      %zu bytes, %u after trimming trailing 0xFF\n", image.size(),
+                    cache.imageSize());
+        std::printf("frames     %zu\n", cache.frameCount());
+        std::printf("pages      %zu (512 bytes, RUN_CKS CRC-32 each)\n", cache.pageCount());
+        std::printf("crc32      0x%08X\n", cache.imageCrc32());
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "nuisp-pack: %s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,379 @@
+// SPDX-License-Identifier: Apache-2.0
+//
+// nuisp-trace: decode a capture written by nuisp --capture or
+// nuisp-impair --capture into a per-exchange timeline and show where the
+// time goes: on the wire, in the device, or in the host.
+//
+//   nuisp -C run.cap -p /dev/ttyUSB0 program app.bin
+//   nuisp-trace run.cap            # timeline, per-command table, histograms
+//   nuisp-trace -s run.cap         # summary only
+//   nuisp-trace -o csv run.cap > timeline.csv
+//
+// Per exchange (request frame and its response):
+//   wire        10 bit times per byte of request and response at the
+//               captured bit rate
+//   turnaround  end of the request to start of the response, as seen by
+//               the device
+//   think       end of the response to start of the next request
+// A capture only has a timestamp per chunk, so where a whole frame arrived
+// in one chunk its other end is placed one frame's wire time away.
+#include "nuisp/capture.hpp"
+#include "nuisp/protocol.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <getopt.h>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+
+using namespace nuisp;
+
+namespace {
+
+// A partial frame older than this is discarded, as the bootloaders do
+constexpr std::uint64_t kFrameGapUs = 50000;
+
+void usage()
+{
+    std::fprintf(stderr,
+                 "usage: nuisp-trace [options] CAPTURE\n"
+                 "\n"
+                 "options:\n"
+                 "  -o, --format FMT        text or csv timeline (default text)\n"
+                 "  -s, --summary           per-command table and histograms only\n");
+}
+
+const char* commandName(std::uint32_t command)
+{
+    // Delta uses the full word, W20B checks the low byte only
+    if ((command & 0xFFFFFF00) != (cmd::Connect & 0xFFFFFF00) && command > 0xFF) {
+        return nullptr;
+    }
+    switch (command & 0xFF) {
+    case 0x00: return "(data)";
+    case 0xA0: return "UPDATE_APROM";
+    case 0xA1: return "UPDATE_CONFIG";
+    case 0xA2: return "READ_CONFIG";
+    case 0xA3: return "ERASE_ALL";
+    case 0xA4: return "SYNC_PACKNO";
+    case 0xA6: return "GET_FWVER";
+    case 0xAB: return "RUN_APROM";
+    case 0xAC: return "RUN_LDROM";
+    case 0xAD: return "RESET";
+    case 0xAE: return "CONNECT";
+    case 0xB1: return "GET_DEVICEID";
+    case 0xB2: return "GET_DEVICE_INFO";
+    case 0xB3: return "GET_STATS";
+    case 0xB4: return "DUMP_TRACE";
+    case 0xB5: return "SET_SPEED";
+    case 0xC3: return "UPDATE_DATAFLASH";
+    case 0xC4: return "WRITE_DATAFLASH_AT";
+    case 0xC5: return "READ_FLASH";
+    case 0xFF: return "RESEND_PACKET";
+    default: return nullptr;
+    }
+}
+
+struct WireFrame
+{
+    Frame bytes{};
+    std::uint64_t first = 0;  // timestamp of the chunk with the first byte
+    std::uint64_t last = 0;   // and with the last
+    std::uint32_t baud = 0;
+};
+
+struct Exchange
+{
+    WireFrame request;
+    std::optional<WireFrame> response;
+    std::string command;
+    std::uint64_t reqStart = 0, reqEnd = 0, respStart = 0, respEnd = 0;
+    double wireUs = 0;
+    std::optional<double> turnaroundUs, thinkUs;
+    const char* status = "ok";
+};
+
+double frameUs(std::uint32_t baud)
+{
+    return kFrameSize * 10 * 1e6 / baud;
+}
+
+// Frames in both directions, in the order their last byte was seen.
+std::vector<std::pair<bool, WireFrame>> reassemble(const std::vector<CaptureRecord>& records,
+                                                   unsigned& fragments)
+{
+    std::vector<std::pair<bool, WireFrame>> frames;
+    WireFrame partial[2];
+    std::size_t fill[2] = {0, 0};
+    std::uint64_t lastByte[2] = {0, 0};
+    std::uint32_t baud = 38400;
+
+    for (const CaptureRecord& r : records) {
+        if (r.kind == '=') {
+            baud = r.baud;
+            continue;
+        }
+        const int dir = r.kind == '>' ? 0 : 1;
+        if (fill[dir] != 0 && r.us - lastByte[dir] > kFrameGapUs) {
+            ++fragments;
+            fill[dir] = 0;
+        }
+        lastByte[dir] = r.us;
+        for (std::uint8_t b : r.bytes) {
+            WireFrame& f = partial[dir];
+            if (fill[dir] == 0) {
+                f.first = r.us;
+                f.baud = baud;
+            }
+            f.bytes[fill[dir]++] = b;
+            if (fill[dir] == kFrameSize) {
+                f.last = r.us;
+                frames.emplace_back(dir == 0, f);
+                fill[dir] = 0;
+            }
+        }
+    }
+    fragments += (fill[0] != 0) + (fill[1] != 0);
+    return frames;
+}
+
+std::vector<Exchange> pair(const std::vector<std::pair<bool, WireFrame>>& frames,
+                           unsigned& unsolicited)
+{
+    std::vector<Exchange> out;
+    std::string lastCommand = "?";
+    bool open = false;
+
+    for (const auto& [toDevice, f] : frames) {
+        if (!toDevice) {
+            if (!open) {
+                ++unsolicited;
+                continue;
+            }
+            out.back().response = f;
+            open = false;
+            continue;
+        }
+
+        Exchange e;
+        e.request = f;
+        const std::uint32_t command = getLe32(f.bytes.data());
+        if (const char* name = commandName(command)) {
+            // continuation frames carry no command; name them after the last one
+            e.command = command == 0 ? lastCommand + "+" : name;
+            if (command != 0) {
+                lastCommand = name;
+            }
+        } else {
+            char hex[16];
+            std::snprintf(hex, sizeof(hex), "0x%08X", command);
+            e.command = hex;
+        }
+        out.push_back(std::move(e));
+        open = true;
+    }
+
+    for (std::size_t i = 0; i < out.size(); ++i) {
+        Exchange& e = out[i];
+        const double reqWire = frameUs(e.request.baud);
+        e.reqStart = e.request.first;
+        e.reqEnd = std::max<std::uint64_t>(e.request.last, e.reqStart + std::llround(reqWire));
+        e.wireUs = reqWire;
+        if (!e.response) {
+            e.status = "no response";
+            continue;
+        }
+        const double respWire = frameUs(e.response->baud);
+        e.wireUs += respWire;
+        e.respEnd = e.response->last;
+        e.respStart = std::min<std::uint64_t>(
+            e.response->first,
+            e.respEnd - std::min<std::uint64_t>(e.respEnd, std::llround(respWire)));
+        e.turnaroundUs = static_cast<double>(e.respStart) - static_cast<double>(e.reqEnd);
+        if (getLe16(e.response->bytes.data()) != frameChecksum(e.request.bytes)) {
+            e.status = "bad checksum";
+        }
+        if (i + 1 < out.size()) {
+            e.thinkUs = static_cast<double>(out[i + 1].request.first) -
+                        static_cast<double>(e.respEnd);
+        }
+    }
+    return out;
+}
+
+std::string us(const std::optional<double>& v)
+{
+    if (!v) {
+        return "-";
+    }
+    char buf[32];
+    std::snprintf(buf, sizeof(buf), "%.0f", *v);
+    return buf;
+}
+
+double percentile(std::vector<double> v, double p)
+{
+    if (v.empty()) {
+        return 0.0;
+    }
+    std::sort(v.begin(), v.end());
+    return v[static_cast<std::size_t>(p * static_cast<double>(v.size() - 1) + 0.5)];
+}
+
+void histogram(const char* title, const std::vector<double>& samples)
+{
+    std::printf("\n%s (us)\n", title);
+    if (samples.empty()) {
+        std::printf("  no samples\n");
+        return;
+    }
+    // power-of-two buckets; everything below 1 us (or negative, from
+    // timestamp granularity) goes in the first
+    std::map<int, unsigned> buckets;
+    for (double s : samples) {
+        buckets[s < 1.0 ? 0 : static_cast<int>(std::log2(s)) + 1]++;
+    }
+    unsigned peak = 0;
+    for (const auto& [b, n] : buckets) {
+        peak = std::max(peak, n);
+    }
+    for (int b = buckets.begin()->first; b <= buckets.rbegin()->first; ++b) {
+        const unsigned n = buckets.count(b) ? buckets[b] : 0;
+        const unsigned long lo = b == 0 ? 0 : 1ul << (b - 1);
+        const unsigned long hi = 1ul << b;
+        std::printf("  %8lu - %-8lu %6u %s\n", lo, hi, n,
+                    std::string((n * 50 + peak - 1) / peak, '#').c_str());
+    }
+}
+
+void summary(const std::vector<Exchange>& ex, unsigned fragments, unsigned unsolicited)
+{
+    double wire = 0, device = 0, host = 0;
+    unsigned lost = 0, bad = 0;
+    std::vector<double> turnarounds, thinks;
+    std::map<std::string, std::vector<double>> byCommand;
+
+    for (const Exchange& e : ex) {
+        wire += e.wireUs;
+        lost += e.response ? 0 : 1;
+        bad += std::strcmp(e.status, "bad checksum") == 0;
+        if (e.turnaroundUs) {
+            device += std::max(0.0, *e.turnaroundUs);
+            turnarounds.push_back(*e.turnaroundUs);
+            byCommand[e.command].push_back(*e.turnaroundUs);
+        }
+        if (e.thinkUs) {
+            host += std::max(0.0, *e.thinkUs);
+            thinks.push_back(*e.thinkUs);
+        }
+    }
+
+    const double span = ex.empty() ? 0.0
+                                   : static_cast<double>(std::max(ex.back().respEnd,
+                                                                  ex.back().reqEnd) -
+                                                         ex.front().reqStart);
+    std::printf("%zu exchanges in %.3f s: %u without response, %u bad checksum, "
+                "%u partial frames, %u unsolicited responses\n",
+                ex.size(), span / 1e6, lost, bad, fragments, unsolicited);
+    const double total = std::max(1.0, wire + device + host);
+    std::printf("  wire        %10.1f ms  %5.1f%%\n", wire / 1e3, 100 * wire / total);
+    std::printf("  device      %10.1f ms  %5.1f%%\n", device / 1e3, 100 * device / total);
+    std::printf("  host think  %10.1f ms  %5.1f%%\n", host / 1e3, 100 * host / total);
+    const char* bound = wire >= device && wire >= host ? "the link"
+                        : device >= host              ? "the device"
+                                                      : "the host";
+    std::printf("  bound by %s\n", bound);
+
+    std::printf("\n%-22s %7s %10s %10s %10s %10s\n", "turnaround (us)", "count", "mean", "p50",
+                "p95", "max");
+    for (const auto& [command, v] : byCommand) {
+        double sum = 0;
+        for (double x : v) {
+            sum += x;
+        }
+        std::printf("%-22s %7zu %10.0f %10.0f %10.0f %10.0f\n", command.c_str(), v.size(),
+                    sum / static_cast<double>(v.size()), percentile(v, 0.5),
+                    percentile(v, 0.95), *std::max_element(v.begin(), v.end()));
+    }
+
+    histogram("device turnaround", turnarounds);
+    histogram("host think time", thinks);
+}
+
+}  // namespace
+
+int main(int argc, char** argv)
+{
+    static const option longOptions[] = {
+        {"format", required_argument, nullptr, 'o'},
+        {"summary", no_argument, nullptr, 's'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+
+    bool csv = false;
+    bool summaryOnly = false;
+
+    int c;
+    while ((c = getopt_long(argc, argv, "o:sh", longOptions, nullptr)) != -1) {
+        switch (c) {
+        case 'o':
+            if (std::strcmp(optarg, "csv") != 0 && std::strcmp(optarg, "text") != 0) {
+                usage();
+                return 2;
+            }
+            csv = optarg[0] == 'c';
+            break;
+        case 's': summaryOnly = true; break;
+        default: usage(); return c == 'h' ? 0 : 2;
+        }
+    }
+    if (optind + 1 != argc) {
+        usage();
+        return 2;
+    }
+
+    std::vector<Exchange> exchanges;
+    unsigned fragments = 0, unsolicited = 0;
+    try {
+        exchanges = pair(reassemble(readCapture(argv[optind]), fragments), unsolicited);
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "nuisp-trace: %s\n", e.what());
+        return 1;
+    }
+
+    if (csv) {
+        std::printf("start_us,command,packno,baud,wire_us,turnaround_us,think_us,status\n");
+    } else if (!summaryOnly) {
+        std::printf("%12s  %-22s %8s %8s %10s %10s  %s\n", "start_us", "command", "packno",
+                    "wire", "turnaround", "think", "status");
+    }
+    if (csv || !summaryOnly) {
+        for (const Exchange& e : exchanges) {
+            const std::uint32_t packno = getLe32(e.request.bytes.data() + 4);
+            if (csv) {
+                std::printf("%llu,%s,%u,%u,%.0f,%s,%s,%s\n",
+                            static_cast<unsigned long long>(e.reqStart), e.command.c_str(),
+                            packno, e.request.baud, e.wireUs, us(e.turnaroundUs).c_str(),
+                            us(e.thinkUs).c_str(), e.status);
+            } else {
+                std::printf("%12llu  %-22s %8u %8.0f %10s %10s  %s\n",
+                            static_cast<unsigned long long>(e.reqStart), e.command.c_str(),
+                            packno, e.wireUs, us(e.turnaroundUs).c_str(),
+                            us(e.thinkUs).c_str(), e.status);
+            }
+        }
+    }
+    if (!csv) {
+        if (!summaryOnly) {
+            std::printf("\n");
+        }
+        summary(exchanges, fragments, unsolicited);
+    }
+    return 0;
+}